@@ -0,0 +1,206 @@
+/// Temporal accumulation and edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) over the resolved frame
+/// temporal_accumulate runs once per frame before the filter. It reprojects the first hit of every pixel
+/// into the previous frame, rejects history whose G-buffer disagrees (disocclusion) and blends the rest.
+/// One dispatch per iteration, iteration i runs the 5x5 B3-spline kernel with taps 2^i pixels apart.
+/// The radiance is divided by the first-hit albedo of the G-buffer written by path_tracer.wgsl, so
+/// texture detail is not blurred, and multiplied back by the last iteration. Taps are weighted down by
+/// their luminance, normal (as in SVGF) and depth difference to the center pixel.
+const kMinAlbedo = 0.001;
+const kMinLuminance = 0.01;
+/// History taps off the plane of the pixel (in pixel extents at its distance) or with another normal
+/// (cosine) belong to another surface
+const kPlaneTolerance = 0.5;
+const kMinNormalSimilarity = 0.9;
+/// Reprojections covering less of the bilinear footprint restart the history
+const kMinHistoryWeight = 0.01;
+
+/// Iteration of the filter, bound with a dynamic offset per iteration
+struct DenoiseParam {
+  // Pixels between two taps
+  step : u32,
+  iteration : u32,
+  // Last iteration: remodulate and write the 8-bit output as well
+  last : u32,
+  pad : u32,
+  sigma_color : f32,
+  sigma_normal : f32,
+  sigma_depth : f32,
+  // Extent of a pixel at unit distance from the camera
+  pixel_angle : f32,
+};
+
+/// Pixel grid of a camera (Camera::View)
+struct View {
+  origin : vec3f,
+  // Center of pixel (0, 0) on the image plane
+  pixel_origin : vec3f,
+  pixel_delta_u : vec3f,
+  pixel_delta_v : vec3f,
+  // View direction over the focal length: p projects to origin + (p - origin) / dot(p - origin, forward)
+  forward : vec3f,
+};
+
+struct TemporalParam {
+  current : View,
+  previous : View,
+  // Longest history, in frames
+  max_frames : f32,
+  // The history textures hold the previous frame
+  history_valid : u32,
+};
+
+@group(0) @binding(0) var<uniform> denoise : DenoiseParam;
+@group(0) @binding(1) var radiance_in : texture_2d<f32>;
+@group(0) @binding(2) var gbuffer_albedo : texture_2d<f32>;
+@group(0) @binding(3) var gbuffer_normal_depth : texture_2d<f32>;
+@group(0) @binding(4) var radiance_out : texture_storage_2d<rgba32float,write>;
+@group(0) @binding(5) var frameBuffer : texture_storage_2d<rgba8unorm,write>;
+@group(0) @binding(6) var<uniform> temporal : TemporalParam;
+// Accumulated radiance (rgb) and history length in frames (a), normal + distance of the previous frame
+@group(0) @binding(7) var history_in : texture_2d<f32>;
+@group(0) @binding(8) var history_normal_depth : texture_2d<f32>;
+@group(0) @binding(9) var history_out : texture_storage_2d<rgba32float,write>;
+
+fn luminance(col: vec3f) -> f32 {
+  return dot(col, vec3f(0.2126, 0.7152, 0.0722));
+}
+
+fn albedo(p: vec2i) -> vec3f {
+  return max(textureLoad(gbuffer_albedo, p, 0).rgb, vec3f(kMinAlbedo));
+}
+
+/// Radiance divided by the albedo, the input of the first iteration is still modulated
+fn illumination(p: vec2i) -> vec3f {
+  let col = textureLoad(radiance_in, p, 0).rgb;
+  if (denoise.iteration == 0u) {
+    return col / albedo(p);
+  }
+  return col;
+}
+
+/// B3-spline weights 3/8, 1/4, 1/16
+fn kernel_weight(d: i32) -> f32 {
+  return select(select(0.0625, 0.25, abs(d) == 1), 0.375, d == 0);
+}
+
+@compute @workgroup_size(16, 16)
+fn denoise_atrous(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let size = vec2i(textureDimensions(radiance_in));
+  let p = vec2i(invocation_id.xy);
+  if (any(p >= size)) {
+    return;
+  }
+  let center = illumination(p);
+  let center_lum = luminance(center);
+  let center_nd = textureLoad(gbuffer_normal_depth, p, 0);
+  var sum = center * kernel_weight(0) * kernel_weight(0);
+  var weight_sum = kernel_weight(0) * kernel_weight(0);
+  // Misses (zero distance) have no surface to filter along
+  if (center_nd.w > 0.0) {
+    // The color tolerance halves with every iteration, the larger steps see less noise
+    let color_phi = denoise.sigma_color / f32(denoise.step);
+    let depth_phi = denoise.sigma_depth * denoise.pixel_angle * center_nd.w * f32(denoise.step);
+    for (var dy = -2; dy <= 2; dy++) {
+      for (var dx = -2; dx <= 2; dx++) {
+        let q = p + vec2i(dx, dy) * i32(denoise.step);
+        if ((dx == 0 && dy == 0) || any(q < vec2i(0)) || any(q >= size)) {
+          continue;
+        }
+        let nd = textureLoad(gbuffer_normal_depth, q, 0);
+        let col = illumination(q);
+        let lum = luminance(col);
+        let contrast = abs(center_lum - lum) / max(max(center_lum, lum), kMinLuminance);
+        let w_color = exp(-contrast / color_phi);
+        let w_normal = pow(max(dot(center_nd.xyz, nd.xyz), 0.0), denoise.sigma_normal);
+        let w_depth = exp(-abs(center_nd.w - nd.w) / (depth_phi * length(vec2f(f32(dx), f32(dy)))));
+        let w = kernel_weight(dx) * kernel_weight(dy) * w_color * w_normal * w_depth;
+        sum += col * w;
+        weight_sum += w;
+      }
+    }
+  }
+  var filtered = sum / weight_sum;
+  if (denoise.last != 0u) {
+    filtered *= albedo(p);
+    textureStore(frameBuffer, p, vec4f(filtered, 1.0));
+  }
+  textureStore(radiance_out, p, vec4f(filtered, 1.0));
+}
+
+fn primary_dir(view: View, p: vec2i) -> vec3f {
+  return normalize(view.pixel_origin + f32(p.x) * view.pixel_delta_u + f32(p.y) * view.pixel_delta_v - view.origin);
+}
+
+/// Whether history tap q shows the surface of the current pixel
+/// The G-buffer sample hit somewhere in its pixel, the plane test allows for half a pixel of it.
+/// \param pos first hit of the current pixel
+/// \param pixel_angle extent of a pixel at unit distance from the camera
+fn same_surface(nd: vec4f, pos: vec3f, q: vec2i, pixel_angle: f32) -> bool {
+  let history_nd = textureLoad(history_normal_depth, q, 0);
+  // Misses only continue misses
+  if (nd.w == 0.0 || history_nd.w == 0.0) {
+    return nd.w == history_nd.w;
+  }
+  let history_pos = temporal.previous.origin + history_nd.w * primary_dir(temporal.previous, q);
+  return abs(dot(history_pos - pos, nd.xyz)) <= kPlaneTolerance * pixel_angle * nd.w &&
+         dot(nd.xyz, history_nd.xyz) >= kMinNormalSimilarity;
+}
+
+/// History of pixel p: bilinear over the taps of the previous frame that pass same_surface, zero if none does
+fn reproject(p: vec2i, nd: vec4f, size: vec2i) -> vec4f {
+  let current = temporal.current;
+  let previous = temporal.previous;
+  let pixel_angle = length(current.pixel_delta_v) * length(current.forward);
+  let ray_dir = primary_dir(current, p);
+  let pos = current.origin + nd.w * ray_dir;
+  // Misses are reprojected as directions, they stay at infinity when the camera moves
+  var d = ray_dir;
+  if (nd.w > 0.0) {
+    d = pos - previous.origin;
+  }
+  let depth = dot(d, previous.forward);
+  if (depth <= 0.0) {
+    return vec4f(0.0);
+  }
+  // Motion vector: pixel coordinates of the surface in the previous frame
+  let image_pos = previous.origin + d / depth - previous.pixel_origin;
+  let pixel = vec2f(dot(image_pos, previous.pixel_delta_u) / dot(previous.pixel_delta_u, previous.pixel_delta_u),
+                    dot(image_pos, previous.pixel_delta_v) / dot(previous.pixel_delta_v, previous.pixel_delta_v));
+  let base = vec2i(floor(pixel));
+  let f = pixel - floor(pixel);
+  var sum = vec4f(0.0);
+  var weight_sum = 0.0;
+  for (var k = 0; k < 4; k++) {
+    let offset = vec2i(k & 1, k >> 1u);
+    let q = base + offset;
+    if (any(q < vec2i(0)) || any(q >= size) || !same_surface(nd, pos, q, pixel_angle)) {
+      continue;
+    }
+    let w = select(1.0 - f.x, f.x, offset.x == 1) * select(1.0 - f.y, f.y, offset.y == 1);
+    sum += textureLoad(history_in, q, 0) * w;
+    weight_sum += w;
+  }
+  if (weight_sum < kMinHistoryWeight) {
+    return vec4f(0.0);
+  }
+  return sum / weight_sum;
+}
+
+@compute @workgroup_size(16, 16)
+fn temporal_accumulate(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let size = vec2i(textureDimensions(radiance_in));
+  let p = vec2i(invocation_id.xy);
+  if (any(p >= size)) {
+    return;
+  }
+  let col = textureLoad(radiance_in, p, 0).rgb;
+  var history = vec4f(0.0);
+  if (temporal.history_valid != 0u) {
+    history = reproject(p, textureLoad(gbuffer_normal_depth, p, 0), size);
+  }
+  // Running mean over the first max_frames frames, exponential afterwards
+  let frames = min(history.a + 1.0, temporal.max_frames);
+  let accumulated = mix(history.rgb, col, 1.0 / frames);
+  textureStore(history_out, p, vec4f(accumulated, frames));
+  textureStore(frameBuffer, p, vec4f(accumulated, 1.0));
+}
@@ -3,11 +3,23 @@ const k_1_PI = 0.318309886184;
 const kNoHit = 0xffffffffu;
 const kXup = vec3f(1.0, 0.0, 0.0);
 const kYup = vec3f(0.0, 1.0, 0.0);
-const kRayDepth = 50;
 const kRayMin = 0.001;
 const kRayMax = 1e20;
 const kZero = vec3f(0.0, 0.0, 0.0);
 const kOne = vec3f(1.0, 1.0, 1.0);
+const kBVHStackSize = 32u;
+const kPrimTypeShift = 29u;
+const kPrimIndexMask = 0x1fffffffu;
+// Largest float below 1
+const kOneMinusEpsilon = 0x1.fffffep-1f;
+// Adaptive sampling: mean luminance the error of darker pixels is relative to
+const kAdaptiveMinLuminance = 0.01;
+// Material.bxdf of the smooth dielectric, Lambertian(0) and GGX(1) are the cases of sample_from_bxdf
+const kDielectric = 2u;
+// Smallest GGX alpha, sharper lobes overflow the normal distribution in f32
+const kMinAlpha = 1e-3;
+// Wavefront mode: misses and lights, then one bin per bxdf
+const kShadeBins = 4u;
 
 struct Ray {
   start : vec3f,
@@ -21,18 +33,42 @@ struct CameraParam {
   fovy : f32,
   spp : u32,
   seed : u32,
+  // Progressive mode: samples already accumulated / samples of this dispatch
+  sample_offset : u32,
+  sample_count : u32,
+  // Bounce limit / bounces traced before Russian roulette may end a path
+  max_depth : u32,
+  rr_depth : u32,
+  // Count the paths of every bounce in path_stats (0 = off)
+  path_stats : u32,
+  // Light selection: power alias table (0) or light tree (1)
+  light_tree : u32,
+  // Random numbers: PCG (0), Owen-scrambled Sobol (1) or blue-noise dithered Sobol (2)
+  sampler : u32,
+  // Scrambling of the quasi-random sequence, the same for every dispatch of a frame
+  sampler_seed : u32,
+  // Adaptive sampling: relative standard error below which a pixel stops taking samples
+  adaptive_threshold : f32,
+  // Write the first hit of every pixel to the G-buffer of the denoiser (0 = off)
+  gbuffer : u32,
+  // quads and tris hold compact records (load_quad, load_triangle), 0 = the Quad and Triangle layouts
+  compact_geometry : u32,
 };
 
 /// shape: tri(0), quad(1), sphere(2)
 struct HitInfo {
   dist : f32,
-  emissive : bool,
   front_face : bool,
   shape : u32,
   pos : vec3f,
   norm : vec3f,
   uv : vec2f,
-  col : vec3f,
+  // Direction of increasing u on the surface (not normalized), frame of normal maps
+  tangent : vec3f,
+  // Texture coordinates per unit of surface length, sqrt(uv area / surface area)
+  uv_scale : f32,
+  // Index into materials
+  material : u32,
 };
 
 struct ONB {
@@ -54,15 +90,87 @@ struct Quad {
   norm : vec4f,
   w : vec3f,
   d : f32,
-  col : vec3f,
-  emissive : f32,
+  material : u32,
+};
+
+/// Light quad and its alias table entry, the emissive spheres follow the quads
+/// Picked as itself below alias_prob, as lights[alias] above, power_pdf = power / total power
+struct Light {
+  quad : Quad,
+  alias_prob : f32,
+  alias : u32,
+  power_pdf : f32,
+  // Index into spheres of a sphere light (quad unused), kNoHit for a quad light
+  sphere : u32,
+};
+
+/// Vertex uvs are packed into the w components:
+/// (u0, v0) = (v0.w, e1.w), (u1, v1) = (e2.w, norm.w), (u2, v2) = (n0.w, n1.w), n2.w = uv_scale of HitInfo
+struct Triangle {
+  v0 : vec4f,
+  e1 : vec4f,
+  e2 : vec4f,
+  norm : vec4f,
+  n0 : vec4f,
+  n1 : vec4f,
+  n2 : vec4f,
+  material : u32,
 };
 
 struct Sphere {
   center : vec3f,
   radius : f32,
-  col : vec3f,
-  emissive : f32,
+  material : u32,
+};
+
+/// Interior: prim_count == 0, children are left_first and left_first + 1
+/// Leaf: bvh_prims[left_first .. left_first + prim_count)
+struct BVHNode {
+  aabb_min : vec3f,
+  left_first : u32,
+  aabb_max : vec3f,
+  prim_count : u32,
+};
+
+/// Light BVH node, the first 32 bytes match BVHNode
+/// Interior: prim_count == 0, children are left_first and left_first + 1
+/// Leaf: prim_count == 1, light left_first
+/// Emission of the subtree: directions within acos(cos_theta_o) of axis, plus a hemisphere around them
+struct LightNode {
+  aabb_min : vec3f,
+  left_first : u32,
+  aabb_max : vec3f,
+  prim_count : u32,
+  axis : vec3f,
+  cos_theta_o : f32,
+  power : f32,
+};
+
+/// Placement of a bottom-level BVH (BVHInstance), the transforms are the top three rows of affine matrices
+struct Instance {
+  object_to_world : array<vec4f, 3>,
+  world_to_object : array<vec4f, 3>,
+  // Replaces the material of the instanced primitives, kNoHit keeps theirs
+  material : u32,
+  // Root of the bottom-level BVH in bvh_nodes
+  root : u32,
+};
+
+/// Material table entry (Material in material.h), emissive where emission > 0
+struct Material {
+  base_color : vec3f,
+  // Lambertian(0), GGX(1) or Dielectric(2)
+  bxdf : u32,
+  // Perceptual roughness, alpha = roughness^2
+  roughness : f32,
+  metallic : f32,
+  ior : f32,
+  // Emitted radiance = base_color * emission
+  emission : f32,
+  // Layers of textures, kNoHit for none (textured_material)
+  base_color_texture : u32,
+  normal_texture : u32,
+  roughness_texture : u32,
 };
 
 fn fabs(x: f32) -> f32 {
@@ -77,6 +185,10 @@ fn face_norm(r: Ray, norm: vec3f) -> vec3f {
   return select(-norm, norm, dot(r.dir, norm.xyz) < 0.0);
 }
 
+fn srgb_to_linear(col: vec3f) -> vec3f {
+  return select(pow((col + 0.055) / 1.055, vec3f(2.4)), col / 12.92, col <= vec3f(0.04045));
+}
+
 fn sphere_uv(norm: vec3f) -> vec2f {
   let theta = acos(-norm.y);
   let phi = atan2(-norm.z, norm.x) + kPI;
@@ -85,13 +197,100 @@ fn sphere_uv(norm: vec3f) -> vec2f {
   return vec2f(u, v);
 }
 
+/// Sobol dimensions with a generator matrix, the size of a dimension group
+const kSobolDimensions = 4u;
+/// Per bounce: one group for shading, one for the roulette before the next bounce
+const kBounceDimensions = 8u;
+
+/// Sampler lookup tables (SamplerTables), uploaded once per Renderer
+/// sobol_matrices[j][d]: bit j of the generator matrix of Sobol dimension d
+@group(3) @binding(0) var<uniform> sobol_matrices : array<vec4u, 32>;
+/// Blue-noise ranks in [0, 1)
+@group(3) @binding(1) var blue_noise : texture_2d<f32>;
+
 // random function from
 // https://compute.toys/view/145
 var<private> seed : u32;
+/// Quasi-random samplers: dimension of the next rand() of a pixel sample
+var<private> sample_pixel : vec2u;
+var<private> sample_index : u32;
+var<private> sample_dimension : u32;
+
 fn rand() -> f32 {
+  if (camera.sampler == 0u) {
     seed = seed * 747796405u + 2891336453u;
     let word = ((seed >> ((seed >> 28u) + 4u)) ^ seed) * 277803737u;
     return f32((word >> 22u) ^ word) * bitcast<f32>(0x2f800004u);
+  }
+  let dim = sample_dimension;
+  sample_dimension += 1u;
+  if (camera.sampler == 1u) {
+    // Decorrelated sequence per pixel
+    let pixel_seed = hash_u32(sample_pixel.x ^ hash_u32(sample_pixel.y ^ camera.sampler_seed));
+    return f32(owen_sobol(sample_index, dim, pixel_seed) >> 8u) * 0x1p-24f;
+  }
+  // One sequence for the image, shifted by a blue-noise tile placed differently per dimension
+  let u = f32(owen_sobol(sample_index, dim, camera.sampler_seed) >> 8u) * 0x1p-24f;
+  let h = hash_u32(dim ^ camera.sampler_seed);
+  let texel = (sample_pixel + vec2u(h, h >> 16u)) % textureDimensions(blue_noise);
+  let v = u + textureLoad(blue_noise, texel, 0).r;
+  return min(select(v, v - 1.0, v >= 1.0), kOneMinusEpsilon);
+}
+
+/// Sample `index` of `pixel`, the camera ray draws the first dimensions
+fn start_pixel_sample(pixel: vec2u, index: u32) {
+  sample_pixel = pixel;
+  sample_index = index;
+  sample_dimension = 0u;
+}
+
+/// Restart the dimensions at `dim`, so that a bounce sees the same dimensions whatever the
+/// earlier bounces consumed
+fn start_dimension(dim: u32) {
+  sample_dimension = dim;
+}
+
+/// First dimension of the shading at bounce `depth`
+fn shade_dimension(depth: u32) -> u32 {
+  return kSobolDimensions + depth * kBounceDimensions;
+}
+
+/// Same hash as SamplerTables::Hash
+fn hash_u32(v: u32) -> u32 {
+  var x = v;
+  x ^= x >> 16u;
+  x *= 0x7feb352du;
+  x ^= x >> 15u;
+  x *= 0x846ca68bu;
+  x ^= x >> 16u;
+  return x;
+}
+
+/// Owen scrambling: random flips of every bit, depending on the higher bits only (Burley 2020)
+fn nested_uniform_scramble(v: u32, scramble: u32) -> u32 {
+  var x = reverseBits(v);
+  x += scramble;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+/// Dimension `dim` from 4D group dim / 4: the index is shuffled per group and every dimension
+/// scrambled with its own hash, so the 4 generator matrices pad to any number of dimensions
+fn owen_sobol(index: u32, dim: u32, scramble: u32) -> u32 {
+  let group_seed = hash_u32(scramble ^ hash_u32(dim / kSobolDimensions));
+  let component = dim % kSobolDimensions;
+  var shuffled = nested_uniform_scramble(index, group_seed);
+  var bits = 0u;
+  for (var j = 0u; shuffled != 0u; j++) {
+    if ((shuffled & 1u) != 0u) {
+      bits ^= sobol_matrices[j][component];
+    }
+    shuffled >>= 1u;
+  }
+  return nested_uniform_scramble(bits, hash_u32(group_seed + component + 1u));
 }
 
 fn rand_unit_sphere() -> vec3f {
@@ -110,10 +309,11 @@ fn rand_unit_sphere() -> vec3f {
     return vec3f(x, y, z);
 }
 
-fn rand_to_sphere(radius: f32, square_dist: f32) -> vec3f {
+/// Uniform direction in the cone around +z with half angle acos(cos_theta_max)
+fn rand_to_sphere(cos_theta_max: f32) -> vec3f {
   let r1 = rand();
   let r2 = rand();
-  let z = 1.0 + r2 * (sqrt(1.0 - radius * radius / square_dist) - 1.0);
+  let z = 1.0 + r2 * (cos_theta_max - 1.0);
   let phi = 2.0 * kPI * r1;
   let x = cos(phi) * sqrt(1.0 - z * z);
   let y = sin(phi) * sqrt(1.0 - z * z);
@@ -143,9 +343,11 @@ fn onb_local(onb: ONB, a: vec3f) -> vec3f {
   return a.x * onb.u + a.y * onb.v + a.z * onb.w;
 }
 
-fn sample_direction(hit: HitInfo) -> vec3f {
+/// One-sample MIS: the BSDF or the light strategy with equal probability, weighted by mixture_pdf
+/// wo points from the hit back along the ray
+fn sample_direction(hit: HitInfo, material: Material, wo: vec3f) -> vec3f {
     if (rand() > 0.5) {
-      return sample_from_bxdf(hit);
+      return sample_from_bxdf(hit, material, wo);
     }
     else {
       // Not normalized
@@ -153,28 +355,113 @@ fn sample_direction(hit: HitInfo) -> vec3f {
     }
 }
 
+/// Cone of directions from pos to the sphere, every direction from inside
+fn sphere_cos_theta_max(sphere: Sphere, pos: vec3f) -> f32 {
+  let square_dist = dot(sphere.center - pos, sphere.center - pos);
+  let radius2 = sphere.radius * sphere.radius;
+  return select(-1.0, sqrt(1.0 - radius2 / square_dist), square_dist > radius2);
+}
+
 fn sample_from_sphere(sphere: Sphere, pos: vec3f) -> vec3f {
-  let dir = sphere.center - pos;
-  let onb = build_onb_from_w(dir);
-  let square_dist = dot(dir, dir);
-  return onb_local(onb, rand_to_sphere(sphere.radius, square_dist));
+  let onb = build_onb_from_w(sphere.center - pos);
+  return onb_local(onb, rand_to_sphere(sphere_cos_theta_max(sphere, pos)));
 }
 
 fn sample_from_light(hit: HitInfo) -> vec3f {
-  // Only one light
-  let light = lights[0u];
-  let p = light.pos.xyz + (rand() * light.right.xyz) + (rand() * light.up.xyz);
+  let light = lights[select_light(hit)];
+  if (light.sphere != kNoHit) {
+    return sample_from_sphere(spheres[light.sphere], hit.pos);
+  }
+  let p = light.quad.pos.xyz + (rand() * light.quad.right.xyz) + (rand() * light.quad.up.xyz);
   return p - hit.pos;
 }
 
-fn sample_from_bxdf(hit: HitInfo) -> vec3f {
-    let bxdf = 0u;
+/// Light for next event estimation, proportional to power or descending the light tree
+fn select_light(hit: HitInfo) -> u32 {
+  var u = rand();
+  if (camera.light_tree == 0u) {
+    let n = arrayLength(&lights);
+    let scaled = u * f32(n);
+    let i = min(u32(scaled), n - 1u);
+    return select(lights[i].alias, i, scaled - f32(i) < lights[i].alias_prob);
+  }
+  // One random number, rescaled to [0, 1) at every level
+  var node_idx = 0u;
+  while (light_nodes[node_idx].prim_count == 0u) {
+    let node = light_nodes[node_idx];
+    let p = first_child_probability(node, hit);
+    if (u < p) {
+      u = min(u / p, kOneMinusEpsilon);
+      node_idx = node.left_first;
+    } else {
+      u = min((u - p) / (1.0 - p), kOneMinusEpsilon);
+      node_idx = node.left_first + 1u;
+    }
+  }
+  return light_nodes[node_idx].left_first;
+}
+
+/// cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of a and b
+fn cos_sub_clamped(sin_a: f32, cos_a: f32, sin_b: f32, cos_b: f32) -> f32 {
+  return select(cos_a * cos_b + sin_a * sin_b, 1.0, cos_a > cos_b);
+}
+
+fn sin_sub_clamped(sin_a: f32, cos_a: f32, sin_b: f32, cos_b: f32) -> f32 {
+  return select(sin_a * cos_b - cos_a * sin_b, 0.0, cos_a > cos_b);
+}
+
+fn sin_from_cos(cos: f32) -> f32 {
+  return sqrt(max(0.0, 1.0 - cos * cos));
+}
+
+/// Bound of the power of a light subtree arriving at the shading point (LightBounds::Importance of PBRT-v4)
+fn light_importance(node: LightNode, hit: HitInfo) -> f32 {
+  let center = 0.5 * (node.aabb_min + node.aabb_max);
+  let to_pos = hit.pos - center;
+  let dist2 = dot(to_pos, to_pos);
+  let diag = node.aabb_max - node.aabb_min;
+  let radius2 = 0.25 * dot(diag, diag);
+  let wi = select(kZero, to_pos / sqrt(dist2), dist2 > 0.0);
+  // Angle between the emission axis and the point, and the angle subtended by the bounds
+  let cos_w = dot(node.axis, wi);
+  let sin_w = sin_from_cos(cos_w);
+  let cos_b = select(-1.0, sqrt(1.0 - radius2 / dist2), dist2 > radius2);
+  let sin_b = sin_from_cos(cos_b);
+  let sin_o = sin_from_cos(node.cos_theta_o);
+  let cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+  let sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+  let cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+  // Outside the emission hemisphere
+  if (cos_p <= 0.0) {
+    return 0.0;
+  }
+  let cos_i = fabs(dot(wi, hit.norm));
+  let cos_i_bound = cos_sub_clamped(sin_from_cos(cos_i), cos_i, sin_b, cos_b);
+  return max(node.power * cos_p * cos_i_bound / max(dist2, radius2), 0.0);
+}
+
+/// Probability of descending into the first child, 0.5 if no child can light the point
+fn first_child_probability(node: LightNode, hit: HitInfo) -> f32 {
+  let first = light_importance(light_nodes[node.left_first], hit);
+  let second = light_importance(light_nodes[node.left_first + 1u], hit);
+  return select(first / (first + second), 0.5, first + second <= 0.0);
+}
+
+fn sample_from_bxdf(hit: HitInfo, material: Material, wo: vec3f) -> vec3f {
     var dir: vec3f;
-    switch (bxdf) {
+    switch (material.bxdf) {
       // Lambertian
       case 0u: {
         dir = sample_from_cosine(hit);
       }
+      // GGX: specular lobe or diffuse base
+      case 1u: {
+        if (rand() < specular_probability(material)) {
+          dir = sample_from_ggx(hit, material, wo);
+        } else {
+          dir = sample_from_cosine(hit);
+        }
+      }
       default: {
         dir = vec3f(0.0, -1.0, 0.0);
       }
@@ -188,24 +475,185 @@ fn sample_from_cosine(hit: HitInfo) -> vec3f {
   return onb_local(onb, a);
 }
 
-fn mixture_pdf(hit: HitInfo, dir: vec3f) -> f32 {
-  return 0.5 * cosine_pdf(hit, dir) + 0.5 * light_area_pdf(hit, dir);
+/// Visible normal sampling of the GGX distribution (Heitz 2018), reflected about the sampled normal
+fn sample_from_ggx(hit: HitInfo, material: Material, wo: vec3f) -> vec3f {
+  let alpha = ggx_alpha(material);
+  let onb = build_onb_from_w(hit.norm);
+  // View direction in the hemisphere configuration of the stretched distribution
+  let v = vec3f(dot(wo, onb.u), dot(wo, onb.v), dot(wo, onb.w));
+  let vh = normalize(vec3f(alpha * v.x, alpha * v.y, v.z));
+  let len2 = vh.x * vh.x + vh.y * vh.y;
+  let t1 = select(kXup, vec3f(-vh.y, vh.x, 0.0) / sqrt(len2), len2 > 0.0);
+  let t2 = cross(vh, t1);
+  let r1 = rand();
+  let r2 = rand();
+  let r = sqrt(r1);
+  let phi = 2.0 * kPI * r2;
+  let p1 = r * cos(phi);
+  let s = 0.5 * (1.0 + vh.z);
+  let p2 = (1.0 - s) * sqrt(1.0 - p1 * p1) + s * r * sin(phi);
+  let nh = p1 * t1 + p2 * t2 + sqrt(max(0.0, 1.0 - p1 * p1 - p2 * p2)) * vh;
+  let h = normalize(vec3f(alpha * nh.x, alpha * nh.y, max(0.0, nh.z)));
+  return reflect(-wo, onb_local(onb, h));
+}
+
+fn ggx_alpha(material: Material) -> f32 {
+  return max(material.roughness * material.roughness, kMinAlpha);
+}
+
+/// Reflectance at normal incidence: from the IOR for dielectrics, the base color for metals
+fn ggx_f0(material: Material) -> vec3f {
+  let r = (material.ior - 1.0) / (material.ior + 1.0);
+  return mix(vec3f(r * r), material.base_color, material.metallic);
+}
+
+/// Probability of sampling the specular lobe, metals have no diffuse base
+fn specular_probability(material: Material) -> f32 {
+  return mix(0.5, 1.0, material.metallic);
 }
 
-fn sphere_pdf(hit: HitInfo, sphere: Sphere, dir: vec3f) -> f32 {
-  let squared_dist = dot(sphere.center - hit.pos, sphere.center - hit.pos);
-  let cos_theta_max = sqrt(1.0 - sphere.radius * sphere.radius / squared_dist);
-  let solid_angle = 2.0 * kPI * (1.0 - cos_theta_max);
+/// Trowbridge-Reitz normal distribution, cos_h = dot(n, h)
+fn ggx_d(alpha: f32, cos_h: f32) -> f32 {
+  let a2 = alpha * alpha;
+  let t = cos_h * cos_h * (a2 - 1.0) + 1.0;
+  return a2 / (kPI * t * t);
+}
+
+/// Smith masking of one direction, cos = dot(n, w) > 0
+fn ggx_g1(alpha: f32, cos: f32) -> f32 {
+  let a2 = alpha * alpha;
+  return 2.0 * cos / (cos + sqrt(a2 + (1.0 - a2) * cos * cos));
+}
+
+/// Density of sample_from_ggx: visible normals G1(wo) D(h) / (4 cos_o)
+fn ggx_pdf(hit: HitInfo, material: Material, wo: vec3f, wi: vec3f) -> f32 {
+  let cos_o = dot(hit.norm, wo);
+  let cos_h = dot(hit.norm, normalize(wo + wi));
+  if (cos_o <= 0.0 || cos_h <= 0.0 || dot(hit.norm, wi) <= 0.0) {
+    return 0.0;
+  }
+  let alpha = ggx_alpha(material);
+  return ggx_g1(alpha, cos_o) * ggx_d(alpha, cos_h) / (4.0 * cos_o);
+}
+
+/// Diffuse base under a GGX specular layer (metallic-roughness), times the cosine of wi
+fn eval_ggx(hit: HitInfo, material: Material, wo: vec3f, wi: vec3f) -> vec3f {
+  let cos_o = dot(hit.norm, wo);
+  let cos_i = dot(hit.norm, wi);
+  if (cos_o <= 0.0 || cos_i <= 0.0) {
+    return kZero;
+  }
+  let alpha = ggx_alpha(material);
+  let h = normalize(wo + wi);
+  let f = schlick_fresnel(ggx_f0(material), max(dot(wo, h), 0.0));
+  let specular = f * ggx_d(alpha, dot(hit.norm, h)) * ggx_g1(alpha, cos_o) * ggx_g1(alpha, cos_i) / (4.0 * cos_o);
+  let diffuse = (1.0 - material.metallic) * (kOne - f) * material.base_color * k_1_PI * cos_i;
+  return specular + diffuse;
+}
+
+/// BSDF times the cosine of dir, for a direction from either strategy
+fn eval_bsdf(hit: HitInfo, material: Material, wo: vec3f, dir: vec3f) -> vec3f {
+  switch (material.bxdf) {
+    case 1u: {
+      return eval_ggx(hit, material, wo, normalize(dir));
+    }
+    default: {
+      return material.base_color * scattering_pdf(hit, dir);
+    }
+  }
+}
+
+/// Density of sample_from_bxdf
+fn bsdf_pdf(hit: HitInfo, material: Material, wo: vec3f, dir: vec3f) -> f32 {
+  switch (material.bxdf) {
+    case 1u: {
+      let p = specular_probability(material);
+      return p * ggx_pdf(hit, material, wo, normalize(dir)) + (1.0 - p) * cosine_pdf(hit, dir);
+    }
+    default: {
+      return cosine_pdf(hit, dir);
+    }
+  }
+}
+
+/// Density of sample_direction
+fn mixture_pdf(hit: HitInfo, material: Material, wo: vec3f, dir: vec3f) -> f32 {
+  return 0.5 * bsdf_pdf(hit, material, wo, dir) + 0.5 * light_pdf(hit, dir);
+}
+
+/// Smooth dielectric: mirror reflection with the Fresnel probability, refraction otherwise
+/// A delta lobe, so it takes no light samples. The transmission is tinted by the base color.
+fn scatter_dielectric(path: Path, hit: HitInfo, material: Material) -> Path {
+  let dir = normalize(path.ray.dir);
+  // Entering through the front face, leaving otherwise; hit.norm faces the ray
+  let eta = select(material.ior, 1.0 / material.ior, hit.front_face);
+  let cos_i = min(dot(-dir, hit.norm), 1.0);
+  let sin2_t = eta * eta * (1.0 - cos_i * cos_i);
+  // Schlick with the angle on the optically thinner side
+  let cos_outer = select(sqrt(max(0.0, 1.0 - sin2_t)), cos_i, hit.front_face);
+  let r0 = (1.0 - material.ior) / (1.0 + material.ior);
+  let reflectance = schlick_fresnel(vec3f(r0 * r0), cos_outer).x;
+  if (sin2_t >= 1.0 || rand() < reflectance) {
+    return Path(Ray(hit.pos, reflect(dir, hit.norm)), path.col, false);
+  }
+  return Path(Ray(hit.pos, refract(dir, hit.norm, eta)), path.col * material.base_color, false);
+}
+
+/// Density of sample_from_sphere for a direction that hits the sphere
+fn sphere_pdf(hit: HitInfo, sphere: Sphere) -> f32 {
+  let solid_angle = 2.0 * kPI * (1.0 - sphere_cos_theta_max(sphere, hit.pos));
   return 1.0 / solid_angle;
 }
 
-fn light_area_pdf(hit: HitInfo, to_light: vec3f) -> f32 {
-  // Only one light
-  let light = lights[0u];
-  let area = length(cross(light.right.xyz, light.up.xyz));
-  let distance_squared = length(to_light) * length(to_light);
-  let light_cosine = fabs(normalize(to_light).y) + kRayMin;
-  return distance_squared / (light_cosine * area);
+/// Solid angle density of sample_from_light for dir, summed over every light the ray passes through
+/// The light tree bounds the lights in both modes, the tree mode also carries the branch probabilities.
+fn light_pdf(hit: HitInfo, dir: vec3f) -> f32 {
+  let r = Ray(hit.pos, normalize(dir));
+  let safe_dir = select(r.dir, vec3f(1e-8), abs(r.dir) < vec3f(1e-8));
+  let inv_dir = 1.0 / safe_dir;
+  var no_hit = HitInfo();
+  no_hit.dist = kRayMax;
+  no_hit.shape = kNoHit;
+  var stack : array<u32, kBVHStackSize>;
+  var stack_pmf : array<f32, kBVHStackSize>;
+  stack[0] = 0u;
+  stack_pmf[0] = 1.0;
+  var stack_ptr = 1u;
+  var pdf = 0.0;
+  while (stack_ptr > 0u) {
+    stack_ptr--;
+    let node = light_nodes[stack[stack_ptr]];
+    let pmf = stack_pmf[stack_ptr];
+    let bounds = BVHNode(node.aabb_min, node.left_first, node.aabb_max, node.prim_count);
+    if (intersect_aabb(r, inv_dir, bounds, kRayMax) == kRayMax) {
+      continue;
+    }
+    if (node.prim_count > 0u) {
+      let light = lights[node.left_first];
+      let select_pmf = select(light.power_pdf, pmf, camera.light_tree != 0u);
+      if (light.sphere != kNoHit) {
+        let sphere = spheres[light.sphere];
+        if (intersect_sphere(r, sphere, no_hit).shape != kNoHit) {
+          pdf += select_pmf * sphere_pdf(hit, sphere);
+        }
+        continue;
+      }
+      let hit_light = intersect_quad(r, light.quad, no_hit);
+      if (hit_light.shape != kNoHit) {
+        let area = length(cross(light.quad.right.xyz, light.quad.up.xyz));
+        let light_cosine = fabs(dot(r.dir, light.quad.norm.xyz)) + kRayMin;
+        pdf += select_pmf * hit_light.dist * hit_light.dist / (light_cosine * area);
+      }
+      continue;
+    }
+    let p = select(1.0, first_child_probability(node, hit), camera.light_tree != 0u);
+    stack[stack_ptr] = node.left_first;
+    stack_pmf[stack_ptr] = pmf * p;
+    stack[stack_ptr + 1u] = node.left_first + 1u;
+    stack_pmf[stack_ptr + 1u] = pmf * (1.0 - p);
+    stack_ptr += 2u;
+  }
+  return pdf;
 }
 
 fn cosine_pdf(hit: HitInfo, dir: vec3f) -> f32 {
@@ -225,12 +673,32 @@ fn schlick_fresnel(col: vec3f, cos: f32) -> vec3f {
 }
 
 @group(0) @binding(0) var<uniform> camera : CameraParam;
-@group(1) @binding(0) var<storage> lights : array<Quad>;
-@group(1) @binding(1) var<storage> quads : array<Quad>;
+@group(1) @binding(0) var<storage> lights : array<Light>;
+/// Quad records (6 x vec4) or compact ones (3 x vec4), read through load_quad
+@group(1) @binding(1) var<storage> quads : array<vec4u>;
 @group(1) @binding(2) var<storage> spheres : array<Sphere>;
+@group(1) @binding(3) var<storage> bvh_nodes : array<BVHNode>;
+/// prim type: tri(0), quad(1), sphere(2), light(3) in the upper 2 bits
+@group(1) @binding(4) var<storage> bvh_prims : array<u32>;
+/// Triangle records (8 x vec4) or the grid and compact ones (2 + 4 x vec4), read through load_triangle
+@group(1) @binding(5) var<storage> tris : array<vec4u>;
+@group(1) @binding(6) var<storage> light_nodes : array<LightNode>;
+@group(1) @binding(7) var<storage> instances : array<Instance>;
+@group(1) @binding(8) var<storage> materials : array<Material>;
+/// Texture maps of the materials, one per layer with its mip chain (TextureArray)
+@group(1) @binding(9) var textures : texture_2d_array<f32>;
+/// Trilinear, repeating
+@group(1) @binding(10) var texture_sampler : sampler;
 
 fn pixel_sample_square(offset: vec2f, u: vec3f, v: vec3f) -> vec3f {
-    let recip_sqrt_spp = 1.0 / sqrt(f32(camera.spp));
+    // The quasi-random samplers stratify the pixel by themselves
+    if (camera.sampler != 0u) {
+      let px = -0.5 + rand();
+      let py = -0.5 + rand();
+      return (px * u) + (py * v);
+    }
+    // Same stratum count as compute_sample
+    let recip_sqrt_spp = 1.0 / f32(max(u32(sqrt(f32(camera.spp))), 1u));
     let px = -0.5 + recip_sqrt_spp * (offset.x + rand());
     let py = -0.5 + recip_sqrt_spp * (offset.y + rand());
     return (px * u) + (py * v);
@@ -261,51 +729,343 @@ fn setup_camera_ray(pos: vec2f, offset: vec2f, screen_size: vec2f) -> Ray {
     return Ray(origin, ray_dir);
 }
 
-fn raytrace(path: Path, depth: i32) -> Path {
+/// Spread angle of the ray cone through a pixel
+fn pixel_spread() -> f32 {
+  let screen_height = f32(textureDimensions(frameBuffer).y);
+  return atan(2.0 * tan(0.5 * radians(camera.fovy)) / screen_height);
+}
+
+/// Mip level of the texture lookups at a hit from the ray cone (Akenine-Möller et al. 2019, "Texture Level of
+/// Detail Strategies for Real-Time Ray Tracing"): the width of the cone over the texel size, wider where the ray
+/// grazes the surface. cone_width = pixel_spread() * path length, the spread is kept at every bounce.
+fn texture_lod(hit: HitInfo, dir: vec3f, cone_width: f32) -> f32 {
+  let size = f32(textureDimensions(textures).x);
+  let cos = max(fabs(dot(normalize(dir), hit.norm)), 1e-3);
+  return log2(max(cone_width * hit.uv_scale * size / cos, 1e-8));
+}
+
+/// Material of a hit with its texture maps applied, the normal map bends hit.norm
+fn textured_material(hit: ptr<function, HitInfo>, dir: vec3f, cone_width: f32) -> Material {
+  if ((*hit).shape == kNoHit) {
+    return Material();
+  }
+  var material = materials[(*hit).material];
+  if (material.base_color_texture == kNoHit && material.normal_texture == kNoHit && material.roughness_texture == kNoHit) {
+    return material;
+  }
+  let lod = texture_lod(*hit, dir, cone_width);
+  // Images start at the top row, v points up
+  let uv = vec2f((*hit).uv.x, 1.0 - (*hit).uv.y);
+  if (material.base_color_texture != kNoHit) {
+    let texel = textureSampleLevel(textures, texture_sampler, uv, material.base_color_texture, lod);
+    material.base_color *= srgb_to_linear(texel.rgb);
+  }
+  if (material.roughness_texture != kNoHit) {
+    material.roughness *= textureSampleLevel(textures, texture_sampler, uv, material.roughness_texture, lod).g;
+  }
+  if (material.normal_texture != kNoHit) {
+    let texel = textureSampleLevel(textures, texture_sampler, uv, material.normal_texture, lod);
+    (*hit).norm = normal_mapped(*hit, texel.xyz * 2.0 - 1.0);
+  }
+  return material;
+}
+
+/// Tangent space normal to world space, in the frame of the uv tangent and the outward shading normal
+/// (bitangent = normal x tangent), then faced to the ray again. Degenerate uvs keep the normal.
+fn normal_mapped(hit: HitInfo, n: vec3f) -> vec3f {
+  let norm = select(-hit.norm, hit.norm, hit.front_face);
+  let t = hit.tangent - norm * dot(norm, hit.tangent);
+  if (dot(t, t) < 1e-12) {
+    return hit.norm;
+  }
+  let tangent = normalize(t);
+  let mapped = normalize(n.x * tangent + n.y * cross(norm, tangent) + n.z * norm);
+  return select(-mapped, mapped, hit.front_face);
+}
+
+/// Emission, scattering and termination of a path at its closest hit
+/// material: textured_material of the hit
+fn shade(path: Path, hit: HitInfo, material: Material, depth: i32) -> Path {
+  start_dimension(shade_dimension(u32(depth)));
   let r = path.ray;
-  let hit = sample_hit(r);
+  // Missed everything: no environment light
+  if (hit.shape == kNoHit) {
+    return Path(r, kZero, true);
+  }
   // If light end trace
-  if (hit.emissive) {
+  if (material.emission > 0.0) {
+    let emitted = material.base_color * material.emission;
     if (depth == 0) {
-      return Path(r, hit.col, true);
+      return Path(r, emitted, true);
     }
     // Light estimation
-    let ray_col = f32(hit.front_face) * hit.col * path.col;
+    let ray_col = f32(hit.front_face) * emitted * path.col;
     return Path(r, ray_col, true);
   }
+  // Glass
+  else if (material.bxdf == kDielectric) {
+    return scatter_dielectric(path, hit, material);
+  }
   // Non-light object
   else {
     // Reflection
-    // MIS(Light & LambertBRDF)
-    var scatter_dir = sample_direction(hit);
-    let pdf_val = mixture_pdf(hit, scatter_dir);
+    // MIS(Light & BSDF)
+    let wo = -normalize(r.dir);
+    var scatter_dir = sample_direction(hit, material, wo);
+    let pdf_val = mixture_pdf(hit, material, wo, scatter_dir);
+    // Degenerate direction no strategy samples: 0 / 0 would put a NaN into the pixel
+    if (pdf_val <= 0.0) {
+      return Path(r, kZero, true);
+    }
     scatter_dir = normalize(scatter_dir);
     // Update path
     let scattered_ray = Ray(hit.pos, scatter_dir);
-    let scattered_col = path.col * hit.col * scattering_pdf(hit, scatter_dir) / pdf_val;
+    let scattered_col = path.col * eval_bsdf(hit, material, wo, scatter_dir) / pdf_val;
     return Path(scattered_ray, scattered_col, false);
   }
 }
 
+/// Russian roulette before bounce `depth`: a path survives with the probability of its largest
+/// throughput component and is reweighted by its inverse, so the estimate stays unbiased
+fn roulette(path: Path, depth: u32) -> Path {
+  if (path.end || depth < camera.rr_depth || depth >= camera.max_depth) {
+    return path;
+  }
+  let survival = min(max(path.col.r, max(path.col.g, path.col.b)), 1.0);
+  start_dimension(shade_dimension(depth - 1u) + kSobolDimensions);
+  if (rand() >= survival) {
+    return Path(path.ray, kZero, true);
+  }
+  return Path(path.ray, path.col / survival, false);
+}
+
+/// Closest hit in the top-level BVH, instances continue in their bottom-level BVH (traverse_blas)
 fn sample_hit(r: Ray) -> HitInfo {
   var hit = HitInfo();
   hit.dist = kRayMax;
   hit.shape = kNoHit;
-  hit.emissive = false;
   hit.front_face = false;
-  hit.col = kZero;
-  for (var idx = 0u; idx < arrayLength(&lights); idx++) {
-    let light = lights[idx];
-    hit = intersect_quad(r, light, hit);
+  hit.material = kNoHit;
+  let inv_dir = safe_inv_dir(r.dir);
+  // HitInfo.dist is euclidean, the slab test works in ray parameter units
+  let dir_len = length(r.dir);
+  var stack : array<u32, kBVHStackSize>;
+  var stack_ptr = 0u;
+  var node_idx = 0u;
+  loop {
+    let node = bvh_nodes[node_idx];
+    if (node.prim_count > 0u) {
+      for (var i = 0u; i < node.prim_count; i++) {
+        hit = intersect_prim(r, bvh_prims[node.left_first + i], hit);
+      }
+      node_idx = pop_node(&stack, &stack_ptr);
+    } else {
+      node_idx = descend(r, inv_dir, node, hit.dist / dir_len, &stack, &stack_ptr);
+    }
+    if (node_idx == kNoHit) {
+      break;
+    }
   }
-  for (var idx = 0u; idx < arrayLength(&quads); idx++) {
-    let quad = quads[idx];
-    hit = intersect_quad(r, quad, hit);
+  return hit;
+}
+
+/// Closest hit in the bottom-level BVH at bvh_nodes[root], r is in object space
+/// The same loop as sample_hit: WGSL has no recursion.
+fn traverse_blas(r: Ray, root: u32, closest: HitInfo) -> HitInfo {
+  var hit = closest;
+  let inv_dir = safe_inv_dir(r.dir);
+  let dir_len = length(r.dir);
+  var stack : array<u32, kBVHStackSize>;
+  var stack_ptr = 0u;
+  var node_idx = root;
+  loop {
+    let node = bvh_nodes[node_idx];
+    if (node.prim_count > 0u) {
+      for (var i = 0u; i < node.prim_count; i++) {
+        hit = intersect_local_prim(r, bvh_prims[node.left_first + i], hit);
+      }
+      node_idx = pop_node(&stack, &stack_ptr);
+    } else {
+      node_idx = descend(r, inv_dir, node, hit.dist / dir_len, &stack, &stack_ptr);
+    }
+    if (node_idx == kNoHit) {
+      break;
+    }
   }
-  for (var idx = 0u; idx < arrayLength(&spheres); idx++) {
-    let sphere = spheres[idx];
-    hit = intersect_sphere(r, sphere, hit);
+  return hit;
+}
+
+/// Avoid division by zero in the slab test
+fn safe_inv_dir(dir: vec3f) -> vec3f {
+  return 1.0 / select(dir, vec3f(1e-8), abs(dir) < vec3f(1e-8));
+}
+
+/// Next node from the stack, kNoHit once it is empty
+fn pop_node(stack: ptr<function, array<u32, kBVHStackSize>>, stack_ptr: ptr<function, u32>) -> u32 {
+  if (*stack_ptr == 0u) {
+    return kNoHit;
+  }
+  *stack_ptr -= 1u;
+  return (*stack)[*stack_ptr];
+}
+
+/// Next node below an interior node: the nearer child hit by the ray, the farther one is pushed
+/// \param t_max closest hit so far, in ray parameter units
+fn descend(r: Ray, inv_dir: vec3f, node: BVHNode, t_max: f32, stack: ptr<function, array<u32, kBVHStackSize>>,
+           stack_ptr: ptr<function, u32>) -> u32 {
+  var near_idx = node.left_first;
+  var far_idx = node.left_first + 1u;
+  var t_near = intersect_aabb(r, inv_dir, bvh_nodes[near_idx], t_max);
+  var t_far = intersect_aabb(r, inv_dir, bvh_nodes[far_idx], t_max);
+  if (t_far < t_near) {
+    let tmp_idx = near_idx;
+    near_idx = far_idx;
+    far_idx = tmp_idx;
+    let tmp_t = t_near;
+    t_near = t_far;
+    t_far = tmp_t;
+  }
+  if (t_near == kRayMax) {
+    return pop_node(stack, stack_ptr);
+  }
+  if (t_far != kRayMax) {
+    (*stack)[*stack_ptr] = far_idx;
+    *stack_ptr += 1u;
+  }
+  return near_idx;
+}
+
+/// Slab test, returns the entry distance or kRayMax on miss
+fn intersect_aabb(r: Ray, inv_dir: vec3f, node: BVHNode, t_max: f32) -> f32 {
+  let t0 = (node.aabb_min - r.start) * inv_dir;
+  let t1 = (node.aabb_max - r.start) * inv_dir;
+  let t_near = min(t0, t1);
+  let t_far = max(t0, t1);
+  let t_enter = max(max(t_near.x, t_near.y), max(t_near.z, 0.0));
+  let t_exit = min(min(t_far.x, t_far.y), min(t_far.z, t_max));
+  return select(kRayMax, t_enter, t_enter <= t_exit);
+}
+
+fn intersect_prim(r: Ray, prim: u32, closest: HitInfo) -> HitInfo {
+  let idx = prim & kPrimIndexMask;
+  switch (prim >> kPrimTypeShift) {
+    case 1u: {
+      return intersect_quad(r, load_quad(idx), closest);
+    }
+    case 2u: {
+      return intersect_sphere(r, spheres[idx], closest);
+    }
+    case 3u: {
+      return intersect_quad(r, lights[idx].quad, closest);
+    }
+    case 4u: {
+      return intersect_instance(r, instances[idx], closest);
+    }
+    default: {
+      return intersect_triangle(r, load_triangle(idx), closest);
+    }
+  }
+}
+
+/// Primitives of a bottom-level BVH: no lights and no nested instances
+fn intersect_local_prim(r: Ray, prim: u32, closest: HitInfo) -> HitInfo {
+  let idx = prim & kPrimIndexMask;
+  switch (prim >> kPrimTypeShift) {
+    case 1u: {
+      return intersect_quad(r, load_quad(idx), closest);
+    }
+    case 2u: {
+      return intersect_sphere(r, spheres[idx], closest);
+    }
+    default: {
+      return intersect_triangle(r, load_triangle(idx), closest);
+    }
+  }
+}
+
+/// quads[idx], compact records keep q, right and up and derive the rest as the Quad constructor does
+fn load_quad(idx: u32) -> Quad {
+  if (camera.compact_geometry == 0u) {
+    let base = idx * 6u;
+    return Quad(bitcast<vec4f>(quads[base]), bitcast<vec4f>(quads[base + 1u]), bitcast<vec4f>(quads[base + 2u]),
+                bitcast<vec4f>(quads[base + 3u]), bitcast<vec3f>(quads[base + 4u].xyz), bitcast<f32>(quads[base + 4u].w),
+                quads[base + 5u].x);
+  }
+  let base = idx * 3u;
+  let pos = bitcast<vec4f>(quads[base]).xyz;
+  let right = bitcast<vec4f>(quads[base + 1u]).xyz;
+  let up = bitcast<vec4f>(quads[base + 2u]).xyz;
+  let n = cross(right, up);
+  let norm = normalize(n);
+  return Quad(vec4f(pos, 1.0), vec4f(right, 1.0), vec4f(up, 1.0), vec4f(norm, 1.0), n / dot(n, n), dot(norm, pos),
+              quads[base].w);
+}
+
+/// Octahedral unit vector (CompactGeometry::DecodeNormal)
+fn decode_normal(packed: u32) -> vec3f {
+  let p = unpack2x16snorm(packed);
+  var n = vec3f(p, 1.0 - abs(p.x) - abs(p.y));
+  let t = max(-n.z, 0.0);
+  n.x += select(t, -t, n.x >= 0.0);
+  n.y += select(t, -t, n.y >= 0.0);
+  return normalize(n);
+}
+
+/// tris[idx], compact records are decoded on the grid at the start of tris (CompactGeometry)
+/// Words: 16-bit positions (x0 y0) (z0 x1) (y1 z1) (x2 y2) | z2, octahedral n0, n1, n2 | u0 v0 u1 v1 | u2 v2 uv_scale material
+fn load_triangle(idx: u32) -> Triangle {
+  if (camera.compact_geometry == 0u) {
+    let base = idx * 8u;
+    return Triangle(bitcast<vec4f>(tris[base]), bitcast<vec4f>(tris[base + 1u]), bitcast<vec4f>(tris[base + 2u]),
+                    bitcast<vec4f>(tris[base + 3u]), bitcast<vec4f>(tris[base + 4u]), bitcast<vec4f>(tris[base + 5u]),
+                    bitcast<vec4f>(tris[base + 6u]), tris[base + 7u].x);
+  }
+  let origin = bitcast<vec3f>(tris[0].xyz);
+  let step = bitcast<vec3f>(tris[1].xyz);
+  let base = 2u + idx * 4u;
+  let w0 = tris[base];
+  let w1 = tris[base + 1u];
+  let uv01 = bitcast<vec4f>(tris[base + 2u]);
+  let uv2 = bitcast<vec4f>(tris[base + 3u]);
+  let v0 = origin + vec3f(vec3u(w0.x & 0xffffu, w0.x >> 16u, w0.y & 0xffffu)) * step;
+  let v1 = origin + vec3f(vec3u(w0.y >> 16u, w0.z & 0xffffu, w0.z >> 16u)) * step;
+  let v2 = origin + vec3f(vec3u(w0.w & 0xffffu, w0.w >> 16u, w1.x & 0xffffu)) * step;
+  let e1 = v1 - v0;
+  let e2 = v2 - v0;
+  return Triangle(vec4f(v0, uv01.x), vec4f(e1, uv01.y), vec4f(e2, uv01.z), vec4f(normalize(cross(e1, e2)), uv01.w),
+                  vec4f(decode_normal(w1.y), uv2.x), vec4f(decode_normal(w1.z), uv2.y),
+                  vec4f(decode_normal(w1.w), uv2.z), bitcast<u32>(uv2.w));
+}
+
+fn transform_point(m: array<vec4f, 3>, p: vec3f) -> vec3f {
+  let h = vec4f(p, 1.0);
+  return vec3f(dot(m[0], h), dot(m[1], h), dot(m[2], h));
+}
+
+fn transform_dir(m: array<vec4f, 3>, d: vec3f) -> vec3f {
+  return vec3f(dot(m[0].xyz, d), dot(m[1].xyz, d), dot(m[2].xyz, d));
+}
+
+/// Trace the bottom-level BVH of an instance with the ray in object space (BVHPrimitives::IntersectInstance)
+/// The ray parameter is the same in both spaces, distances along the ray all scale by the same factor.
+fn intersect_instance(r: Ray, instance: Instance, closest: HitInfo) -> HitInfo {
+  let local_ray = Ray(transform_point(instance.world_to_object, r.start), transform_dir(instance.world_to_object, r.dir));
+  let scale = length(local_ray.dir) / length(r.dir);
+  var local = closest;
+  local.dist = closest.dist * scale;
+  local = traverse_blas(local_ray, instance.root, local);
+  if (local.dist >= closest.dist * scale) {
+    return closest;
   }
+  let m = instance.world_to_object;
+  var hit = local;
+  hit.dist = local.dist / scale;
+  hit.pos = transform_point(instance.object_to_world, local.pos);
+  // Normals transform with the inverse transpose
+  hit.norm = normalize(local.norm.x * m[0].xyz + local.norm.y * m[1].xyz + local.norm.z * m[2].xyz);
+  hit.tangent = transform_dir(instance.object_to_world, local.tangent);
+  hit.uv_scale = local.uv_scale * scale;
+  hit.material = select(local.material, instance.material, instance.material != kNoHit);
   return hit;
 }
 
@@ -313,7 +1073,8 @@ fn sample_hit(r: Ray) -> HitInfo {
 /// https://raytracing.github.io/books/RayTracingTheNextWeek.html#quadrilaterals/interiortestingoftheintersectionusinguvcoordinates
 fn intersect_quad(r: Ray, quad: Quad, closest: HitInfo) -> HitInfo {
   let denom = dot(quad.norm.xyz, r.dir);
-  if (fabs(denom) < kRayMin) {
+  // Relative to the ray length: instances scale the direction
+  if (fabs(denom) < kRayMin * length(r.dir)) {
     return closest;
   }
   let t = (quad.d - dot(quad.norm.xyz, r.start)) / denom;
@@ -334,7 +1095,50 @@ fn intersect_quad(r: Ray, quad: Quad, closest: HitInfo) -> HitInfo {
   let front_face = dot(r.dir, quad.norm.xyz) < 0.0;
   let norm = select(-quad.norm.xyz, quad.norm.xyz, front_face);
   let uv = vec2f(a, b);
-  return HitInfo(ray_dist, bool(quad.emissive > 0.0f), front_face, 1u, pos, norm, uv, quad.col);
+  // |w| = 1 / area
+  return HitInfo(ray_dist, front_face, 1u, pos, norm, uv, quad.right.xyz, sqrt(length(quad.w)), quad.material);
+}
+
+/// Möller–Trumbore with the precomputed edges e1, e2
+fn intersect_triangle(r: Ray, tri: Triangle, closest: HitInfo) -> HitInfo {
+  let p = cross(r.dir, tri.e2.xyz);
+  let det = dot(tri.e1.xyz, p);
+  if (fabs(det) < 1e-8) {
+    return closest;
+  }
+  let inv_det = 1.0 / det;
+  let s = r.start - tri.v0.xyz;
+  let u = dot(s, p) * inv_det;
+  if (u < 0.0 || 1.0 < u) {
+    return closest;
+  }
+  let q = cross(s, tri.e1.xyz);
+  let v = dot(r.dir, q) * inv_det;
+  if (v < 0.0 || 1.0 < u + v) {
+    return closest;
+  }
+  let t = dot(tri.e2.xyz, q) * inv_det;
+  if (t < kRayMin || kRayMax < t) {
+    return closest;
+  }
+  let pos = point_at(r, t);
+  let ray_dist = distance(pos, r.start);
+  if (ray_dist >= closest.dist) {
+    return closest;
+  }
+  // Interpolated vertex normal, oriented by the geometric normal
+  let w = 1.0 - u - v;
+  let front_face = dot(r.dir, tri.norm.xyz) < 0.0;
+  let shading_norm = normalize(w * tri.n0.xyz + u * tri.n1.xyz + v * tri.n2.xyz);
+  let norm = select(-shading_norm, shading_norm, front_face);
+  let uv0 = vec2f(tri.v0.w, tri.e1.w);
+  let duv1 = vec2f(tri.e2.w, tri.norm.w) - uv0;
+  let duv2 = vec2f(tri.n0.w, tri.n1.w) - uv0;
+  let uv = w * uv0 + u * vec2f(tri.e2.w, tri.norm.w) + v * vec2f(tri.n0.w, tri.n1.w);
+  // dp/du
+  let det_uv = duv1.x * duv2.y - duv2.x * duv1.y;
+  let tangent = select(kZero, (duv2.y * tri.e1.xyz - duv1.y * tri.e2.xyz) / det_uv, det_uv != 0.0);
+  return HitInfo(ray_dist, front_face, 0u, pos, norm, uv, tangent, tri.n2.w, tri.material);
 }
 
 fn intersect_sphere(r: Ray, sphere: Sphere, closest: HitInfo) -> HitInfo {
@@ -365,34 +1169,378 @@ fn intersect_sphere(r: Ray, sphere: Sphere, closest: HitInfo) -> HitInfo {
   let front_face = dot(r.dir, sphere_norm) < 0.0;
   let norm = select(-sphere_norm, sphere_norm, front_face);
   let uv = sphere_uv(norm);
-  return HitInfo(ray_dist, bool(sphere.emissive > 0.0f), front_face, 2u, pos, norm, uv, sphere.col);
+  // Along increasing phi, the uv square covers the whole sphere
+  let tangent = vec3f(norm.z, 0.0, -norm.x);
+  return HitInfo(ray_dist, front_face, 2u, pos, norm, uv, tangent, 1.0 / (2.0 * sphere.radius * sqrt(kPI)), sphere.material);
 }
 
-@group(2) @binding(0) var<storage,read> inputBuffer: array<f32,64>;
+/// Screen region handled by one dispatch, bound with a dynamic offset per tile
+struct TileParam {
+  origin : vec2u,
+  size : vec2u,
+  // Row stride of the tile in accumBuffer
+  stride : u32,
+};
+
+/// Accumulated radiance of the current tile, two planes of tile.stride^2 pixels and a summary:
+/// [idx] rgb = sum of samples, w = number of samples
+/// [moments_index(idx)] x = sum of squared sample luminance, y = 1 while the pixel takes samples
+/// [summary_index()] written by adaptive_update
+@group(2) @binding(0) var<storage, read_write> accumBuffer: array<vec4f>;
 @group(2) @binding(1) var frameBuffer: texture_storage_2d<rgba8unorm,write>;
+@group(2) @binding(2) var<uniform> tile : TileParam;
+/// Paths entering every bounce of the frame as 64-bit counters: [2 * depth] low, [2 * depth + 1] high word
+@group(2) @binding(6) var<storage, read_write> path_stats : array<atomic<u32>>;
+/// Denoiser input (camera.gbuffer): resolved radiance, first-hit albedo and normal + distance.
+/// Full-resolution textures, 1x1 while the denoiser is off.
+@group(2) @binding(7) var radiance : texture_storage_2d<rgba32float,write>;
+@group(2) @binding(8) var gbuffer_albedo : texture_storage_2d<rgba16float,write>;
+@group(2) @binding(9) var gbuffer_normal_depth : texture_storage_2d<rgba32float,write>;
+
+fn moments_index(idx: u32) -> u32 {
+  return tile.stride * tile.stride + idx;
+}
+
+fn summary_index() -> u32 {
+  return 2u * tile.stride * tile.stride;
+}
+
+fn luminance(col: vec3f) -> f32 {
+  return dot(col, vec3f(0.2126, 0.7152, 0.0722));
+}
+
+/// Pixels converged by adaptive_update take no more samples
+fn pixel_active(idx: u32) -> bool {
+  return camera.sample_offset == 0u || accumBuffer[moments_index(idx)].y != 0.0;
+}
+
+/// First hit of the first sample of a pixel, misses are stored as zero distance
+fn write_gbuffer(pixel: vec2u, hit: HitInfo, material: Material) {
+  if (hit.shape == kNoHit) {
+    textureStore(gbuffer_albedo, pixel, vec4f(0.0));
+    textureStore(gbuffer_normal_depth, pixel, vec4f(0.0));
+    return;
+  }
+  // Emitted radiance of lights, the base color of everything else
+  let albedo = select(material.base_color, material.base_color * material.emission, material.emission > 0.0);
+  textureStore(gbuffer_albedo, pixel, vec4f(albedo, 1.0));
+  textureStore(gbuffer_normal_depth, pixel, vec4f(hit.norm, hit.dist));
+}
+
+fn count_path(depth: u32) {
+  if (camera.path_stats != 0u && atomicAdd(&path_stats[2u * depth], 1u) == 0xffffffffu) {
+    atomicAdd(&path_stats[2u * depth + 1u], 1u);
+  }
+}
 
 @compute @workgroup_size(16, 16)
 fn compute_sample(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
   let screen_size = vec2u(textureDimensions(frameBuffer));
-  if (all(invocation_id.xy < screen_size)) {
-    seed = invocation_id.x + invocation_id.y * screen_size.x + u32(camera.seed) * screen_size.x * screen_size.y;;
-    var col : vec3f;
-    var sqrt_spp = u32(sqrt(f32(camera.spp)));
-    for (var s_j = 0u; s_j < sqrt_spp; s_j++) {
-      for (var s_i = 0u; s_i < sqrt_spp; s_i++) {
-        let pos = vec2f(f32(invocation_id.x), f32(invocation_id.y));
-        let offset = vec2f(f32(s_i), f32(s_j));
-        let r = setup_camera_ray(pos, offset, vec2f(screen_size));
-        var path = Path(r, kOne, false);
-        for (var i = 0; i < kRayDepth; i++) {
-          path = raytrace(path, i);
-          if (path.end) {
-            break;
-          }
+  let local = invocation_id.xy;
+  let accum_idx = local.x + local.y * tile.stride;
+  if (all(local < tile.size) && pixel_active(accum_idx)) {
+    let pixel = tile.origin + local;
+    seed = pixel.x + pixel.y * screen_size.x + u32(camera.seed) * screen_size.x * screen_size.y;
+    var col = kZero;
+    var luminance_sq = 0.0;
+    let sqrt_spp = max(u32(sqrt(f32(camera.spp))), 1u);
+    let pos = vec2f(f32(pixel.x), f32(pixel.y));
+    let spread = pixel_spread();
+    for (var s = 0u; s < camera.sample_count; s++) {
+      // Keep the pixel stratification across progressive dispatches
+      let stratum = (camera.sample_offset + s) % (sqrt_spp * sqrt_spp);
+      let offset = vec2f(f32(stratum % sqrt_spp), f32(stratum / sqrt_spp));
+      start_pixel_sample(pixel, camera.sample_offset + s);
+      let r = setup_camera_ray(pos, offset, vec2f(screen_size));
+      var path = Path(r, kOne, false);
+      // Width of the ray cone at the start of the path segment
+      var cone_width = 0.0;
+      for (var i = 0u; i < camera.max_depth; i++) {
+        count_path(i);
+        var hit = sample_hit(path.ray);
+        cone_width += spread * hit.dist;
+        let material = textured_material(&hit, path.ray.dir, cone_width);
+        if (i == 0u && camera.gbuffer != 0u && camera.sample_offset + s == 0u) {
+          write_gbuffer(pixel, hit, material);
+        }
+        path = roulette(shade(path, hit, material, i32(i)), i + 1u);
+        if (path.end) {
+          break;
         }
-        col += max(path.col, kZero) / f32(camera.spp);
       }
+      let sample_col = max(path.col, kZero);
+      col += sample_col;
+      luminance_sq += luminance(sample_col) * luminance(sample_col);
+    }
+    let prev = select(vec4f(0.0), accumBuffer[accum_idx], camera.sample_offset > 0u);
+    accumBuffer[accum_idx] = prev + vec4f(col, f32(camera.sample_count));
+    let prev_moments = select(0.0, accumBuffer[moments_index(accum_idx)].x, camera.sample_offset > 0u);
+    accumBuffer[moments_index(accum_idx)] = vec4f(prev_moments + luminance_sq, 1.0, 0.0, 0.0);
+  }
+}
+
+/// Average the accumulated samples of the current tile into the 8-bit output (and the denoiser input)
+@compute @workgroup_size(16, 16)
+fn resolve(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let local = invocation_id.xy;
+  if (all(local < tile.size)) {
+    let accum = accumBuffer[local.x + local.y * tile.stride];
+    let col = accum.rgb / max(accum.w, 1.0);
+    textureStore(frameBuffer, tile.origin + local, vec4f(col, 1.0));
+    if (camera.gbuffer != 0u) {
+      textureStore(radiance, tile.origin + local, vec4f(col, 1.0));
+    }
+  }
+}
+
+/// Wavefront mode: state of the path of one pixel between the wave kernels
+/// Indexed like accumBuffer, so that every path only ever touches its own pixel.
+/// hit_flags: front_face(bit 0)
+struct PathState {
+  start : vec3f,
+  seed : u32,
+  dir : vec3f,
+  // Samples of the current dispatch already generated
+  sample : u32,
+  col : vec3f,
+  hit_flags : u32,
+  hit_pos : vec3f,
+  hit_shape : u32,
+  hit_norm : vec3f,
+  hit_dist : f32,
+  // Base color and roughness after the texture maps of the hit
+  hit_col : vec3f,
+  hit_material : u32,
+  hit_roughness : f32,
+  // Width of the ray cone at start (texture_lod)
+  cone_width : f32,
+};
+
+/// Two ray queues of path indices, read from queue depth % 2 and written to the other one
+/// items[q * capacity ..] holds queue q, items[2 * capacity ..] the input queue sorted by shading bin,
+/// capacity = tile.stride * tile.stride
+struct RayQueues {
+  count : array<atomic<u32>, 2>,
+  // Paths of the input queue per shading bin (wave_extend) and placed per bin (wave_sort)
+  bin_count : array<atomic<u32>, kShadeBins>,
+  bin_fill : array<atomic<u32>, kShadeBins>,
+  items : array<u32>,
+};
+
+/// Bounce of the wave kernels, bound with a dynamic offset per depth
+struct WaveParam {
+  depth : u32,
+  // Read by wave_prepare only
+  path_stats : u32,
+};
+
+@group(2) @binding(3) var<storage, read_write> paths : array<PathState>;
+@group(2) @binding(4) var<storage, read_write> queues : RayQueues;
+@group(2) @binding(5) var<uniform> wave : WaveParam;
+
+/// Per tile and dispatch: random streams of compute_sample
+@compute @workgroup_size(16, 16)
+fn wave_begin(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let screen_size = vec2u(textureDimensions(frameBuffer));
+  let local = invocation_id.xy;
+  if (all(local < tile.size)) {
+    let pixel = tile.origin + local;
+    let idx = local.x + local.y * tile.stride;
+    paths[idx].seed = pixel.x + pixel.y * screen_size.x + u32(camera.seed) * screen_size.x * screen_size.y;
+    paths[idx].sample = 0u;
+    if (camera.sample_offset == 0u) {
+      accumBuffer[idx] = vec4f(0.0);
+      accumBuffer[moments_index(idx)] = vec4f(0.0, 1.0, 0.0, 0.0);
+    }
+  }
+}
+
+/// Per sample: camera ray of every pixel into queue 0
+@compute @workgroup_size(16, 16)
+fn wave_generate(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let screen_size = vec2u(textureDimensions(frameBuffer));
+  let local = invocation_id.xy;
+  if (all(invocation_id == vec3u(0u))) {
+    atomicStore(&queues.count[0], tile.size.x * tile.size.y);
+  }
+  if (any(local >= tile.size)) {
+    return;
+  }
+  let idx = local.x + local.y * tile.stride;
+  // Every pixel starts a path, queued in scanline order for coherent first hits. Converged pixels
+  // (adaptive sampling) leave their slot empty, wave_prepare still counts it for the first bounce.
+  let slot = local.x + local.y * tile.size.x;
+  if (accumBuffer[moments_index(idx)].y == 0.0) {
+    queues.items[slot] = kNoHit;
+    return;
+  }
+  let pixel = tile.origin + local;
+  seed = paths[idx].seed;
+  let sqrt_spp = max(u32(sqrt(f32(camera.spp))), 1u);
+  let stratum = (camera.sample_offset + paths[idx].sample) % (sqrt_spp * sqrt_spp);
+  let offset = vec2f(f32(stratum % sqrt_spp), f32(stratum / sqrt_spp));
+  start_pixel_sample(pixel, camera.sample_offset + paths[idx].sample);
+  let r = setup_camera_ray(vec2f(f32(pixel.x), f32(pixel.y)), offset, vec2f(screen_size));
+  paths[idx].start = r.start;
+  paths[idx].dir = r.dir;
+  paths[idx].col = kOne;
+  paths[idx].cone_width = 0.0;
+  paths[idx].sample += 1u;
+  paths[idx].seed = seed;
+  accumBuffer[idx].w += 1.0;
+  queues.items[slot] = idx;
+}
+
+/// Path of the n-th entry of the input queue, kNoHit past its end
+fn wave_path(n: u32) -> u32 {
+  let in_queue = wave.depth % 2u;
+  if (n >= atomicLoad(&queues.count[in_queue])) {
+    return kNoHit;
+  }
+  return queues.items[in_queue * tile.stride * tile.stride + n];
+}
+
+/// Shading bin of a hit: misses and lights just end their path, the rest go by bxdf
+fn shade_bin(shape: u32, material: u32) -> u32 {
+  if (shape == kNoHit || materials[material].emission > 0.0) {
+    return 0u;
+  }
+  return min(1u + materials[material].bxdf, kShadeBins - 1u);
+}
+
+/// n-th path of the sorted input queue, kNoHit past its end
+fn sorted_path(n: u32) -> u32 {
+  var count = 0u;
+  for (var b = 0u; b < kShadeBins; b++) {
+    count += atomicLoad(&queues.bin_count[b]);
+  }
+  if (n >= count) {
+    return kNoHit;
+  }
+  return queues.items[2u * tile.stride * tile.stride + n];
+}
+
+/// Per bounce (indirect): closest hit of every queued path
+@compute @workgroup_size(64)
+fn wave_extend(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let idx = wave_path(invocation_id.x);
+  if (idx == kNoHit) {
+    return;
+  }
+  let dir = paths[idx].dir;
+  var hit = sample_hit(Ray(paths[idx].start, dir));
+  let cone_width = paths[idx].cone_width + pixel_spread() * hit.dist;
+  // Texture lookups here, so that wave_shade reads a few words instead
+  let material = textured_material(&hit, dir, cone_width);
+  paths[idx].hit_flags = u32(hit.front_face);
+  paths[idx].hit_pos = hit.pos;
+  paths[idx].hit_shape = hit.shape;
+  paths[idx].hit_norm = hit.norm;
+  paths[idx].hit_dist = hit.dist;
+  paths[idx].hit_col = material.base_color;
+  paths[idx].hit_material = hit.material;
+  paths[idx].hit_roughness = material.roughness;
+  paths[idx].cone_width = cone_width;
+  atomicAdd(&queues.bin_count[shade_bin(hit.shape, hit.material)], 1u);
+}
+
+/// Per bounce (indirect): order the queued paths by shading bin, so that the lanes of a wave_shade
+/// workgroup mostly evaluate the same BSDF. Within a bin the order is arbitrary.
+@compute @workgroup_size(64)
+fn wave_sort(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let idx = wave_path(invocation_id.x);
+  if (idx == kNoHit) {
+    return;
+  }
+  let bin = shade_bin(paths[idx].hit_shape, paths[idx].hit_material);
+  var offset = 0u;
+  for (var b = 0u; b < bin; b++) {
+    offset += atomicLoad(&queues.bin_count[b]);
+  }
+  queues.items[2u * tile.stride * tile.stride + offset + atomicAdd(&queues.bin_fill[bin], 1u)] = idx;
+}
+
+/// Per bounce (indirect): shade every queued path in bin order, accumulate finished ones and queue the rest
+@compute @workgroup_size(64)
+fn wave_shade(@builtin(global_invocation_id) invocation_id: vec3<u32>) {
+  let idx = sorted_path(invocation_id.x);
+  if (idx == kNoHit) {
+    return;
+  }
+  let state = paths[idx];
+  var hit = HitInfo();
+  hit.dist = state.hit_dist;
+  hit.front_face = (state.hit_flags & 1u) != 0u;
+  hit.shape = state.hit_shape;
+  hit.pos = state.hit_pos;
+  hit.norm = state.hit_norm;
+  hit.material = state.hit_material;
+  var material = Material();
+  if (hit.shape != kNoHit) {
+    material = materials[state.hit_material];
+    material.base_color = state.hit_col;
+    material.roughness = state.hit_roughness;
+  }
+  seed = state.seed;
+  // The path index is the position of its pixel in the tile
+  let pixel = tile.origin + vec2u(idx % tile.stride, idx / tile.stride);
+  if (wave.depth == 0u && camera.gbuffer != 0u && camera.sample_offset + state.sample == 1u) {
+    write_gbuffer(pixel, hit, material);
+  }
+  start_pixel_sample(pixel, camera.sample_offset + state.sample - 1u);
+  let path = roulette(shade(Path(Ray(state.start, state.dir), state.col, false), hit, material, i32(wave.depth)),
+                      wave.depth + 1u);
+  paths[idx].seed = seed;
+  // Same cut as the bounce loop of compute_sample
+  if (path.end || wave.depth + 1u >= camera.max_depth) {
+    let sample_col = max(path.col, kZero);
+    accumBuffer[idx] += vec4f(sample_col, 0.0);
+    accumBuffer[moments_index(idx)].x += luminance(sample_col) * luminance(sample_col);
+    return;
+  }
+  paths[idx].start = path.ray.start;
+  paths[idx].dir = path.ray.dir;
+  paths[idx].col = path.col;
+  let out_queue = 1u - wave.depth % 2u;
+  queues.items[out_queue * tile.stride * tile.stride + atomicAdd(&queues.count[out_queue], 1u)] = idx;
+}
+
+/// Adaptive sampling totals of a tile, shared by the invocations of adaptive_update
+var<workgroup> tile_active : atomic<u32>;
+var<workgroup> tile_samples : atomic<u32>;
+var<workgroup> tile_max_error : atomic<u32>;
+
+/// Adaptive sampling, one workgroup per tile: pixels whose relative standard error of the mean
+/// luminance fell below camera.adaptive_threshold stop taking samples. The summary holds the
+/// pixels still active, the largest error among them and the mean samples per pixel of the tile.
+@compute @workgroup_size(256)
+fn adaptive_update(@builtin(local_invocation_index) local_idx: u32) {
+  let count = tile.size.x * tile.size.y;
+  for (var i = local_idx; i < count; i += 256u) {
+    let idx = i % tile.size.x + (i / tile.size.x) * tile.stride;
+    let accum = accumBuffer[idx];
+    atomicAdd(&tile_samples, u32(accum.w));
+    var moments = accumBuffer[moments_index(idx)];
+    if (moments.y == 0.0) {
+      continue;
+    }
+    let n = max(accum.w, 1.0);
+    let mean = luminance(accum.rgb) / n;
+    let variance = max(moments.x / n - mean * mean, 0.0) / max(n - 1.0, 1.0);
+    // Dark pixels are measured against a floor, their absolute error is invisible
+    let rel_error = sqrt(variance) / max(mean, kAdaptiveMinLuminance);
+    if (rel_error < camera.adaptive_threshold) {
+      moments.y = 0.0;
+      accumBuffer[moments_index(idx)] = moments;
+    } else {
+      atomicAdd(&tile_active, 1u);
+      // Non-negative floats order like their bits
+      atomicMax(&tile_max_error, bitcast<u32>(rel_error));
     }
-    textureStore(frameBuffer, invocation_id.xy, vec4(col, 1.0));
   }
-}
\ No newline at end of file
+  workgroupBarrier();
+  if (local_idx == 0u) {
+    accumBuffer[summary_index()] = vec4f(f32(atomicLoad(&tile_active)), bitcast<f32>(atomicLoad(&tile_max_error)),
+                                         f32(atomicLoad(&tile_samples)) / f32(count), 0.0);
+  }
+}
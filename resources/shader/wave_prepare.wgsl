@@ -0,0 +1,43 @@
+/// Indirect dispatch of the wave kernels of one bounce (see wave_extend / wave_shade in path_tracer.wgsl)
+const kWaveGroupSize = 64u;
+const kShadeBins = 4u;
+
+struct RayQueues {
+  count : array<atomic<u32>, 2>,
+  bin_count : array<atomic<u32>, kShadeBins>,
+  bin_fill : array<atomic<u32>, kShadeBins>,
+  items : array<u32>,
+};
+
+struct WaveParam {
+  depth : u32,
+  // Count the paths of every bounce in path_stats (0 = off, CameraParam::path_stats)
+  path_stats : u32,
+};
+
+@group(0) @binding(0) var<storage, read_write> queues : RayQueues;
+@group(0) @binding(1) var<storage, read_write> args : array<u32, 3>;
+@group(0) @binding(2) var<uniform> wave : WaveParam;
+/// Paths entering every bounce, 64-bit counters as in path_tracer.wgsl
+@group(0) @binding(3) var<storage, read_write> path_stats : array<atomic<u32>>;
+
+/// Workgroups over the input queue of this bounce, empty output queue and shading bins
+@compute @workgroup_size(1)
+fn wave_prepare() {
+  let in_queue = wave.depth % 2u;
+  let count = atomicLoad(&queues.count[in_queue]);
+  if (wave.path_stats != 0u) {
+    let low = atomicAdd(&path_stats[2u * wave.depth], count);
+    if (low + count < low) {
+      atomicAdd(&path_stats[2u * wave.depth + 1u], 1u);
+    }
+  }
+  args[0] = (count + kWaveGroupSize - 1u) / kWaveGroupSize;
+  args[1] = 1u;
+  args[2] = 1u;
+  atomicStore(&queues.count[1u - in_queue], 0u);
+  for (var b = 0u; b < kShadeBins; b++) {
+    atomicStore(&queues.bin_count[b], 0u);
+    atomicStore(&queues.bin_fill[b], 0u);
+  }
+}
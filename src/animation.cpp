@@ -0,0 +1,35 @@
+#include "animation.h"
+
+float Ease(Easing easing, float t) {
+  t = Clamp(t, 0.0f, 1.0f);
+  switch (easing) {
+    case Easing::Linear:
+      return t;
+    case Easing::EaseInQuart:
+      return EaseInQuart(t);
+    case Easing::EaseOutCubic:
+      return EaseOutCubic(t);
+    case Easing::EaseInOutExpo:
+      return EaseInOutExpo(t);
+    case Easing::Sigmoid:
+      return Sigmoid(t);
+  }
+  return t;
+}
+
+bool ParseEasing(const std::string &name, Easing &easing) {
+  if (name == "linear") {
+    easing = Easing::Linear;
+  } else if (name == "ease_in_quart") {
+    easing = Easing::EaseInQuart;
+  } else if (name == "ease_out_cubic") {
+    easing = Easing::EaseOutCubic;
+  } else if (name == "ease_in_out_expo") {
+    easing = Easing::EaseInOutExpo;
+  } else if (name == "sigmoid") {
+    easing = Easing::Sigmoid;
+  } else {
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,424 @@
+#include "bvh.h"
+#include <algorithm>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define BVH_USE_SSE 1
+#endif
+
+/// \brief AABB of a packed primitive reference
+/// \param prim packed primitive (see PackPrim)
+/// \return bounds padded so that flat quads/triangles never have a zero-thickness slab
+AABB BVHPrimitives::Bounds(uint32_t prim) const {
+  AABB bounds;
+  auto idx = PrimIndexOf(prim);
+  switch (PrimTypeOf(prim)) {
+    case PrimType::Triangle: {
+      const auto &tri = tris[idx];
+      for (const auto &vertex: tri.vertex_) {
+        bounds.Grow(vertex.point_);
+      }
+      break;
+    }
+    case PrimType::Quad:
+    case PrimType::Light: {
+      const auto &quad = PrimTypeOf(prim) == PrimType::Quad ? quads[idx] : lights[idx];
+      bounds.Grow(quad.q_);
+      bounds.Grow(quad.q_ + quad.right_);
+      bounds.Grow(quad.q_ + quad.up_);
+      bounds.Grow(quad.q_ + quad.right_ + quad.up_);
+      break;
+    }
+    case PrimType::Sphere: {
+      const auto &sphere = spheres[idx];
+      bounds.Grow(sphere.center_ - vec3(sphere.radius_));
+      bounds.Grow(sphere.center_ + vec3(sphere.radius_));
+      break;
+    }
+    case PrimType::Instance: {
+      /// Corners of the bottom-level root, already padded in object space
+      const auto &instance = instances[idx];
+      const auto local = blas[instance.blas].Bounds();
+      for (int corner = 0; corner < 8; ++corner) {
+        const auto p = vec3(corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y,
+                            corner & 4 ? local.max.z : local.min.z);
+        bounds.Grow(vec3(instance.object_to_world * vec4(p, 1)));
+      }
+      return bounds;
+    }
+  }
+  bounds.min -= vec3(kRayMin);
+  bounds.max += vec3(kRayMin);
+  return bounds;
+}
+
+/// \brief Intersect a single packed primitive
+/// \return true if `closest` was updated
+bool BVHPrimitives::Intersect(uint32_t prim, const Ray &r, HitInfo &closest) const {
+  auto idx = PrimIndexOf(prim);
+  bool hit = false;
+  switch (PrimTypeOf(prim)) {
+    case PrimType::Triangle:
+      hit = tris[idx].Intersect(r, closest);
+      break;
+    case PrimType::Quad:
+      hit = quads[idx].Intersect(r, closest);
+      break;
+    case PrimType::Sphere:
+      hit = spheres[idx].Intersect(r, closest);
+      break;
+    case PrimType::Light:
+      hit = lights[idx].Intersect(r, closest);
+      break;
+    case PrimType::Instance:
+      hit = IntersectInstance(instances[idx], r, closest);
+      break;
+  }
+  if (hit) {
+    closest.prim = prim;
+  }
+  return hit;
+}
+
+/// \brief Trace the bottom-level BVH of an instance with the ray in object space (mirrors intersect_instance)
+/// The ray parameter is the same in both spaces, distances along the ray all scale by the same factor.
+bool BVHPrimitives::IntersectInstance(const BVHInstance &instance, const Ray &r, HitInfo &closest) const {
+  const Ray local_ray(vec3(instance.world_to_object * vec4(r.start, 1)), vec3(instance.world_to_object * vec4(r.dir, 0)));
+  const auto scale = glm::length(local_ray.dir) / glm::length(r.dir);
+  HitInfo local = closest;
+  local.dist = closest.dist * scale;
+  if (!blas[instance.blas].Intersect(local_ray, *this, local)) {
+    return false;
+  }
+  closest = local;
+  closest.dist = local.dist / scale;
+  closest.pos = vec3(instance.object_to_world * vec4(local.pos, 1));
+  /// Normals transform with the inverse transpose
+  closest.norm = glm::normalize(vec3(glm::transpose(instance.world_to_object) * vec4(local.norm, 0)));
+  closest.tangent = vec3(instance.object_to_world * vec4(local.tangent, 0));
+  closest.uv_scale = local.uv_scale * scale;
+  if (instance.material != kNoHit) {
+    closest.material = instance.material;
+  }
+  return true;
+}
+
+/// \brief Build the BVH over all lights, quads, spheres and triangles
+/// Nodes are stored flattened with siblings adjacent, root at index 0.
+/// \param prims scene primitives
+/// \param pool worker threads used by the binned SAH builder
+void BVH::Build(const BVHPrimitives &prims, ThreadPool &pool) {
+  std::vector<uint32_t> packed;
+  packed.reserve(prims.lights.size() + prims.quads.size() + prims.spheres.size() + prims.tris.size());
+  for (uint32_t i = 0; i < prims.lights.size(); ++i) packed.push_back(PackPrim(PrimType::Light, i));
+  for (uint32_t i = 0; i < prims.quads.size(); ++i) packed.push_back(PackPrim(PrimType::Quad, i));
+  for (uint32_t i = 0; i < prims.spheres.size(); ++i) packed.push_back(PackPrim(PrimType::Sphere, i));
+  for (uint32_t i = 0; i < prims.tris.size(); ++i) packed.push_back(PackPrim(PrimType::Triangle, i));
+  Build(prims, packed, pool);
+}
+
+void BVH::Build(const BVHPrimitives &prims, const std::vector<uint32_t> &packed, ThreadPool &pool) {
+  std::vector<AABB> bounds(packed.size());
+  ParallelFor(pool, (uint32_t) packed.size(), BVHBuilder::kParallelThreshold, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        bounds[i] = prims.Bounds(packed[i]);
+      }
+  });
+  /// The builder returns a permutation of `bounds`, resolve it back into packed references
+  std::vector<uint32_t> order;
+  BVHBuilder(pool).Build(bounds, nodes_, order);
+  prims_.resize(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    prims_[i] = packed[order[i]];
+  }
+  parents_.clear();
+}
+
+void BVH::Assign(const BVHNode *nodes, uint32_t num_nodes, const uint32_t *prims, uint32_t num_prims) {
+  nodes_.assign(nodes, nodes + num_nodes);
+  prims_.assign(prims, prims + num_prims);
+  parents_.clear();
+}
+
+AABB BVH::Bounds() const {
+  if (nodes_.empty()) {
+    return {};
+  }
+  return {nodes_[0].aabb_min, nodes_[0].aabb_max};
+}
+
+/// \brief Parent links and primitive leaves for Refit
+void BVH::InitRefit() {
+  parents_.assign(nodes_.size(), kNoParent);
+  leaves_.clear();
+  leaves_.reserve(prims_.size());
+  refit_marks_.assign(nodes_.size(), 0);
+  for (uint32_t i = 0; i < (uint32_t) nodes_.size(); ++i) {
+    const auto &node = nodes_[i];
+    if (node.IsLeaf()) {
+      for (uint32_t p = 0; p < node.prim_count; ++p) {
+        leaves_[prims_[node.left_first + p]] = i;
+      }
+    } else {
+      parents_[node.left_first] = i;
+      parents_[node.left_first + 1] = i;
+    }
+  }
+}
+
+/// \brief Walk up from the leaves of the moved primitives and recompute the bounds of every node on the way
+/// The builder allocates children after their parent, so refitting in descending index order
+/// sees both children of a node before the node itself.
+std::vector<uint32_t> BVH::Refit(const BVHPrimitives &prims, const std::vector<uint32_t> &moved) {
+  std::vector<uint32_t> dirty;
+  if (nodes_.empty()) {
+    return dirty;
+  }
+  if (parents_.empty()) {
+    InitRefit();
+  }
+  for (auto prim: moved) {
+    auto leaf = leaves_.find(prim);
+    if (leaf == leaves_.end()) {
+      continue;
+    }
+    /// Stop at the first node already marked, its ancestors are too
+    for (auto node = leaf->second; node != kNoParent && !refit_marks_[node]; node = parents_[node]) {
+      refit_marks_[node] = 1;
+      dirty.push_back(node);
+    }
+  }
+  std::sort(dirty.begin(), dirty.end(), std::greater<>());
+  for (auto i: dirty) {
+    auto &node = nodes_[i];
+    AABB bounds;
+    if (node.IsLeaf()) {
+      for (uint32_t p = 0; p < node.prim_count; ++p) {
+        bounds.Grow(prims.Bounds(prims_[node.left_first + p]));
+      }
+    } else {
+      for (uint32_t c = 0; c < 2; ++c) {
+        const auto &child = nodes_[node.left_first + c];
+        bounds.Grow(AABB{child.aabb_min, child.aabb_max});
+      }
+    }
+    node.aabb_min = bounds.min;
+    node.aabb_max = bounds.max;
+    refit_marks_[i] = 0;
+  }
+  std::reverse(dirty.begin(), dirty.end());
+  return dirty;
+}
+
+/// \brief Slab test
+/// \return entry distance along the ray, or kRayMax on miss
+static float IntersectAABB(const Ray &r, const vec3 &inv_dir, const BVHNode &node, float t_max) {
+  auto t0 = (node.aabb_min - r.start) * inv_dir;
+  auto t1 = (node.aabb_max - r.start) * inv_dir;
+  auto t_near = glm::min(t0, t1);
+  auto t_far = glm::max(t0, t1);
+  auto t_enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+  auto t_exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, t_max));
+  return t_enter <= t_exit ? t_enter : kRayMax;
+}
+
+static vec3 SafeInverse(const vec3 &dir) {
+  vec3 inv;
+  for (int i = 0; i < 3; ++i) {
+    inv[i] = 1.0f / (fabsf(dir[i]) < 1e-8f ? 1e-8f : dir[i]);
+  }
+  return inv;
+}
+
+/// \brief Stack-based closest hit traversal (mirrors sample_hit in path_tracer.wgsl)
+/// \return true if anything was hit
+bool BVH::Intersect(const Ray &r, const BVHPrimitives &prims, HitInfo &closest) const {
+  if (prims_.empty()) {
+    return false;
+  }
+  auto inv_dir = SafeInverse(r.dir);
+  /// HitInfo.dist is euclidean, the slab test works in ray parameter units
+  auto dir_len = glm::length(r.dir);
+  bool hit = false;
+  uint32_t stack[BVHBuilder::kStackSize];
+  uint32_t stack_ptr = 0;
+  uint32_t node_idx = 0;
+  while (true) {
+    const auto &node = nodes_[node_idx];
+    if (node.IsLeaf()) {
+      for (uint32_t i = 0; i < node.prim_count; ++i) {
+        hit |= prims.Intersect(prims_[node.left_first + i], r, closest);
+      }
+      if (stack_ptr == 0) break;
+      node_idx = stack[--stack_ptr];
+      continue;
+    }
+    auto near_idx = node.left_first;
+    auto far_idx = node.left_first + 1;
+    auto t_max = closest.dist / dir_len;
+    auto t_near = IntersectAABB(r, inv_dir, nodes_[near_idx], t_max);
+    auto t_far = IntersectAABB(r, inv_dir, nodes_[far_idx], t_max);
+    if (t_far < t_near) {
+      std::swap(near_idx, far_idx);
+      std::swap(t_near, t_far);
+    }
+    if (t_near == kRayMax) {
+      if (stack_ptr == 0) break;
+      node_idx = stack[--stack_ptr];
+      continue;
+    }
+    node_idx = near_idx;
+    if (t_far != kRayMax) {
+      stack[stack_ptr++] = far_idx;
+    }
+  }
+  return hit;
+}
+
+/// \brief Ray packet in SoA layout for the 4-wide slab test
+struct alignas(16) RayPacket {
+    float start[3][BVH::kPacketSize];
+    float inv_dir[3][BVH::kPacketSize];
+    float t_max[BVH::kPacketSize];
+};
+
+/// \brief Slab test of every lane against one node
+/// \param t_enter entry distance per lane, kRayMax on miss
+/// \return mask of the lanes entering the node
+static uint32_t IntersectAABB4(const RayPacket &packet, const BVHNode &node, float *t_enter) {
+#ifdef BVH_USE_SSE
+  auto enter = _mm_setzero_ps();
+  auto exit = _mm_load_ps(packet.t_max);
+  for (int a = 0; a < 3; ++a) {
+    auto start = _mm_load_ps(packet.start[a]);
+    auto inv_dir = _mm_load_ps(packet.inv_dir[a]);
+    auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.aabb_min[a]), start), inv_dir);
+    auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.aabb_max[a]), start), inv_dir);
+    enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+    exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+  }
+  auto hit = _mm_cmple_ps(enter, exit);
+  _mm_store_ps(t_enter, _mm_or_ps(_mm_and_ps(hit, enter), _mm_andnot_ps(hit, _mm_set1_ps(kRayMax))));
+  return (uint32_t) _mm_movemask_ps(hit);
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < BVH::kPacketSize; ++i) {
+    auto enter = 0.0f;
+    auto exit = packet.t_max[i];
+    for (int a = 0; a < 3; ++a) {
+      auto t0 = (node.aabb_min[a] - packet.start[a][i]) * packet.inv_dir[a][i];
+      auto t1 = (node.aabb_max[a] - packet.start[a][i]) * packet.inv_dir[a][i];
+      enter = std::max(enter, std::min(t0, t1));
+      exit = std::min(exit, std::max(t0, t1));
+    }
+    t_enter[i] = enter <= exit ? enter : kRayMax;
+    mask |= enter <= exit ? 1u << i : 0u;
+  }
+  return mask;
+#endif
+}
+
+/// \brief Packet traversal: a node is visited if any lane enters it, leaves are tested per entering lane
+/// Gives the same closest hits as Intersect() on every lane.
+uint32_t BVH::Intersect4(const Ray *rays, uint32_t active, const BVHPrimitives &prims, HitInfo *closest) const {
+  if (prims_.empty() || active == 0) {
+    return 0;
+  }
+  RayPacket packet{};
+  float dir_len[kPacketSize]{};
+  for (uint32_t i = 0; i < kPacketSize; ++i) {
+    if (!(active & (1u << i))) {
+      /// Inactive lanes never enter a node
+      packet.t_max[i] = -1.0f;
+      continue;
+    }
+    auto inv_dir = SafeInverse(rays[i].dir);
+    for (int a = 0; a < 3; ++a) {
+      packet.start[a][i] = rays[i].start[a];
+      packet.inv_dir[a][i] = inv_dir[a];
+    }
+    dir_len[i] = glm::length(rays[i].dir);
+    packet.t_max[i] = closest[i].dist / dir_len[i];
+  }
+  struct StackEntry {
+      uint32_t node;
+      uint32_t mask;
+  };
+  StackEntry stack[BVHBuilder::kStackSize];
+  uint32_t stack_ptr = 0;
+  uint32_t node_idx = 0;
+  uint32_t mask = active;
+  uint32_t hit_mask = 0;
+  while (true) {
+    const auto &node = nodes_[node_idx];
+    if (node.IsLeaf()) {
+      for (uint32_t p = 0; p < node.prim_count; ++p) {
+        auto prim = prims_[node.left_first + p];
+        for (uint32_t i = 0; i < kPacketSize; ++i) {
+          if ((mask & (1u << i)) && prims.Intersect(prim, rays[i], closest[i])) {
+            hit_mask |= 1u << i;
+            packet.t_max[i] = closest[i].dist / dir_len[i];
+          }
+        }
+      }
+      if (stack_ptr == 0) break;
+      --stack_ptr;
+      node_idx = stack[stack_ptr].node;
+      mask = stack[stack_ptr].mask;
+      continue;
+    }
+    alignas(16) float t_left[kPacketSize];
+    alignas(16) float t_right[kPacketSize];
+    auto left_idx = node.left_first;
+    auto right_idx = node.left_first + 1;
+    auto left_mask = IntersectAABB4(packet, nodes_[left_idx], t_left) & mask;
+    auto right_mask = IntersectAABB4(packet, nodes_[right_idx], t_right) & mask;
+    if (left_mask == 0 && right_mask == 0) {
+      if (stack_ptr == 0) break;
+      --stack_ptr;
+      node_idx = stack[stack_ptr].node;
+      mask = stack[stack_ptr].mask;
+      continue;
+    }
+    if (left_mask == 0 || right_mask == 0) {
+      node_idx = left_mask ? left_idx : right_idx;
+      mask = left_mask ? left_mask : right_mask;
+      continue;
+    }
+    /// Both children: descend into the one entered first by any lane
+    auto near_left = kRayMax;
+    auto near_right = kRayMax;
+    for (uint32_t i = 0; i < kPacketSize; ++i) {
+      if (left_mask & (1u << i)) near_left = std::min(near_left, t_left[i]);
+      if (right_mask & (1u << i)) near_right = std::min(near_right, t_right[i]);
+    }
+    if (near_right < near_left) {
+      std::swap(left_idx, right_idx);
+      std::swap(left_mask, right_mask);
+    }
+    stack[stack_ptr++] = {right_idx, right_mask};
+    node_idx = left_idx;
+    mask = left_mask;
+  }
+  return hit_mask;
+}
+
+/// \brief Reference intersection over every primitive, used to validate the BVH
+bool BVH::IntersectBruteForce(const Ray &r, const BVHPrimitives &prims, HitInfo &closest) {
+  bool hit = false;
+  for (uint32_t i = 0; i < prims.lights.size(); ++i) hit |= prims.Intersect(PackPrim(PrimType::Light, i), r, closest);
+  for (uint32_t i = 0; i < prims.quads.size(); ++i) hit |= prims.Intersect(PackPrim(PrimType::Quad, i), r, closest);
+  for (uint32_t i = 0; i < prims.spheres.size(); ++i) hit |= prims.Intersect(PackPrim(PrimType::Sphere, i), r, closest);
+  for (uint32_t i = 0; i < prims.tris.size(); ++i) hit |= prims.Intersect(PackPrim(PrimType::Triangle, i), r, closest);
+  return hit;
+}
+
+/// \brief Reference intersection over the packed references a BVH was built from (instances still use their BVH)
+bool BVH::IntersectBruteForce(const Ray &r, const BVHPrimitives &prims, const std::vector<uint32_t> &packed, HitInfo &closest) {
+  bool hit = false;
+  for (auto prim: packed) {
+    hit |= prims.Intersect(prim, r, closest);
+  }
+  return hit;
+}
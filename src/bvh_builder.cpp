@@ -0,0 +1,270 @@
+#include "bvh_builder.h"
+#include <algorithm>
+#include <numeric>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define BVH_BUILDER_USE_SSE 1
+#endif
+
+/// \brief Build over `bounds`
+void BVHBuilder::Build(const std::vector<AABB> &bounds, std::vector<BVHNode> &nodes, std::vector<uint32_t> &order) {
+  auto num_prims = (uint32_t) bounds.size();
+  order.resize(num_prims);
+  std::iota(order.begin(), order.end(), 0);
+  if (num_prims == 0) {
+    nodes.assign(1, BVHNode{vec3(0.0f), 0, vec3(0.0f), 0});
+    return;
+  }
+  /// Centroids are padded to 16 bytes for the SIMD bound computation
+  bounds_ = &bounds;
+  centroids_.resize(num_prims);
+  ParallelFor(pool_, num_prims, kParallelThreshold, [this](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        auto c = (*bounds_)[i].Centroid();
+        centroids_[i] = {{c.x, c.y, c.z, 0.0f}};
+      }
+  });
+  /// Node arena: at most 2N - 1 nodes, index 1 stays unused so that sibling pairs share a cache line
+  nodes.resize(2 * (size_t) num_prims + 1);
+  nodes_ = nodes.data();
+  order_ = order.data();
+  node_count_ = 2;
+  Subdivide(0, 0, num_prims, 0);
+  nodes.resize(node_count_);
+  centroids_.clear();
+  centroids_.shrink_to_fit();
+  bounds_ = nullptr;
+}
+
+/// \brief Primitive and centroid bounds of order_[first .. first + count)
+BVHBuilder::RangeBounds BVHBuilder::ComputeBoundsSerial(uint32_t first, uint32_t count) const {
+  RangeBounds range;
+#ifdef BVH_BUILDER_USE_SSE
+  auto b_min = _mm_set1_ps(std::numeric_limits<float>::max());
+  auto b_max = _mm_set1_ps(-std::numeric_limits<float>::max());
+  auto c_min = b_min;
+  auto c_max = b_max;
+  for (uint32_t i = first; i < first + count; ++i) {
+    auto idx = order_[i];
+    auto c = _mm_load_ps(centroids_[idx].v);
+    c_min = _mm_min_ps(c_min, c);
+    c_max = _mm_max_ps(c_max, c);
+    /// AABB is { min.xyz, max.xyz }: two unaligned loads stay inside the struct
+    const auto &b = (*bounds_)[idx];
+    auto lo = _mm_loadu_ps(&b.min.x);  // min.x, min.y, min.z, max.x
+    auto hi = _mm_loadu_ps(&b.min.z);  // min.z, max.x, max.y, max.z
+    hi = _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(0, 3, 2, 1));
+    b_min = _mm_min_ps(b_min, lo);
+    b_max = _mm_max_ps(b_max, hi);
+  }
+  alignas(16) float tmp[4];
+  _mm_store_ps(tmp, b_min);
+  range.bounds.min = vec3(tmp[0], tmp[1], tmp[2]);
+  _mm_store_ps(tmp, b_max);
+  range.bounds.max = vec3(tmp[0], tmp[1], tmp[2]);
+  _mm_store_ps(tmp, c_min);
+  range.centroid_bounds.min = vec3(tmp[0], tmp[1], tmp[2]);
+  _mm_store_ps(tmp, c_max);
+  range.centroid_bounds.max = vec3(tmp[0], tmp[1], tmp[2]);
+#else
+  for (uint32_t i = first; i < first + count; ++i) {
+    auto idx = order_[i];
+    const auto &c = centroids_[idx].v;
+    range.centroid_bounds.Grow(vec3(c[0], c[1], c[2]));
+    range.bounds.Grow((*bounds_)[idx]);
+  }
+#endif
+  return range;
+}
+
+BVHBuilder::RangeBounds BVHBuilder::ComputeBounds(uint32_t first, uint32_t count) const {
+  if (count < 4 * kParallelThreshold) {
+    return ComputeBoundsSerial(first, count);
+  }
+  /// Parallel reduction over chunks
+  auto num_chunks = pool_.Size() * 2;
+  std::vector<RangeBounds> partial(num_chunks);
+  auto chunk_size = (count + num_chunks - 1) / num_chunks;
+  ParallelFor(pool_, num_chunks, 1, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t chunk = begin; chunk < end; ++chunk) {
+        auto chunk_first = first + chunk * chunk_size;
+        auto chunk_end = std::min(chunk_first + chunk_size, first + count);
+        if (chunk_first < chunk_end) {
+          partial[chunk] = ComputeBoundsSerial(chunk_first, chunk_end - chunk_first);
+        }
+      }
+  });
+  RangeBounds range;
+  for (const auto &p: partial) {
+    range.bounds.Grow(p.bounds);
+    range.centroid_bounds.Grow(p.centroid_bounds);
+  }
+  return range;
+}
+
+/// \brief Evaluate kBins SAH bins on every axis
+/// \return false if all centroids coincide
+bool BVHBuilder::FindSplit(uint32_t first, uint32_t count, const RangeBounds &range, int &axis, uint32_t &split_bin, float &cost) const {
+  struct Bin {
+      AABB bounds;
+      uint32_t count = 0;
+  };
+  using Bins = std::array<std::array<Bin, kBins>, 3>;
+  const auto c_min = range.centroid_bounds.min;
+  const auto extent = range.centroid_bounds.max - range.centroid_bounds.min;
+  vec3 scale;
+  for (int a = 0; a < 3; ++a) {
+    scale[a] = extent[a] > 0.0f ? (float) kBins / extent[a] : 0.0f;
+  }
+  auto bin_range = [&](uint32_t begin, uint32_t end, Bins &bins) {
+      for (uint32_t i = begin; i < end; ++i) {
+        auto idx = order_[i];
+        const auto &c = centroids_[idx].v;
+        for (int a = 0; a < 3; ++a) {
+          auto b = std::min(kBins - 1, (uint32_t) ((c[a] - c_min[a]) * scale[a]));
+          bins[a][b].count++;
+          bins[a][b].bounds.Grow((*bounds_)[idx]);
+        }
+      }
+  };
+  Bins bins{};
+  if (count < 4 * kParallelThreshold) {
+    bin_range(first, first + count, bins);
+  } else {
+    /// Bin chunks in parallel and merge
+    auto num_chunks = pool_.Size() * 2;
+    std::vector<Bins> partial(num_chunks);
+    auto chunk_size = (count + num_chunks - 1) / num_chunks;
+    ParallelFor(pool_, num_chunks, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t chunk = begin; chunk < end; ++chunk) {
+          auto chunk_first = first + chunk * chunk_size;
+          auto chunk_end = std::min(chunk_first + chunk_size, first + count);
+          if (chunk_first < chunk_end) {
+            bin_range(chunk_first, chunk_end, partial[chunk]);
+          }
+        }
+    });
+    for (const auto &p: partial) {
+      for (int a = 0; a < 3; ++a) {
+        for (uint32_t b = 0; b < kBins; ++b) {
+          bins[a][b].count += p[a][b].count;
+          bins[a][b].bounds.Grow(p[a][b].bounds);
+        }
+      }
+    }
+  }
+  bool found = false;
+  cost = std::numeric_limits<float>::max();
+  for (int a = 0; a < 3; ++a) {
+    if (scale[a] == 0.0f) {
+      continue;
+    }
+    /// Sweep from both sides to get the cost of every bin boundary
+    std::array<float, kBins - 1> left_cost{};
+    AABB left_bounds;
+    uint32_t left_count = 0;
+    for (uint32_t b = 0; b < kBins - 1; ++b) {
+      left_count += bins[a][b].count;
+      left_bounds.Grow(bins[a][b].bounds);
+      left_cost[b] = left_count > 0 ? (float) left_count * left_bounds.Area() : 0.0f;
+    }
+    AABB right_bounds;
+    uint32_t right_count = 0;
+    for (uint32_t b = kBins - 1; b > 0; --b) {
+      right_count += bins[a][b].count;
+      right_bounds.Grow(bins[a][b].bounds);
+      auto left = count - right_count;
+      if (left == 0 || right_count == 0) {
+        continue;
+      }
+      auto split_cost = left_cost[b - 1] + (float) right_count * right_bounds.Area();
+      if (split_cost < cost) {
+        cost = split_cost;
+        axis = a;
+        split_bin = b;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+/// \brief Recursive binned SAH split
+void BVHBuilder::Subdivide(uint32_t node_idx, uint32_t first, uint32_t count, uint32_t depth) {
+  auto range = ComputeBounds(first, count);
+  auto &node = nodes_[node_idx];
+  node.aabb_min = range.bounds.min;
+  node.aabb_max = range.bounds.max;
+  node.left_first = first;
+  node.prim_count = count;
+  if (count <= 1 || depth + 1 >= kStackSize) {
+    return;
+  }
+  int axis = 0;
+  uint32_t split_bin = 0;
+  float split_cost = 0.0f;
+  uint32_t mid = first;
+  if (FindSplit(first, count, range, axis, split_bin, split_cost)) {
+    auto node_area = std::max(range.bounds.Area(), std::numeric_limits<float>::min());
+    auto sah_split = kTraversalCost + kIntersectCost * split_cost / node_area;
+    auto sah_leaf = kIntersectCost * (float) count;
+    if (sah_split >= sah_leaf && count <= kMaxLeafPrims) {
+      return;
+    }
+    auto c_min = range.centroid_bounds.min[axis];
+    auto scale = (float) kBins / (range.centroid_bounds.max[axis] - c_min);
+    auto *split = std::partition(order_ + first, order_ + first + count, [&](uint32_t idx) {
+        auto b = std::min(kBins - 1, (uint32_t) ((centroids_[idx].v[axis] - c_min) * scale));
+        return b < split_bin;
+    });
+    mid = (uint32_t) (split - order_);
+  }
+  if (mid == first || mid == first + count) {
+    if (count <= kMaxLeafPrims) {
+      return;
+    }
+    /// Centroids coincide: split the range in half
+    mid = first + count / 2;
+  }
+  auto left_idx = node_count_.fetch_add(2);
+  node.left_first = left_idx;
+  node.prim_count = 0;
+  if (count > kParallelThreshold) {
+    TaskGroup group(pool_);
+    group.Run([this, left_idx, first, mid, depth] { Subdivide(left_idx, first, mid - first, depth + 1); });
+    Subdivide(left_idx + 1, mid, first + count - mid, depth + 1);
+    group.Wait();
+  } else {
+    Subdivide(left_idx, first, mid - first, depth + 1);
+    Subdivide(left_idx + 1, mid, first + count - mid, depth + 1);
+  }
+}
+
+/// \brief SAH cost normalized by the root surface area
+float BVHBuilder::SAHCost(const std::vector<BVHNode> &nodes) {
+  if (nodes.empty() || (nodes.size() == 1 && !nodes[0].IsLeaf())) {
+    return 0.0f;
+  }
+  auto area = [](const BVHNode &node) {
+      AABB b;
+      b.min = node.aabb_min;
+      b.max = node.aabb_max;
+      return b.Area();
+  };
+  auto root_area = std::max(area(nodes[0]), std::numeric_limits<float>::min());
+  float cost = 0.0f;
+  std::vector<uint32_t> stack{0};
+  while (!stack.empty()) {
+    const auto &node = nodes[stack.back()];
+    stack.pop_back();
+    if (node.IsLeaf()) {
+      cost += kIntersectCost * (float) node.prim_count * area(node) / root_area;
+    } else {
+      cost += kTraversalCost * area(node) / root_area;
+      stack.push_back(node.left_first);
+      stack.push_back(node.left_first + 1);
+    }
+  }
+  return cost;
+}
@@ -61,10 +61,61 @@ void Camera::InitBindGroup(Device &device) {
   uniforms_.bind_group_ = device.createBindGroup(bind_group_desc);
 }
 
-void Camera::Update(Queue &queue, float t, float aspect) {
-  Point3 origin = vec3(278, 278, -800);
-  Point3 target = vec3(278, 278, 0);
-  float fovy = 40.0f;
-  CameraParam param(origin, target, aspect, fovy, spp_, RandSeed());
-  queue.writeBuffer(uniform_buffer_, 0, &param, sizeof(CameraParam));
+void Camera::Update(Queue &queue, float t, float aspect, uint32_t sampler_seed) {
+  param_ = ParamAt(t, aspect, spp_, RandSeed(), track_);
+  param_.max_depth = max_depth_;
+  param_.rr_depth = rr_depth_;
+  param_.path_stats = path_stats_ ? 1 : 0;
+  param_.light_tree = light_tree_ ? 1 : 0;
+  param_.sampler = sampler_;
+  param_.sampler_seed = sampler_seed;
+  param_.adaptive_threshold = adaptive_threshold_;
+  param_.gbuffer = gbuffer_ ? 1 : 0;
+  param_.compact_geometry = compact_geometry_ ? 1 : 0;
+  queue.writeBuffer(uniform_buffer_, 0, &param_, sizeof(CameraParam));
+}
+
+/// \brief Camera at time t, shared by the GPU uniform and the CPU backend
+/// \param t animation time in frames
+/// \param aspect width / height
+/// \param track camera keyframes
+Camera::CameraParam Camera::ParamAt(float t, float aspect, uint32_t spp, uint32_t seed, const Track<CameraPose> &track) {
+  const auto pose = track.Sample(t, RestPose());
+  return {pose.origin, pose.target, aspect, pose.fovy, spp, seed};
+}
+
+CameraPose Camera::RestPose() {
+  return {Point3(278, 278, -800), Point3(278, 278, 0), 40.0f};
+}
+
+Camera::View Camera::ViewOf(const CameraParam &param, uint32_t width, uint32_t height) {
+  const auto focal_length = glm::length(param.origin - param.target);
+  const auto viewport_height = 2.0f * std::tan(0.5f * glm::radians(param.fovy)) * focal_length;
+  const auto viewport_width = viewport_height * param.aspect;
+  const auto w = glm::normalize(param.origin - param.target);
+  const auto u = glm::normalize(glm::cross(vec3(0.0f, 1.0f, 0.0f), w));
+  const auto v = glm::cross(w, u);
+  const auto viewport_u = viewport_width * u;
+  const auto viewport_v = viewport_height * -v;
+  View view;
+  view.origin = param.origin;
+  view.pixel_delta_u = viewport_u / (float) width;
+  view.pixel_delta_v = viewport_v / (float) height;
+  const auto viewport_upper_left = param.origin - focal_length * w - viewport_u * 0.5f - viewport_v * 0.5f;
+  view.pixel_origin = viewport_upper_left + 0.5f * (view.pixel_delta_u + view.pixel_delta_v);
+  view.forward = -w / focal_length;
+  return view;
+}
+
+/// \brief Update the progressive sample range without rewriting the whole uniform
+/// \param queue
+/// \param sample_offset samples already accumulated
+/// \param sample_count samples taken by the next dispatch
+/// \param seed random seed of the dispatch, every dispatch needs its own random sequence
+void Camera::SetProgress(Queue &queue, uint32_t sample_offset, uint32_t sample_count, uint32_t seed) {
+  param_.seed = seed;
+  param_.sample_offset = sample_offset;
+  param_.sample_count = sample_count;
+  const auto offset = offsetof(CameraParam, seed);
+  queue.writeBuffer(uniform_buffer_, offset, (const uint8_t *) &param_ + offset, sizeof(CameraParam) - offset);
 }
@@ -0,0 +1,139 @@
+#include "compact_geometry.h"
+#include <cstring>
+
+namespace {
+constexpr float kGridMax = 65535.0f;
+
+/// \brief Grid index of one coordinate
+uint32_t Quantize(float p, float origin, float step) {
+  return step > 0.0f ? (uint32_t) Clamp(std::floor((p - origin) / step + 0.5f), 0.0f, kGridMax) : 0u;
+}
+
+/// \brief Round like pack2x16snorm
+uint32_t PackSnorm16(float x) {
+  return (uint32_t) (uint16_t) (int16_t) std::floor(0.5f + 32767.0f * Clamp(x, -1.0f, 1.0f));
+}
+
+float UnpackSnorm16(uint32_t x) {
+  return std::max((float) (int16_t) (uint16_t) x / 32767.0f, -1.0f);
+}
+
+float SignNotZero(float x) {
+  return x >= 0.0f ? 1.0f : -1.0f;
+}
+
+void StoreVec3(vec3 v, uint32_t *data) {
+  const float xyz[3] = {v.x, v.y, v.z};
+  std::memcpy(data, xyz, sizeof(xyz));
+}
+
+vec3 LoadVec3(const uint32_t *data) {
+  float xyz[3];
+  std::memcpy(xyz, data, sizeof(xyz));
+  return {xyz[0], xyz[1], xyz[2]};
+}
+}
+
+CompactGeometry::CompactGeometry(const AABB &bounds) {
+  if (bounds.min.x > bounds.max.x) {
+    return;
+  }
+  origin_ = bounds.min;
+  step_ = (bounds.max - bounds.min) / kGridMax;
+}
+
+void CompactGeometry::WriteHeader(uint32_t *data) const {
+  std::memset(data, 0, kHeaderWords * sizeof(uint32_t));
+  StoreVec3(origin_, data);
+  StoreVec3(step_, data + 4);
+}
+
+vec3 CompactGeometry::Dequantize(uint32_t x, uint32_t y, uint32_t z) const {
+  return origin_ + vec3((float) x, (float) y, (float) z) * step_;
+}
+
+void CompactGeometry::EncodeTriangle(const Triangle &tri, uint32_t *data) const {
+  uint32_t q[9];
+  for (int i = 0; i < 3; ++i) {
+    for (int axis = 0; axis < 3; ++axis) {
+      q[i * 3 + axis] = Quantize(tri.vertex_[i].point_[axis], origin_[axis], step_[axis]);
+    }
+  }
+  /// 16-bit positions in pairs: (x0 y0) (z0 x1) (y1 z1) (x2 y2) (z2 -)
+  data[0] = q[0] | q[1] << 16;
+  data[1] = q[2] | q[3] << 16;
+  data[2] = q[4] | q[5] << 16;
+  data[3] = q[6] | q[7] << 16;
+  data[4] = q[8];
+  for (int i = 0; i < 3; ++i) {
+    data[5 + i] = EncodeNormal(tri.vertex_[i].normal_);
+  }
+  for (int i = 0; i < 3; ++i) {
+    std::memcpy(data + 8 + i * 2, &tri.vertex_[i].u_, sizeof(float));
+    std::memcpy(data + 9 + i * 2, &tri.vertex_[i].v_, sizeof(float));
+  }
+  std::memcpy(data + 14, &tri.uv_scale_, sizeof(float));
+  data[15] = tri.material_;
+}
+
+Triangle CompactGeometry::DecodeTriangle(const uint32_t *data) const {
+  const vec3 p[3] = {Dequantize(data[0] & 0xffffu, data[0] >> 16, data[1] & 0xffffu),
+                     Dequantize(data[1] >> 16, data[2] & 0xffffu, data[2] >> 16),
+                     Dequantize(data[3] & 0xffffu, data[3] >> 16, data[4] & 0xffffu)};
+  Vertex v[3];
+  for (int i = 0; i < 3; ++i) {
+    float uv[2];
+    std::memcpy(uv, data + 8 + i * 2, sizeof(uv));
+    v[i] = Vertex(p[i], DecodeNormal(data[5 + i]), uv[0], uv[1]);
+  }
+  Triangle tri(v[0], v[1], v[2], data[15]);
+  std::memcpy(&tri.uv_scale_, data + 14, sizeof(float));
+  return tri;
+}
+
+Triangle CompactGeometry::Snap(const Triangle &tri) const {
+  uint32_t data[kTriangleWords];
+  EncodeTriangle(tri, data);
+  auto snapped = DecodeTriangle(data);
+  /// Texture coordinate density of the snapped edges
+  snapped.InitTexCoords();
+  return snapped;
+}
+
+void CompactGeometry::EncodeQuad(const Quad &quad, uint32_t *data) {
+  std::memset(data, 0, kQuadWords * sizeof(uint32_t));
+  StoreVec3(quad.q_, data);
+  data[3] = quad.material_;
+  StoreVec3(quad.right_, data + 4);
+  StoreVec3(quad.up_, data + 8);
+}
+
+Quad CompactGeometry::DecodeQuad(const uint32_t *data) {
+  /// norm, w and d as the constructor derives them
+  return {LoadVec3(data), LoadVec3(data + 4), LoadVec3(data + 8), data[3]};
+}
+
+uint32_t CompactGeometry::EncodeNormal(vec3 n) {
+  const auto sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  /// Degenerate normals decode as +z
+  if (!(sum > 0.0f) || !std::isfinite(sum)) {
+    return 0;
+  }
+  n /= sum;
+  float x = n.x, y = n.y;
+  /// Lower hemisphere folded over the diagonals
+  if (n.z < 0.0f) {
+    x = (1.0f - std::abs(n.y)) * SignNotZero(n.x);
+    y = (1.0f - std::abs(n.x)) * SignNotZero(n.y);
+  }
+  return PackSnorm16(x) | PackSnorm16(y) << 16;
+}
+
+vec3 CompactGeometry::DecodeNormal(uint32_t packed) {
+  vec3 n(UnpackSnorm16(packed & 0xffffu), UnpackSnorm16(packed >> 16), 0.0f);
+  n.z = 1.0f - std::abs(n.x) - std::abs(n.y);
+  const auto t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
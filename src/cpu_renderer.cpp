@@ -0,0 +1,1002 @@
+#include "cpu_renderer.h"
+#include "stb_image_write.h"
+#include "utils/color_util.h"
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+/// Line-by-line port of path_tracer.wgsl. Every rand() call is a separate statement so that the
+/// random stream of a pixel is consumed in the same order as on the GPU.
+namespace {
+const float kPI = 3.14159265359f;
+const float k_1_PI = 0.318309886184f;
+const vec3 kXup = vec3(1.0f, 0.0f, 0.0f);
+const vec3 kYup = vec3(0.0f, 1.0f, 0.0f);
+const vec3 kZero = vec3(0.0f);
+const vec3 kOne = vec3(1.0f);
+/// Adaptive sampling: luminance floor of the relative error (kAdaptiveMinLuminance of the shader)
+const float kAdaptiveMinLuminance = 0.01f;
+/// Smallest GGX alpha (kMinAlpha of the shader)
+const float kMinAlpha = 1e-3f;
+
+float Luminance(const vec3 &col) {
+  return glm::dot(col, vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+/// Albedo and luminance floors of the denoiser (kMinAlbedo / kMinLuminance of denoise.wgsl)
+const float kDenoiseMinAlbedo = 0.001f;
+const float kDenoiseMinLuminance = 0.01f;
+
+/// Disocclusion tests of temporal accumulation (kPlaneTolerance / kMinNormalSimilarity / kMinHistoryWeight of denoise.wgsl)
+const float kTemporalPlaneTolerance = 0.5f;
+const float kTemporalMinNormalSimilarity = 0.9f;
+const float kTemporalMinHistoryWeight = 0.01f;
+
+/// \brief Whether a history tap shows the surface of the current pixel (same_surface of denoise.wgsl)
+/// The G-buffer sample hit somewhere in its pixel, the plane test allows for half a pixel of it.
+/// \param pos first hit of the current pixel
+/// \param history_pos first hit of the tap, from its normal + distance in the previous frame
+/// \param pixel_angle extent of a pixel at unit distance from the camera
+bool SameSurface(const vec4 &nd, const vec4 &history_nd, const vec3 &pos, const vec3 &history_pos, float pixel_angle) {
+  // Misses only continue misses
+  if (nd.w == 0.0f || history_nd.w == 0.0f) {
+    return nd.w == history_nd.w;
+  }
+  return std::abs(glm::dot(history_pos - pos, vec3(nd))) <= kTemporalPlaneTolerance * pixel_angle * nd.w &&
+         glm::dot(vec3(nd), vec3(history_nd)) >= kTemporalMinNormalSimilarity;
+}
+
+/// \brief B3-spline weights 3/8, 1/4, 1/16
+float KernelWeight(int d) {
+  return d == 0 ? 0.375f : (std::abs(d) == 1 ? 0.25f : 0.0625f);
+}
+
+/// \brief Edge-avoiding a-trous filter, port of denoise_atrous in denoise.wgsl
+/// \param image resolved radiance, row-major
+/// \param pixel_angle extent of a pixel at unit distance from the camera
+std::vector<vec3> Denoise(const std::vector<vec3> &image, const std::vector<vec3> &albedo, const std::vector<vec4> &normal_depth,
+                          int width, int height, const RenderConfig &config, float pixel_angle) {
+  std::vector<vec3> illumination(image.size());
+  for (size_t i = 0; i < image.size(); ++i) {
+    illumination[i] = image[i] / glm::max(albedo[i], vec3(kDenoiseMinAlbedo));
+  }
+  std::vector<vec3> filtered(image.size());
+  const auto iterations = std::min(config.denoise_iterations, RenderConfig::kMaxDenoiseIterations);
+  for (uint32_t iteration = 0; iteration < iterations; ++iteration) {
+    const int step = 1 << iteration;
+    const float color_phi = config.denoise_sigma_color / (float) step;
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const auto p = (size_t) y * width + x;
+        const auto center = illumination[p];
+        const auto center_lum = Luminance(center);
+        const auto &center_nd = normal_depth[p];
+        auto sum = center * KernelWeight(0) * KernelWeight(0);
+        auto weight_sum = KernelWeight(0) * KernelWeight(0);
+        // Misses (zero distance) have no surface to filter along
+        if (center_nd.w > 0.0f) {
+          const float depth_phi = config.denoise_sigma_depth * pixel_angle * center_nd.w * (float) step;
+          for (int dy = -2; dy <= 2; ++dy) {
+            for (int dx = -2; dx <= 2; ++dx) {
+              const int qx = x + dx * step;
+              const int qy = y + dy * step;
+              if ((dx == 0 && dy == 0) || qx < 0 || qy < 0 || qx >= width || qy >= height) {
+                continue;
+              }
+              const auto q = (size_t) qy * width + qx;
+              const auto &nd = normal_depth[q];
+              const auto col = illumination[q];
+              const auto lum = Luminance(col);
+              const auto contrast = std::abs(center_lum - lum) / std::max(std::max(center_lum, lum), kDenoiseMinLuminance);
+              const auto w_color = std::exp(-contrast / color_phi);
+              const auto w_normal = std::pow(std::max(glm::dot(vec3(center_nd), vec3(nd)), 0.0f), config.denoise_sigma_normal);
+              const auto w_depth = std::exp(-std::abs(center_nd.w - nd.w) / (depth_phi * std::sqrt((float) (dx * dx + dy * dy))));
+              const auto w = KernelWeight(dx) * KernelWeight(dy) * w_color * w_normal * w_depth;
+              sum += col * w;
+              weight_sum += w;
+            }
+          }
+        }
+        filtered[p] = sum / weight_sum;
+      }
+    }
+    std::swap(illumination, filtered);
+  }
+  for (size_t i = 0; i < image.size(); ++i) {
+    filtered[i] = illumination[i] * glm::max(albedo[i], vec3(kDenoiseMinAlbedo));
+  }
+  return filtered;
+}
+
+/// \brief bitcast<f32>(0x2f800004u): maps a 32 bit integer to [0, 1)
+float RandScale() {
+  uint32_t bits = 0x2f800004u;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return scale;
+}
+
+const float kRandScale = RandScale();
+
+/// Sobol dimensions of the camera ray / per bounce (kSobolDimensions / kBounceDimensions of the shader)
+const uint32_t kSobolDimensions = SamplerTables::kSobolDimensions;
+const uint32_t kBounceDimensions = 2 * kSobolDimensions;
+
+/// \brief Random numbers of one pixel (rand() of the shader)
+/// PCG hash stream, or the dimensions of a pixel sample of the quasi-random samplers.
+struct Rng {
+    uint32_t seed = 0;
+    /// CameraParam::sampler / sampler_seed
+    uint32_t sampler = 0;
+    uint32_t sampler_seed = 0;
+    uint32_t pixel[2]{};
+    uint32_t index = 0;
+    uint32_t dimension = 0;
+
+    float Next() {
+      if (sampler == 0) {
+        seed = seed * 747796405u + 2891336453u;
+        const uint32_t word = ((seed >> ((seed >> 28u) + 4u)) ^ seed) * 277803737u;
+        return (float) ((word >> 22u) ^ word) * kRandScale;
+      }
+      return SamplerTables::Shared().Sample(sampler, pixel[0], pixel[1], index, dimension++, sampler_seed);
+    }
+
+    /// \brief start_pixel_sample of the shader
+    void StartPixelSample(uint32_t x, uint32_t y, uint32_t sample_index) {
+      pixel[0] = x;
+      pixel[1] = y;
+      index = sample_index;
+      dimension = 0;
+    }
+
+    /// \brief start_dimension of the shader
+    void StartDimension(uint32_t dim) { dimension = dim; }
+};
+
+/// \brief First dimension of the shading at bounce `depth`
+uint32_t ShadeDimension(uint32_t depth) {
+  return kSobolDimensions + depth * kBounceDimensions;
+}
+
+struct ONB {
+    vec3 u, v, w;
+};
+
+struct Path {
+    Ray ray;
+    vec3 col;
+    bool end;
+};
+
+ONB BuildONBFromW(const vec3 &w) {
+  ONB onb{};
+  onb.w = glm::normalize(w);
+  const auto a = std::fabs(onb.w.x) > 0.9f ? kYup : kXup;
+  onb.v = glm::normalize(glm::cross(onb.w, a));
+  onb.u = glm::cross(onb.w, onb.v);
+  return onb;
+}
+
+vec3 ONBLocal(const ONB &onb, const vec3 &a) {
+  return a.x * onb.u + a.y * onb.v + a.z * onb.w;
+}
+
+vec3 RandCosDir(Rng &rng) {
+  const auto r1 = rng.Next();
+  const auto r2 = rng.Next();
+  const auto z = std::sqrt(1.0f - r2);
+  const auto phi = 2.0f * kPI * r1;
+  const auto x = std::cos(phi) * std::sqrt(r2);
+  const auto y = std::sin(phi) * std::sqrt(r2);
+  return {x, y, z};
+}
+
+vec3 SampleFromCosine(const HitInfo &hit, Rng &rng) {
+  const auto onb = BuildONBFromW(hit.norm);
+  const auto a = RandCosDir(rng);
+  return ONBLocal(onb, a);
+}
+
+/// \brief Uniform direction in the cone around +z with half angle acos(cos_theta_max)
+vec3 RandToSphere(float cos_theta_max, Rng &rng) {
+  const auto r1 = rng.Next();
+  const auto r2 = rng.Next();
+  const auto z = 1.0f + r2 * (cos_theta_max - 1.0f);
+  const auto phi = 2.0f * kPI * r1;
+  const auto x = std::cos(phi) * std::sqrt(1.0f - z * z);
+  const auto y = std::sin(phi) * std::sqrt(1.0f - z * z);
+  return {x, y, z};
+}
+
+vec3 SampleFromSphere(const Sphere &sphere, const vec3 &pos, Rng &rng) {
+  const auto onb = BuildONBFromW(sphere.center_ - pos);
+  return ONBLocal(onb, RandToSphere(LightSampler::CosThetaMax(sphere, pos), rng));
+}
+
+/// Not normalized
+vec3 SampleFromLight(const HitInfo &hit, const Scene &scene, bool light_tree, Rng &rng) {
+  const auto u = rng.Next();
+  const auto index = scene.light_sampler_.Sample(hit.pos, hit.norm, u, light_tree);
+  const auto sphere = scene.light_sampler_.AliasTable()[index].sphere;
+  if (sphere != kNoHit) {
+    return SampleFromSphere(scene.spheres_[sphere], hit.pos, rng);
+  }
+  const auto &light = scene.lights_[index];
+  const auto r_right = rng.Next();
+  const auto r_up = rng.Next();
+  const auto p = light.q_ + r_right * light.right_ + r_up * light.up_;
+  return p - hit.pos;
+}
+
+float GGXAlpha(const Material &material) {
+  return std::max(material.roughness * material.roughness, kMinAlpha);
+}
+
+/// \brief Reflectance at normal incidence: from the IOR for dielectrics, the base color for metals
+vec3 GGXF0(const Material &material) {
+  const auto r = (material.ior - 1.0f) / (material.ior + 1.0f);
+  return glm::mix(vec3(r * r), material.base_color, material.metallic);
+}
+
+/// \brief Probability of sampling the specular lobe, metals have no diffuse base
+float SpecularProbability(const Material &material) {
+  return Lerp(0.5f, 1.0f, material.metallic);
+}
+
+/// \brief Trowbridge-Reitz normal distribution, cos_h = dot(n, h)
+float GGXD(float alpha, float cos_h) {
+  const auto a2 = alpha * alpha;
+  const auto t = cos_h * cos_h * (a2 - 1.0f) + 1.0f;
+  return a2 / (kPI * t * t);
+}
+
+/// \brief Smith masking of one direction, cos = dot(n, w) > 0
+float GGXG1(float alpha, float cos) {
+  const auto a2 = alpha * alpha;
+  return 2.0f * cos / (cos + std::sqrt(a2 + (1.0f - a2) * cos * cos));
+}
+
+vec3 SchlickFresnel(const vec3 &col, float cos) {
+  const auto pow5 = std::pow(1.0f - cos, 5.0f);
+  return col + pow5 * (1.0f - col);
+}
+
+/// \brief Visible normal sampling of the GGX distribution (Heitz 2018), reflected about the sampled normal
+vec3 SampleFromGGX(const HitInfo &hit, const Material &material, const vec3 &wo, Rng &rng) {
+  const auto alpha = GGXAlpha(material);
+  const auto onb = BuildONBFromW(hit.norm);
+  // View direction in the hemisphere configuration of the stretched distribution
+  const vec3 v(glm::dot(wo, onb.u), glm::dot(wo, onb.v), glm::dot(wo, onb.w));
+  const auto vh = glm::normalize(vec3(alpha * v.x, alpha * v.y, v.z));
+  const auto len2 = vh.x * vh.x + vh.y * vh.y;
+  const auto t1 = len2 > 0.0f ? vec3(-vh.y, vh.x, 0.0f) / std::sqrt(len2) : kXup;
+  const auto t2 = glm::cross(vh, t1);
+  const auto r1 = rng.Next();
+  const auto r2 = rng.Next();
+  const auto r = std::sqrt(r1);
+  const auto phi = 2.0f * kPI * r2;
+  const auto p1 = r * std::cos(phi);
+  const auto s = 0.5f * (1.0f + vh.z);
+  const auto p2 = (1.0f - s) * std::sqrt(1.0f - p1 * p1) + s * r * std::sin(phi);
+  const auto nh = p1 * t1 + p2 * t2 + std::sqrt(std::max(0.0f, 1.0f - p1 * p1 - p2 * p2)) * vh;
+  const auto h = glm::normalize(vec3(alpha * nh.x, alpha * nh.y, std::max(0.0f, nh.z)));
+  return glm::reflect(-wo, ONBLocal(onb, h));
+}
+
+vec3 SampleFromBxDF(const HitInfo &hit, const Material &material, const vec3 &wo, Rng &rng) {
+  switch (material.bxdf) {
+    case BxDF::Lambertian:
+      return SampleFromCosine(hit, rng);
+    case BxDF::GGX:
+      if (rng.Next() < SpecularProbability(material)) {
+        return SampleFromGGX(hit, material, wo, rng);
+      }
+      return SampleFromCosine(hit, rng);
+    case BxDF::Dielectric:
+      break;
+  }
+  return {0.0f, -1.0f, 0.0f};
+}
+
+/// \brief One-sample MIS: the BSDF or the light strategy with equal probability, weighted by MixturePDF
+vec3 SampleDirection(const HitInfo &hit, const Material &material, const vec3 &wo, const Scene &scene,
+                     bool light_tree, Rng &rng) {
+  if (rng.Next() > 0.5f) {
+    return SampleFromBxDF(hit, material, wo, rng);
+  }
+  return SampleFromLight(hit, scene, light_tree, rng);
+}
+
+float CosinePDF(const HitInfo &hit, const vec3 &dir) {
+  const auto onb = BuildONBFromW(hit.norm);
+  const auto cos = glm::dot(glm::normalize(dir), onb.w);
+  return cos <= 0.0f ? 0.0f : cos * k_1_PI;
+}
+
+float ScatteringPDF(const HitInfo &hit, const vec3 &dir) {
+  const auto cos = glm::dot(hit.norm, glm::normalize(dir));
+  return cos < 0.0f ? 0.0f : cos * k_1_PI;
+}
+
+/// \brief Density of SampleFromGGX: visible normals G1(wo) D(h) / (4 cos_o)
+float GGXPDF(const HitInfo &hit, const Material &material, const vec3 &wo, const vec3 &wi) {
+  const auto cos_o = glm::dot(hit.norm, wo);
+  const auto cos_h = glm::dot(hit.norm, glm::normalize(wo + wi));
+  if (cos_o <= 0.0f || cos_h <= 0.0f || glm::dot(hit.norm, wi) <= 0.0f) {
+    return 0.0f;
+  }
+  const auto alpha = GGXAlpha(material);
+  return GGXG1(alpha, cos_o) * GGXD(alpha, cos_h) / (4.0f * cos_o);
+}
+
+/// \brief Diffuse base under a GGX specular layer (metallic-roughness), times the cosine of wi
+vec3 EvalGGX(const HitInfo &hit, const Material &material, const vec3 &wo, const vec3 &wi) {
+  const auto cos_o = glm::dot(hit.norm, wo);
+  const auto cos_i = glm::dot(hit.norm, wi);
+  if (cos_o <= 0.0f || cos_i <= 0.0f) {
+    return kZero;
+  }
+  const auto alpha = GGXAlpha(material);
+  const auto h = glm::normalize(wo + wi);
+  const auto f = SchlickFresnel(GGXF0(material), std::max(glm::dot(wo, h), 0.0f));
+  const auto specular = f * GGXD(alpha, glm::dot(hit.norm, h)) * GGXG1(alpha, cos_o) * GGXG1(alpha, cos_i) / (4.0f * cos_o);
+  const auto diffuse = (1.0f - material.metallic) * (kOne - f) * material.base_color * k_1_PI * cos_i;
+  return specular + diffuse;
+}
+
+/// \brief BSDF times the cosine of dir, for a direction from either strategy
+vec3 EvalBSDF(const HitInfo &hit, const Material &material, const vec3 &wo, const vec3 &dir) {
+  if (material.bxdf == BxDF::GGX) {
+    return EvalGGX(hit, material, wo, glm::normalize(dir));
+  }
+  return material.base_color * ScatteringPDF(hit, dir);
+}
+
+/// \brief Density of SampleFromBxDF
+float BSDFPDF(const HitInfo &hit, const Material &material, const vec3 &wo, const vec3 &dir) {
+  if (material.bxdf == BxDF::GGX) {
+    const auto p = SpecularProbability(material);
+    return p * GGXPDF(hit, material, wo, glm::normalize(dir)) + (1.0f - p) * CosinePDF(hit, dir);
+  }
+  return CosinePDF(hit, dir);
+}
+
+/// \brief Density of SampleDirection
+float MixturePDF(const HitInfo &hit, const Material &material, const vec3 &wo, const Scene &scene, bool light_tree,
+                 const vec3 &dir) {
+  return 0.5f * BSDFPDF(hit, material, wo, dir) +
+         0.5f * scene.light_sampler_.Pdf(scene.lights_, scene.spheres_, hit.pos, hit.norm, dir, light_tree);
+}
+
+/// \brief Smooth dielectric: mirror reflection with the Fresnel probability, refraction otherwise
+/// A delta lobe, so it takes no light samples. The transmission is tinted by the base color.
+Path ScatterDielectric(const Path &path, const HitInfo &hit, const Material &material, Rng &rng) {
+  const auto dir = glm::normalize(path.ray.dir);
+  // Entering through the front face, leaving otherwise; hit.norm faces the ray
+  const auto eta = hit.front_face ? 1.0f / material.ior : material.ior;
+  const auto cos_i = std::min(glm::dot(-dir, hit.norm), 1.0f);
+  const auto sin2_t = eta * eta * (1.0f - cos_i * cos_i);
+  // Schlick with the angle on the optically thinner side
+  const auto cos_outer = hit.front_face ? cos_i : std::sqrt(std::max(0.0f, 1.0f - sin2_t));
+  const auto r0 = (1.0f - material.ior) / (1.0f + material.ior);
+  const auto reflectance = SchlickFresnel(vec3(r0 * r0), cos_outer).x;
+  if (sin2_t >= 1.0f || rng.Next() < reflectance) {
+    return {Ray(hit.pos, glm::reflect(dir, hit.norm)), path.col, false};
+  }
+  return {Ray(hit.pos, glm::refract(dir, hit.norm, eta)), path.col * material.base_color, false};
+}
+
+/// \brief Spread angle of the ray cone through a pixel (pixel_spread of the shader)
+float PixelSpread(float fovy, uint32_t height) {
+  return std::atan(2.0f * std::tan(0.5f * glm::radians(fovy)) / (float) height);
+}
+
+/// \brief Mip level of the texture lookups at a hit (texture_lod of the shader)
+float TextureLOD(const HitInfo &hit, const vec3 &dir, float cone_width, const TextureArray &textures) {
+  const auto size = (float) std::max(textures.Size(), 1u);
+  const auto cos = std::max(std::abs(glm::dot(glm::normalize(dir), hit.norm)), 1e-3f);
+  return std::log2(std::max(cone_width * hit.uv_scale * size / cos, 1e-8f));
+}
+
+/// \brief Tangent space normal to world space (normal_mapped of the shader)
+vec3 NormalMapped(const HitInfo &hit, const vec3 &n) {
+  const auto norm = hit.front_face ? hit.norm : -hit.norm;
+  const auto t = hit.tangent - norm * glm::dot(norm, hit.tangent);
+  if (glm::dot(t, t) < 1e-12f) {
+    return hit.norm;
+  }
+  const auto tangent = glm::normalize(t);
+  const auto mapped = glm::normalize(n.x * tangent + n.y * glm::cross(norm, tangent) + n.z * norm);
+  return hit.front_face ? mapped : -mapped;
+}
+
+/// \brief Material of a hit with its texture maps applied, the normal map bends hit.norm (textured_material of the shader)
+Material TexturedMaterial(HitInfo &hit, const vec3 &dir, float cone_width, const Scene &scene) {
+  if (!hit.IsHit()) {
+    return {};
+  }
+  auto material = scene.materials_[hit.material];
+  if (material.base_color_texture == kNoHit && material.normal_texture == kNoHit && material.roughness_texture == kNoHit) {
+    return material;
+  }
+  const auto &textures = scene.textures_;
+  const auto lod = TextureLOD(hit, dir, cone_width, textures);
+  // Images start at the top row, v points up
+  const glm::vec2 uv(hit.uv.x, 1.0f - hit.uv.y);
+  if (material.base_color_texture != kNoHit) {
+    const auto texel = textures.Sample(material.base_color_texture, uv, lod);
+    material.base_color *= vec3(SRGBToLinear(texel.x), SRGBToLinear(texel.y), SRGBToLinear(texel.z));
+  }
+  if (material.roughness_texture != kNoHit) {
+    material.roughness *= textures.Sample(material.roughness_texture, uv, lod).y;
+  }
+  if (material.normal_texture != kNoHit) {
+    const auto texel = textures.Sample(material.normal_texture, uv, lod);
+    hit.norm = NormalMapped(hit, vec3(texel) * 2.0f - 1.0f);
+  }
+  return material;
+}
+
+/// \brief One bounce of `path` given its closest hit
+/// \param material TexturedMaterial of the hit
+Path Raytrace(const Path &path, int depth, const HitInfo &hit, const Material &material, const Scene &scene, bool light_tree,
+              Rng &rng) {
+  rng.StartDimension(ShadeDimension((uint32_t) depth));
+  const auto &r = path.ray;
+  // Missed everything: no environment light
+  if (!hit.IsHit()) {
+    return {r, kZero, true};
+  }
+  if (material.Emissive()) {
+    if (depth == 0) {
+      return {r, material.Emitted(), true};
+    }
+    // Light estimation
+    return {r, (hit.front_face ? 1.0f : 0.0f) * material.Emitted() * path.col, true};
+  }
+  if (material.bxdf == BxDF::Dielectric) {
+    return ScatterDielectric(path, hit, material, rng);
+  }
+  // MIS(Light & BSDF)
+  const auto wo = -glm::normalize(r.dir);
+  auto scatter_dir = SampleDirection(hit, material, wo, scene, light_tree, rng);
+  const auto pdf_val = MixturePDF(hit, material, wo, scene, light_tree, scatter_dir);
+  // Degenerate direction no strategy samples: 0 / 0 would put a NaN into the pixel
+  if (pdf_val <= 0.0f) {
+    return {r, kZero, true};
+  }
+  scatter_dir = glm::normalize(scatter_dir);
+  const auto scattered_col = path.col * EvalBSDF(hit, material, wo, scatter_dir) / pdf_val;
+  return {Ray(hit.pos, scatter_dir), scattered_col, false};
+}
+
+/// \brief Russian roulette before bounce `depth` (roulette() of the shader)
+Path Roulette(const Path &path, uint32_t depth, const Camera::CameraParam &camera, Rng &rng) {
+  if (path.end || depth < camera.rr_depth || depth >= camera.max_depth) {
+    return path;
+  }
+  const auto survival = std::min(std::max({path.col.x, path.col.y, path.col.z}), 1.0f);
+  rng.StartDimension(ShadeDimension(depth - 1) + kSobolDimensions);
+  const auto u = rng.Next();
+  if (u >= survival) {
+    return {path.ray, kZero, true};
+  }
+  return {path.ray, path.col / survival, false};
+}
+
+/// \brief Pixel grid of the camera (setup_camera_ray of the shader, hoisted out of the sample loop)
+struct CameraRays {
+    vec3 origin;
+    vec3 pixel_origin;
+    vec3 pixel_delta_u;
+    vec3 pixel_delta_v;
+    uint32_t sqrt_spp;
+    float recip_sqrt_spp;
+
+    CameraRays(const Camera::CameraParam &camera, uint32_t width, uint32_t height) {
+      const auto theta = glm::radians(camera.fovy);
+      origin = camera.origin;
+      const auto focal_length = glm::length(camera.origin - camera.target);
+      const auto h = std::tan(theta * 0.5f);
+      const auto viewport_height = 2.0f * h * focal_length;
+      const auto viewport_width = viewport_height * camera.aspect;
+      const auto w = glm::normalize(camera.origin - camera.target);
+      const auto u = glm::normalize(glm::cross(kYup, w));
+      const auto v = glm::cross(w, u);
+      const auto viewport_u = viewport_width * u;
+      const auto viewport_v = viewport_height * -v;
+      pixel_delta_u = viewport_u / (float) width;
+      pixel_delta_v = viewport_v / (float) height;
+      const auto viewport_upper_left = origin - focal_length * w - viewport_u * 0.5f - viewport_v * 0.5f;
+      pixel_origin = viewport_upper_left + 0.5f * (pixel_delta_u + pixel_delta_v);
+      sqrt_spp = std::max((uint32_t) std::sqrt((float) camera.spp), 1u);
+      recip_sqrt_spp = 1.0f / (float) sqrt_spp;
+    }
+
+    [[nodiscard]] Ray Generate(uint32_t x, uint32_t y, uint32_t stratum, Rng &rng) const {
+      const auto offset_x = (float) (stratum % sqrt_spp);
+      const auto offset_y = (float) (stratum / sqrt_spp);
+      const auto pixel_center = pixel_origin + ((float) x * pixel_delta_u) + ((float) y * pixel_delta_v);
+      // The quasi-random samplers stratify the pixel by themselves
+      if (rng.sampler != 0) {
+        const auto px = -0.5f + rng.Next();
+        const auto py = -0.5f + rng.Next();
+        return {origin, pixel_center + (px * pixel_delta_u) + (py * pixel_delta_v) - origin};
+      }
+      const auto r_x = rng.Next();
+      const auto px = -0.5f + recip_sqrt_spp * (offset_x + r_x);
+      const auto r_y = rng.Next();
+      const auto py = -0.5f + recip_sqrt_spp * (offset_y + r_y);
+      const auto pixel_sample = pixel_center + (px * pixel_delta_u) + (py * pixel_delta_v);
+      return {origin, pixel_sample - origin};
+    }
+};
+}
+
+/// \brief Initialize function
+/// \param config render settings
+/// \param scene scene of the first shot
+/// \return whether properly initialized
+bool CpuRenderer::OnInit(const RenderConfig &config, const SceneDesc &scene) {
+  config_ = config;
+  profiler_.SetEnabled(!config_.profile.empty());
+  {
+    auto span = profiler_.Scope("scene build");
+    scene_ = Scene(scene);
+  }
+  if (scene_.light_sampler_.Count() == 0) {
+    Error(PrintInfoType::WebGPUTracer, "CPU backend needs a light");
+    return false;
+  }
+  InitTiles();
+  std::ostringstream sout;
+  sout << pool_.Size() << " threads, " << BVH::kPacketSize << "-wide ray packets";
+  Print(PrintInfoType::WebGPUTracer, "CPU backend: ", sout.str());
+  return true;
+}
+
+/// \brief Switch to the next shot of a batch, the scene is rebuilt only when its description changes
+bool CpuRenderer::SetShot(const RenderConfig &config, const SceneDesc &scene) {
+  encodes_.Wait();
+  config_ = config;
+  profiler_.SetEnabled(!config_.profile.empty());
+  if (scene != scene_.Desc()) {
+    auto span = profiler_.Scope("scene build");
+    scene_ = Scene(scene);
+  }
+  InitTiles();
+  return true;
+}
+
+/// \brief Split the output into kTileSize tiles
+void CpuRenderer::InitTiles() {
+  tiles_.clear();
+  for (uint32_t y = 0; y < config_.height; y += kTileSize) {
+    for (uint32_t x = 0; x < config_.width; x += kTileSize) {
+      Tile tile;
+      tile.origin[0] = x;
+      tile.origin[1] = y;
+      tile.size[0] = std::min(kTileSize, config_.width - x);
+      tile.size[1] = std::min(kTileSize, config_.height - y);
+      tiles_.push_back(tile);
+    }
+  }
+  const auto pixels = (size_t) config_.width * config_.height;
+  accum_.assign(pixels, kZero);
+  pixel_samples_.assign(pixels, 0);
+  luminance_sq_.assign(pixels, 0.0f);
+  pixel_active_.assign(pixels, 1);
+  gbuffer_albedo_.assign(config_.GBuffer() ? pixels : 0, kZero);
+  gbuffer_normal_depth_.assign(config_.GBuffer() ? pixels : 0, vec4(0.0f));
+  // Every shot starts a new history
+  history_.assign(config_.temporal_frames > 0 ? pixels : 0, vec4(0.0f));
+  history_normal_depth_.assign(config_.temporal_frames > 0 ? pixels : 0, vec4(0.0f));
+  history_valid_ = false;
+}
+
+/// \brief Render frames [start_frame, end_frame]
+bool CpuRenderer::OnCompute(uint32_t start_frame, uint32_t end_frame) {
+  Print(PrintInfoType::WebGPUTracer, "Running CPU path tracer ...");
+  std::error_code ec;
+  fs::create_directories(config_.output_dir, ec);
+  if (ec) {
+    Error(PrintInfoType::WebGPUTracer, "Could not create output directory: ", config_.output_dir);
+    return false;
+  }
+  auto success = true;
+  auto start = std::chrono::system_clock::now();
+  for (uint32_t i = start_frame - 1; i < end_frame; ++i) {
+    success = OnRender(i) && success;
+  }
+  // Frames still being encoded
+  encodes_.Wait();
+  success = failed_writes_.exchange(0) == 0 && success;
+  if (profiler_.Enabled()) {
+    success = profiler_.WriteReport(config_.profile) && success;
+  }
+  auto end = std::chrono::system_clock::now();
+  double elapsed = (double) std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+  std::ostringstream sout;
+  sout << elapsed * 0.001 << "(sec)s";
+  Print(PrintInfoType::WebGPUTracer, "Finished: ", sout.str());
+  return success;
+}
+
+/// \brief Render one frame progressively
+/// Same chunking as Renderer::OnRender: every chunk of config_.samples_per_dispatch samples uses a
+/// new seed and continues the pixel stratification, previews and the time budget are checked in between.
+/// \param frame frame number
+bool CpuRenderer::OnRender(uint32_t frame) {
+  auto span = profiler_.Scope("frame");
+  auto start = std::chrono::system_clock::now();
+  const float aspect = (float) config_.width / (float) config_.height;
+  {
+    auto animate_span = profiler_.Scope("scene animate");
+    scene_.Animate((float) frame);
+  }
+  auto camera = Camera::ParamAt((float) frame, aspect, config_.spp, 0, scene_.Desc().animation.camera);
+  camera.max_depth = config_.max_depth;
+  camera.rr_depth = config_.rr_depth;
+  camera.path_stats = config_.path_stats ? 1 : 0;
+  camera.light_tree = config_.light_sampling == LightSampling::Tree ? 1 : 0;
+  camera.sampler = (uint32_t) config_.sampler;
+  camera.sampler_seed = config_.SamplerSeed(frame);
+  camera.gbuffer = config_.GBuffer() ? 1 : 0;
+  fovy_ = camera.fovy;
+  if (config_.path_stats) {
+    path_stats_ = std::vector<std::atomic<uint64_t>>(config_.max_depth);
+  }
+
+  const auto frame_name = RenderConfig::FrameName(frame);
+  std::fill(accum_.begin(), accum_.end(), kZero);
+  std::fill(pixel_samples_.begin(), pixel_samples_.end(), 0);
+  std::fill(luminance_sq_.begin(), luminance_sq_.end(), 0.0f);
+  std::fill(pixel_active_.begin(), pixel_active_.end(), 1);
+  accum_samples_ = 0;
+  active_tiles_.resize(tiles_.size());
+  for (uint32_t i = 0; i < tiles_.size(); ++i) {
+    active_tiles_[i] = i;
+  }
+  const uint32_t spp = config_.spp;
+  const bool adaptive = config_.adaptive_threshold > 0.0f;
+  /// Active pixels of every tile after the last adaptive update
+  std::vector<uint32_t> tile_active(tiles_.size());
+  auto update_adaptive = [&] {
+      auto adaptive_span = profiler_.Scope("adaptive");
+      ParallelFor(pool_, (uint32_t) active_tiles_.size(), 1, [&](uint32_t begin, uint32_t end) {
+          for (uint32_t n = begin; n < end; ++n) {
+            tile_active[active_tiles_[n]] = UpdateAdaptive(tiles_[active_tiles_[n]]);
+          }
+      });
+      active_tiles_.erase(std::remove_if(active_tiles_.begin(), active_tiles_.end(),
+                                         [&](uint32_t i) { return tile_active[i] == 0; }),
+                          active_tiles_.end());
+  };
+  const uint32_t samples_per_dispatch = config_.samples_per_dispatch == 0 ? spp : config_.samples_per_dispatch;
+  uint32_t chunks = 0;
+  while (accum_samples_ < spp) {
+    camera.seed = config_.DispatchSeed(frame, chunks);
+    camera.sample_offset = accum_samples_;
+    camera.sample_count = std::min(samples_per_dispatch, spp - accum_samples_);
+    {
+      /// Tiles are handed out in small chunks, idle workers steal the rest
+      auto trace_span = profiler_.Scope("path trace");
+      ParallelFor(pool_, (uint32_t) active_tiles_.size(), 1, [&](uint32_t begin, uint32_t end) {
+          for (uint32_t n = begin; n < end; ++n) {
+            RenderTile(tiles_[active_tiles_[n]], camera);
+          }
+      });
+    }
+    accum_samples_ += camera.sample_count;
+    ++chunks;
+    if (adaptive && accum_samples_ >= config_.adaptive_min_spp && accum_samples_ < spp) {
+      update_adaptive();
+      if (active_tiles_.empty()) {
+        Print(PrintInfoType::WebGPUTracer, "Adaptive sampling converged at spp: ", accum_samples_);
+        break;
+      }
+    }
+    double elapsed_sec = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+    if (config_.time_budget_sec > 0.0f && elapsed_sec >= config_.time_budget_sec) {
+      Print(PrintInfoType::WebGPUTracer, "Time budget reached at spp: ", accum_samples_);
+      break;
+    }
+    if (config_.preview_interval > 0 && chunks % config_.preview_interval == 0 && accum_samples_ < spp) {
+      WriteOutput(frame_name + "_preview", Resolve());
+    }
+  }
+  if (adaptive) {
+    update_adaptive();
+    ReportAdaptive();
+  }
+  auto image = Resolve();
+  if (config_.temporal_frames > 0) {
+    auto temporal_span = profiler_.Scope("temporal");
+    AccumulateHistory(image, Camera::ViewOf(camera, config_.width, config_.height));
+  }
+  WriteOutput(frame_name, std::move(image));
+  if (config_.path_stats) {
+    const auto path = config_.OutputBase(frame_name + "_paths").string() + ".csv";
+    std::vector<uint64_t> paths(path_stats_.begin(), path_stats_.end());
+    encodes_.Run([this, path, paths = std::move(paths)] {
+        if (!WritePathStats(path, paths)) {
+          ++failed_writes_;
+        }
+    });
+  }
+  auto end = std::chrono::system_clock::now();
+  double elapsed = (double) std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+  std::cout << "[" << frame_name << "]: " << elapsed * 0.001 << "(sec)s, " << accum_samples_ << "spp" << std::endl;
+  return true;
+}
+
+/// \brief Add camera.sample_count samples to every pixel of `tile`
+/// Rows are traced in packets of BVH::kPacketSize pixels. Each lane keeps the random stream of its
+/// pixel and drops out of the packet as soon as its path ends.
+void CpuRenderer::RenderTile(const Tile &tile, const Camera::CameraParam &camera) {
+  const auto width = config_.width;
+  const auto height = config_.height;
+  const CameraRays camera_rays(camera, width, height);
+  const auto prims = scene_.Primitives();
+  const bool light_tree = camera.light_tree != 0;
+  const auto num_strata = camera_rays.sqrt_spp * camera_rays.sqrt_spp;
+  const auto spread = PixelSpread(camera.fovy, height);
+  constexpr uint32_t kLanes = BVH::kPacketSize;
+  /// Paths entering every bounce, merged into path_stats_ once per tile
+  std::vector<uint64_t> path_counts(camera.path_stats ? camera.max_depth : 0, 0);
+  for (uint32_t y = tile.origin[1]; y < tile.origin[1] + tile.size[1]; ++y) {
+    for (uint32_t x0 = tile.origin[0]; x0 < tile.origin[0] + tile.size[0]; x0 += kLanes) {
+      const auto lanes = std::min(kLanes, tile.origin[0] + tile.size[0] - x0);
+      const auto row = (size_t) y * width + x0;
+      // Pixels converged by adaptive sampling take no more samples
+      uint32_t lane_mask = 0;
+      for (uint32_t i = 0; i < lanes; ++i) {
+        lane_mask |= pixel_active_[row + i] ? 1u << i : 0u;
+      }
+      if (lane_mask == 0) {
+        continue;
+      }
+      Rng rng[kLanes];
+      vec3 col[kLanes];
+      float luminance_sq[kLanes]{};
+      for (uint32_t i = 0; i < lanes; ++i) {
+        rng[i].seed = (x0 + i) + y * width + camera.seed * width * height;
+        rng[i].sampler = camera.sampler;
+        rng[i].sampler_seed = camera.sampler_seed;
+        col[i] = kZero;
+      }
+      for (uint32_t s = 0; s < camera.sample_count; ++s) {
+        // Keep the pixel stratification across progressive chunks
+        const auto stratum = (camera.sample_offset + s) % num_strata;
+        Path paths[kLanes];
+        Ray rays[kLanes];
+        // Width of the ray cones at the start of the path segments
+        float cone_width[kLanes]{};
+        for (uint32_t i = 0; i < lanes; ++i) {
+          rng[i].StartPixelSample(x0 + i, y, camera.sample_offset + s);
+          paths[i] = {camera_rays.Generate(x0 + i, y, stratum, rng[i]), kOne, false};
+        }
+        auto active = lane_mask;
+        for (uint32_t depth = 0; depth < camera.max_depth && active != 0; ++depth) {
+          HitInfo hits[kLanes];
+          for (uint32_t i = 0; i < lanes; ++i) {
+            rays[i] = paths[i].ray;
+          }
+          scene_.bvh_.Intersect4(rays, active, prims, hits);
+          for (uint32_t i = 0; i < lanes; ++i) {
+            if (active & (1u << i)) {
+              cone_width[i] += spread * hits[i].dist;
+              const auto material = TexturedMaterial(hits[i], rays[i].dir, cone_width[i], scene_);
+              if (depth == 0 && camera.gbuffer != 0 && camera.sample_offset + s == 0) {
+                // First hit of the first sample, misses are stored as zero distance
+                const bool hit = hits[i].IsHit();
+                gbuffer_albedo_[row + i] = hit ? material.Albedo() : kZero;
+                gbuffer_normal_depth_[row + i] = hit ? vec4(hits[i].norm, hits[i].dist) : vec4(0.0f);
+              }
+              if (!path_counts.empty()) {
+                ++path_counts[depth];
+              }
+              paths[i] = Roulette(Raytrace(paths[i], (int) depth, hits[i], material, scene_, light_tree, rng[i]), depth + 1,
+                                  camera, rng[i]);
+              if (paths[i].end) {
+                active &= ~(1u << i);
+              }
+            }
+          }
+        }
+        for (uint32_t i = 0; i < lanes; ++i) {
+          const auto sample_col = glm::max(paths[i].col, kZero);
+          col[i] += sample_col;
+          luminance_sq[i] += Luminance(sample_col) * Luminance(sample_col);
+        }
+      }
+      for (uint32_t i = 0; i < lanes; ++i) {
+        if (lane_mask & (1u << i)) {
+          accum_[row + i] += col[i];
+          luminance_sq_[row + i] += luminance_sq[i];
+          pixel_samples_[row + i] += camera.sample_count;
+        }
+      }
+    }
+  }
+  for (size_t depth = 0; depth < path_counts.size(); ++depth) {
+    path_stats_[depth] += path_counts[depth];
+  }
+}
+
+uint32_t CpuRenderer::UpdateAdaptive(const Tile &tile) {
+  uint32_t active = 0;
+  for (uint32_t y = tile.origin[1]; y < tile.origin[1] + tile.size[1]; ++y) {
+    for (uint32_t x = tile.origin[0]; x < tile.origin[0] + tile.size[0]; ++x) {
+      const auto idx = (size_t) y * config_.width + x;
+      if (!pixel_active_[idx]) {
+        continue;
+      }
+      const auto n = (float) std::max(pixel_samples_[idx], 1u);
+      const auto mean = Luminance(accum_[idx]) / n;
+      const auto variance = std::max(luminance_sq_[idx] / n - mean * mean, 0.0f) / std::max(n - 1.0f, 1.0f);
+      const auto rel_error = std::sqrt(variance) / std::max(mean, kAdaptiveMinLuminance);
+      if (rel_error < config_.adaptive_threshold) {
+        pixel_active_[idx] = 0;
+      } else {
+        ++active;
+      }
+    }
+  }
+  return active;
+}
+
+/// \brief Print how adaptive sampling distributed the samples of the frame (Renderer::ReportAdaptive)
+void CpuRenderer::ReportAdaptive() const {
+  double samples = 0.0;
+  double active = 0.0;
+  float min_spp = std::numeric_limits<float>::max();
+  float max_spp = 0.0f;
+  for (const auto &tile : tiles_) {
+    double tile_samples = 0.0;
+    for (uint32_t y = tile.origin[1]; y < tile.origin[1] + tile.size[1]; ++y) {
+      for (uint32_t x = tile.origin[0]; x < tile.origin[0] + tile.size[0]; ++x) {
+        const auto idx = (size_t) y * config_.width + x;
+        tile_samples += pixel_samples_[idx];
+        active += pixel_active_[idx];
+      }
+    }
+    samples += tile_samples;
+    const auto tile_spp = (float) (tile_samples / ((double) tile.size[0] * tile.size[1]));
+    min_spp = std::min(min_spp, tile_spp);
+    max_spp = std::max(max_spp, tile_spp);
+  }
+  const auto pixels = (double) config_.width * config_.height;
+  std::ostringstream sout;
+  sout << samples / pixels << "spp on average, tiles " << min_spp << " - " << max_spp << "spp, "
+       << 100.0 * (1.0 - active / pixels) << "% of the pixels converged";
+  Print(PrintInfoType::WebGPUTracer, "Adaptive sampling: ", sout.str());
+}
+
+/// \brief Mean radiance of every pixel (resolve of path_tracer.wgsl)
+std::vector<vec3> CpuRenderer::Resolve() const {
+  std::vector<vec3> image(accum_.size());
+  for (size_t i = 0; i < accum_.size(); ++i) {
+    image[i] = accum_[i] / (float) std::max(pixel_samples_[i], 1u);
+  }
+  return image;
+}
+
+/// \brief Blend the resolved frame with the reprojected history, port of temporal_accumulate in denoise.wgsl
+/// \param image resolved radiance, replaced by the accumulated radiance
+/// \param view pixel grid of the camera of the frame
+void CpuRenderer::AccumulateHistory(std::vector<vec3> &image, const Camera::View &view) {
+  const auto width = (int) config_.width;
+  const auto height = (int) config_.height;
+  const auto &previous = previous_view_;
+  const auto max_frames = (float) config_.temporal_frames;
+  const auto pixel_angle = glm::length(view.pixel_delta_v) * glm::length(view.forward);
+  std::vector<vec4> accumulated(image.size());
+  ParallelFor(pool_, (uint32_t) height, 1, [&](uint32_t begin, uint32_t end) {
+      for (int y = (int) begin; y < (int) end; ++y) {
+        for (int x = 0; x < width; ++x) {
+          const auto p = (size_t) y * width + x;
+          const auto &nd = gbuffer_normal_depth_[p];
+          auto history = vec4(0.0f);
+          const auto ray_dir = glm::normalize(view.pixel_origin + (float) x * view.pixel_delta_u + (float) y * view.pixel_delta_v - view.origin);
+          const auto pos = view.origin + nd.w * ray_dir;
+          // Misses are reprojected as directions, they stay at infinity when the camera moves
+          const auto d = nd.w > 0.0f ? pos - previous.origin : ray_dir;
+          const auto depth = glm::dot(d, previous.forward);
+          if (history_valid_ && depth > 0.0f) {
+            // Motion vector: pixel coordinates of the surface in the previous frame
+            const auto image_pos = previous.origin + d / depth - previous.pixel_origin;
+            const auto pos_x = glm::dot(image_pos, previous.pixel_delta_u) / glm::dot(previous.pixel_delta_u, previous.pixel_delta_u);
+            const auto pos_y = glm::dot(image_pos, previous.pixel_delta_v) / glm::dot(previous.pixel_delta_v, previous.pixel_delta_v);
+            const auto base_x = (int) std::floor(pos_x);
+            const auto base_y = (int) std::floor(pos_y);
+            const auto fx = pos_x - std::floor(pos_x);
+            const auto fy = pos_y - std::floor(pos_y);
+            auto sum = vec4(0.0f);
+            auto weight_sum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+              const int qx = base_x + (k & 1);
+              const int qy = base_y + (k >> 1);
+              if (qx < 0 || qy < 0 || qx >= width || qy >= height) {
+                continue;
+              }
+              const auto q = (size_t) qy * width + qx;
+              const auto &history_nd = history_normal_depth_[q];
+              const auto history_dir = previous.pixel_origin + (float) qx * previous.pixel_delta_u + (float) qy * previous.pixel_delta_v - previous.origin;
+              if (!SameSurface(nd, history_nd, pos, previous.origin + history_nd.w * glm::normalize(history_dir), pixel_angle)) {
+                continue;
+              }
+              const auto w = ((k & 1) ? fx : 1.0f - fx) * ((k >> 1) ? fy : 1.0f - fy);
+              sum += history_[q] * w;
+              weight_sum += w;
+            }
+            if (weight_sum >= kTemporalMinHistoryWeight) {
+              history = sum / weight_sum;
+            }
+          }
+          // Running mean over the first max_frames frames, exponential afterwards
+          const auto frames = std::min(history.w + 1.0f, max_frames);
+          const auto col = glm::mix(vec3(history), image[p], 1.0f / frames);
+          accumulated[p] = vec4(col, frames);
+          image[p] = col;
+        }
+      }
+  });
+  history_ = std::move(accumulated);
+  history_normal_depth_ = gbuffer_normal_depth_;
+  previous_view_ = view;
+  history_valid_ = true;
+}
+
+/// \brief Encode a resolved frame on the pool
+/// \param name output file name without extension
+/// \param image mean radiance per pixel, row-major
+void CpuRenderer::WriteOutput(const std::string &name, std::vector<vec3> image) {
+  const auto path = config_.OutputPath(name).string();
+  const auto width = config_.width;
+  const auto height = config_.height;
+  const auto format = config_.output_format;
+  const auto pixel_angle = 2.0f * std::tan(0.5f * glm::radians(fovy_)) / (float) height;
+  encodes_.Run([this, path, width, height, format, pixel_angle, config = config_, image = std::move(image),
+                albedo = gbuffer_albedo_, normal_depth = gbuffer_normal_depth_]() mutable {
+      auto span = profiler_.Scope("encode");
+      if (config.denoise_iterations > 0) {
+        auto denoise_span = profiler_.Scope("denoise");
+        image = Denoise(image, albedo, normal_depth, (int) width, (int) height, config, pixel_angle);
+      }
+      bool written = false;
+      switch (format) {
+        case OutputFormat::PNG: {
+          /// Same conversion as the rgba8unorm store of the resolve pass
+          std::vector<uint8_t> pixels((size_t) width * height * 4);
+          for (size_t i = 0; i < image.size(); ++i) {
+            for (int c = 0; c < 3; ++c) {
+              pixels[4 * i + c] = (uint8_t) (Clamp(image[i][c], 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+            pixels[4 * i + 3] = 255;
+          }
+          written = stbi_write_png(path.c_str(), (int) width, (int) height, 4, pixels.data(), (int) width * 4) != 0;
+          break;
+        }
+        case OutputFormat::HDR: {
+          std::vector<float> rgb(image.size() * 3);
+          for (size_t i = 0; i < image.size(); ++i) {
+            for (int c = 0; c < 3; ++c) {
+              rgb[3 * i + c] = image[i][c];
+            }
+          }
+          written = stbi_write_hdr(path.c_str(), (int) width, (int) height, 3, rgb.data()) != 0;
+          break;
+        }
+      }
+      if (!written) {
+        Error(PrintInfoType::WebGPUTracer, "Could not write image: ", path);
+        ++failed_writes_;
+      }
+  });
+}
+
+void CpuRenderer::OnFinish() {
+  encodes_.Wait();
+}
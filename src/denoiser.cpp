@@ -0,0 +1,358 @@
+#include "denoiser.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+/// DenoiseParam of denoise.wgsl
+struct DenoiseParam {
+    uint32_t step{};
+    uint32_t iteration{};
+    uint32_t last{};
+    uint32_t pad{};
+    float sigma_color{};
+    float sigma_normal{};
+    float sigma_depth{};
+    float pixel_angle{};
+};
+
+/// TemporalParam of denoise.wgsl
+struct TemporalParam {
+    Camera::View current{};
+    Camera::View previous{};
+    float max_frames{};
+    uint32_t history_valid{};
+    uint32_t pad[2]{};
+};
+
+static_assert(sizeof(Camera::View) == 80, "View of denoise.wgsl");
+static_assert(sizeof(TemporalParam) == 176, "TemporalParam of denoise.wgsl");
+}
+
+void Denoiser::Init(Device device, const Limits &limits) {
+  device_ = device;
+  InitBindGroupLayout();
+  InitTemporalBindGroupLayout();
+  PipelineLayoutDescriptor layout_desc{};
+  layout_desc.bindGroupLayoutCount = 1;
+  layout_desc.bindGroupLayouts = (WGPUBindGroupLayout *) &bind_group_layout_;
+  pipeline_layout_ = device_.createPipelineLayout(layout_desc);
+  layout_desc.bindGroupLayouts = (WGPUBindGroupLayout *) &temporal_bind_group_layout_;
+  temporal_pipeline_layout_ = device_.createPipelineLayout(layout_desc);
+
+  ShaderModule shader_module = LoadShaderModule(RESOURCE_DIR "/shader/denoise.wgsl", device_);
+  pipeline_ = CreatePipeline(shader_module, pipeline_layout_, "denoise_atrous");
+  temporal_pipeline_ = CreatePipeline(shader_module, temporal_pipeline_layout_, "temporal_accumulate");
+  Print(PrintInfoType::WebGPU, "Denoise pipeline: ", pipeline_);
+  Print(PrintInfoType::WebGPU, "Temporal pipeline: ", temporal_pipeline_);
+  shader_module.release();
+
+  param_stride_ = (uint32_t) ((sizeof(DenoiseParam) + limits.minUniformBufferOffsetAlignment - 1) /
+                              limits.minUniformBufferOffsetAlignment * limits.minUniformBufferOffsetAlignment);
+  BufferDescriptor buffer_desc{};
+  buffer_desc.mappedAtCreation = false;
+  buffer_desc.size = (uint64_t) param_stride_ * RenderConfig::kMaxDenoiseIterations;
+  buffer_desc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+  buffer_desc.label = "Denoiser.param_buffer_";
+  param_buffer_ = device_.createBuffer(buffer_desc);
+  buffer_desc.size = sizeof(TemporalParam);
+  buffer_desc.label = "Denoiser.temporal_param_buffer_";
+  temporal_param_buffer_ = device_.createBuffer(buffer_desc);
+}
+
+ComputePipeline Denoiser::CreatePipeline(ShaderModule shader_module, PipelineLayout layout, const char *entry_point) {
+  ComputePipelineDescriptor pipeline_desc;
+  pipeline_desc.compute.constantCount = 0;
+  pipeline_desc.compute.constants = nullptr;
+  pipeline_desc.compute.entryPoint = entry_point;
+  pipeline_desc.compute.module = shader_module;
+  pipeline_desc.layout = layout;
+  pipeline_desc.label = entry_point;
+  return device_.createComputePipeline(pipeline_desc);
+}
+
+/// \brief Group 0 of denoise.wgsl
+void Denoiser::InitBindGroupLayout() {
+  std::vector<BindGroupLayoutEntry> bindings(6, Default);
+  /// DenoiseParam of the iteration
+  bindings[0].binding = 0;
+  bindings[0].buffer.type = BufferBindingType::Uniform;
+  bindings[0].buffer.hasDynamicOffset = true;
+  bindings[0].buffer.minBindingSize = sizeof(DenoiseParam);
+  bindings[0].visibility = ShaderStage::Compute;
+  /// Radiance, albedo and normal + distance, read with textureLoad
+  for (uint32_t binding = 1; binding <= 3; ++binding) {
+    bindings[binding].binding = binding;
+    bindings[binding].texture.sampleType = TextureSampleType::UnfilterableFloat;
+    bindings[binding].texture.viewDimension = TextureViewDimension::_2D;
+    bindings[binding].visibility = ShaderStage::Compute;
+  }
+  /// Filtered radiance
+  bindings[4].binding = 4;
+  bindings[4].storageTexture.access = StorageTextureAccess::WriteOnly;
+  bindings[4].storageTexture.format = TextureFormat::RGBA32Float;
+  bindings[4].storageTexture.viewDimension = TextureViewDimension::_2D;
+  bindings[4].visibility = ShaderStage::Compute;
+  /// Output texture
+  bindings[5].binding = 5;
+  bindings[5].storageTexture.access = StorageTextureAccess::WriteOnly;
+  bindings[5].storageTexture.format = TextureFormat::RGBA8Unorm;
+  bindings[5].storageTexture.viewDimension = TextureViewDimension::_2D;
+  bindings[5].visibility = ShaderStage::Compute;
+  BindGroupLayoutDescriptor bind_group_layout_desc{};
+  bind_group_layout_desc.entryCount = (uint32_t) bindings.size();
+  bind_group_layout_desc.entries = bindings.data();
+  bind_group_layout_desc.label = "Denoiser.bind_group_layout_";
+  bind_group_layout_ = device_.createBindGroupLayout(bind_group_layout_desc);
+}
+
+/// \brief Bindings of denoise.wgsl read or written by temporal_accumulate
+void Denoiser::InitTemporalBindGroupLayout() {
+  std::vector<BindGroupLayoutEntry> bindings(7, Default);
+  /// TemporalParam
+  bindings[0].binding = 6;
+  bindings[0].buffer.type = BufferBindingType::Uniform;
+  bindings[0].buffer.minBindingSize = sizeof(TemporalParam);
+  bindings[0].visibility = ShaderStage::Compute;
+  /// Resolved radiance, normal + distance, history and its normal + distance
+  const std::array<uint32_t, 4> sampled{1, 3, 7, 8};
+  for (size_t i = 0; i < sampled.size(); ++i) {
+    bindings[1 + i].binding = sampled[i];
+    bindings[1 + i].texture.sampleType = TextureSampleType::UnfilterableFloat;
+    bindings[1 + i].texture.viewDimension = TextureViewDimension::_2D;
+    bindings[1 + i].visibility = ShaderStage::Compute;
+  }
+  /// Accumulated history
+  bindings[5].binding = 9;
+  bindings[5].storageTexture.access = StorageTextureAccess::WriteOnly;
+  bindings[5].storageTexture.format = TextureFormat::RGBA32Float;
+  bindings[5].storageTexture.viewDimension = TextureViewDimension::_2D;
+  bindings[5].visibility = ShaderStage::Compute;
+  /// Output texture
+  bindings[6].binding = 5;
+  bindings[6].storageTexture.access = StorageTextureAccess::WriteOnly;
+  bindings[6].storageTexture.format = TextureFormat::RGBA8Unorm;
+  bindings[6].storageTexture.viewDimension = TextureViewDimension::_2D;
+  bindings[6].visibility = ShaderStage::Compute;
+  BindGroupLayoutDescriptor bind_group_layout_desc{};
+  bind_group_layout_desc.entryCount = (uint32_t) bindings.size();
+  bind_group_layout_desc.entries = bindings.data();
+  bind_group_layout_desc.label = "Denoiser.temporal_bind_group_layout_";
+  temporal_bind_group_layout_ = device_.createBindGroupLayout(bind_group_layout_desc);
+}
+
+void Denoiser::Release() {
+  if (!Ready()) {
+    return;
+  }
+  ReleaseFrameResources();
+  param_buffer_.destroy();
+  param_buffer_.release();
+  temporal_param_buffer_.destroy();
+  temporal_param_buffer_.release();
+  pipeline_.release();
+  temporal_pipeline_.release();
+  pipeline_layout_.release();
+  temporal_pipeline_layout_.release();
+  bind_group_layout_.release();
+  temporal_bind_group_layout_.release();
+  pipeline_ = nullptr;
+}
+
+Texture Denoiser::CreateTexture(Device device, uint32_t width, uint32_t height, TextureFormat format, const char *label) {
+  TextureDescriptor texture_desc;
+  texture_desc.dimension = TextureDimension::_2D;
+  texture_desc.format = format;
+  texture_desc.size = {width, height, 1};
+  texture_desc.sampleCount = 1;
+  texture_desc.viewFormatCount = 0;
+  texture_desc.viewFormats = nullptr;
+  texture_desc.usage = TextureUsage::StorageBinding | TextureUsage::TextureBinding | TextureUsage::CopySrc | TextureUsage::CopyDst;
+  texture_desc.mipLevelCount = 1;
+  texture_desc.label = label;
+  return device.createTexture(texture_desc);
+}
+
+TextureView Denoiser::CreateView(Texture texture, TextureFormat format) {
+  TextureViewDescriptor texture_view_desc;
+  texture_view_desc.aspect = TextureAspect::All;
+  texture_view_desc.baseArrayLayer = 0;
+  texture_view_desc.arrayLayerCount = 1;
+  texture_view_desc.dimension = TextureViewDimension::_2D;
+  texture_view_desc.format = format;
+  texture_view_desc.mipLevelCount = 1;
+  texture_view_desc.baseMipLevel = 0;
+  return texture.createView(texture_view_desc);
+}
+
+void Denoiser::InitFrameResources(uint32_t width, uint32_t height, bool enabled, bool temporal, TextureView output_view) {
+  ReleaseFrameResources();
+  ResetHistory();
+  width_ = enabled ? width : 1;
+  height_ = enabled ? height : 1;
+  radiance_[0] = CreateTexture(device_, width_, height_, TextureFormat::RGBA32Float, "Denoiser.radiance_[0]");
+  radiance_[1] = CreateTexture(device_, width_, height_, TextureFormat::RGBA32Float, "Denoiser.radiance_[1]");
+  albedo_ = CreateTexture(device_, width_, height_, TextureFormat::RGBA16Float, "Denoiser.albedo_");
+  normal_depth_ = CreateTexture(device_, width_, height_, TextureFormat::RGBA32Float, "Denoiser.normal_depth_");
+  radiance_views_[0] = CreateView(radiance_[0], TextureFormat::RGBA32Float);
+  radiance_views_[1] = CreateView(radiance_[1], TextureFormat::RGBA32Float);
+  albedo_view_ = CreateView(albedo_, TextureFormat::RGBA16Float);
+  normal_depth_view_ = CreateView(normal_depth_, TextureFormat::RGBA32Float);
+  if (!enabled) {
+    return;
+  }
+
+  for (uint32_t k = 0; k < 2; ++k) {
+    std::vector<BindGroupEntry> entries(6, Default);
+    entries[0].binding = 0;
+    entries[0].buffer = param_buffer_;
+    entries[0].offset = 0;
+    entries[0].size = sizeof(DenoiseParam);
+    entries[1].binding = 1;
+    entries[1].textureView = radiance_views_[k];
+    entries[2].binding = 2;
+    entries[2].textureView = albedo_view_;
+    entries[3].binding = 3;
+    entries[3].textureView = normal_depth_view_;
+    entries[4].binding = 4;
+    entries[4].textureView = radiance_views_[1 - k];
+    entries[5].binding = 5;
+    entries[5].textureView = output_view;
+    BindGroupDescriptor bind_group_desc;
+    bind_group_desc.layout = bind_group_layout_;
+    bind_group_desc.entryCount = (uint32_t) entries.size();
+    bind_group_desc.entries = (WGPUBindGroupEntry *) entries.data();
+    bind_groups_[k] = device_.createBindGroup(bind_group_desc);
+  }
+  Print(PrintInfoType::WebGPU, "Denoise bind group: ", bind_groups_[0]);
+  if (!temporal) {
+    return;
+  }
+
+  history_[0] = CreateTexture(device_, width_, height_, TextureFormat::RGBA32Float, "Denoiser.history_[0]");
+  history_[1] = CreateTexture(device_, width_, height_, TextureFormat::RGBA32Float, "Denoiser.history_[1]");
+  history_normal_depth_ = CreateTexture(device_, width_, height_, TextureFormat::RGBA32Float, "Denoiser.history_normal_depth_");
+  history_views_[0] = CreateView(history_[0], TextureFormat::RGBA32Float);
+  history_views_[1] = CreateView(history_[1], TextureFormat::RGBA32Float);
+  history_normal_depth_view_ = CreateView(history_normal_depth_, TextureFormat::RGBA32Float);
+  for (uint32_t k = 0; k < 2; ++k) {
+    std::vector<BindGroupEntry> entries(7, Default);
+    entries[0].binding = 6;
+    entries[0].buffer = temporal_param_buffer_;
+    entries[0].offset = 0;
+    entries[0].size = sizeof(TemporalParam);
+    entries[1].binding = 1;
+    entries[1].textureView = radiance_views_[0];
+    entries[2].binding = 3;
+    entries[2].textureView = normal_depth_view_;
+    entries[3].binding = 7;
+    entries[3].textureView = history_views_[k];
+    entries[4].binding = 8;
+    entries[4].textureView = history_normal_depth_view_;
+    entries[5].binding = 9;
+    entries[5].textureView = history_views_[1 - k];
+    entries[6].binding = 5;
+    entries[6].textureView = output_view;
+    BindGroupDescriptor bind_group_desc;
+    bind_group_desc.layout = temporal_bind_group_layout_;
+    bind_group_desc.entryCount = (uint32_t) entries.size();
+    bind_group_desc.entries = (WGPUBindGroupEntry *) entries.data();
+    temporal_bind_groups_[k] = device_.createBindGroup(bind_group_desc);
+  }
+  Print(PrintInfoType::WebGPU, "Temporal bind group: ", temporal_bind_groups_[0]);
+}
+
+void Denoiser::ReleaseFrameResources() {
+  if (!albedo_) {
+    return;
+  }
+  for (uint32_t k = 0; k < 2; ++k) {
+    if (bind_groups_[k]) {
+      bind_groups_[k].release();
+      bind_groups_[k] = nullptr;
+    }
+    radiance_views_[k].release();
+    radiance_[k].destroy();
+    radiance_[k].release();
+    if (history_[k]) {
+      temporal_bind_groups_[k].release();
+      temporal_bind_groups_[k] = nullptr;
+      history_views_[k].release();
+      history_[k].destroy();
+      history_[k].release();
+      history_[k] = nullptr;
+    }
+  }
+  if (history_normal_depth_) {
+    history_normal_depth_view_.release();
+    history_normal_depth_.destroy();
+    history_normal_depth_.release();
+    history_normal_depth_ = nullptr;
+  }
+  normal_depth_view_.release();
+  normal_depth_.destroy();
+  normal_depth_.release();
+  albedo_view_.release();
+  albedo_.destroy();
+  albedo_.release();
+  albedo_ = nullptr;
+}
+
+void Denoiser::SetParams(Queue queue, const RenderConfig &config, float pixel_angle) {
+  iterations_ = std::min(config.denoise_iterations, RenderConfig::kMaxDenoiseIterations);
+  std::vector<uint8_t> params((size_t) param_stride_ * RenderConfig::kMaxDenoiseIterations, 0);
+  for (uint32_t i = 0; i < iterations_; ++i) {
+    DenoiseParam param{};
+    param.step = 1u << i;
+    param.iteration = i;
+    param.last = i + 1 == iterations_ ? 1 : 0;
+    param.sigma_color = config.denoise_sigma_color;
+    param.sigma_normal = config.denoise_sigma_normal;
+    param.sigma_depth = config.denoise_sigma_depth;
+    param.pixel_angle = pixel_angle;
+    std::memcpy(params.data() + i * param_stride_, &param, sizeof(DenoiseParam));
+  }
+  queue.writeBuffer(param_buffer_, 0, params.data(), params.size());
+}
+
+void Denoiser::Record(ComputePassEncoder &pass) {
+  const uint32_t workgroup_count_x = (width_ + kWorkgroupSize - 1) / kWorkgroupSize;
+  const uint32_t workgroup_count_y = (height_ + kWorkgroupSize - 1) / kWorkgroupSize;
+  pass.setPipeline(pipeline_);
+  for (uint32_t i = 0; i < iterations_; ++i) {
+    const uint32_t offset = i * param_stride_;
+    pass.setBindGroup(0, bind_groups_[i % 2], 1, &offset);
+    pass.dispatchWorkgroups(workgroup_count_x, workgroup_count_y, 1);
+  }
+}
+
+void Denoiser::SetTemporalParams(Queue queue, const RenderConfig &config, const Camera::View &view) {
+  TemporalParam param{};
+  param.current = view;
+  param.previous = history_valid_ ? previous_view_ : view;
+  param.max_frames = (float) std::max(config.temporal_frames, 1u);
+  param.history_valid = history_valid_ ? 1 : 0;
+  queue.writeBuffer(temporal_param_buffer_, 0, &param, sizeof(TemporalParam));
+  previous_view_ = view;
+}
+
+void Denoiser::RecordTemporal(ComputePassEncoder &pass) {
+  const uint32_t workgroup_count_x = (width_ + kWorkgroupSize - 1) / kWorkgroupSize;
+  const uint32_t workgroup_count_y = (height_ + kWorkgroupSize - 1) / kWorkgroupSize;
+  pass.setPipeline(temporal_pipeline_);
+  pass.setBindGroup(0, temporal_bind_groups_[history_index_], 0, nullptr);
+  pass.dispatchWorkgroups(workgroup_count_x, workgroup_count_y, 1);
+}
+
+void Denoiser::KeepHistory(CommandEncoder &encoder) {
+  history_index_ = 1 - history_index_;
+  const Extent3D size{width_, height_, 1};
+  ImageCopyTexture source = Default;
+  ImageCopyTexture destination = Default;
+  source.texture = history_[history_index_];
+  destination.texture = radiance_[0];
+  encoder.copyTextureToTexture(source, destination, size);
+  source.texture = normal_depth_;
+  destination.texture = history_normal_depth_;
+  encoder.copyTextureToTexture(source, destination, size);
+  history_valid_ = true;
+}
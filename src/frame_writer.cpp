@@ -0,0 +1,180 @@
+#include "frame_writer.h"
+#include "stb_image_write.h"
+
+/// \brief Initialize the readback ring
+/// \param ring_size number of frames that may be in readback at the same time
+void FrameWriter::Init(Device device, Queue queue, uint32_t ring_size, Profiler *profiler) {
+  device_ = device;
+  queue_ = queue;
+  profiler_ = profiler;
+  ring_size_ = std::max(ring_size, 1u);
+}
+
+void FrameWriter::Release() {
+  Flush();
+  for (auto &slot: slots_) {
+    slot->buffer.destroy();
+    slot->buffer.release();
+  }
+  slots_.clear();
+}
+
+/// \brief Free staging buffer of at least `size` bytes, waits for the oldest readback when the ring is full
+FrameWriter::Slot &FrameWriter::AcquireSlot(uint64_t size) {
+  while (true) {
+    for (auto &slot: slots_) {
+      if (!slot->busy) {
+        if (slot->size < size) {
+          slot->buffer.destroy();
+          slot->buffer.release();
+          slot->buffer = nullptr;
+        }
+        if (!slot->buffer) {
+          BufferDescriptor buffer_desc = Default;
+          buffer_desc.mappedAtCreation = false;
+          buffer_desc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+          buffer_desc.size = size;
+          buffer_desc.label = "FrameWriter.staging";
+          slot->buffer = device_.createBuffer(buffer_desc);
+          slot->size = size;
+        }
+        return *slot;
+      }
+    }
+    if (slots_.size() < ring_size_) {
+      slots_.emplace_back(std::make_unique<Slot>());
+      continue;
+    }
+    PollDevice(device_, queue_);
+  }
+}
+
+/// \brief Map the staging buffer once the copy is done, then encode on the pool
+void FrameWriter::MapAndEncode(Slot &slot, uint64_t size, Encoder encoder) {
+  slot.busy = true;
+  auto *slot_ptr = &slot;
+  const auto submitted = Profiler::Clock::now();
+  slot.map_callback = slot.buffer.mapAsync(MapMode::Read, 0, size, [this, slot_ptr, size, submitted, encoder = std::move(encoder)](BufferMapAsyncStatus status) {
+      if (profiler_) {
+        profiler_->Record("readback", submitted, Profiler::Clock::now());
+      }
+      if (status != BufferMapAsyncStatus::Success) {
+        Error(PrintInfoType::WebGPU, "Staging buffer MapAsync error: type ", status);
+        ++failed_;
+      } else {
+        // Copy out so the staging buffer goes back to the ring before the encoder runs
+        const auto staging_start = Profiler::Clock::now();
+        const auto *mapped = (const uint8_t *) slot_ptr->buffer.getConstMappedRange(0, size);
+        auto data = std::make_shared<std::vector<uint8_t>>(mapped, mapped + size);
+        slot_ptr->buffer.unmap();
+        if (profiler_) {
+          profiler_->Record("staging", staging_start, Profiler::Clock::now());
+        }
+        encodes_.Run([this, data, encoder] {
+            const auto encode_start = Profiler::Clock::now();
+            if (!encoder(*data)) {
+              ++failed_;
+            }
+            if (profiler_) {
+              profiler_->Record("encode", encode_start, Profiler::Clock::now());
+            }
+        });
+      }
+      slot_ptr->busy = false;
+  });
+}
+
+FrameWriter::Slot &FrameWriter::CopyTexture(Texture texture, uint32_t texel_size, uint32_t &bytes_per_row) {
+  const uint32_t width = texture.getWidth();
+  const uint32_t height = texture.getHeight();
+  // copyTextureToBuffer needs rows aligned to 256 bytes
+  bytes_per_row = (width * texel_size + 255) / 256 * 256;
+  const uint64_t size = (uint64_t) bytes_per_row * height;
+  auto &slot = AcquireSlot(size);
+
+  CommandEncoder encoder = device_.createCommandEncoder(Default);
+  ImageCopyTexture source = Default;
+  source.texture = texture;
+  source.mipLevel = 0;
+  ImageCopyBuffer destination = Default;
+  destination.buffer = slot.buffer;
+  destination.layout.bytesPerRow = bytes_per_row;
+  destination.layout.offset = 0;
+  destination.layout.rowsPerImage = height;
+  encoder.copyTextureToBuffer(source, destination, {width, height, 1});
+  CommandBuffer command = encoder.finish(Default);
+  queue_.submit(command);
+  command.release();
+  encoder.release();
+  return slot;
+}
+
+/// \brief Write an RGBA8Unorm texture as PNG
+/// \param texture mip level 0 is written
+/// \param path output file
+void FrameWriter::WritePNG(Texture texture, const fs::path &path) {
+  const uint32_t width = texture.getWidth();
+  const uint32_t height = texture.getHeight();
+  const uint32_t channels = 4;
+  uint32_t bytes_per_row = 0;
+  auto &slot = CopyTexture(texture, channels, bytes_per_row);
+  MapAndEncode(slot, (uint64_t) bytes_per_row * height, [path, width, height, channels, bytes_per_row](const std::vector<uint8_t> &data) {
+      if (!stbi_write_png(path.string().c_str(), (int) width, (int) height, (int) channels, data.data(), (int) bytes_per_row)) {
+        Error(PrintInfoType::WebGPUTracer, "Could not write image: ", path);
+        return false;
+      }
+      return true;
+  });
+}
+
+/// \brief Write an RGBA32Float texture as Radiance HDR
+/// \param texture mip level 0 is written, alpha is dropped
+/// \param path output file
+void FrameWriter::WriteHDR(Texture texture, const fs::path &path) {
+  const uint32_t width = texture.getWidth();
+  const uint32_t height = texture.getHeight();
+  uint32_t bytes_per_row = 0;
+  auto &slot = CopyTexture(texture, 4 * sizeof(float), bytes_per_row);
+  MapAndEncode(slot, (uint64_t) bytes_per_row * height, [path, width, height, bytes_per_row](const std::vector<uint8_t> &data) {
+      std::vector<float> rgb((size_t) width * height * 3);
+      for (uint32_t y = 0; y < height; ++y) {
+        const auto *row = (const float *) (data.data() + (size_t) y * bytes_per_row);
+        for (uint32_t x = 0; x < width; ++x) {
+          for (uint32_t c = 0; c < 3; ++c) {
+            rgb[3 * ((size_t) y * width + x) + c] = row[4 * x + c];
+          }
+        }
+      }
+      if (!stbi_write_hdr(path.string().c_str(), (int) width, (int) height, 3, rgb.data())) {
+        Error(PrintInfoType::WebGPUTracer, "Could not write image: ", path);
+        return false;
+      }
+      return true;
+  });
+}
+
+/// \brief Read back a buffer and encode it with a custom encoder
+/// \param buffer source buffer, needs BufferUsage::CopySrc
+/// \param size bytes to read from offset 0
+/// \param encoder called on a worker thread
+void FrameWriter::WriteBuffer(Buffer buffer, uint64_t size, Encoder encoder) {
+  auto &slot = AcquireSlot(size);
+  CommandEncoder command_encoder = device_.createCommandEncoder(Default);
+  command_encoder.copyBufferToBuffer(buffer, 0, slot.buffer, 0, size);
+  CommandBuffer command = command_encoder.finish(Default);
+  queue_.submit(command);
+  command.release();
+  command_encoder.release();
+  MapAndEncode(slot, size, std::move(encoder));
+}
+
+bool FrameWriter::Flush() {
+  auto pending = [this] {
+      return std::any_of(slots_.begin(), slots_.end(), [](const auto &slot) { return slot->busy; });
+  };
+  while (pending()) {
+    PollDevice(device_, queue_);
+  }
+  encodes_.Wait();
+  return failed_.exchange(0) == 0;
+}
@@ -0,0 +1,104 @@
+#include "image_compare.h"
+#include "utils/print_util.h"
+#include "stb_image.h"
+#include <iostream>
+
+bool ReadImage(const std::string &path, Image &image, std::string &error) {
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  if (stbi_is_hdr(path.c_str())) {
+    auto *data = stbi_loadf(path.c_str(), &width, &height, &channels, 3);
+    if (!data) {
+      error = "Could not read image: " + path;
+      return false;
+    }
+    image.rgb.assign(data, data + (size_t) width * height * 3);
+    stbi_image_free(data);
+  } else {
+    /// Not stbi_loadf: it would undo a 2.2 gamma the renderer never applied
+    auto *data = stbi_load(path.c_str(), &width, &height, &channels, 3);
+    if (!data) {
+      error = "Could not read image: " + path;
+      return false;
+    }
+    image.rgb.resize((size_t) width * height * 3);
+    for (size_t i = 0; i < image.rgb.size(); ++i) {
+      image.rgb[i] = (float) data[i] / 255.0f;
+    }
+    stbi_image_free(data);
+  }
+  image.width = (uint32_t) width;
+  image.height = (uint32_t) height;
+  return true;
+}
+
+ImageDiff CompareImages(const Image &image, const Image &reference, float max_block_sigma, uint32_t block_size) {
+  ImageDiff diff;
+  const auto width = image.width;
+  const auto height = image.height;
+  /// Difference of the display luminance of a pixel
+  auto pixel_diff = [&](size_t idx, double &squared_error) {
+      double lum = 0.0;
+      const double weights[3] = {0.2126, 0.7152, 0.0722};
+      for (int c = 0; c < 3; ++c) {
+        auto d = (double) Clamp(image.rgb[3 * idx + c], 0.0f, 1.0f) - (double) Clamp(reference.rgb[3 * idx + c], 0.0f, 1.0f);
+        squared_error += d * d;
+        lum += weights[c] * d;
+      }
+      return lum;
+  };
+  double squared_error = 0.0;
+  for (uint32_t by = 0; by < height; by += block_size) {
+    for (uint32_t bx = 0; bx < width; bx += block_size) {
+      double sum = 0.0;
+      double sum_sq = 0.0;
+      uint32_t n = 0;
+      for (uint32_t y = by; y < std::min(by + block_size, height); ++y) {
+        for (uint32_t x = bx; x < std::min(bx + block_size, width); ++x) {
+          auto d = pixel_diff((size_t) y * width + x, squared_error);
+          sum += d;
+          sum_sq += d * d;
+          ++n;
+        }
+      }
+      const auto mean = sum / n;
+      const auto variance = n > 1 ? std::max(sum_sq - sum * mean, 0.0) / (n - 1) : 0.0;
+      /// The floor keeps identical blocks at 0 and a constant offset far above any tolerance
+      const auto std_error = std::max(std::sqrt(variance / n), 1e-5);
+      const auto sigma = (float) (std::abs(mean) / std_error);
+      diff.max_block_sigma = std::max(diff.max_block_sigma, sigma);
+      diff.failed_blocks += sigma > max_block_sigma ? 1 : 0;
+      ++diff.blocks;
+    }
+  }
+  diff.rmse = (float) std::sqrt(squared_error / std::max<double>((double) width * height * 3, 1.0));
+  return diff;
+}
+
+bool CheckReferences(const RenderConfig &config, uint32_t start_frame, uint32_t end_frame) {
+  bool passed = true;
+  for (uint32_t i = start_frame - 1; i < end_frame; ++i) {
+    const auto path = config.OutputPath(RenderConfig::FrameName(i));
+    const auto reference_path = std::filesystem::path(config.reference_dir) / path.filename();
+    Image image, reference;
+    std::string error;
+    if (!ReadImage(path.string(), image, error) || !ReadImage(reference_path.string(), reference, error)) {
+      Error(PrintInfoType::WebGPUTracer, error.c_str());
+      passed = false;
+      continue;
+    }
+    if (image.width != reference.width || image.height != reference.height) {
+      Error(PrintInfoType::WebGPUTracer, "Reference size differs: ", reference_path.string());
+      passed = false;
+      continue;
+    }
+    const auto diff = CompareImages(image, reference, config.max_block_sigma);
+    const auto ok = diff.rmse <= config.max_rmse && diff.failed_blocks == 0;
+    std::cout << "[" << path.filename().string() << "]: rmse " << diff.rmse << " (max " << config.max_rmse
+              << "), block sigma " << diff.max_block_sigma << " (max " << config.max_block_sigma << "), "
+              << diff.failed_blocks << "/" << diff.blocks << " blocks failed: " << (ok ? "PASS" : "FAIL") << std::endl;
+    passed = passed && ok;
+  }
+  return passed;
+}
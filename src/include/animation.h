@@ -0,0 +1,124 @@
+#pragma once
+
+#include "utils/util.h"
+#include <algorithm>
+#include <map>
+#include <string>
+
+/// \brief Easing of the segment that ends at a keyframe (utils/util.h)
+enum class Easing : uint32_t {
+    Linear,
+    EaseInQuart,
+    EaseOutCubic,
+    EaseInOutExpo,
+    Sigmoid,
+};
+
+/// \param t progress of the segment in [0, 1]
+float Ease(Easing easing, float t);
+
+/// \brief Easing by name: linear, ease_in_quart, ease_out_cubic, ease_in_out_expo or sigmoid
+/// \return false if the name is unknown
+bool ParseEasing(const std::string &name, Easing &easing);
+
+/// \brief Camera placement, interpolated component-wise
+struct CameraPose {
+    Point3 origin{};
+    Point3 target{};
+    float fovy{};
+
+    bool operator==(const CameraPose &other) const {
+      return origin == other.origin && target == other.target && fovy == other.fovy;
+    }
+};
+
+/// \brief Rigid transform of a scene object relative to its rest placement
+/// The rotation turns the object around the center of its rest bounds, the translation follows.
+struct ObjectPose {
+    vec3 translation = vec3(0.0f);
+    /// Degrees around the Y-axis
+    float rotate_y = 0.0f;
+
+    bool operator==(const ObjectPose &other) const {
+      return translation == other.translation && rotate_y == other.rotate_y;
+    }
+
+    bool operator!=(const ObjectPose &other) const { return !(*this == other); }
+};
+
+inline CameraPose Lerp(const CameraPose &a, const CameraPose &b, float t) {
+  return {glm::mix(a.origin, b.origin, t), glm::mix(a.target, b.target, t), Lerp(a.fovy, b.fovy, t)};
+}
+
+inline ObjectPose Lerp(const ObjectPose &a, const ObjectPose &b, float t) {
+  return {glm::mix(a.translation, b.translation, t), Lerp(a.rotate_y, b.rotate_y, t)};
+}
+
+template<typename T>
+struct Keyframe {
+    /// Frame number (RenderConfig::FrameName), fractional times are allowed
+    float time{};
+    T value{};
+    /// Easing from the previous keyframe to this one
+    Easing easing = Easing::Linear;
+
+    bool operator==(const Keyframe &other) const {
+      return time == other.time && value == other.value && easing == other.easing;
+    }
+};
+
+/// \brief Keyframes of one animated value, sorted by time
+/// Before the first and after the last keyframe the value holds still.
+template<typename T>
+class Track {
+public:
+    /// \brief Insert a keyframe, replacing one at the same time
+    void Add(const Keyframe<T> &key) {
+      auto it = std::lower_bound(keys_.begin(), keys_.end(), key.time,
+                                 [](const Keyframe<T> &k, float time) { return k.time < time; });
+      if (it != keys_.end() && it->time == key.time) {
+        *it = key;
+      } else {
+        keys_.insert(it, key);
+      }
+    }
+
+    [[nodiscard]] bool Empty() const { return keys_.empty(); }
+
+    [[nodiscard]] const std::vector<Keyframe<T>> &Keys() const { return keys_; }
+
+    /// \param rest value of a track without keyframes
+    [[nodiscard]] T Sample(float t, const T &rest) const {
+      if (keys_.empty()) {
+        return rest;
+      }
+      auto next = std::upper_bound(keys_.begin(), keys_.end(), t,
+                                   [](float time, const Keyframe<T> &k) { return time < k.time; });
+      if (next == keys_.begin()) {
+        return keys_.front().value;
+      }
+      if (next == keys_.end()) {
+        return keys_.back().value;
+      }
+      const auto &prev = *(next - 1);
+      const auto s = (t - prev.time) / (next->time - prev.time);
+      return Lerp(prev.value, next->value, Ease(next->easing, s));
+    }
+
+    bool operator==(const Track &other) const { return keys_ == other.keys_; }
+
+private:
+    std::vector<Keyframe<T>> keys_;
+};
+
+/// \brief Keyframed camera and object transforms of a shot
+struct AnimationDesc {
+    /// Empty = the fixed camera of Camera::RestPose
+    Track<CameraPose> camera;
+    /// By object name (Scene::HasObject)
+    std::map<std::string, Track<ObjectPose>> objects;
+
+    bool operator==(const AnimationDesc &other) const {
+      return camera == other.camera && objects == other.objects;
+    }
+};
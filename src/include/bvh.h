@@ -0,0 +1,129 @@
+#pragma once
+
+#include "utils/util.h"
+#include "ray.h"
+#include "objects/triangle.h"
+#include "objects/quad.h"
+#include "objects/sphere.h"
+#include "bvh_builder.h"
+#include <unordered_map>
+
+/// \brief Primitive kinds referenced from BVH leaves.
+/// Matches the `shape` convention of HitInfo (tri(0), quad(1), sphere(2)); lights are quads stored in their own buffer,
+/// instances place a bottom-level BVH in the top-level one.
+enum class PrimType : uint32_t {
+    Triangle = 0,
+    Quad = 1,
+    Sphere = 2,
+    Light = 3,
+    Instance = 4,
+};
+
+/// Packed primitive reference: upper 3 bits = PrimType, lower 29 bits = index into its buffer
+constexpr uint32_t kPrimTypeShift = 29;
+constexpr uint32_t kPrimIndexMask = (1u << kPrimTypeShift) - 1u;
+
+inline uint32_t PackPrim(PrimType type, uint32_t index) {
+  return ((uint32_t) type << kPrimTypeShift) | (index & kPrimIndexMask);
+}
+
+inline PrimType PrimTypeOf(uint32_t prim) { return (PrimType) (prim >> kPrimTypeShift); }
+
+inline uint32_t PrimIndexOf(uint32_t prim) { return prim & kPrimIndexMask; }
+
+class BVH;
+
+/// \brief Placement of a bottom-level BVH in the world (mirrors `Instance` in path_tracer.wgsl)
+/// The bottom-level BVH and its primitives are stored once in object space, however often they are placed.
+struct BVHInstance {
+    /// Affine, the last row is (0, 0, 0, 1)
+    mat4x4 object_to_world = mat4x4(1.0f);
+    mat4x4 world_to_object = mat4x4(1.0f);
+    /// Index into BVHPrimitives::blas
+    uint32_t blas = 0;
+    /// Index into Scene::materials_ replacing the material of the instanced primitives, kNoHit keeps theirs
+    uint32_t material = kNoHit;
+
+    void SetTransform(const mat4x4 &m) {
+      object_to_world = m;
+      world_to_object = glm::inverse(m);
+    }
+};
+
+/// \brief Read-only view of the scene primitives indexed by the BVH
+struct BVHPrimitives {
+    const std::vector<Quad> &lights;
+    const std::vector<Quad> &quads;
+    const std::vector<Sphere> &spheres;
+    const std::vector<Triangle> &tris;
+    const std::vector<BVHInstance> &instances;
+    /// Bottom-level BVHs over object space primitives, referenced by instances
+    const std::vector<BVH> &blas;
+
+    [[nodiscard]] AABB Bounds(uint32_t prim) const;
+
+    bool Intersect(uint32_t prim, const Ray &r, HitInfo &closest) const;
+
+private:
+    bool IntersectInstance(const BVHInstance &instance, const Ray &r, HitInfo &closest) const;
+};
+
+class BVH {
+public:
+    BVH() = default;
+
+    /// \brief Build over every light, quad, sphere and triangle (a single-level scene)
+    void Build(const BVHPrimitives &prims, ThreadPool &pool = ThreadPool::Shared());
+
+    /// \brief Build over the packed primitive references `packed`
+    /// A top-level BVH gets the world space primitives and the instances, a bottom-level one the
+    /// object space primitives of one blob.
+    void Build(const BVHPrimitives &prims, const std::vector<uint32_t> &packed, ThreadPool &pool = ThreadPool::Shared());
+
+    /// \brief Adopt nodes and packed primitive references of a tree built earlier (scene cache)
+    void Assign(const BVHNode *nodes, uint32_t num_nodes, const uint32_t *prims, uint32_t num_prims);
+
+    bool Intersect(const Ray &r, const BVHPrimitives &prims, HitInfo &closest) const;
+
+    /// \brief Closest hits of up to kPacketSize rays sharing one traversal
+    /// \param rays kPacketSize rays
+    /// \param active bit i set if rays[i] is traced
+    /// \param closest kPacketSize hit records
+    /// \return bit i set if closest[i] was updated
+    uint32_t Intersect4(const Ray *rays, uint32_t active, const BVHPrimitives &prims, HitInfo *closest) const;
+
+    /// \brief Refit the nodes above primitives that moved, the tree topology is kept
+    /// Costs O(moved primitives x depth) instead of a rebuild, but the SAH quality of the tree degrades
+    /// with the distance the primitives moved from where the tree was built.
+    /// \param moved packed references of the primitives whose bounds changed
+    /// \return indices of the refitted nodes, ascending
+    std::vector<uint32_t> Refit(const BVHPrimitives &prims, const std::vector<uint32_t> &moved);
+
+    static bool IntersectBruteForce(const Ray &r, const BVHPrimitives &prims, HitInfo &closest);
+
+    static bool IntersectBruteForce(const Ray &r, const BVHPrimitives &prims, const std::vector<uint32_t> &packed, HitInfo &closest);
+
+    [[nodiscard]] const std::vector<BVHNode> &Nodes() const { return nodes_; }
+
+    [[nodiscard]] const std::vector<uint32_t> &Prims() const { return prims_; }
+
+    /// \brief Bounds of the root node
+    [[nodiscard]] AABB Bounds() const;
+
+public:
+    /// Rays traced together by Intersect4
+    static const uint32_t kPacketSize = 4;
+
+private:
+    void InitRefit();
+
+private:
+    static constexpr uint32_t kNoParent = ~0u;
+    std::vector<BVHNode> nodes_;
+    std::vector<uint32_t> prims_;
+    /// Refit: parent of every node, leaf of every packed primitive and nodes marked by the current Refit,
+    /// set up by the first Refit after a Build
+    std::vector<uint32_t> parents_;
+    std::unordered_map<uint32_t, uint32_t> leaves_;
+    std::vector<uint8_t> refit_marks_;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "utils/util.h"
+#include "utils/thread_pool.h"
+#include <atomic>
+
+struct AABB {
+    vec3 min = vec3(std::numeric_limits<float>::max());
+    vec3 max = vec3(-std::numeric_limits<float>::max());
+
+    void Grow(const vec3 &p) {
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+    }
+
+    void Grow(const AABB &b) {
+      min = glm::min(min, b.min);
+      max = glm::max(max, b.max);
+    }
+
+    [[nodiscard]] vec3 Centroid() const { return (min + max) * 0.5f; }
+
+    [[nodiscard]] float Area() const {
+      auto e = max - min;
+      return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+};
+
+/// \brief Flattened BVH node (32 bytes, two vec4f on the GPU)
+/// Interior: prim_count == 0, children are nodes[left_first] and nodes[left_first + 1]
+/// Leaf: prims[left_first .. left_first + prim_count)
+struct BVHNode {
+    vec3 aabb_min;
+    uint32_t left_first;
+    vec3 aabb_max;
+    uint32_t prim_count;
+
+    [[nodiscard]] bool IsLeaf() const { return prim_count > 0; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must match the WGSL layout");
+
+/// \brief Binned SAH builder working on primitive bounds only
+/// Subtrees above kParallelThreshold primitives are split across the thread pool and nodes are
+/// written into an arena sized for the worst case (2N), so no vector ever grows during the build.
+class BVHBuilder {
+public:
+    explicit BVHBuilder(ThreadPool &pool = ThreadPool::Shared()) : pool_(pool) {}
+
+    /// \brief Build over `bounds`
+    /// \param bounds per-primitive bounds
+    /// \param nodes output nodes, root at index 0
+    /// \param order output permutation: leaf ranges index into bounds through it
+    void Build(const std::vector<AABB> &bounds, std::vector<BVHNode> &nodes, std::vector<uint32_t> &order);
+
+    /// \brief SAH cost of a built tree, normalized by the root surface area
+    static float SAHCost(const std::vector<BVHNode> &nodes);
+
+public:
+    /// Max primitives per leaf (unless the depth limit forces a bigger leaf)
+    static const uint32_t kMaxLeafPrims = 4;
+    /// Max tree depth, equals the traversal stack size of the shader
+    static const uint32_t kStackSize = 32;
+    /// Number of SAH bins per axis
+    static const uint32_t kBins = 16;
+    /// Subtrees bigger than this are built as separate tasks
+    static const uint32_t kParallelThreshold = 4096;
+    /// SAH constants
+    static constexpr float kTraversalCost = 1.0f;
+    static constexpr float kIntersectCost = 1.0f;
+
+private:
+    struct alignas(16) Float4 {
+        float v[4];
+    };
+
+    struct RangeBounds {
+        AABB bounds;
+        AABB centroid_bounds;
+    };
+
+    RangeBounds ComputeBounds(uint32_t first, uint32_t count) const;
+
+    RangeBounds ComputeBoundsSerial(uint32_t first, uint32_t count) const;
+
+    void Subdivide(uint32_t node_idx, uint32_t first, uint32_t count, uint32_t depth);
+
+    bool FindSplit(uint32_t first, uint32_t count, const RangeBounds &range, int &axis, uint32_t &split_bin, float &cost) const;
+
+private:
+    ThreadPool &pool_;
+    const std::vector<AABB> *bounds_ = nullptr;
+    std::vector<Float4> centroids_;
+    BVHNode *nodes_ = nullptr;
+    uint32_t *order_ = nullptr;
+    std::atomic<uint32_t> node_count_{0};
+};
@@ -2,6 +2,7 @@
 
 #include "utils/wgpu_util.h"
 #include "utils/util.h"
+#include "animation.h"
 
 class Camera {
 public:
@@ -17,24 +18,107 @@ public:
     };
 
     struct CameraParam {
-        Point3 origin;
+        Point3 origin{};
         float dummy{};
-        Point3 target;
+        Point3 target{};
         float dummy1{};
-        float aspect;
-        float fovy;
-        uint32_t spp;
-        uint32_t seed;
+        float aspect{};
+        float fovy{};
+        uint32_t spp{};
+        uint32_t seed{};
+        /// Samples already accumulated for this frame (progressive mode)
+        uint32_t sample_offset{};
+        /// Samples taken by the current dispatch
+        uint32_t sample_count{};
+        /// Bounce limit of a path
+        uint32_t max_depth{50};
+        /// Bounces traced before Russian roulette may end a path (>= max_depth disables it)
+        uint32_t rr_depth{3};
+        /// Count the paths entering every bounce (0 = off)
+        uint32_t path_stats{};
+        /// Light selection: power alias table (0) or light tree (1)
+        uint32_t light_tree{};
+        /// Random numbers: PCG (0), Owen-scrambled Sobol (1) or blue-noise dithered Sobol (2)
+        uint32_t sampler{};
+        /// Scrambling of the quasi-random sequence, the same for every dispatch of a frame
+        uint32_t sampler_seed{};
+        /// Adaptive sampling: relative standard error below which a pixel stops taking samples
+        float adaptive_threshold{};
+        /// Write the first hit of every pixel to the G-buffer of the denoiser (0 = off)
+        uint32_t gbuffer{};
+        /// Quad and triangle buffers in the compact layout (Scene::CompactLayout, 0 = off)
+        uint32_t compact_geometry{};
+        uint32_t dummy3{};
+
+        CameraParam() = default;
 
         CameraParam(vec3 origin, vec3 target, float aspect, float fovy, uint32_t spp, uint32_t seed) :
-                origin(origin), target(target), aspect(aspect), fovy(fovy), spp(spp), seed(seed) {}
+                origin(origin), target(target), aspect(aspect), fovy(fovy), spp(spp), seed(seed), sample_count(spp) {}
+    };
+
+    /// \brief Pixel grid of a camera, laid out as the View struct of denoise.wgsl
+    /// The primary ray of pixel (x, y) points from origin to pixel_origin + x pixel_delta_u + y pixel_delta_v.
+    struct View {
+        vec3 origin{};
+        float pad{};
+        vec3 pixel_origin{};
+        float pad1{};
+        vec3 pixel_delta_u{};
+        float pad2{};
+        vec3 pixel_delta_v{};
+        float pad3{};
+        /// View direction over the focal length
+        vec3 forward{};
+        float pad4{};
     };
 
+    /// \brief Pixel grid of `param` for a width x height frame (setup_camera_ray of path_tracer.wgsl)
+    static View ViewOf(const CameraParam &param, uint32_t width, uint32_t height);
+
     Uniforms GetUniforms() { return uniforms_; }
 
     void Release();
 
-    void Update(Queue &queue, float t, float aspect);
+    /// \param sampler_seed CameraParam::sampler_seed of the frame
+    void Update(Queue &queue, float t, float aspect, uint32_t sampler_seed);
+
+    /// \param track keyframed camera, RestPose() if empty
+    static CameraParam ParamAt(float t, float aspect, uint32_t spp, uint32_t seed, const Track<CameraPose> &track = {});
+
+    /// \brief The Cornell box camera, used when no camera keyframes are given
+    static CameraPose RestPose();
+
+    void SetProgress(Queue &queue, uint32_t sample_offset, uint32_t sample_count, uint32_t seed);
+
+    void SetSpp(uint32_t spp) { spp_ = spp; }
+
+    /// \brief Path length settings, applied by the next Update
+    void SetDepth(uint32_t max_depth, uint32_t rr_depth, bool path_stats) {
+      max_depth_ = max_depth;
+      rr_depth_ = rr_depth;
+      path_stats_ = path_stats;
+    }
+
+    /// \brief Light selection, applied by the next Update
+    void SetLightTree(bool light_tree) { light_tree_ = light_tree; }
+
+    /// \brief Sampler (CameraParam::sampler), applied by the next Update
+    void SetSampler(uint32_t sampler) { sampler_ = sampler; }
+
+    /// \brief Adaptive sampling threshold (CameraParam::adaptive_threshold), applied by the next Update
+    void SetAdaptiveThreshold(float threshold) { adaptive_threshold_ = threshold; }
+
+    /// \brief G-buffer output of the denoiser (CameraParam::gbuffer), applied by the next Update
+    void SetGBuffer(bool gbuffer) { gbuffer_ = gbuffer; }
+
+    /// \brief Layout of the scene buffers (CameraParam::compact_geometry), applied by the next Update
+    void SetCompactGeometry(bool compact_geometry) { compact_geometry_ = compact_geometry; }
+
+    /// \brief Camera keyframes (AnimationDesc::camera), applied by the next Update
+    void SetTrack(const Track<CameraPose> &track) { track_ = track; }
+
+    /// \brief Parameters of the last Update
+    [[nodiscard]] const CameraParam &Param() const { return param_; }
 
 private:
     void InitBindGroupLayout(Device &device);
@@ -45,6 +129,16 @@ private:
 
 private:
     uint32_t spp_{1};
+    uint32_t max_depth_{50};
+    uint32_t rr_depth_{3};
+    bool path_stats_{false};
+    bool light_tree_{false};
+    uint32_t sampler_{};
+    float adaptive_threshold_{};
+    bool gbuffer_{false};
+    bool compact_geometry_{false};
+    Track<CameraPose> track_;
+    CameraParam param_{};
     Buffer uniform_buffer_ = nullptr;
     Uniforms uniforms_ = {};
 };
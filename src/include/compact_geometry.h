@@ -0,0 +1,51 @@
+#pragma once
+
+#include "objects/triangle.h"
+#include "objects/quad.h"
+#include "bvh_builder.h"
+
+/// \brief Compact GPU records of quads and triangles (SceneDesc::compact_geometry)
+/// Quads keep q, right and up at full precision and drop the padding and everything derived from them (norm, w, d),
+/// which the shader recomputes: 12 words instead of 24. Triangles store 16-bit positions on a grid spanning the mesh
+/// bounds, octahedral vertex normals, full precision texture coordinates and the material: 16 words instead of 32.
+/// The grid leads the triangle buffer. load_quad / load_triangle of path_tracer.wgsl decode them the same way.
+class CompactGeometry {
+public:
+    static constexpr uint32_t kQuadWords = 12;
+    static constexpr uint32_t kTriangleWords = 16;
+    /// Grid origin and step ahead of the triangle records
+    static constexpr uint32_t kHeaderWords = 8;
+
+    CompactGeometry() = default;
+
+    /// \param bounds of the triangles, the root of their bottom-level BVH
+    explicit CompactGeometry(const AABB &bounds);
+
+    /// \brief Grid spacing, zero along flat axes
+    [[nodiscard]] vec3 Step() const { return step_; }
+
+    void WriteHeader(uint32_t *data) const;
+
+    void EncodeTriangle(const Triangle &tri, uint32_t *data) const;
+
+    [[nodiscard]] Triangle DecodeTriangle(const uint32_t *data) const;
+
+    /// \brief The triangle the GPU decodes: positions on the grid, octahedral normals
+    [[nodiscard]] Triangle Snap(const Triangle &tri) const;
+
+    static void EncodeQuad(const Quad &quad, uint32_t *data);
+
+    static Quad DecodeQuad(const uint32_t *data);
+
+    /// \brief Octahedral unit vector, two 16-bit snorm components (pack2x16snorm)
+    static uint32_t EncodeNormal(vec3 n);
+
+    static vec3 DecodeNormal(uint32_t packed);
+
+private:
+    [[nodiscard]] vec3 Dequantize(uint32_t x, uint32_t y, uint32_t z) const;
+
+private:
+    vec3 origin_{};
+    vec3 step_{};
+};
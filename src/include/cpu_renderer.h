@@ -0,0 +1,84 @@
+#pragma once
+
+#include "render_backend.h"
+#include "camera.h"
+#include "profiler.h"
+#include "utils/thread_pool.h"
+#include <atomic>
+
+/// \brief CPU port of path_tracer.wgsl
+/// Uses the camera, samplers, stratification, MIS and intersection code of the compute shader,
+/// so that both backends converge to the same image. Tiles are spread over the work-stealing ThreadPool
+/// and the paths of BVH::kPacketSize neighbouring pixels are traced as one ray packet.
+class CpuRenderer : public RenderBackend {
+public:
+    explicit CpuRenderer(ThreadPool &pool = ThreadPool::Shared()) : pool_(pool), encodes_(pool) {}
+
+    bool OnInit(const RenderConfig &config, const SceneDesc &scene) override;
+
+    bool SetShot(const RenderConfig &config, const SceneDesc &scene) override;
+
+    bool OnCompute(uint32_t start_frame, uint32_t end_frame) override;
+
+    void OnFinish() override;
+
+private:
+    struct Tile {
+        uint32_t origin[2]{};
+        uint32_t size[2]{};
+    };
+
+    void InitTiles();
+
+    bool OnRender(uint32_t frame);
+
+    void RenderTile(const Tile &tile, const Camera::CameraParam &camera);
+
+    /// \brief Retire the converged pixels of `tile` (adaptive_update of path_tracer.wgsl)
+    /// \return pixels of the tile still taking samples
+    uint32_t UpdateAdaptive(const Tile &tile);
+
+    void ReportAdaptive() const;
+
+    [[nodiscard]] std::vector<vec3> Resolve() const;
+
+    /// \brief Temporal accumulation of the finished frame (RenderConfig::temporal_frames)
+    void AccumulateHistory(std::vector<vec3> &image, const Camera::View &view);
+
+    void WriteOutput(const std::string &name, std::vector<vec3> image);
+
+private:
+    /// Edge length of a CPU tile, small enough to keep every worker busy
+    static constexpr uint32_t kTileSize = 32;
+    ThreadPool &pool_;
+    /// CPU spans (RenderConfig::profile), outlives the encoders
+    Profiler profiler_;
+    /// Image encoders still running
+    TaskGroup encodes_;
+    std::atomic<uint32_t> failed_writes_{0};
+    RenderConfig config_{};
+    Scene scene_{};
+    std::vector<Tile> tiles_;
+    /// Indices into tiles_ still taking samples in the current frame (adaptive sampling)
+    std::vector<uint32_t> active_tiles_;
+    /// Radiance sum per pixel, row-major
+    std::vector<vec3> accum_;
+    /// Samples taken by the frame, a converged pixel has fewer of its own
+    uint32_t accum_samples_ = 0;
+    /// Per pixel: samples, sum of squared sample luminance, still taking samples
+    std::vector<uint32_t> pixel_samples_;
+    std::vector<float> luminance_sq_;
+    std::vector<uint8_t> pixel_active_;
+    /// First hit of every pixel (CameraParam::gbuffer): albedo, normal + distance
+    std::vector<vec3> gbuffer_albedo_;
+    std::vector<vec4> gbuffer_normal_depth_;
+    /// Vertical field of view of the current frame, sets the depth tolerance of the denoiser
+    float fovy_ = 0.0f;
+    /// Temporal accumulation: radiance + frames and normal + distance of the last frame, seen from previous_view_
+    std::vector<vec4> history_;
+    std::vector<vec4> history_normal_depth_;
+    Camera::View previous_view_{};
+    bool history_valid_ = false;
+    /// Paths entering every bounce of the current frame (RenderConfig::path_stats)
+    std::vector<std::atomic<uint64_t>> path_stats_;
+};
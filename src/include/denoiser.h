@@ -0,0 +1,120 @@
+#pragma once
+
+#include "utils/wgpu_util.h"
+#include "render_config.h"
+#include "camera.h"
+#include <array>
+
+/// \brief Edge-avoiding a-trous denoiser of the resolved frame (RenderConfig::denoise_iterations)
+/// compute_sample / wave_shade write the first hit of every pixel to the G-buffer (CameraParam::gbuffer)
+/// and resolve writes the radiance, both through group 2 of path_tracer.wgsl. Record then runs
+/// denoise.wgsl once per iteration over the whole frame, ping-ponging between two radiance textures,
+/// since the wider iterations reach across tiles. The last iteration overwrites the 8-bit output texture.
+/// With RenderConfig::temporal_frames, RecordTemporal first blends the resolved radiance with the history
+/// of the previous frames, reprojected through the camera views, so the filter sees the accumulated frame.
+class Denoiser {
+public:
+    Denoiser() = default;
+
+    Denoiser(const Denoiser &) = delete;
+
+    Denoiser &operator=(const Denoiser &) = delete;
+
+    /// \brief Pipeline of denoise.wgsl
+    void Init(Device device, const Limits &limits);
+
+    void Release();
+
+    [[nodiscard]] bool Ready() const { return pipeline_ != nullptr; }
+
+    /// \brief G-buffer and radiance textures of a width x height frame
+    /// \param enabled 1x1 textures otherwise, path_tracer.wgsl still needs something to bind
+    /// \param temporal history textures of temporal accumulation as well, starts a new history
+    /// \param output_view 8-bit output texture, written by the last iteration
+    void InitFrameResources(uint32_t width, uint32_t height, bool enabled, bool temporal, TextureView output_view);
+
+    void ReleaseFrameResources();
+
+    /// \brief Edge-stopping weights and iteration count for the next Record
+    /// \param pixel_angle extent of a pixel at unit distance from the camera (2 tan(fovy / 2) / height)
+    void SetParams(Queue queue, const RenderConfig &config, float pixel_angle);
+
+    /// \brief Record the iterations into a compute pass
+    void Record(ComputePassEncoder &pass);
+
+    /// \brief History length and camera of the frame for the next RecordTemporal
+    /// \param view pixel grid of the current camera, the history is reprojected from the previous one
+    void SetTemporalParams(Queue queue, const RenderConfig &config, const Camera::View &view);
+
+    /// \brief Record temporal accumulation of the resolved radiance into a compute pass
+    void RecordTemporal(ComputePassEncoder &pass);
+
+    /// \brief After the pass of RecordTemporal: the accumulated radiance becomes the input of Record and,
+    /// with the G-buffer, the history of the next frame
+    void KeepHistory(CommandEncoder &encoder);
+
+    /// \brief The next frame starts a new history (new shot)
+    void ResetHistory() { history_valid_ = false; }
+
+    /// \brief Storage views bound to group 2 of path_tracer.wgsl
+    [[nodiscard]] TextureView RadianceView() const { return radiance_views_[0]; }
+
+    [[nodiscard]] TextureView AlbedoView() const { return albedo_view_; }
+
+    [[nodiscard]] TextureView NormalDepthView() const { return normal_depth_view_; }
+
+    /// \brief Denoised RGBA32Float radiance of the last Record
+    [[nodiscard]] Texture Output() const { return radiance_[iterations_ % 2]; }
+
+private:
+    void InitBindGroupLayout();
+
+    void InitTemporalBindGroupLayout();
+
+    ComputePipeline CreatePipeline(ShaderModule shader_module, PipelineLayout layout, const char *entry_point);
+
+    static Texture CreateTexture(Device device, uint32_t width, uint32_t height, TextureFormat format, const char *label);
+
+    static TextureView CreateView(Texture texture, TextureFormat format);
+
+private:
+    static const uint32_t kWorkgroupSize = 16;
+    Device device_ = nullptr;
+    BindGroupLayout bind_group_layout_ = nullptr;
+    PipelineLayout pipeline_layout_ = nullptr;
+    ComputePipeline pipeline_ = nullptr;
+    /// DenoiseParam per iteration, padded to minUniformBufferOffsetAlignment
+    Buffer param_buffer_ = nullptr;
+    uint32_t param_stride_ = 0;
+    uint32_t iterations_ = 0;
+
+    uint32_t width_ = 0;
+    uint32_t height_ = 0;
+    /// Ping-pong radiance, [0] is written by resolve
+    std::array<Texture, 2> radiance_{nullptr, nullptr};
+    std::array<TextureView, 2> radiance_views_{nullptr, nullptr};
+    Texture albedo_ = nullptr;
+    TextureView albedo_view_ = nullptr;
+    Texture normal_depth_ = nullptr;
+    TextureView normal_depth_view_ = nullptr;
+    /// [k] reads radiance_[k] and writes the other one
+    std::array<BindGroup, 2> bind_groups_{nullptr, nullptr};
+
+    /// Temporal accumulation
+    BindGroupLayout temporal_bind_group_layout_ = nullptr;
+    PipelineLayout temporal_pipeline_layout_ = nullptr;
+    ComputePipeline temporal_pipeline_ = nullptr;
+    Buffer temporal_param_buffer_ = nullptr;
+    /// Ping-pong history (rgb = accumulated radiance, a = frames), history_[history_index_] holds the last frame
+    std::array<Texture, 2> history_{nullptr, nullptr};
+    std::array<TextureView, 2> history_views_{nullptr, nullptr};
+    uint32_t history_index_ = 0;
+    /// G-buffer normal + distance of the last frame
+    Texture history_normal_depth_ = nullptr;
+    TextureView history_normal_depth_view_ = nullptr;
+    /// [k] reads history_[k] and writes the other one
+    std::array<BindGroup, 2> temporal_bind_groups_{nullptr, nullptr};
+    /// Camera of the last frame, valid once a frame was kept
+    Camera::View previous_view_{};
+    bool history_valid_ = false;
+};
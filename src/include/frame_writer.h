@@ -0,0 +1,70 @@
+#pragma once
+
+#include "utils/wgpu_util.h"
+#include "utils/thread_pool.h"
+#include "profiler.h"
+#include <atomic>
+#include <utility>
+
+/// \brief Asynchronous GPU to file pipeline
+/// Readbacks go through a ring of reusable MapRead staging buffers: the copy is recorded on the
+/// queue right behind the frame, the buffer is mapped while the next frames render, and the
+/// contents are encoded on the thread pool so the render loop never waits on an image encoder.
+class FrameWriter {
+public:
+    /// \brief Runs on a worker with a copy of the staging buffer
+    using Encoder = std::function<bool(const std::vector<uint8_t> &data)>;
+
+    explicit FrameWriter(ThreadPool &pool = ThreadPool::Shared()) : encodes_(pool) {}
+
+    FrameWriter(const FrameWriter &) = delete;
+
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    /// \param profiler receives readback, staging and encode spans (optional)
+    void Init(Device device, Queue queue, uint32_t ring_size, Profiler *profiler = nullptr);
+
+    void Release();
+
+    /// \brief Write an RGBA8Unorm texture as PNG
+    void WritePNG(Texture texture, const fs::path &path);
+
+    /// \brief Write an RGBA32Float texture as Radiance HDR
+    void WriteHDR(Texture texture, const fs::path &path);
+
+    /// \brief Read back `size` bytes of `buffer` (needs CopySrc) and hand them to `encoder`
+    void WriteBuffer(Buffer buffer, uint64_t size, Encoder encoder);
+
+    /// \brief Wait until every queued frame is mapped and encoded
+    /// \return false if any readback or encode failed since the last Flush
+    bool Flush();
+
+private:
+    using MapCallbackHandle = decltype(std::declval<Buffer &>().mapAsync(MapMode::Read, 0, 0, std::function<void(BufferMapAsyncStatus)>()));
+
+    struct Slot {
+        Buffer buffer = nullptr;
+        uint64_t size = 0;
+        bool busy = false;
+        MapCallbackHandle map_callback;
+    };
+
+    Slot &AcquireSlot(uint64_t size);
+
+    void MapAndEncode(Slot &slot, uint64_t size, Encoder encoder);
+
+    /// \brief Copy mip level 0 of `texture` into a staging buffer
+    /// \return staging slot, rows are padded to bytes_per_row
+    Slot &CopyTexture(Texture texture, uint32_t texel_size, uint32_t &bytes_per_row);
+
+private:
+    /// Pending encoder tasks
+    TaskGroup encodes_;
+    Device device_ = nullptr;
+    Queue queue_ = nullptr;
+    uint32_t ring_size_ = 2;
+    /// Slots are never moved, map callbacks keep pointers to them
+    std::vector<std::unique_ptr<Slot>> slots_;
+    std::atomic<uint32_t> failed_{0};
+    Profiler *profiler_ = nullptr;
+};
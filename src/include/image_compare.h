@@ -0,0 +1,37 @@
+#pragma once
+
+#include "render_config.h"
+#include <string>
+#include <vector>
+
+/// \brief RGB float image, row-major
+struct Image {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<float> rgb;
+};
+
+/// \brief Statistics of a rendered image against its reference
+struct ImageDiff {
+    /// RMSE of the display values (clamped to [0, 1])
+    float rmse = 0.0f;
+    /// Largest |mean difference| of a block, in standard errors of the per-pixel differences
+    /// Pure Monte Carlo noise stays at a few sigma, a bias covering a block grows with its pixel count.
+    float max_block_sigma = 0.0f;
+    /// Blocks above the tolerance
+    uint32_t failed_blocks = 0;
+    uint32_t blocks = 0;
+};
+
+/// \brief Load a PNG (unorm values) or HDR (linear values) image
+bool ReadImage(const std::string &path, Image &image, std::string &error);
+
+/// \brief Compare two images of the same size
+/// \param block_size edge length of the blocks of the bias test
+/// \param max_block_sigma blocks above it are counted in failed_blocks
+ImageDiff CompareImages(const Image &image, const Image &reference, float max_block_sigma, uint32_t block_size = 16);
+
+/// \brief Compare the written frames of a shot with the images of config.reference_dir
+/// Prints the statistics of every frame.
+/// \return false if a reference is missing or a frame is above the tolerances of `config`
+bool CheckReferences(const RenderConfig &config, uint32_t start_frame, uint32_t end_frame);
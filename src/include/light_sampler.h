@@ -0,0 +1,98 @@
+#pragma once
+
+#include "utils/util.h"
+#include "objects/quad.h"
+#include "objects/sphere.h"
+#include "material.h"
+#include "bvh_builder.h"
+#include <vector>
+
+/// \brief Alias table entry of a light, stored after its quad in the light buffer (struct Light in path_tracer.wgsl)
+/// Lights are the quads of Scene::lights_ followed by the emissive spheres.
+struct LightAlias {
+    /// Threshold of the own light in its alias table bucket
+    float alias_prob;
+    /// Light picked above the threshold
+    uint32_t alias;
+    /// Selection probability of the light, proportional to its power
+    float power_pdf;
+    /// Index into the spheres of a sphere light, kNoHit for a quad light
+    uint32_t sphere;
+};
+
+static_assert(sizeof(LightAlias) == 16, "LightAlias must match the WGSL layout");
+
+/// \brief Light tree node (64 bytes, matches LightNode in path_tracer.wgsl)
+/// The first 32 bytes are laid out like BVHNode, so that the slab test of the scene BVH can be reused.
+/// Interior: prim_count == 0, children are nodes[left_first] and nodes[left_first + 1]
+/// Leaf: prim_count == 1, light index left_first
+/// Emission of the subtree: directions within acos(cos_theta_o) of axis, plus a hemisphere around them.
+struct LightNode {
+    vec3 aabb_min;
+    uint32_t left_first;
+    vec3 aabb_max;
+    uint32_t prim_count;
+    vec3 axis;
+    float cos_theta_o;
+    float power;
+    float dummy[3];
+
+    [[nodiscard]] bool IsLeaf() const { return prim_count > 0; }
+};
+
+static_assert(sizeof(LightNode) == 64, "LightNode must match the WGSL layout");
+
+/// \brief Light selection for next event estimation
+/// Alias: lights are picked with a probability proportional to their power in O(1) (Vose's alias method).
+/// Tree: a BVH over the lights is descended by the importance of each child seen from the shading
+/// point (power, distance and orientation bounds as in PBRT-v4), so that nearby lights facing the
+/// point are preferred and noise stays flat as the light count grows.
+/// Both are mirrored by select_light / light_pdf in path_tracer.wgsl and use the same random number.
+class LightSampler {
+public:
+    LightSampler() = default;
+
+    /// \brief Alias table and light tree of the quad `lights` and the emissive `spheres`
+    /// Lights without power are never selected, unless no light has any power.
+    /// \param materials indexed by the material of the lights and spheres
+    void Build(const std::vector<Quad> &lights, const std::vector<Sphere> &spheres, const std::vector<Material> &materials);
+
+    /// \brief Quad lights plus sphere lights
+    [[nodiscard]] uint32_t Count() const { return (uint32_t) alias_.size(); }
+
+    /// \brief Light for a shading point
+    /// \param u uniform random number in [0, 1)
+    /// \param tree descend the light tree instead of the alias table
+    [[nodiscard]] uint32_t Sample(const vec3 &pos, const vec3 &norm, float u, bool tree) const;
+
+    /// \brief Solid angle density of picking `dir` by sampling a point on a selected light
+    /// Sums over every light the ray from `pos` passes through, in front of each other or not.
+    [[nodiscard]] float Pdf(const std::vector<Quad> &lights, const std::vector<Sphere> &spheres, const vec3 &pos,
+                            const vec3 &norm, const vec3 &dir, bool tree) const;
+
+    /// \brief Cosine of the half angle of the cone `sphere` subtends from `pos`, -1 inside the sphere
+    /// Sphere lights are sampled uniformly in this cone (rand_to_sphere in path_tracer.wgsl).
+    static float CosThetaMax(const Sphere &sphere, const vec3 &pos);
+
+    [[nodiscard]] const std::vector<LightAlias> &AliasTable() const { return alias_; }
+
+    [[nodiscard]] const std::vector<LightNode> &Nodes() const { return nodes_; }
+
+private:
+    void BuildAliasTable(const std::vector<float> &power);
+
+    void BuildTree(const std::vector<Quad> &lights, const std::vector<Sphere> &spheres, const std::vector<float> &power);
+
+    void Subdivide(uint32_t node, std::vector<uint32_t>::iterator begin, std::vector<uint32_t>::iterator end,
+                   const std::vector<AABB> &bounds, const std::vector<LightNode> &leaves);
+
+    /// \brief Probability of descending into the first child of an interior node
+    [[nodiscard]] float FirstChildProbability(const LightNode &node, const vec3 &pos, const vec3 &norm) const;
+
+    static float Importance(const LightNode &node, const vec3 &pos, const vec3 &norm);
+
+private:
+    std::vector<LightAlias> alias_;
+    /// Root at index 0, lights without power are left out (a leaf with empty bounds if none is left)
+    std::vector<LightNode> nodes_;
+};
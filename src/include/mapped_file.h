@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/// \brief Read-only mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept;
+
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    ~MappedFile() { Close(); }
+
+    /// \return false if the file cannot be mapped or is empty
+    bool Open(const std::string &path);
+
+    void Close();
+
+    [[nodiscard]] const uint8_t *Data() const { return data_; }
+
+    [[nodiscard]] uint64_t Size() const { return size_; }
+
+private:
+    const uint8_t *data_ = nullptr;
+    uint64_t size_ = 0;
+};
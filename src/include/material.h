@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ray.h"
+#include <string>
+
+/// \brief Scattering model of a material, the `bxdf` switch of path_tracer.wgsl
+enum class BxDF : uint32_t {
+    /// Cosine-weighted diffuse
+    Lambertian = 0,
+    /// Diffuse base under a GGX specular layer, blended to a conductor by metallic
+    GGX = 1,
+    /// Smooth glass: Fresnel-weighted mirror reflection or refraction, roughness is ignored
+    Dielectric = 2,
+};
+
+/// \brief Scattering model by name: lambertian, ggx or dielectric
+/// \return false if the name is unknown
+bool ParseBxDF(const std::string &name, BxDF &bxdf);
+
+/// \brief Entry of the material table (mirrors `Material` in path_tracer.wgsl)
+/// Primitives reference materials by index. Emissive materials end a path where it hits them.
+/// Texture maps are layers of Scene::textures_, looked up with the uv of the hit (kNoHit = none).
+struct Material {
+    Color3 base_color = Color3(.73, .73, .73);
+    BxDF bxdf = BxDF::Lambertian;
+    /// Perceptual roughness, GGX alpha = roughness^2
+    float roughness = 0.5f;
+    float metallic = 0.0f;
+    /// Index of refraction, also sets the normal incidence reflectance of the GGX layer
+    float ior = 1.5f;
+    /// Emitted radiance = base_color * emission
+    float emission = 0.0f;
+    /// Multiplies base_color, sRGB encoded
+    uint32_t base_color_texture = kNoHit;
+    /// Tangent space normal map, bends the shading normal
+    uint32_t normal_texture = kNoHit;
+    /// Multiplies roughness by its green channel (glTF metallic-roughness maps, grayscale maps alike)
+    uint32_t roughness_texture = kNoHit;
+    uint32_t pad{};
+
+    [[nodiscard]] bool Emissive() const { return emission > 0.0f; }
+
+    [[nodiscard]] Color3 Emitted() const { return base_color * emission; }
+
+    /// \brief Albedo of the denoiser G-buffer: the emitted radiance of lights, the base color otherwise
+    [[nodiscard]] Color3 Albedo() const { return Emissive() ? Emitted() : base_color; }
+
+    static Material Diffuse(Color3 color) {
+      Material material;
+      material.base_color = color;
+      return material;
+    }
+
+    static Material Light(Color3 color, float emission) {
+      Material material;
+      material.base_color = color;
+      material.emission = emission;
+      return material;
+    }
+
+    bool operator==(const Material &other) const {
+      return base_color == other.base_color && bxdf == other.bxdf && roughness == other.roughness &&
+             metallic == other.metallic && ior == other.ior && emission == other.emission &&
+             base_color_texture == other.base_color_texture && normal_texture == other.normal_texture &&
+             roughness_texture == other.roughness_texture;
+    }
+};
+
+static_assert(sizeof(Material) == 48, "Material must match the WGSL layout");
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "objects/vertex.h"
+#include "ray.h"
+#include "utils/thread_pool.h"
+#include <string>
+
+/// \brief Indexed triangle mesh of an OBJ file
+struct ObjMesh {
+    /// Distinct position / texture coordinate / normal combinations of the face corners
+    /// Missing normals are zero (Triangle substitutes the face normal), missing texture coordinates zero.
+    std::vector<Vertex> vertices;
+    /// Three vertices per triangle, polygons are triangulated as fans
+    std::vector<uint32_t> indices;
+    /// usemtl of every triangle: index into material_names, kNoHit before the first usemtl
+    std::vector<uint32_t> face_materials;
+    std::vector<std::string> material_names;
+    /// mtllib files, relative to the OBJ file
+    std::vector<std::string> material_libraries;
+
+    [[nodiscard]] size_t Triangles() const { return indices.size() / 3; }
+};
+
+/// \brief Parse the geometry of an OBJ file on the thread pool
+/// The file is mapped and split into line ranges. Every range is counted first, then parsed straight into its slice
+/// of the exactly sized position, normal, texture coordinate and corner arrays, so nothing grows or is merged.
+/// The corners are finally deduplicated into shared vertices. Lines other than v, vt, vn, f, usemtl and mtllib are
+/// skipped, comments are cut from every line, MTL files are left to the caller.
+/// \param error the first malformed line with its number, or that the file is missing or empty
+/// \return false on error, the mesh is then empty
+bool LoadObjFile(const std::string &path, ObjMesh &mesh, std::string &error, ThreadPool &pool = ThreadPool::Shared());
@@ -7,7 +7,7 @@ class Box {
 public:
     Box() = default;
 
-    Box(vec3 aabb_min, vec3 aabb_max, Color3 color, bool emissive = false);
+    Box(vec3 aabb_min, vec3 aabb_max, uint32_t material);
 
     void RotateY(float angle);
 
@@ -19,7 +19,6 @@ private:
     vec3 aabb_min_{};
     vec3 aabb_max_{};
     vec3 center_{};
-    Color3 color_{};
-    bool emissive_{};
+    uint32_t material_{};
     std::vector<Quad> quads_;
 };
\ No newline at end of file
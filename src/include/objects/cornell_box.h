@@ -5,7 +5,8 @@
 
 class CornellBox {
 public:
-    CornellBox();
+    /// \param red, green, white material indices of the walls
+    CornellBox(uint32_t red, uint32_t green, uint32_t white);
 
     void PushToQuads(std::vector<Quad> &quads);
 
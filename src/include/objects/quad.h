@@ -1,17 +1,24 @@
 #pragma once
 
 #include "utils/util.h"
+#include "ray.h"
 
 class Quad {
 public:
     Quad() = default;
 
-    Quad(vec3 q, vec3 right, vec3 up, Color3 color, bool emissive = false);
+    /// \param material index into Scene::materials_
+    Quad(vec3 q, vec3 right, vec3 up, uint32_t material);
 
     void RotateY(float angle);
 
     void Translate(vec3 direction);
 
+    /// \brief Copy moved by a rigid transform
+    [[nodiscard]] Quad Transformed(const mat4x4 &m) const;
+
+    bool Intersect(const Ray &r, HitInfo &closest) const;
+
 public:
     vec3 q_{};
     vec3 right_{};
@@ -19,6 +26,5 @@ public:
     vec3 norm_{};
     vec3 w_{};
     float d_;
-    Color3 color_{};
-    bool emissive_;
+    uint32_t material_{};
 };
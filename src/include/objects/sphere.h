@@ -1,20 +1,21 @@
 #pragma once
 
 #include "utils/util.h"
+#include "ray.h"
 
 class Sphere {
 public:
     Sphere() = default;
 
-    explicit Sphere(Point3 center, float radius, Color3 color, float emissive = 0.0f) :
+    explicit Sphere(Point3 center, float radius, uint32_t material) :
             center_(center),
             radius_(radius),
-            color_(color),
-            emissive_(emissive) {}
+            material_(material) {}
+
+    bool Intersect(const Ray &r, HitInfo &closest) const;
 
 public:
     Point3 center_;
     float radius_;
-    Color3 color_;
-    float emissive_;
+    uint32_t material_;
 };
\ No newline at end of file
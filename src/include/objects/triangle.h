@@ -1,16 +1,28 @@
 #pragma once
 
 #include "objects/vertex.h"
+#include "ray.h"
 
 class Triangle {
 public:
     Triangle() = default;
 
-    Triangle(Vertex v0, Vertex v1, Vertex v2, Color3 color, bool emissive = false);
+    Triangle(Vertex v0, Vertex v1, Vertex v2, uint32_t material);
+
+    /// \brief Copy moved by a rigid transform
+    [[nodiscard]] Triangle Transformed(const mat4x4 &m) const;
+
+    bool Intersect(const Ray &r, HitInfo &closest) const;
+
+    /// \brief tangent_ and uv_scale_ from the edges and the texture coordinates
+    void InitTexCoords();
 
 public:
     Vertex vertex_[3];
     vec3 face_norm_, e1_, e2_;
-    Color3 color_;
-    bool emissive_;
+    /// dp/du of the texture coordinates, zero where they are degenerate
+    vec3 tangent_{};
+    /// sqrt(uv area / area)
+    float uv_scale_ = 0.0f;
+    uint32_t material_;
 };
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "utils/wgpu_util.h"
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+/// \brief GPU pass timings through timestamp queries plus CPU spans
+/// Compute passes get a Beginning/End timestamp pair from a query set that is resolved and read back
+/// in batches. Without the timestamp-query feature only the CPU spans are recorded.
+/// The report is written as an aggregated JSON and CSV table and as a Chrome trace (chrome://tracing).
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// \brief Records the lifetime of the span on destruction (nothing if profiling is off)
+    class Span {
+    public:
+        Span(Profiler *profiler, const char *name) : profiler_(profiler), name_(name), start_(Clock::now()) {}
+
+        Span(const Span &) = delete;
+
+        Span &operator=(const Span &) = delete;
+
+        ~Span() {
+          if (profiler_) {
+            profiler_->Record(name_, start_, Clock::now());
+          }
+        }
+
+    private:
+        Profiler *profiler_;
+        const char *name_;
+        Clock::time_point start_;
+    };
+
+    Profiler() = default;
+
+    Profiler(const Profiler &) = delete;
+
+    Profiler &operator=(const Profiler &) = delete;
+
+    /// \brief Enable GPU timings on a device created with FeatureName::TimestampQuery
+    void InitTimestamps(Device device, Queue queue);
+
+    void Release();
+
+    void SetEnabled(bool enabled) { enabled_ = enabled; }
+
+    [[nodiscard]] bool Enabled() const { return enabled_; }
+
+    /// \brief CPU span over the current scope
+    [[nodiscard]] Span Scope(const char *name) { return {enabled_ ? this : nullptr, name}; }
+
+    /// \brief CPU span with explicit bounds (e.g. from a map callback), thread safe
+    void Record(const char *name, Clock::time_point start, Clock::time_point end);
+
+    /// \brief Timestamp writes for a compute pass
+    /// \param writes receives up to two writes, assign them to ComputePassDescriptor::timestampWrites
+    /// \return number of writes to use: 0 if profiling is off, unsupported or the query set is full
+    uint32_t GpuPass(const char *name, ComputePassTimestampWrite *writes);
+
+    /// \brief Read back the timestamps of submitted passes
+    /// Must not be called while a command buffer with timed passes is still being recorded.
+    /// \param force collect even if the query set is less than half full
+    void Collect(bool force);
+
+    /// \brief Write `base`.json, `base`.csv and `base`.trace.json and clear the recorded events
+    bool WriteReport(const std::string &base);
+
+private:
+    struct Event {
+        std::string name;
+        bool gpu = false;
+        /// Microseconds since the first event
+        double start_us = 0.0;
+        double duration_us = 0.0;
+        uint32_t thread = 0;
+    };
+
+    struct PendingPass {
+        const char *name;
+        Clock::time_point cpu_time;
+    };
+
+    double SinceEpoch(Clock::time_point time);
+
+    uint32_t ThreadIndex();
+
+private:
+    /// Timed passes per query set batch
+    static const uint32_t kMaxPasses = 512;
+    bool enabled_ = false;
+    Device device_ = nullptr;
+    Queue queue_ = nullptr;
+    QuerySet query_set_ = nullptr;
+    Buffer resolve_buffer_ = nullptr;
+    Buffer map_buffer_ = nullptr;
+    std::vector<PendingPass> pending_passes_;
+
+    std::mutex mutex_;
+    bool has_epoch_ = false;
+    Clock::time_point epoch_{};
+    std::vector<Event> events_;
+    std::unordered_map<std::thread::id, uint32_t> threads_;
+};
+
+/// \brief Write the paths entering every bounce as CSV: depth, paths, survival from the previous bounce
+/// and share of all traced bounces
+bool WritePathStats(const std::string &path, const std::vector<uint64_t> &paths_per_depth);
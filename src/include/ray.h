@@ -0,0 +1,41 @@
+#pragma once
+
+#include "utils/util.h"
+
+/// Constants shared with path_tracer.wgsl
+constexpr uint32_t kNoHit = 0xffffffffu;
+constexpr float kRayMin = 0.001f;
+constexpr float kRayMax = 1e20f;
+
+/// \brief CPU-side ray (mirrors `Ray` in path_tracer.wgsl)
+struct Ray {
+    Point3 start{};
+    vec3 dir{};
+
+    Ray() = default;
+
+    Ray(Point3 start, vec3 dir) : start(start), dir(dir) {}
+
+    [[nodiscard]] Point3 At(float t) const { return start + t * dir; }
+};
+
+/// \brief CPU-side hit record (mirrors `HitInfo` in path_tracer.wgsl)
+/// shape: tri(0), quad(1), sphere(2)
+struct HitInfo {
+    float dist = kRayMax;
+    bool front_face = false;
+    uint32_t shape = kNoHit;
+    Point3 pos{};
+    vec3 norm{};
+    glm::vec2 uv{};
+    /// Direction of increasing u on the surface (not normalized), frame of normal maps
+    vec3 tangent{};
+    /// Texture coordinates per unit of surface length: sqrt(uv area / surface area), for the mip level
+    float uv_scale = 0.0f;
+    /// Index into Scene::materials_
+    uint32_t material = kNoHit;
+    /// Packed primitive reference of the hit (see bvh.h)
+    uint32_t prim = kNoHit;
+
+    [[nodiscard]] bool IsHit() const { return shape != kNoHit; }
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "render_config.h"
+#include "scene.h"
+
+/// \brief Which renderer executes a headless job
+enum class BackendType {
+    /// WebGPU compute path tracer (Renderer)
+    GPU,
+    /// Multithreaded CPU port of path_tracer.wgsl (CpuRenderer)
+    CPU,
+};
+
+/// \brief Common interface of the headless renderers
+/// A backend is initialized once, then SetShot/OnCompute are called for every shot of a job.
+class RenderBackend {
+public:
+    virtual ~RenderBackend() = default;
+
+    virtual bool OnInit(const RenderConfig &config, const SceneDesc &scene) = 0;
+
+    virtual bool SetShot(const RenderConfig &config, const SceneDesc &scene) = 0;
+
+    /// \brief Render and write frames [start_frame, end_frame]
+    virtual bool OnCompute(uint32_t start_frame, uint32_t end_frame) = 0;
+
+    virtual void OnFinish() = 0;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "utils/util.h"
+#include "sampler.h"
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+/// \brief Image format of the rendered frames
+enum class OutputFormat {
+    /// 8-bit resolved output texture
+    PNG,
+    /// Radiance HDR straight from the float accumulation buffer (or the denoised radiance)
+    HDR,
+};
+
+/// \brief Kernel layout of the GPU path tracer
+enum class KernelMode {
+    /// compute_sample traces every path of a pixel to the end
+    Megakernel,
+    /// Generate / extend / shade kernels per bounce over queues of live paths
+    Wavefront,
+};
+
+/// \brief Light selection of next event estimation
+enum class LightSampling {
+    /// Proportional to light power, O(1) per sample
+    Alias,
+    /// Light BVH descended by the importance of every subtree for the shading point
+    Tree,
+};
+
+/// \brief Random numbers of the path tracer
+enum class SamplerType {
+    /// Independent PCG stream per pixel and dispatch
+    PCG,
+    /// Owen-scrambled Sobol sequence per pixel
+    Sobol,
+    /// Sobol sequence shared by all pixels, dithered per pixel with a blue-noise tile
+    BlueNoise,
+};
+
+/// \brief Renderer settings shared by the render modes
+struct RenderConfig {
+    /// Largest RenderConfig::denoise_iterations, the last one filters with taps 512 pixels apart
+    static constexpr uint32_t kMaxDenoiseIterations = 10;
+    /// Output resolution
+    uint32_t width = 512;
+    uint32_t height = 512;
+    /// Samples per pixel for a frame
+    uint32_t spp = 1000;
+    /// Progressive mode: samples taken per dispatch (0 = the whole frame in a single dispatch)
+    uint32_t samples_per_dispatch = 16;
+    /// Progressive mode: stop accumulating a frame after this many seconds (0 = no limit)
+    float time_budget_sec = 0.0f;
+    /// Progressive mode: write a preview image every N dispatches (0 = no previews)
+    uint32_t preview_interval = 0;
+    /// Adaptive sampling: a pixel stops taking samples once the relative standard error of its mean
+    /// luminance is below this, the frame ends when every pixel has (0 = off, every pixel takes spp)
+    float adaptive_threshold = 0.0f;
+    /// Adaptive sampling: samples every pixel takes before its error is trusted
+    uint32_t adaptive_min_spp = 64;
+    /// Denoiser: edge-avoiding a-trous iterations over the resolved frame, guided by the first-hit
+    /// albedo, normal and depth (0 = off). Iteration i filters with taps 2^i pixels apart.
+    uint32_t denoise_iterations = 0;
+    /// Denoiser: tolerated relative luminance difference of two taps, halved every iteration
+    float denoise_sigma_color = 1.0f;
+    /// Denoiser: exponent of the normal similarity of two taps
+    float denoise_sigma_normal = 128.0f;
+    /// Denoiser: tolerated depth difference of two taps, in the depth extent of a pixel
+    float denoise_sigma_depth = 1.0f;
+    /// Temporal accumulation: blend every frame into the history of the previous frames, reprojected
+    /// through the first hit of the G-buffer, and keep at most this many frames of it (0 = off)
+    uint32_t temporal_frames = 0;
+    /// Tile scheduler: edge length of a square tile in pixels (rounded up to the 16x16 workgroup)
+    uint32_t tile_size = 256;
+    /// Tile scheduler: tiles recorded into one command buffer
+    uint32_t tiles_per_submit = 4;
+    /// Tile scheduler: command buffers allowed on the GPU at the same time
+    uint32_t max_in_flight = 2;
+    /// GPU kernel layout
+    KernelMode kernel = KernelMode::Megakernel;
+    /// Bounce limit of a path
+    uint32_t max_depth = 50;
+    /// Bounces traced before Russian roulette may end a path by its throughput (>= max_depth = off)
+    uint32_t rr_depth = 3;
+    /// Write the number of paths entering every bounce as `frame`_paths.csv next to the frame
+    bool path_stats = false;
+    /// Light selection for next event estimation
+    LightSampling light_sampling = LightSampling::Alias;
+    /// Random numbers of camera rays, light selection and scattering
+    SamplerType sampler = SamplerType::PCG;
+    /// Output directory, created if missing
+    std::string output_dir = ".";
+    /// Prepended to the zero padded frame number
+    std::string output_prefix;
+    /// Output image format
+    OutputFormat output_format = OutputFormat::PNG;
+    /// Frames that may be read back and encoded while the next frames render
+    uint32_t readback_ring_size = 3;
+    /// Base seed of the random streams (0 = a new random seed for every dispatch)
+    uint32_t seed = 0;
+    /// Regression check: directory with reference images named like the output (empty = no check)
+    std::string reference_dir;
+    /// Regression check: allowed RMSE of the display values against the reference
+    float max_rmse = 0.02f;
+    /// Regression check: allowed mean difference of an image block, in standard errors
+    float max_block_sigma = 4.0f;
+    /// Profiling report written after the shot as `profile`.json/.csv/.trace.json (empty = off)
+    std::string profile;
+
+    /// \brief Whether the first hit of every pixel is kept (denoiser and temporal accumulation)
+    [[nodiscard]] bool GBuffer() const { return denoise_iterations > 0 || temporal_frames > 0; }
+
+    /// \brief Output file of `name` without extension
+    [[nodiscard]] std::filesystem::path OutputBase(const std::string &name) const {
+      return std::filesystem::path(output_dir) / (output_prefix + name);
+    }
+
+    /// \brief Output file of `name` with the extension of output_format
+    [[nodiscard]] std::filesystem::path OutputPath(const std::string &name) const {
+      return OutputBase(name).string() + (output_format == OutputFormat::HDR ? ".hdr" : ".png");
+    }
+
+    /// \brief Zero padded file name of a frame
+    static std::string FrameName(uint32_t frame) {
+      std::ostringstream sout;
+      sout << std::setw(3) << std::setfill('0') << frame;
+      return sout.str();
+    }
+
+    /// \brief Seed of one progressive dispatch
+    /// With a fixed `seed` every dispatch of every frame gets a reproducible, decorrelated seed.
+    [[nodiscard]] uint32_t DispatchSeed(uint32_t frame, uint32_t dispatch) const {
+      if (seed == 0) {
+        return RandSeed();
+      }
+      return SamplerTables::Hash(SamplerTables::Hash(SamplerTables::Hash(seed) ^ frame) ^ dispatch);
+    }
+
+    /// \brief Scrambling of the quasi-random sequence of a frame (CameraParam::sampler_seed)
+    /// Unlike DispatchSeed it is the same for every dispatch, later dispatches continue the sequence.
+    [[nodiscard]] uint32_t SamplerSeed(uint32_t frame) const {
+      if (seed == 0) {
+        return RandSeed();
+      }
+      return SamplerTables::Hash(SamplerTables::Hash(seed) ^ frame) ^ 0x9e3779b9u;
+    }
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "render_backend.h"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/// \brief One shot of a batch: render settings, scene and frame range
+struct RenderShot {
+    std::string name;
+    RenderConfig config;
+    SceneDesc scene;
+    uint32_t start_frame = 1;
+    uint32_t end_frame = 1;
+};
+
+/// \brief What main() has to do, parsed from the command line and an optional job file
+struct RenderJob {
+    bool has_window = false;
+    bool show_help = false;
+    /// Headless renderer (command line only)
+    BackendType backend = BackendType::GPU;
+    /// Rendered in order by a single backend
+    std::vector<RenderShot> shots;
+};
+
+/// \brief Parse the command line
+/// Options are the job file keys with dashes, e.g. `--samples-per-dispatch 8` sets `samples_per_dispatch`.
+/// With `--job`, the other options become the defaults of every shot in the file.
+/// \return false with `error` set on invalid input
+bool ParseCommandLine(int argc, char *argv[], RenderJob &job, std::string &error);
+
+/// \brief Load a job file
+/// The file is a TOML subset: `key = value` lines before the first `[[shot]]` override `defaults`,
+/// each `[[shot]]` table starts a new shot. Values are numbers, booleans, "strings" or [arrays].
+/// \return false with `error` set on invalid input
+bool LoadJobFile(const std::filesystem::path &path, const RenderShot &defaults, std::vector<RenderShot> &shots, std::string &error);
+
+void PrintUsage();
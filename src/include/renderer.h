@@ -5,18 +5,29 @@
 #include "utils/wgpu_util.h"
 #include "camera.h"
 #include "scene.h"
-
-class Renderer {
+#include "render_config.h"
+#include "render_backend.h"
+#include "frame_writer.h"
+#include "profiler.h"
+#include "wavefront.h"
+#include "denoiser.h"
+#include <functional>
+
+class Renderer : public RenderBackend {
 public:
-    bool OnInit(bool hasWindow);
+    bool OnInit(bool hasWindow, const RenderConfig &config = {}, const SceneDesc &scene = {});
+
+    bool OnInit(const RenderConfig &config, const SceneDesc &scene) override;
 
-    bool OnCompute(uint32_t start_frame, uint32_t end_frame);
+    bool SetShot(const RenderConfig &config, const SceneDesc &scene) override;
+
+    bool OnCompute(uint32_t start_frame, uint32_t end_frame) override;
 
     bool OnRender(uint32_t frame);
 
     void OnFrame();
 
-    void OnFinish();
+    void OnFinish() override;
 
     bool IsRunning();
 
@@ -39,6 +50,40 @@ private:
 
     void InitComputePipeline();
 
+    bool InitFrameResources();
+
+    void ReleaseFrameResources();
+
+    bool InitTiles(const Limits &limits);
+
+    void InitTileBuffer();
+
+    void InitAccumulationBuffer();
+
+    void InitPathStatsBuffer();
+
+    void InitTileSummaryBuffer();
+
+    [[nodiscard]] uint64_t PathStatsSize() const { return 2 * sizeof(uint32_t) * (uint64_t) config_.max_depth; }
+
+    void InitComputeBindGroupLayout();
+
+    void InitComputeBindGroup();
+
+    void InitSamplerTables();
+
+    void DispatchTiles(ComputePipeline &pipeline, const char *pass_name, const std::vector<uint32_t> &tiles);
+
+    void DispatchWavefront(uint32_t sample_count);
+
+    void Resolve(bool final);
+
+    void UpdateAdaptive();
+
+    void ReportAdaptive() const;
+
+    void WriteOutput(const std::string &name);
+
     void InitBuffers();
 
     void InitBindGroup();
@@ -50,10 +95,11 @@ private:
     void UpdateGui(RenderPassEncoder render_pass);
 
 private:
-    static const uint32_t WIDTH = 512;
-    static const uint32_t HEIGHT = 512;
     static const uint32_t MAX_FRAME = 1;
-    static const uint32_t SPP = 1000;
+    /// Workgroup size of the compute entry points
+    static const uint32_t WORKGROUP_SIZE = 16;
+    RenderConfig config_{};
+    SceneDesc scene_desc_{};
     Camera camera_{};
     Scene scene_{};
     bool hasWindow_ = false;
@@ -65,6 +111,8 @@ private:
     Device device_ = nullptr;
     Surface surface_ = nullptr;
     Queue queue_ = nullptr;
+    /// Limits the device was created with
+    Limits device_limits_{};
 
     /// Swap Chain
     SwapChain swap_chain_ = nullptr;
@@ -77,14 +125,17 @@ private:
     /// Texture
     TextureFormat swap_chain_format_ = TextureFormat::Undefined;
     Texture texture_ = nullptr;
-    Extent3D texture_size_ = {WIDTH, HEIGHT, 1};
+    Extent3D texture_size_ = {512, 512, 1};
     TextureView output_texture_view_ = nullptr;
 
     /// Pipeline
     BindGroupLayout bind_group_layout_ = nullptr;
     PipelineLayout pipeline_layout_ = nullptr;
     RenderPipeline render_pipeline_ = nullptr;
+    PipelineLayout compute_pipeline_layout_ = nullptr;
     ComputePipeline compute_pipeline_ = nullptr;
+    ComputePipeline resolve_pipeline_ = nullptr;
+    ComputePipeline adaptive_pipeline_ = nullptr;
 
     /// Uniform
     struct RenderParam {
@@ -111,4 +162,69 @@ private:
     Buffer index_buffer_ = nullptr;
     Buffer uniform_buffer_ = nullptr;
     Buffer map_buffer_ = nullptr;
+
+    /// Compute
+    BindGroupLayout compute_bind_group_layout_ = nullptr;
+    BindGroup compute_bind_group_ = nullptr;
+    /// Progressive accumulation (rgb = radiance sum, w = sample count), kept across dispatches
+    /// Tile-major: every tile owns accum_tile_stride_ bytes, bound with a dynamic offset. A tile holds
+    /// the accumulation plane, the luminance moments plane and a TileSummary (adaptive sampling).
+    Buffer accum_buffer_ = nullptr;
+    uint64_t accum_buffer_size_ = 0;
+    uint64_t accum_tile_stride_ = 0;
+    /// Paths entering every bounce (RenderConfig::path_stats), cleared per frame
+    Buffer path_stats_buffer_ = nullptr;
+    /// Sampler lookup tables (group 3), kept for the lifetime of the Renderer
+    BindGroupLayout sampler_bind_group_layout_ = nullptr;
+    BindGroup sampler_bind_group_ = nullptr;
+    Buffer sobol_buffer_ = nullptr;
+    Texture blue_noise_texture_ = nullptr;
+    TextureView blue_noise_view_ = nullptr;
+
+    /// Tiles
+    struct TileParam {
+        uint32_t origin[2]{};
+        uint32_t size[2]{};
+        uint32_t stride{};
+        uint32_t pad[3]{};
+    };
+
+    /// Written by adaptive_update after the two planes of a tile
+    struct TileSummary {
+        float active_pixels{};
+        float max_error{};
+        float mean_spp{};
+        float pad{};
+    };
+
+    std::vector<TileParam> tiles_;
+    /// Indices into tiles_: every tile, and the tiles still taking samples in the current frame
+    std::vector<uint32_t> all_tiles_;
+    std::vector<uint32_t> active_tiles_;
+    /// Last summary of every tile, read back by UpdateAdaptive
+    std::vector<TileSummary> tile_summaries_;
+    Buffer tile_summary_buffer_ = nullptr;
+    uint32_t tile_size_ = 0;
+    /// TileParam entries are padded to minUniformBufferOffsetAlignment
+    uint32_t tile_param_stride_ = 0;
+    Buffer tile_param_buffer_ = nullptr;
+    SubmissionQueue submissions_;
+
+    /// Records the commands of one tile into the shared compute pass
+    using TileRecorder = std::function<void(ComputePassEncoder &, const TileParam &, const std::array<uint32_t, 2> &)>;
+
+    void RecordTiles(const char *pass_name, const std::vector<uint32_t> &tiles, const TileRecorder &record);
+
+    /// Per-bounce kernels of KernelMode::Wavefront, created with the first wavefront shot
+    WavefrontIntegrator wavefront_;
+
+    /// Temporal accumulation and a-trous filter of the resolved frame (RenderConfig::temporal_frames,
+    /// denoise_iterations), owns the G-buffer
+    Denoiser denoiser_;
+
+    /// GPU timestamps and CPU spans (RenderConfig::profile), outlives frame_writer_
+    Profiler profiler_;
+
+    /// Readback ring and image encoders
+    FrameWriter frame_writer_;
 };
\ No newline at end of file
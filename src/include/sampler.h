@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/// \brief Lookup tables of the quasi-random samplers (RenderConfig::sampler)
+/// Built once per process: the Renderer uploads them once as group 3 of path_tracer.wgsl and the
+/// CPU backend samples from the same tables, so that both backends draw the same numbers.
+///
+/// Sobol: generator matrices of 4 Sobol dimensions (Joe & Kuo direction numbers). rand() draws
+/// dimension d of a sample from 4D group d / 4, every group shuffles the sample index and every
+/// dimension is Owen-scrambled with its own hash (Burley, Practical Hash-based Owen Scrambling),
+/// so the 4 matrices are padded to any number of dimensions.
+/// Blue noise: a tile of blue-noise ranks (void and cluster), used to toroidally shift one Sobol
+/// sequence shared by all pixels, which spreads the error of neighbouring pixels as blue noise.
+class SamplerTables {
+public:
+    /// Sobol dimensions with a generator matrix, the size of a dimension group
+    static constexpr uint32_t kSobolDimensions = 4;
+    static constexpr uint32_t kSobolBits = 32;
+    /// Edge length of the blue-noise tile
+    static constexpr uint32_t kBlueNoiseSize = 64;
+
+    /// \brief Tables shared by every renderer of the process
+    static const SamplerTables &Shared();
+
+    /// \brief Dimension `dim` of sample `index` of pixel (x, y) (rand() of path_tracer.wgsl)
+    /// \param sampler CameraParam::sampler, Sobol (1) or blue noise (2)
+    /// \param seed CameraParam::sampler_seed, constant over the samples of a frame
+    [[nodiscard]] float Sample(uint32_t sampler, uint32_t x, uint32_t y, uint32_t index, uint32_t dim, uint32_t seed) const;
+
+    /// \brief sobol_matrices[j][d] (array<vec4u, 32>): bit j of the generator matrix of dimension d
+    [[nodiscard]] const std::array<uint32_t, kSobolBits * kSobolDimensions> &SobolMatrices() const { return sobol_; }
+
+    /// \brief Row-major kBlueNoiseSize^2 tile, rank r is stored as (r + 0.5) / kBlueNoiseSize^2
+    [[nodiscard]] const std::vector<float> &BlueNoise() const { return blue_noise_; }
+
+    /// \brief Integer hash (hash_u32 of path_tracer.wgsl)
+    static uint32_t Hash(uint32_t x) {
+      x ^= x >> 16;
+      x *= 0x7feb352du;
+      x ^= x >> 15;
+      x *= 0x846ca68bu;
+      x ^= x >> 16;
+      return x;
+    }
+
+private:
+    SamplerTables();
+
+    void BuildSobolMatrices();
+
+    void BuildBlueNoise();
+
+    /// \brief Owen-scrambled Sobol bits of dimension `dim` (owen_sobol of path_tracer.wgsl)
+    [[nodiscard]] uint32_t OwenSobol(uint32_t index, uint32_t dim, uint32_t seed) const;
+
+private:
+    std::array<uint32_t, kSobolBits * kSobolDimensions> sobol_{};
+    std::vector<float> blue_noise_;
+};
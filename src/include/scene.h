@@ -4,12 +4,57 @@
 #include "objects/triangle.h"
 #include "objects/quad.h"
 #include "objects/sphere.h"
+#include "bvh.h"
+#include "light_sampler.h"
+#include "animation.h"
+#include "material.h"
+#include "texture.h"
+#include "scene_cache.h"
+#include "compact_geometry.h"
+#include <string>
+
+/// \brief Scene contents: the Cornell box plus an optional OBJ mesh
+struct SceneDesc {
+    /// OBJ file added to the Cornell box (empty = Cornell box only)
+    std::string obj_file;
+    /// Translation of the mesh instance
+    vec3 translation = vec3(0.0f);
+    /// Mesh color, for faces without an MTL material
+    Color3 color = Color3(.73, .73, .73);
+    /// Largest layer size of the texture array (power of two), bigger maps are downsampled to it
+    uint32_t texture_size = 1024;
+    /// Load the mesh from its scene cache (SceneCache::Path, written by scene_compile) when that is up to date
+    bool scene_cache = true;
+    /// Upload quads and triangles in the compact layout (CompactGeometry): mesh positions snap to a 16-bit grid
+    /// over its bounds and its normals to 32-bit octahedral ones, the CPU backend renders the snapped mesh too.
+    /// The mesh is then loaded from the OBJ file, its scene cache holds it before snapping.
+    bool compact_geometry = false;
+    /// Material overrides by object name (Scene::HasObject), the light stays emissive
+    std::map<std::string, Material> materials;
+    /// Further instances of the mesh, sharing its triangles and bottom-level BVH
+    /// Posed like animated objects, relative to the coordinates of the OBJ file
+    std::vector<ObjectPose> mesh_instances;
+    /// Camera and object keyframes
+    AnimationDesc animation;
+
+    bool operator==(const SceneDesc &other) const {
+      return obj_file == other.obj_file && translation == other.translation && color == other.color &&
+             texture_size == other.texture_size && scene_cache == other.scene_cache &&
+             compact_geometry == other.compact_geometry && materials == other.materials && mesh_instances == other.mesh_instances && animation == other.animation;
+    }
+
+    bool operator!=(const SceneDesc &other) const { return !(*this == other); }
+};
 
 class Scene {
 public:
     Scene() = default;
 
-    explicit Scene(Device &device);
+    /// \brief CPU side only: primitives and BVH
+    explicit Scene(const SceneDesc &desc);
+
+    /// \brief CPU side plus the GPU buffers and bind group
+    explicit Scene(Device &device, const SceneDesc &desc = {});
 
     struct Objects {
         BindGroupLayout bind_group_layout_;
@@ -20,10 +65,103 @@ public:
 
     void Release();
 
+    void Reload(Device &device, const SceneDesc &desc);
+
+    [[nodiscard]] const SceneDesc &Desc() const { return desc_; }
+
+    [[nodiscard]] BVHPrimitives Primitives() const { return {lights_, quads_, spheres_, tris_, instances_, blas_}; }
+
+    /// \brief Whether objects named `name` can be animated: light, tall_box, short_box or mesh
+    static bool HasObject(const std::string &name);
+
+    /// \brief Pose the animated objects at time t
+    /// Only objects whose pose changed since the last Animate are transformed, their BVH leaves are
+    /// refitted and the changed buffer ranges are recorded for WriteDirty.
+    /// \param t animation time in frames
+    /// \return whether anything moved
+    bool Animate(float t);
+
+    /// \brief Write the mesh as a scene cache: its triangles, materials, bottom-level BVH and texture array
+    /// \return false without a mesh, with compact_geometry or if the file cannot be written
+    bool WriteCache(const std::string &path) const;
+
+    /// \brief Whether the quad and triangle buffers use the compact layout (SceneDesc::compact_geometry)
+    [[nodiscard]] bool CompactLayout() const { return desc_.compact_geometry; }
+
+    /// \brief Upload the ranges changed by the last Animate
+    /// \return bytes written
+    uint64_t WriteDirty(Queue &queue);
+
 private:
-    void LoadObj(const char *file_path, Color3 color, vec3 translation = vec3(0, 0, 0), bool emissive = false);
+    /// \brief Primitives of a named object
+    struct SceneObject {
+        std::string name;
+        /// World space Light or Quad range, or a single Instance
+        PrimType type = PrimType::Quad;
+        uint32_t first = 0;
+        uint32_t count = 0;
+        /// Rotation center: center of the bounds at rest
+        vec3 pivot{};
+        /// Pose of the last Animate
+        ObjectPose pose{};
+        /// At rest, copied only for animated objects
+        std::vector<Quad> rest_quads;
+        mat4x4 rest_transform = mat4x4(1.0f);
+    };
+
+    /// \brief Object space primitives shared by instances, traced through one bottom-level BVH
+    struct Blob {
+        /// Quad or Triangle
+        PrimType type;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    /// \brief Element range of a storage buffer
+    struct BufferRange {
+        uint32_t first;
+        uint32_t count;
+    };
+
+    void AddObject(const std::string &name, PrimType type, uint32_t first, uint32_t count);
+
+    /// \return blob index
+    uint32_t AddBlob(PrimType type, uint32_t first, uint32_t count);
+
+    /// \param name animatable name, empty for none
+    /// A named instance takes the material override of its name (BVHInstance::material).
+    void AddInstance(const std::string &name, uint32_t blob, const mat4x4 &object_to_world);
+
+    /// \return index into materials_
+    uint32_t AddMaterial(const Material &material);
+
+    [[nodiscard]] AABB BlobBounds(uint32_t blob) const;
+
+    void MoveObject(SceneObject &object, const ObjectPose &pose, std::vector<uint32_t> &moved);
 
-    void LoadVertices(const char *file_path, std::vector<Vertex> &vertices);
+    void InitObjects();
+
+    void BuildBVH();
+
+    void BuildLightSampler();
+
+    void ReleaseBuffers();
+
+    /// \brief Mesh triangles, materials, bottom-level BVH and textures from the scene cache of desc_.obj_file
+    /// The BVH is stored for the blob added next. The cache stays mapped for InitBuffers.
+    /// \return false if there is no up to date cache
+    bool LoadCache();
+
+    /// \brief Element sizes of the scene cache sections
+    [[nodiscard]] SceneCache::Sections CacheLayout() const;
+
+    /// \brief Triangles of an OBJ file, its MTL materials are added to materials_ and their maps to textures_
+    /// \param material of faces without an MTL material
+    /// \return false if the file cannot be parsed, nothing is added then
+    bool LoadObj(const char *file_path, uint32_t material, vec3 translation = vec3(0, 0, 0));
+
+    /// \brief Snap the mesh to the compact layout, its BVH is then built over the snapped triangles
+    void SnapMesh();
 
     void InitBindGroupLayout(Device &device);
 
@@ -33,8 +171,41 @@ private:
 
     Buffer CreateQuadBuffer(Device &device, std::vector<Quad> &quads, WGPUBufferUsageFlags usage_flags, bool mapped_at_creation) const;
 
+    /// \brief Quad buffer record size of the layout in use
+    [[nodiscard]] uint32_t QuadStride() const;
+
+    /// \brief Triangle buffer size of the layout in use, at least one record
+    [[nodiscard]] uint64_t TriangleBufferSize() const;
+
+    /// \brief Quad buffer record of the layout in use
+    void WriteQuadRecord(const Quad &quad, float *quad_data) const;
+
+    Buffer CreateLightBuffer(Device &device);
+
+    Buffer CreateLightNodeBuffer(Device &device);
+
+    static void WriteQuad(const Quad &quad, float *quad_data);
+
+    static void WriteTriangle(const Triangle &tri, float *tri_data);
+
+    static Triangle ReadTriangle(const float *tri_data);
+
+    void WriteLights(float *light_data) const;
+
+    void WriteInstance(const BVHInstance &instance, float *instance_data) const;
+
+    Buffer CreateInstanceBuffer(Device &device);
+
     Buffer CreateSphereBuffer(Device &device, size_t num, WGPUBufferUsageFlags usage_flags, bool mapped_at_creation);
 
+    Buffer CreateBVHNodeBuffer(Device &device);
+
+    Buffer CreateBVHPrimBuffer(Device &device);
+
+    Buffer CreateMaterialBuffer(Device &device);
+
+    void CreateTextureArray(Device &device);
+
     void InitBindGroup(Device &device);
 
 public:
@@ -42,12 +213,64 @@ public:
     std::vector<Quad> lights_;
     std::vector<Quad> quads_;
     std::vector<Sphere> spheres_;
-    uint32_t tri_stride_ = 20 * 4;
+    /// Placements of the blobs, referenced from the top-level BVH
+    std::vector<BVHInstance> instances_;
+    /// Material table, indexed by the material of every primitive
+    std::vector<Material> materials_;
+    /// Texture maps of the materials
+    TextureArray textures_;
+    uint32_t tri_stride_ = 32 * 4;
     uint32_t quad_stride_ = 24 * 4;
+    /// Compact layouts (CompactGeometry), the triangle records follow the grid of the mesh
+    uint32_t compact_tri_stride_ = CompactGeometry::kTriangleWords * 4;
+    uint32_t compact_quad_stride_ = CompactGeometry::kQuadWords * 4;
+    uint32_t compact_header_size_ = CompactGeometry::kHeaderWords * 4;
+    /// Quad + alias table entry, sphere lights follow the quads of lights_
+    uint32_t light_stride_ = 28 * 4;
     uint32_t sphere_stride_ = 8 * 4;
+    uint32_t bvh_node_stride_ = sizeof(BVHNode);
+    uint32_t light_node_stride_ = sizeof(LightNode);
+    uint32_t material_stride_ = sizeof(Material);
+    /// Two 3x4 transforms + material + bottom-level root
+    uint32_t instance_stride_ = 28 * 4;
+    /// Top-level BVH over the world space primitives and the instances
+    BVH bvh_;
+    /// Bottom-level BVH of every blob, stored after the top-level BVH in the node and prim buffers
+    std::vector<BVH> blas_;
+    /// Light selection for next event estimation, shared with the CPU backend
+    LightSampler light_sampler_;
     Buffer tri_buffer_ = nullptr;
     Buffer quad_buffer_ = nullptr;
     Buffer light_buffer_ = nullptr;
     Buffer sphere_buffer_ = nullptr;
+    Buffer bvh_node_buffer_ = nullptr;
+    Buffer bvh_prim_buffer_ = nullptr;
+    Buffer light_node_buffer_ = nullptr;
+    Buffer instance_buffer_ = nullptr;
+    Buffer material_buffer_ = nullptr;
+    Texture texture_array_ = nullptr;
+    TextureView texture_array_view_ = nullptr;
+    Sampler texture_sampler_ = nullptr;
     Objects objects_ = {};
+
+private:
+    SceneDesc desc_;
+    std::vector<SceneObject> scene_objects_;
+    std::vector<Blob> blobs_;
+    /// Materials of the mesh: its SceneDesc::color material and the MTL materials after it
+    uint32_t mesh_materials_ = 0;
+    /// Mapped scene cache, released once the buffers are uploaded
+    SceneCache cache_;
+    /// Grid of the snapped mesh
+    CompactGeometry compact_;
+    /// Quads before this index are in world space, the rest belong to blobs
+    uint32_t world_quads_ = 0;
+    /// Offsets of every bottom-level BVH in the node and prim buffers, the last entry is the buffer length
+    std::vector<uint32_t> blas_node_offsets_;
+    std::vector<uint32_t> blas_prim_offsets_;
+    /// Changed by the last Animate
+    std::vector<BufferRange> dirty_quads_;
+    std::vector<BufferRange> dirty_instances_;
+    std::vector<BufferRange> dirty_nodes_;
+    bool dirty_lights_ = false;
 };
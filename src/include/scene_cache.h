@@ -0,0 +1,72 @@
+#pragma once
+
+#include "mapped_file.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// \brief Compiled OBJ mesh (tools/scene_compile): MTL materials, triangles, bottom-level BVH and texture mip chains
+/// stored in their GPU layouts
+/// The file is memory-mapped and its sections are copied or uploaded as they are, nothing is parsed or built.
+/// It is tied to the content hash of the OBJ file and of the MTL files and maps it was compiled from, and to the
+/// element sizes of its sections: a cache of an edited mesh or an older layout is stale and ignored.
+class SceneCache {
+public:
+    /// Bump whenever the contents of a section change without changing its element size
+    static constexpr uint32_t kVersion = 1;
+
+    /// \brief Elements of a section
+    struct Span {
+        const void *data = nullptr;
+        uint32_t count = 0;
+        /// Element size
+        uint32_t stride = 0;
+    };
+
+    struct Sections {
+        /// MTL materials, the mesh material of SceneDesc::color is not cached
+        Span materials;
+        /// Scene::WriteTriangle records
+        Span triangles;
+        /// Bottom-level BVH of the mesh
+        Span bvh_nodes;
+        Span bvh_prims;
+        /// Every mip level of every layer of the texture array, RGBA8 texels
+        Span textures;
+    };
+
+    /// \brief Cache file of an OBJ file
+    static std::string Path(const std::string &obj_file) { return obj_file + ".scene"; }
+
+    /// \brief Write the sections of a compiled mesh, the file is replaced once complete
+    /// \param texture_size SceneDesc::texture_size the texture array was built with
+    /// \param dependencies maps besides the OBJ file, hashed into the cache with the MTL files of the OBJ file
+    static bool Write(const std::string &path, const std::string &obj_file, uint32_t texture_size, uint32_t layer_size,
+                      uint32_t mip_levels, const Sections &sections, const std::vector<std::string> &dependencies);
+
+    /// \brief Map the cache of obj_file if it is up to date
+    /// \param layout element size of every section the reader expects, data and counts are ignored
+    /// \return false if there is no cache, it is stale or broken
+    bool Open(const std::string &path, const std::string &obj_file, uint32_t texture_size, const Sections &layout);
+
+    void Close();
+
+    [[nodiscard]] bool IsOpen() const { return file_.Data() != nullptr; }
+
+    /// \brief Sections of the mapped file
+    [[nodiscard]] const Sections &Get() const { return sections_; }
+
+    /// \brief Layer size and mip levels of the texture array
+    [[nodiscard]] uint32_t LayerSize() const { return layer_size_; }
+
+    [[nodiscard]] uint32_t MipLevels() const { return mip_levels_; }
+
+    /// \brief FNV-1a over 8-byte words
+    static uint64_t Hash(const uint8_t *data, uint64_t size);
+
+private:
+    MappedFile file_;
+    Sections sections_{};
+    uint32_t layer_size_ = 0;
+    uint32_t mip_levels_ = 0;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "utils/util.h"
+#include <string>
+#include <vector>
+
+/// \brief Texture maps of the scene, packed as the layers of one 2D texture array with precomputed mip chains
+/// (mirrors `textures` and `texture_sampler` in path_tracer.wgsl)
+/// A single binding holds every map, materials refer to their maps by layer. All layers share the size of the
+/// largest map, smaller maps are resampled up to it.
+class TextureArray {
+public:
+    /// \brief Queue an image file as a new layer, a file already loaded returns its layer
+    /// \param srgb color map: decoded by the shader after filtering, the mips are averaged in linear space
+    /// \return layer, kNoHit if the file cannot be read
+    uint32_t Load(const std::string &path, bool srgb);
+
+    /// \brief Number of channels of an image file, 0 if it cannot be read
+    static int Channels(const std::string &path);
+
+    /// \brief Resample the loaded images to the common layer size and build their mip chains
+    /// \param max_size largest layer size, rounded down to a power of two
+    void Build(uint32_t max_size);
+
+    /// \brief Adopt the mip chains of layers built earlier (scene cache)
+    /// \param texels every mip level of every layer in order, RGBA8
+    void Assign(uint32_t size, uint32_t layers, uint32_t mip_levels, const uint8_t *texels);
+
+    void Clear();
+
+    /// \brief Width and height of the layers, 0 before Build or without any map
+    [[nodiscard]] uint32_t Size() const { return size_; }
+
+    [[nodiscard]] uint32_t Layers() const { return (uint32_t) layers_.size(); }
+
+    [[nodiscard]] uint32_t MipLevels() const { return layers_.empty() ? 0 : (uint32_t) layers_[0].mips.size(); }
+
+    /// \brief Image file of a layer, empty for assigned layers
+    [[nodiscard]] const std::string &Path(uint32_t layer) const { return layers_[layer].path; }
+
+    /// \brief RGBA8 texels of one mip level, Size() >> mip texels square
+    [[nodiscard]] const std::vector<uint8_t> &Level(uint32_t layer, uint32_t mip) const { return layers_[layer].mips[mip]; }
+
+    /// \brief textureSampleLevel with the trilinear repeating sampler of the shader
+    [[nodiscard]] vec4 Sample(uint32_t layer, glm::vec2 uv, float lod) const;
+
+private:
+    struct Layer {
+        std::string path;
+        bool srgb = false;
+        /// Loaded image until Build, then the levels of the mip chain
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> texels;
+        std::vector<std::vector<uint8_t>> mips;
+    };
+
+    [[nodiscard]] vec4 Bilinear(uint32_t layer, uint32_t mip, glm::vec2 uv) const;
+
+    std::vector<Layer> layers_;
+    uint32_t size_ = 0;
+};
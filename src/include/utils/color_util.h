@@ -8,3 +8,12 @@ static const auto COL_BLUE = Color3(.1, .2, .5);
 static const auto COL_WHITE = Color3(.73, .73, .73);
 static const auto COL_LIGHT = Color3(15, 15, 15);
 static const auto COL_ZERO = Color3(0, 0, 0);
+
+/// sRGB transfer function of 8-bit color textures (srgb_to_linear in path_tracer.wgsl)
+inline float SRGBToLinear(float c) {
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline float LinearToSRGB(float c) {
+  return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
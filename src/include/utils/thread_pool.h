@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \brief Work-stealing thread pool
+/// Each worker owns a deque: it pops its own tasks LIFO (good locality for recursive splits)
+/// and steals from the other workers FIFO (takes the largest, oldest subtrees).
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t num_threads = std::max(1u, std::thread::hardware_concurrency())) {
+      queues_.reserve(num_threads);
+      for (uint32_t i = 0; i < num_threads; ++i) {
+        queues_.emplace_back(std::make_unique<WorkQueue>());
+      }
+      workers_.reserve(num_threads);
+      for (uint32_t i = 0; i < num_threads; ++i) {
+        workers_.emplace_back([this, i] { WorkerLoop(i); });
+      }
+    }
+
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+      }
+      sleep_cv_.notify_all();
+      for (auto &worker: workers_) {
+        worker.join();
+      }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /// \brief Process-wide pool shared by the BVH builder, image encoders and the CPU backend
+    static ThreadPool &Shared() {
+      static ThreadPool pool;
+      return pool;
+    }
+
+    [[nodiscard]] uint32_t Size() const { return (uint32_t) workers_.size(); }
+
+    /// \brief Enqueue a task (on the calling worker's own deque when called from inside the pool)
+    /// \param group TaskGroup the task belongs to, only its own tasks are run while it waits
+    void Submit(std::function<void()> task, const void *group = nullptr) {
+      auto idx = WorkerIndex() >= 0 ? (uint32_t) WorkerIndex() : next_queue_++ % (uint32_t) queues_.size();
+      {
+        std::lock_guard<std::mutex> lock(queues_[idx]->mutex);
+        queues_[idx]->tasks.push_back({std::move(task), group});
+      }
+      {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        ++queued_;
+      }
+      sleep_cv_.notify_one();
+    }
+
+    /// \brief Run one pending task of `group` on the calling thread (used to help while waiting)
+    /// Tasks of other groups are left alone, a waiting BVH build must not pick up a long image encode.
+    /// \return false if no task of the group was available
+    bool RunPendingTask(const void *group) {
+      std::function<void()> task;
+      auto self = WorkerIndex();
+      if (!Pop(self >= 0 ? (uint32_t) self : 0, task, group)) {
+        return false;
+      }
+      task();
+      return true;
+    }
+
+private:
+    struct Task {
+        std::function<void()> run;
+        const void *group = nullptr;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct WorkerSlot {
+        const ThreadPool *owner = nullptr;
+        int index = -1;
+    };
+
+    static WorkerSlot &CurrentWorker() {
+      static thread_local WorkerSlot slot;
+      return slot;
+    }
+
+    /// \return index of the calling worker in this pool, or -1 for external threads
+    [[nodiscard]] int WorkerIndex() const {
+      const auto &slot = CurrentWorker();
+      return slot.owner == this ? slot.index : -1;
+    }
+
+    /// \brief Pop from the own queue (back), otherwise steal from the others (front)
+    /// \param group only tasks of this group, nullptr for any task
+    bool Pop(uint32_t self, std::function<void()> &task, const void *group = nullptr) {
+      auto matches = [group](const Task &t) { return group == nullptr || t.group == group; };
+      {
+        auto &queue = *queues_[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto it = std::find_if(queue.tasks.rbegin(), queue.tasks.rend(), matches);
+        if (it != queue.tasks.rend()) {
+          task = std::move(it->run);
+          queue.tasks.erase(std::next(it).base());
+          --queued_;
+          return true;
+        }
+      }
+      for (size_t i = 1; i < queues_.size(); ++i) {
+        auto &victim = *queues_[(self + i) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        auto it = std::find_if(victim.tasks.begin(), victim.tasks.end(), matches);
+        if (it != victim.tasks.end()) {
+          task = std::move(it->run);
+          victim.tasks.erase(it);
+          --queued_;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void WorkerLoop(uint32_t index) {
+      CurrentWorker() = {this, (int) index};
+      while (true) {
+        std::function<void()> task;
+        if (Pop(index, task)) {
+          task();
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        sleep_cv_.wait(lock, [this] { return stop_ || queued_ > 0; });
+        if (stop_ && queued_ == 0) {
+          return;
+        }
+      }
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<uint32_t> next_queue_{0};
+    std::atomic<int64_t> queued_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+    bool stop_ = false;
+};
+
+/// \brief Fork/join helper on top of ThreadPool
+/// Wait() executes pending tasks of the group instead of blocking, so nested groups inside workers cannot deadlock.
+/// Tasks of the group that were already stolen finish on their thieves, nested groups always end in leaf tasks.
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool &pool) : pool_(pool) {}
+
+    ~TaskGroup() { Wait(); }
+
+    void Run(std::function<void()> task) {
+      ++pending_;
+      pool_.Submit([this, task = std::move(task)] {
+          task();
+          --pending_;
+      }, this);
+    }
+
+    void Wait() {
+      while (pending_ > 0) {
+        if (!pool_.RunPendingTask(this)) {
+          std::this_thread::yield();
+        }
+      }
+    }
+
+private:
+    ThreadPool &pool_;
+    std::atomic<uint32_t> pending_{0};
+};
+
+/// \brief Split [0, count) into chunks of at least `grain` items and run them on the pool
+/// \param func called with [begin, end) of each chunk
+inline void ParallelFor(ThreadPool &pool, uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)> &func) {
+  if (count == 0) {
+    return;
+  }
+  auto num_chunks = std::min((count + grain - 1) / std::max(grain, 1u), pool.Size() * 4);
+  if (num_chunks <= 1) {
+    func(0, count);
+    return;
+  }
+  auto chunk_size = (count + num_chunks - 1) / num_chunks;
+  TaskGroup group(pool);
+  for (uint32_t begin = chunk_size; begin < count; begin += chunk_size) {
+    auto end = std::min(begin + chunk_size, count);
+    group.Run([&func, begin, end] { func(begin, end); });
+  }
+  func(0, std::min(chunk_size, count));
+  group.Wait();
+}
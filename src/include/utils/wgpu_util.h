@@ -28,6 +28,7 @@
 
 #include <iostream>
 #include <cassert>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
@@ -70,6 +71,90 @@ void inline OnQueueWorkDone(QueueWorkDoneStatus status) {
   Print(PrintInfoType::WebGPU, "Queued work finished with status: ", status);
 }
 
+/// \brief Let the backend make progress and fire pending callbacks (work done, buffer mapping)
+/// \param device WebGPU device
+/// \param queue WebGPU queue
+void inline PollDevice(Device device, Queue queue) {
+#ifdef WEBGPU_BACKEND_WGPU
+  (void) device;
+  wgpuQueueSubmit(queue, 0, nullptr);
+#else
+  (void) queue;
+  device.tick();
+#endif
+}
+
+/// \brief Block until the work submitted to the queue so far has finished
+/// \param device WebGPU device
+/// \param queue WebGPU queue
+void inline WaitForSubmittedWork(Device device, Queue queue) {
+  bool done = false;
+  auto callback_handle = queue.onSubmittedWorkDone([&done](QueueWorkDoneStatus status) {
+      if (status != QueueWorkDoneStatus::Success) {
+        OnQueueWorkDone(status);
+      }
+      done = true;
+  });
+  while (!done) {
+    PollDevice(device, queue);
+  }
+}
+
+/// \brief Keeps at most `max_in_flight` command buffers queued on the GPU
+/// Submit() blocks (polling the device) until an older submission has finished,
+/// so a long frame is split into many short submissions without flooding the queue.
+class SubmissionQueue {
+public:
+    SubmissionQueue() = default;
+
+    SubmissionQueue(const SubmissionQueue &) = delete;
+
+    SubmissionQueue &operator=(const SubmissionQueue &) = delete;
+
+    void Init(Device device, Queue queue, uint32_t max_in_flight) {
+      device_ = device;
+      queue_ = queue;
+      max_in_flight_ = std::max(max_in_flight, 1u);
+    }
+
+    void Submit(CommandBuffer command) {
+      Wait(max_in_flight_ - 1);
+      queue_.submit(command);
+      ++submitted_;
+      callbacks_.push_back(queue_.onSubmittedWorkDone([this](QueueWorkDoneStatus status) {
+          if (status != QueueWorkDoneStatus::Success) {
+            OnQueueWorkDone(status);
+          }
+          ++completed_;
+      }));
+    }
+
+    /// \brief Block until at most `max_pending` submissions are unfinished
+    void Wait(uint32_t max_pending) {
+      while (submitted_ - completed_ > max_pending) {
+        PollDevice(device_, queue_);
+      }
+      /// Work done callbacks fire in submission order
+      while (callbacks_.size() > submitted_ - completed_) {
+        callbacks_.pop_front();
+      }
+    }
+
+    void WaitAll() { Wait(0); }
+
+    [[nodiscard]] uint32_t MaxInFlight() const { return max_in_flight_; }
+
+private:
+    using CallbackHandle = decltype(std::declval<Queue &>().onSubmittedWorkDone(std::function<void(QueueWorkDoneStatus)>()));
+
+    Device device_ = nullptr;
+    Queue queue_ = nullptr;
+    uint32_t max_in_flight_ = 1;
+    uint64_t submitted_ = 0;
+    uint64_t completed_ = 0;
+    std::deque<CallbackHandle> callbacks_;
+};
+
 /// \brief Function to load shader from file
 /// \param path shader path
 /// \param device WebGPU device
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "utils/wgpu_util.h"
+#include <array>
+
+/// \brief Wavefront variant of the compute path tracer (RenderConfig::kernel)
+/// compute_sample runs the whole path of a pixel in one invocation, so a workgroup waits for its
+/// longest path and lanes of terminated paths idle. Here one bounce is split into small kernels over
+/// a queue of live paths: wave_generate (camera rays), wave_extend (closest hit), wave_sort (order by
+/// material) and wave_shade (emission, BSDF scattering, termination). Path state stays in a storage
+/// buffer between kernels and wave_prepare sizes the indirect dispatch of every bounce from the queue
+/// length, so terminated paths cost nothing in later bounces. Sorting keeps the lanes of a wave_shade
+/// workgroup on one BSDF. Per pixel the random stream matches compute_sample.
+class WavefrontIntegrator {
+public:
+    /// Scene (9) + accumBuffer + path state + ray queues
+    static constexpr uint32_t kStorageBuffers = 12;
+
+    WavefrontIntegrator() = default;
+
+    WavefrontIntegrator(const WavefrontIntegrator &) = delete;
+
+    WavefrontIntegrator &operator=(const WavefrontIntegrator &) = delete;
+
+    /// \brief Pipelines sharing the camera (group 0), scene (group 1) and sampler table (group 3) bind group layouts
+    /// \param limits device limits, checked against kStorageBuffers
+    /// \return false if the device cannot bind the wave kernels
+    bool Init(Device device, BindGroupLayout camera_layout, BindGroupLayout scene_layout, BindGroupLayout sampler_layout,
+              const Limits &limits);
+
+    void Release();
+
+    [[nodiscard]] bool Ready() const { return pipeline_layout_ != nullptr; }
+
+    /// \brief Path state and ray queues for tiles of tile_size x tile_size pixels
+    /// \param max_depth bounce limit (CameraParam::max_depth)
+    /// \param accum_buffer tile-major accumulation buffer, one range of accum_tile_stride bytes per tile
+    /// \param tile_param_size bound size of one TileParam entry
+    /// \param path_stats_buffer per-depth path counters, counted by wave_prepare
+    /// \param path_stats whether wave_prepare counts the paths (RenderConfig::path_stats)
+    /// \param albedo_view, normal_depth_view G-buffer of the Denoiser
+    /// \return false if the path state of a tile cannot be bound
+    bool InitFrameResources(uint32_t tile_size, uint32_t max_depth, Buffer accum_buffer, uint64_t accum_tile_stride,
+                            TextureView output_view, Buffer tile_param_buffer, uint64_t tile_param_size,
+                            Buffer path_stats_buffer, bool path_stats, TextureView albedo_view,
+                            TextureView normal_depth_view);
+
+    void ReleaseFrameResources();
+
+    /// \brief Record the samples of one tile (CameraParam::sample_count) into a compute pass
+    /// Binds its own pipelines and groups, the caller rebinds before using other pipelines.
+    /// \param offsets dynamic offsets of the tile: accumBuffer, TileParam
+    /// \param size tile size in pixels
+    void Record(ComputePassEncoder &pass, BindGroup camera, BindGroup scene, BindGroup sampler,
+                const std::array<uint32_t, 2> &offsets, const uint32_t size[2], uint32_t sample_count);
+
+private:
+    void InitBindGroupLayouts();
+
+private:
+    /// Workgroup size of wave_begin / wave_generate, wave_prepare sizes the 1D kernels
+    static const uint32_t kTileGroupSize = 16;
+    /// Bytes of PathState in path_tracer.wgsl
+    static const uint64_t kPathStateSize = 112;
+    /// kShadeBins of path_tracer.wgsl: misses and lights, then one per BxDF
+    static const uint64_t kShadeBins = 4;
+    Device device_ = nullptr;
+    Limits limits_{};
+
+    BindGroupLayout wave_bind_group_layout_ = nullptr;
+    BindGroupLayout prepare_bind_group_layout_ = nullptr;
+    PipelineLayout pipeline_layout_ = nullptr;
+    PipelineLayout prepare_pipeline_layout_ = nullptr;
+    ComputePipeline begin_pipeline_ = nullptr;
+    ComputePipeline generate_pipeline_ = nullptr;
+    ComputePipeline extend_pipeline_ = nullptr;
+    ComputePipeline sort_pipeline_ = nullptr;
+    ComputePipeline shade_pipeline_ = nullptr;
+    ComputePipeline prepare_pipeline_ = nullptr;
+
+    /// WaveParam entries are padded to minUniformBufferOffsetAlignment
+    uint32_t wave_param_stride_ = 0;
+
+    /// Per tile size and depth
+    uint32_t max_depth_ = 0;
+    /// WaveParam per depth
+    Buffer wave_param_buffer_ = nullptr;
+    Buffer path_buffer_ = nullptr;
+    Buffer queue_buffer_ = nullptr;
+    /// Indirect workgroup counts written by wave_prepare
+    Buffer args_buffer_ = nullptr;
+    BindGroup wave_bind_group_ = nullptr;
+    BindGroup prepare_bind_group_ = nullptr;
+};
@@ -0,0 +1,342 @@
+#include "light_sampler.h"
+#include "bvh_builder.h"
+#include <algorithm>
+
+namespace {
+const float kPI = 3.14159265359f;
+/// Largest float below 1, keeps rescaled random numbers in [0, 1)
+const float kOneMinusEpsilon = 0x1.fffffep-1f;
+/// Light tree depth is at most log2 of the light count (median splits)
+const uint32_t kStackSize = 32;
+
+float Luminance(const Color3 &col) {
+  return 0.2126f * col.x + 0.7152f * col.y + 0.0722f * col.z;
+}
+
+/// \brief cos(max(0, a - b)) from the sines and cosines of a and b
+float CosSubClamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+  if (cos_a > cos_b) {
+    return 1.0f;
+  }
+  return cos_a * cos_b + sin_a * sin_b;
+}
+
+/// \brief sin(max(0, a - b)) from the sines and cosines of a and b
+float SinSubClamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+  if (cos_a > cos_b) {
+    return 0.0f;
+  }
+  return sin_a * cos_b - cos_a * sin_b;
+}
+
+float SinFromCos(float cos) {
+  return std::sqrt(std::max(0.0f, 1.0f - cos * cos));
+}
+
+/// \brief Smallest cone containing the emission cones of `a` and `b` (DirectionCone::Union of PBRT-v4)
+void MergeCones(const LightNode &a, const LightNode &b, LightNode &node) {
+  const auto theta_a = std::acos(Clamp(a.cos_theta_o, -1.0f, 1.0f));
+  const auto theta_b = std::acos(Clamp(b.cos_theta_o, -1.0f, 1.0f));
+  const auto theta_d = std::acos(Clamp(glm::dot(a.axis, b.axis), -1.0f, 1.0f));
+  if (std::min(theta_d + theta_b, kPI) <= theta_a) {
+    node.axis = a.axis;
+    node.cos_theta_o = a.cos_theta_o;
+    return;
+  }
+  if (std::min(theta_d + theta_a, kPI) <= theta_b) {
+    node.axis = b.axis;
+    node.cos_theta_o = b.cos_theta_o;
+    return;
+  }
+  const auto theta_o = 0.5f * (theta_a + theta_d + theta_b);
+  const auto w_r = glm::cross(a.axis, b.axis);
+  if (theta_o >= kPI || glm::dot(w_r, w_r) < 1e-12f) {
+    node.axis = a.axis;
+    node.cos_theta_o = -1.0f;
+    return;
+  }
+  /// Rotate a.axis towards b.axis by theta_o - theta_a (Rodrigues, a.axis is orthogonal to k)
+  const auto theta_r = theta_o - theta_a;
+  const auto k = glm::normalize(w_r);
+  node.axis = glm::normalize(a.axis * std::cos(theta_r) + glm::cross(k, a.axis) * std::sin(theta_r));
+  node.cos_theta_o = std::cos(theta_o);
+}
+
+/// \brief Slab test of intersect_aabb in path_tracer.wgsl, without a distance limit
+bool HitsBounds(const Ray &r, const vec3 &inv_dir, const LightNode &node) {
+  const auto t0 = (node.aabb_min - r.start) * inv_dir;
+  const auto t1 = (node.aabb_max - r.start) * inv_dir;
+  const auto t_near = glm::min(t0, t1);
+  const auto t_far = glm::max(t0, t1);
+  const auto t_enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+  const auto t_exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, kRayMax));
+  return t_enter <= t_exit;
+}
+}
+
+void LightSampler::Build(const std::vector<Quad> &lights, const std::vector<Sphere> &spheres,
+                         const std::vector<Material> &materials) {
+  std::vector<float> power;
+  std::vector<uint32_t> sphere_lights;
+  for (const auto &light: lights) {
+    const auto area = glm::length(glm::cross(light.right_, light.up_));
+    power.push_back(std::max(area * Luminance(materials[light.material_].Emitted()), 0.0f));
+  }
+  for (uint32_t i = 0; i < (uint32_t) spheres.size(); ++i) {
+    const auto &sphere = spheres[i];
+    const auto &material = materials[sphere.material_];
+    if (material.Emissive() && sphere.radius_ > 0.0f) {
+      const auto area = 4.0f * kPI * sphere.radius_ * sphere.radius_;
+      power.push_back(std::max(area * Luminance(material.Emitted()), 0.0f));
+      sphere_lights.push_back(i);
+    }
+  }
+  float total = 0.0f;
+  for (auto p: power) {
+    total += p;
+  }
+  if (total <= 0.0f) {
+    std::fill(power.begin(), power.end(), 1.0f);
+  }
+  BuildAliasTable(power);
+  for (size_t i = 0; i < sphere_lights.size(); ++i) {
+    alias_[lights.size() + i].sphere = sphere_lights[i];
+  }
+  BuildTree(lights, spheres, power);
+}
+
+/// \brief Vose's alias method
+void LightSampler::BuildAliasTable(const std::vector<float> &power) {
+  const auto n = (uint32_t) power.size();
+  alias_.assign(n, LightAlias{1.0f, 0, 0.0f, kNoHit});
+  double total = 0.0;
+  for (auto p: power) {
+    total += p;
+  }
+  if (n == 0 || total <= 0.0) {
+    return;
+  }
+  std::vector<double> scaled(n);
+  std::vector<uint32_t> small;
+  std::vector<uint32_t> large;
+  for (uint32_t i = 0; i < n; ++i) {
+    alias_[i].power_pdf = (float) (power[i] / total);
+    alias_[i].alias = i;
+    scaled[i] = power[i] / total * n;
+    (scaled[i] < 1.0 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    const auto s = small.back();
+    small.pop_back();
+    const auto l = large.back();
+    large.pop_back();
+    alias_[s].alias_prob = (float) scaled[s];
+    alias_[s].alias = l;
+    scaled[l] = scaled[l] + scaled[s] - 1.0;
+    (scaled[l] < 1.0 ? small : large).push_back(l);
+  }
+  /// Leftovers are 1 up to rounding
+  for (auto i: small) {
+    alias_[i].alias_prob = 1.0f;
+  }
+  for (auto i: large) {
+    alias_[i].alias_prob = 1.0f;
+  }
+}
+
+void LightSampler::BuildTree(const std::vector<Quad> &lights, const std::vector<Sphere> &spheres, const std::vector<float> &power) {
+  nodes_.clear();
+  /// Leaf of every light with power
+  std::vector<uint32_t> order;
+  std::vector<AABB> bounds(power.size());
+  std::vector<LightNode> leaves(power.size());
+  for (uint32_t i = 0; i < (uint32_t) power.size(); ++i) {
+    if (power[i] <= 0.0f) {
+      continue;
+    }
+    auto &leaf = leaves[i];
+    if (alias_[i].sphere == kNoHit) {
+      const auto &light = lights[i];
+      bounds[i].Grow(light.q_);
+      bounds[i].Grow(light.q_ + light.right_);
+      bounds[i].Grow(light.q_ + light.up_);
+      bounds[i].Grow(light.q_ + light.right_ + light.up_);
+      leaf.axis = light.norm_;
+      leaf.cos_theta_o = 1.0f;
+    } else {
+      /// Emits in every direction
+      const auto &sphere = spheres[alias_[i].sphere];
+      bounds[i].Grow(sphere.center_ - vec3(sphere.radius_));
+      bounds[i].Grow(sphere.center_ + vec3(sphere.radius_));
+      leaf.axis = vec3(0.0f, 0.0f, 1.0f);
+      leaf.cos_theta_o = -1.0f;
+    }
+    leaf.aabb_min = bounds[i].min;
+    leaf.aabb_max = bounds[i].max;
+    leaf.left_first = i;
+    leaf.prim_count = 1;
+    leaf.power = power[i];
+    order.push_back(i);
+  }
+  if (order.empty()) {
+    /// Leaf that no ray reaches
+    LightNode empty{};
+    empty.aabb_min = vec3(std::numeric_limits<float>::max());
+    empty.aabb_max = vec3(-std::numeric_limits<float>::max());
+    empty.prim_count = 1;
+    empty.axis = vec3(0.0f, 0.0f, 1.0f);
+    empty.cos_theta_o = 1.0f;
+    nodes_.push_back(empty);
+    return;
+  }
+  nodes_.reserve(2 * order.size() - 1);
+  nodes_.emplace_back();
+  Subdivide(0, order.begin(), order.end(), bounds, leaves);
+}
+
+/// \brief Fill nodes_[node] with the lights of [begin, end), median split on the largest centroid axis
+void LightSampler::Subdivide(uint32_t node, std::vector<uint32_t>::iterator begin, std::vector<uint32_t>::iterator end,
+                             const std::vector<AABB> &bounds, const std::vector<LightNode> &leaves) {
+  if (end - begin == 1) {
+    nodes_[node] = leaves[*begin];
+    return;
+  }
+  AABB centroid_bounds;
+  for (auto it = begin; it != end; ++it) {
+    centroid_bounds.Grow(bounds[*it].Centroid());
+  }
+  const auto extent = centroid_bounds.max - centroid_bounds.min;
+  const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+  const auto mid = begin + (end - begin) / 2;
+  std::nth_element(begin, mid, end, [&](uint32_t a, uint32_t b) { return bounds[a].Centroid()[axis] < bounds[b].Centroid()[axis]; });
+
+  const auto first = (uint32_t) nodes_.size();
+  nodes_.emplace_back();
+  nodes_.emplace_back();
+  Subdivide(first, begin, mid, bounds, leaves);
+  Subdivide(first + 1, mid, end, bounds, leaves);
+  const auto &a = nodes_[first];
+  const auto &b = nodes_[first + 1];
+  auto &interior = nodes_[node];
+  interior.aabb_min = glm::min(a.aabb_min, b.aabb_min);
+  interior.aabb_max = glm::max(a.aabb_max, b.aabb_max);
+  interior.left_first = first;
+  interior.prim_count = 0;
+  interior.power = a.power + b.power;
+  MergeCones(a, b, interior);
+}
+
+/// \brief Importance of the lights below `node` for a point with normal `norm` (LightBounds::Importance of PBRT-v4)
+/// Bounds the power arriving at `pos` with the closest distance and the smallest emission and
+/// incidence angles any point in the bounds could have. Quad lights emit on their front side only.
+float LightSampler::Importance(const LightNode &node, const vec3 &pos, const vec3 &norm) {
+  const auto center = 0.5f * (node.aabb_min + node.aabb_max);
+  const auto to_pos = pos - center;
+  const auto dist2 = glm::dot(to_pos, to_pos);
+  const auto diag = node.aabb_max - node.aabb_min;
+  const auto radius2 = 0.25f * glm::dot(diag, diag);
+  const auto wi = dist2 > 0.0f ? to_pos / std::sqrt(dist2) : vec3(0.0f);
+  /// Angle between the emission axis and pos, and the angle subtended by the bounds
+  const auto cos_w = glm::dot(node.axis, wi);
+  const auto sin_w = SinFromCos(cos_w);
+  const auto cos_b = dist2 > radius2 ? std::sqrt(1.0f - radius2 / dist2) : -1.0f;
+  const auto sin_b = SinFromCos(cos_b);
+  const auto sin_o = SinFromCos(node.cos_theta_o);
+  const auto cos_x = CosSubClamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+  const auto sin_x = SinSubClamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+  const auto cos_p = CosSubClamped(sin_x, cos_x, sin_b, cos_b);
+  /// Outside the emission hemisphere (cos_theta_e = 0)
+  if (cos_p <= 0.0f) {
+    return 0.0f;
+  }
+  const auto cos_i = std::fabs(glm::dot(wi, norm));
+  const auto cos_i_bound = CosSubClamped(SinFromCos(cos_i), cos_i, sin_b, cos_b);
+  return std::max(node.power * cos_p * cos_i_bound / std::max(dist2, radius2), 0.0f);
+}
+
+float LightSampler::FirstChildProbability(const LightNode &node, const vec3 &pos, const vec3 &norm) const {
+  const auto first = Importance(nodes_[node.left_first], pos, norm);
+  const auto second = Importance(nodes_[node.left_first + 1], pos, norm);
+  /// No child can light pos, any choice is fine as long as Pdf makes the same
+  if (first + second <= 0.0f) {
+    return 0.5f;
+  }
+  return first / (first + second);
+}
+
+uint32_t LightSampler::Sample(const vec3 &pos, const vec3 &norm, float u, bool tree) const {
+  if (!tree) {
+    const auto n = (uint32_t) alias_.size();
+    const auto scaled = u * (float) n;
+    const auto i = std::min((uint32_t) scaled, n - 1);
+    return scaled - (float) i < alias_[i].alias_prob ? i : alias_[i].alias;
+  }
+  /// Descend with one random number, rescaled to [0, 1) at every level
+  uint32_t idx = 0;
+  while (!nodes_[idx].IsLeaf()) {
+    const auto &node = nodes_[idx];
+    const auto p = FirstChildProbability(node, pos, norm);
+    if (u < p) {
+      u = std::min(u / p, kOneMinusEpsilon);
+      idx = node.left_first;
+    } else {
+      u = std::min((u - p) / (1.0f - p), kOneMinusEpsilon);
+      idx = node.left_first + 1;
+    }
+  }
+  return nodes_[idx].left_first;
+}
+
+float LightSampler::CosThetaMax(const Sphere &sphere, const vec3 &pos) {
+  const auto square_dist = glm::dot(sphere.center_ - pos, sphere.center_ - pos);
+  const auto radius2 = sphere.radius_ * sphere.radius_;
+  return square_dist > radius2 ? std::sqrt(1.0f - radius2 / square_dist) : -1.0f;
+}
+
+float LightSampler::Pdf(const std::vector<Quad> &lights, const std::vector<Sphere> &spheres, const vec3 &pos,
+                        const vec3 &norm, const vec3 &dir, bool tree) const {
+  const Ray r(pos, glm::normalize(dir));
+  vec3 inv_dir;
+  for (int i = 0; i < 3; ++i) {
+    inv_dir[i] = 1.0f / (std::fabs(r.dir[i]) < 1e-8f ? 1e-8f : r.dir[i]);
+  }
+  struct Entry {
+      uint32_t node;
+      float pmf;
+  };
+  Entry stack[kStackSize];
+  uint32_t stack_ptr = 0;
+  stack[stack_ptr++] = {0, 1.0f};
+  float pdf = 0.0f;
+  while (stack_ptr > 0) {
+    const auto entry = stack[--stack_ptr];
+    const auto &node = nodes_[entry.node];
+    if (!HitsBounds(r, inv_dir, node)) {
+      continue;
+    }
+    if (node.IsLeaf()) {
+      const auto &alias = alias_[node.left_first];
+      const auto pmf = tree ? entry.pmf : alias.power_pdf;
+      HitInfo hit;
+      if (alias.sphere != kNoHit) {
+        /// Uniform in the cone of the sphere
+        const auto &sphere = spheres[alias.sphere];
+        if (sphere.Intersect(r, hit)) {
+          pdf += pmf / (2.0f * kPI * (1.0f - CosThetaMax(sphere, pos)));
+        }
+        continue;
+      }
+      const auto &light = lights[node.left_first];
+      if (light.Intersect(r, hit)) {
+        const auto area = glm::length(glm::cross(light.right_, light.up_));
+        const auto light_cosine = std::fabs(glm::dot(r.dir, light.norm_)) + kRayMin;
+        pdf += pmf * hit.dist * hit.dist / (light_cosine * area);
+      }
+      continue;
+    }
+    const auto p = tree ? FirstChildProbability(node, pos, norm) : 1.0f;
+    stack[stack_ptr++] = {node.left_first, entry.pmf * p};
+    stack[stack_ptr++] = {node.left_first + 1, entry.pmf * (1.0f - p)};
+  }
+  return pdf;
+}
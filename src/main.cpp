@@ -1,39 +1,78 @@
 #include "renderer.h"
+#include "cpu_renderer.h"
+#include "render_job.h"
+#include "image_compare.h"
+#include <chrono>
 
 int main(int argc, char *argv[]) {
   Print(PrintInfoType::WebGPUTracer, "Starting WebGPUTracer (_)=---=(_)");
-  Renderer renderer;
-  bool hasWindow = true;
-  bool isCompute = false;
-  renderer.OnInit(hasWindow);
+  // コマンドライン入力形式
+  // ./WebGPUTracer.exe [--backend gpu|cpu] [--job job.toml] [--resolution WxH] [--spp N] [--frame start end] ... (--help)
+  RenderJob job;
+  std::string error;
+  if (!ParseCommandLine(argc, argv, job, error)) {
+    Error(PrintInfoType::WebGPUTracer, error.c_str());
+    PrintUsage();
+    return 1;
+  }
+  if (job.show_help) {
+    PrintUsage();
+    return 0;
+  }
 
+  const auto &first_shot = job.shots.front();
   // RenderPipeline
-  if (hasWindow) {
+  if (job.has_window) {
+    Renderer renderer;
+    if (!renderer.OnInit(true, first_shot.config, first_shot.scene)) {
+      Error(PrintInfoType::WebGPUTracer, "(_)=--.. Initialization failed");
+      return 1;
+    }
     while (renderer.IsRunning()) {
       renderer.OnFrame();
     }
+    renderer.OnFinish();
+    Print(PrintInfoType::WebGPUTracer, "(_)=---=(_) WebGPUTracer Finished");
+    return 0;
   }
 
-  uint32_t start_frame = 1;
-  uint32_t end_frame = 1;
-  // コマンドライン入力形式
-  // ./WebGPUTracer.exe --frame [start] [end]
-  if (argc == 4) {
-    if (strcmp(argv[1], "--frame") == 0) {
-      start_frame = (uint32_t) atoi(argv[2]);
-      end_frame = (uint32_t) atoi(argv[3]);
-    }
+  // ComputePipeline or the CPU reference
+  std::unique_ptr<RenderBackend> backend;
+  if (job.backend == BackendType::CPU) {
+    backend = std::make_unique<CpuRenderer>();
+  } else {
+    backend = std::make_unique<Renderer>();
   }
-
-  if (isCompute) {
-    // ComputePipeline
-    if (!renderer.OnCompute(start_frame, end_frame)) {
+  if (!backend->OnInit(first_shot.config, first_shot.scene)) {
+    Error(PrintInfoType::WebGPUTracer, "(_)=--.. Initialization failed");
+    return 1;
+  }
+  // Device, pipelines and scene are shared by every shot of the job
+  uint32_t failed_checks = 0;
+  for (const auto &shot: job.shots) {
+    if (job.shots.size() > 1) {
+      Print(PrintInfoType::WebGPUTracer, "Shot: ", shot.name);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    if (!backend->SetShot(shot.config, shot.scene) || !backend->OnCompute(shot.start_frame, shot.end_frame)) {
       Error(PrintInfoType::WebGPUTracer, "(_)=--.. Something went wrong");
       return 1;
     }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // Regression check against the reference images
+    if (!shot.config.reference_dir.empty()) {
+      const auto passed = CheckReferences(shot.config, shot.start_frame, shot.end_frame);
+      std::cout << "[" << (shot.name.empty() ? "shot" : shot.name) << "]: " << elapsed << "(sec)s, "
+                << (passed ? "PASS" : "FAIL") << std::endl;
+      failed_checks += passed ? 0 : 1;
+    }
   }
 
-  renderer.OnFinish();
+  backend->OnFinish();
+  if (failed_checks > 0) {
+    Error(PrintInfoType::WebGPUTracer, "Shots differing from their references: ", failed_checks);
+    return 2;
+  }
   Print(PrintInfoType::WebGPUTracer, "(_)=---=(_) WebGPUTracer Finished");
   return 0;
 }
@@ -0,0 +1,14 @@
+#include "material.h"
+
+bool ParseBxDF(const std::string &name, BxDF &bxdf) {
+  if (name == "lambertian") {
+    bxdf = BxDF::Lambertian;
+  } else if (name == "ggx") {
+    bxdf = BxDF::GGX;
+  } else if (name == "dielectric") {
+    bxdf = BxDF::Dielectric;
+  } else {
+    return false;
+  }
+  return true;
+}
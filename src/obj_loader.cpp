@@ -0,0 +1,434 @@
+#include "obj_loader.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
+namespace {
+/// Line ranges below this size are not split further
+constexpr uint64_t kMinChunkSize = 1 << 20;
+/// Material of the triangles before the first usemtl of a range, resolved from the ranges before it
+constexpr uint32_t kInheritMaterial = kNoHit - 1;
+
+/// \brief Position, texture coordinate and normal indices of a face corner, kNoHit where absent
+struct Corner {
+    uint32_t position;
+    uint32_t texcoord;
+    uint32_t normal;
+};
+
+/// \brief Line range of the file and what it holds
+struct Chunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    /// Counted by the first pass
+    uint32_t lines = 0;
+    uint32_t positions = 0;
+    uint32_t texcoords = 0;
+    uint32_t normals = 0;
+    uint32_t triangles = 0;
+    std::vector<std::string> material_names;
+    std::vector<std::string> material_libraries;
+    /// Prefix sums of the counts: where the slices of the chunk start
+    uint32_t first_line = 0;
+    uint32_t first_position = 0;
+    uint32_t first_texcoord = 0;
+    uint32_t first_normal = 0;
+    uint32_t first_triangle = 0;
+    /// usemtl in effect at the end of the range, kInheritMaterial without one
+    uint32_t last_material = kInheritMaterial;
+    /// First malformed line of the range, counted from its start
+    std::string error;
+    uint32_t error_line = 0;
+};
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char *SkipSpace(const char *p, const char *end) {
+  while (p < end && IsSpace(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+/// \brief Rest of a statement without surrounding spaces
+std::string Trimmed(const char *p, const char *end) {
+  p = SkipSpace(p, end);
+  while (end > p && IsSpace(end[-1])) {
+    --end;
+  }
+  return {p, end};
+}
+
+/// \brief Keyword at the start of a line, followed by a space or the end of the line
+bool IsStatement(const char *p, const char *end, const char *keyword, size_t length) {
+  return (size_t) (end - p) >= length && std::memcmp(p, keyword, length) == 0 &&
+         ((size_t) (end - p) == length || IsSpace(p[length]));
+}
+
+/// \brief Number of whitespace separated tokens
+uint32_t CountTokens(const char *p, const char *end) {
+  uint32_t tokens = 0;
+  while (true) {
+    p = SkipSpace(p, end);
+    if (p == end) {
+      return tokens;
+    }
+    ++tokens;
+    while (p < end && !IsSpace(*p)) {
+      ++p;
+    }
+  }
+}
+
+/// \brief Decimal floating point number, exponent allowed
+/// Digits beyond the 19th only scale the value. Accurate to the float it is rounded to in all but the last bit.
+const char *ParseFloat(const char *p, const char *end, float &value) {
+  static const double kPow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                  1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  p = SkipSpace(p, end);
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p++ == '-';
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+      digits += mantissa > 0;
+    } else {
+      ++exponent;
+    }
+  }
+  if (p < end && *p == '.') {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+        digits += mantissa > 0;
+        --exponent;
+      }
+    }
+  }
+  if (!any) {
+    return nullptr;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool negative_exponent = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      negative_exponent = *p++ == '-';
+    }
+    if (p == end || *p < '0' || *p > '9') {
+      return nullptr;
+    }
+    int e = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+      e = std::min(e * 10 + (*p - '0'), 1000);
+    }
+    exponent += negative_exponent ? -e : e;
+  }
+  auto result = (double) mantissa;
+  if (exponent < 0) {
+    result = -exponent <= 22 ? result / kPow10[-exponent] : result / std::pow(10.0, -exponent);
+  } else if (exponent > 0) {
+    result = exponent <= 22 ? result * kPow10[exponent] : result * std::pow(10.0, exponent);
+  }
+  value = (float) (negative ? -result : result);
+  return p;
+}
+
+const char *ParseInt(const char *p, const char *end, int64_t &value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p++ == '-';
+  }
+  if (p == end || *p < '0' || *p > '9') {
+    return nullptr;
+  }
+  value = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    value = std::min<int64_t>(value * 10 + (*p - '0'), INT64_C(1) << 40);
+  }
+  if (negative) {
+    value = -value;
+  }
+  return p;
+}
+
+/// \brief 1-based or negative (relative) OBJ index to a 0-based one
+/// \param defined elements defined before the statement
+bool ResolveIndex(int64_t index, uint32_t defined, uint32_t total, uint32_t &resolved) {
+  const auto absolute = index > 0 ? index - 1 : (int64_t) defined + index;
+  if (index == 0 || absolute < 0 || absolute >= (int64_t) total) {
+    return false;
+  }
+  resolved = (uint32_t) absolute;
+  return true;
+}
+
+/// \brief Call `func(begin, end)` for every line of [begin, end), line ends and comments (from #) excluded
+template<typename Func>
+void ForEachLine(const char *begin, const char *end, Func func) {
+  while (begin < end) {
+    const auto *newline = (const char *) std::memchr(begin, '\n', (size_t) (end - begin));
+    const auto *line_end = newline != nullptr ? newline : end;
+    const auto *comment = (const char *) std::memchr(begin, '#', (size_t) (line_end - begin));
+    if (!func(SkipSpace(begin, line_end), comment != nullptr ? comment : line_end)) {
+      return;
+    }
+    begin = line_end + 1;
+  }
+}
+
+/// \brief First pass: count the elements of a range and collect its material names
+void CountChunk(Chunk &chunk) {
+  ForEachLine(chunk.begin, chunk.end, [&chunk](const char *p, const char *end) {
+      ++chunk.lines;
+      if (p == end) {
+        return true;
+      }
+      if (IsStatement(p, end, "v", 1)) {
+        ++chunk.positions;
+      } else if (IsStatement(p, end, "vt", 2)) {
+        ++chunk.texcoords;
+      } else if (IsStatement(p, end, "vn", 2)) {
+        ++chunk.normals;
+      } else if (IsStatement(p, end, "f", 1)) {
+        const auto corners = CountTokens(p + 1, end);
+        chunk.triangles += corners >= 3 ? corners - 2 : 0;
+      } else if (IsStatement(p, end, "usemtl", 6)) {
+        auto name = Trimmed(p + 6, end);
+        if (std::find(chunk.material_names.begin(), chunk.material_names.end(), name) == chunk.material_names.end()) {
+          chunk.material_names.push_back(std::move(name));
+        }
+      } else if (IsStatement(p, end, "mtllib", 6)) {
+        for (const auto *q = SkipSpace(p + 6, end); q < end; q = SkipSpace(q, end)) {
+          const auto *name_end = q;
+          while (name_end < end && !IsSpace(*name_end)) {
+            ++name_end;
+          }
+          chunk.material_libraries.emplace_back(q, name_end);
+          q = name_end;
+        }
+      }
+      return true;
+  });
+}
+
+/// \brief Second pass: parse a range into its slices of the shared arrays
+void ParseChunk(Chunk &chunk, const std::unordered_map<std::string, uint32_t> &material_ids, ObjMesh &mesh,
+                std::vector<vec3> &positions, std::vector<glm::vec2> &texcoords, std::vector<vec3> &normals,
+                std::vector<Corner> &corners) {
+  uint32_t line = 0;
+  uint32_t position = chunk.first_position;
+  uint32_t texcoord = chunk.first_texcoord;
+  uint32_t normal = chunk.first_normal;
+  uint32_t triangle = chunk.first_triangle;
+  uint32_t material = kInheritMaterial;
+  const auto fail = [&chunk, &line](const char *message) {
+      chunk.error = message;
+      chunk.error_line = line;
+      return false;
+  };
+  ForEachLine(chunk.begin, chunk.end, [&](const char *p, const char *end) {
+      ++line;
+      if (p == end) {
+        return true;
+      }
+      if (IsStatement(p, end, "v", 1)) {
+        auto &v = positions[position++];
+        const auto *q = ParseFloat(p + 1, end, v.x);
+        q = q != nullptr ? ParseFloat(q, end, v.y) : nullptr;
+        q = q != nullptr ? ParseFloat(q, end, v.z) : nullptr;
+        /// Vertex colors may follow
+        return q != nullptr || fail("malformed vertex");
+      }
+      if (IsStatement(p, end, "vt", 2)) {
+        auto &vt = texcoords[texcoord++];
+        const auto *q = ParseFloat(p + 2, end, vt.x);
+        /// v and w are optional
+        if (q != nullptr && ParseFloat(q, end, vt.y) == nullptr) {
+          vt.y = 0.0f;
+        }
+        return q != nullptr || fail("malformed texture coordinate");
+      }
+      if (IsStatement(p, end, "vn", 2)) {
+        auto &vn = normals[normal++];
+        const auto *q = ParseFloat(p + 2, end, vn.x);
+        q = q != nullptr ? ParseFloat(q, end, vn.y) : nullptr;
+        q = q != nullptr ? ParseFloat(q, end, vn.z) : nullptr;
+        return q != nullptr || fail("malformed normal");
+      }
+      if (IsStatement(p, end, "f", 1)) {
+        /// Fan around the first corner
+        Corner first{}, previous{};
+        uint32_t count = 0;
+        for (const auto *q = SkipSpace(p + 1, end); q < end; q = SkipSpace(q, end), ++count) {
+          Corner corner{kNoHit, kNoHit, kNoHit};
+          int64_t index;
+          q = ParseInt(q, end, index);
+          if (q == nullptr || !ResolveIndex(index, position, (uint32_t) positions.size(), corner.position)) {
+            return fail("invalid vertex index");
+          }
+          if (q < end && *q == '/') {
+            ++q;
+            if (q < end && *q != '/') {
+              q = ParseInt(q, end, index);
+              if (q == nullptr || !ResolveIndex(index, texcoord, (uint32_t) texcoords.size(), corner.texcoord)) {
+                return fail("invalid texture coordinate index");
+              }
+            }
+            if (q < end && *q == '/') {
+              q = ParseInt(q + 1, end, index);
+              if (q == nullptr || !ResolveIndex(index, normal, (uint32_t) normals.size(), corner.normal)) {
+                return fail("invalid normal index");
+              }
+            }
+          }
+          if (q < end && !IsSpace(*q)) {
+            return fail("malformed face");
+          }
+          if (count == 0) {
+            first = corner;
+          } else if (count >= 2) {
+            corners[(size_t) triangle * 3] = first;
+            corners[(size_t) triangle * 3 + 1] = previous;
+            corners[(size_t) triangle * 3 + 2] = corner;
+            mesh.face_materials[triangle++] = material;
+          }
+          previous = corner;
+        }
+        return true;
+      }
+      if (IsStatement(p, end, "usemtl", 6)) {
+        material = material_ids.at(Trimmed(p + 6, end));
+      }
+      return true;
+  });
+  chunk.last_material = material;
+}
+}
+
+bool LoadObjFile(const std::string &path, ObjMesh &mesh, std::string &error, ThreadPool &pool) {
+  mesh = {};
+  MappedFile file;
+  if (!file.Open(path)) {
+    std::error_code ec;
+    const auto empty = std::filesystem::is_regular_file(path, ec) && std::filesystem::file_size(path, ec) == 0;
+    error = empty ? path + " is empty" : "Cannot read " + path;
+    return false;
+  }
+  /// Line ranges: split evenly, then moved past the next line end
+  const auto *data = (const char *) file.Data();
+  const auto *data_end = data + file.Size();
+  const auto num_chunks = (uint32_t) std::max<uint64_t>(1, std::min<uint64_t>(file.Size() / kMinChunkSize, pool.Size() * 4));
+  std::vector<Chunk> chunks;
+  chunks.reserve(num_chunks);
+  const auto *begin = data;
+  for (uint32_t i = 1; i <= num_chunks && begin < data_end; ++i) {
+    const auto *end = i == num_chunks ? data_end : data + file.Size() * i / num_chunks;
+    if (end < begin) {
+      continue;
+    }
+    const auto *newline = (const char *) std::memchr(end, '\n', (size_t) (data_end - end));
+    end = newline != nullptr ? newline + 1 : data_end;
+    chunks.emplace_back();
+    chunks.back().begin = begin;
+    chunks.back().end = end;
+    begin = end;
+  }
+  ParallelFor(pool, (uint32_t) chunks.size(), 1, [&chunks](uint32_t first, uint32_t last) {
+      for (uint32_t i = first; i < last; ++i) {
+        CountChunk(chunks[i]);
+      }
+  });
+  /// Slices of every range and the material names in order of appearance
+  uint64_t lines = 0, positions = 0, texcoords = 0, normals = 0, triangles = 0;
+  std::unordered_map<std::string, uint32_t> material_ids;
+  for (auto &chunk: chunks) {
+    chunk.first_line = (uint32_t) lines;
+    chunk.first_position = (uint32_t) positions;
+    chunk.first_texcoord = (uint32_t) texcoords;
+    chunk.first_normal = (uint32_t) normals;
+    chunk.first_triangle = (uint32_t) triangles;
+    lines += chunk.lines;
+    positions += chunk.positions;
+    texcoords += chunk.texcoords;
+    normals += chunk.normals;
+    triangles += chunk.triangles;
+    for (auto &name: chunk.material_names) {
+      if (material_ids.emplace(name, (uint32_t) mesh.material_names.size()).second) {
+        mesh.material_names.push_back(std::move(name));
+      }
+    }
+    for (auto &library: chunk.material_libraries) {
+      mesh.material_libraries.push_back(std::move(library));
+    }
+  }
+  if (std::max({positions, texcoords, normals, triangles}) * 3 >= kNoHit - 1) {
+    error = path + " is too large";
+    return false;
+  }
+  std::vector<vec3> position_data(positions);
+  std::vector<glm::vec2> texcoord_data(texcoords);
+  std::vector<vec3> normal_data(normals);
+  std::vector<Corner> corners(triangles * 3);
+  mesh.face_materials.resize(triangles);
+  ParallelFor(pool, (uint32_t) chunks.size(), 1, [&](uint32_t first, uint32_t last) {
+      for (uint32_t i = first; i < last; ++i) {
+        ParseChunk(chunks[i], material_ids, mesh, position_data, texcoord_data, normal_data, corners);
+      }
+  });
+  for (const auto &chunk: chunks) {
+    if (!chunk.error.empty()) {
+      error = path + ":" + std::to_string(chunk.first_line + chunk.error_line) + ": " + chunk.error;
+      mesh = {};
+      return false;
+    }
+  }
+  /// Triangles before the first usemtl of a range continue the material of the ranges before it
+  uint32_t material = kNoHit;
+  for (const auto &chunk: chunks) {
+    for (uint32_t i = chunk.first_triangle; i < chunk.first_triangle + chunk.triangles; ++i) {
+      if (mesh.face_materials[i] != kInheritMaterial) {
+        break;
+      }
+      mesh.face_materials[i] = material;
+    }
+    if (chunk.last_material != kInheritMaterial) {
+      material = chunk.last_material;
+    }
+  }
+  /// Shared vertices: corners of a position are chained, the chains are short
+  std::vector<uint32_t> position_vertex(positions, kNoHit);
+  std::vector<uint32_t> next_vertex;
+  std::vector<Corner> vertex_corners;
+  next_vertex.reserve(positions);
+  vertex_corners.reserve(positions);
+  mesh.vertices.reserve(positions);
+  mesh.indices.resize(corners.size());
+  for (size_t i = 0; i < corners.size(); ++i) {
+    const auto &corner = corners[i];
+    auto vertex = position_vertex[corner.position];
+    while (vertex != kNoHit && (vertex_corners[vertex].texcoord != corner.texcoord || vertex_corners[vertex].normal != corner.normal)) {
+      vertex = next_vertex[vertex];
+    }
+    if (vertex == kNoHit) {
+      vertex = (uint32_t) mesh.vertices.size();
+      next_vertex.push_back(position_vertex[corner.position]);
+      position_vertex[corner.position] = vertex;
+      vertex_corners.push_back(corner);
+      const auto uv = corner.texcoord != kNoHit ? texcoord_data[corner.texcoord] : glm::vec2(0.0f, 0.0f);
+      mesh.vertices.emplace_back(position_data[corner.position], corner.normal != kNoHit ? normal_data[corner.normal] : vec3(0.0f),
+                                 uv.x, uv.y);
+    }
+    mesh.indices[i] = vertex;
+  }
+  return true;
+}
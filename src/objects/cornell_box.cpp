@@ -1,13 +1,12 @@
 #include "objects/cornell_box.h"
-#include "utils/color_util.h"
 
-CornellBox::CornellBox() {
+CornellBox::CornellBox(uint32_t red, uint32_t green, uint32_t white) {
   // Walls
-  quads_.emplace_back(Point3(555, 0, 0), vec3(0, 0, 555), vec3(0, 555, 0), COL_GREEN);
-  quads_.emplace_back(Point3(0, 0, 555), vec3(0, 0, -555), vec3(0, 555, 0), COL_RED);
-  quads_.emplace_back(Point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), COL_WHITE);
-  quads_.emplace_back(Point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), COL_WHITE);
-  quads_.emplace_back(Point3(555, 0, 555), vec3(-555, 0, 0), vec3(0, 555, 0), COL_WHITE);
+  quads_.emplace_back(Point3(555, 0, 0), vec3(0, 0, 555), vec3(0, 555, 0), green);
+  quads_.emplace_back(Point3(0, 0, 555), vec3(0, 0, -555), vec3(0, 555, 0), red);
+  quads_.emplace_back(Point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white);
+  quads_.emplace_back(Point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 0, -555), white);
+  quads_.emplace_back(Point3(555, 0, 555), vec3(-555, 0, 0), vec3(0, 555, 0), white);
 }
 
 void CornellBox::PushToQuads(std::vector<Quad> &quads) {
@@ -1,6 +1,6 @@
 #include "objects/quad.h"
 
-Quad::Quad(vec3 q, vec3 right, vec3 up, Color3 color, bool emissive) {
+Quad::Quad(vec3 q, vec3 right, vec3 up, uint32_t material) {
   q_ = q;
   right_ = right;
   up_ = up;
@@ -8,8 +8,7 @@ Quad::Quad(vec3 q, vec3 right, vec3 up, Color3 color, bool emissive) {
   norm_ = glm::normalize(n);
   d_ = glm::dot(norm_, q_);
   w_ = n / glm::dot(n, n);
-  color_ = color;
-  emissive_ = emissive;
+  material_ = material;
 }
 
 void Quad::RotateY(float angle) {
@@ -33,3 +32,41 @@ void Quad::Translate(vec3 direction) {
   d_ = glm::dot(norm_, q_);
   w_ = n / glm::dot(n, n);
 }
+
+Quad Quad::Transformed(const mat4x4 &m) const {
+  return {vec3(m * vec4(q_, 1)), vec3(m * vec4(right_, 0)), vec3(m * vec4(up_, 0)), material_};
+}
+
+/// quad form RayTracingTheNextWeek (mirrors intersect_quad in path_tracer.wgsl)
+bool Quad::Intersect(const Ray &r, HitInfo &closest) const {
+  auto denom = glm::dot(norm_, r.dir);
+  if (fabsf(denom) < kRayMin * glm::length(r.dir)) {
+    return false;
+  }
+  auto t = (d_ - glm::dot(norm_, r.start)) / denom;
+  if (t < kRayMin || kRayMax < t) {
+    return false;
+  }
+  auto pos = r.At(t);
+  auto ray_dist = glm::distance(pos, r.start);
+  if (ray_dist >= closest.dist) {
+    return false;
+  }
+  auto hit_vec = pos - q_;
+  auto a = glm::dot(w_, glm::cross(hit_vec, up_));
+  auto b = glm::dot(w_, glm::cross(right_, hit_vec));
+  if ((a < 0.0f) || (1.0f < a) || (b < 0.0f) || (1.0f < b)) {
+    return false;
+  }
+  closest.dist = ray_dist;
+  closest.front_face = glm::dot(r.dir, norm_) < 0.0f;
+  closest.shape = 1;
+  closest.pos = pos;
+  closest.norm = closest.front_face ? norm_ : -norm_;
+  closest.uv = glm::vec2(a, b);
+  // |w| = 1 / area
+  closest.tangent = right_;
+  closest.uv_scale = std::sqrt(glm::length(w_));
+  closest.material = material_;
+  return true;
+}
@@ -0,0 +1,42 @@
+#include "objects/sphere.h"
+
+/// Mirrors intersect_sphere in path_tracer.wgsl
+bool Sphere::Intersect(const Ray &r, HitInfo &closest) const {
+  auto oc = r.start - center_;
+  auto a = glm::dot(r.dir, r.dir);
+  auto half_b = glm::dot(oc, r.dir);
+  auto c = glm::dot(oc, oc) - radius_ * radius_;
+  auto discriminant = half_b * half_b - a * c;
+  if (discriminant < 0.0f) {
+    return false;
+  }
+  auto sqrt_d = sqrtf(discriminant);
+  // 最近傍のrootを探す
+  auto root = (-half_b - sqrt_d) / a;
+  if (root < kRayMin || kRayMax < root) {
+    root = (-half_b + sqrt_d) / a;
+    if (root < kRayMin || kRayMax < root) {
+      return false;
+    }
+  }
+  auto pos = r.At(root);
+  auto ray_dist = glm::distance(pos, r.start);
+  if (ray_dist >= closest.dist) {
+    return false;
+  }
+  auto sphere_norm = (pos - center_) / radius_;
+  closest.dist = ray_dist;
+  closest.front_face = glm::dot(r.dir, sphere_norm) < 0.0f;
+  closest.shape = 2;
+  closest.pos = pos;
+  closest.norm = closest.front_face ? sphere_norm : -sphere_norm;
+  // sphere_uv
+  auto theta = acosf(-closest.norm.y);
+  auto phi = atan2f(-closest.norm.z, closest.norm.x) + (float) M_PI;
+  closest.uv = glm::vec2(phi / (float) (2.0 * M_PI), theta / (float) M_PI);
+  // Along increasing phi, the uv square covers the whole sphere
+  closest.tangent = vec3(closest.norm.z, 0.0f, -closest.norm.x);
+  closest.uv_scale = 1.0f / (2.0f * radius_ * std::sqrt((float) M_PI));
+  closest.material = material_;
+  return true;
+}
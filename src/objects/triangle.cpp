@@ -1,6 +1,6 @@
 #include "objects/triangle.h"
 
-Triangle::Triangle(Vertex v0, Vertex v1, Vertex v2, Color3 color, bool emissive) {
+Triangle::Triangle(Vertex v0, Vertex v1, Vertex v2, uint32_t material) {
   // 頂点
   vertex_[0] = v0;
   vertex_[1] = v1;
@@ -9,8 +9,78 @@ Triangle::Triangle(Vertex v0, Vertex v1, Vertex v2, Color3 color, bool emissive)
   e1_ = vertex_[1].point_ - vertex_[0].point_;
   e2_ = vertex_[2].point_ - vertex_[0].point_;
   face_norm_ = glm::normalize(glm::cross(e1_, e2_));
-  // カラー
-  color_ = color;
-  // エミッシブ
-  emissive_ = emissive;
-}
\ No newline at end of file
+  // 頂点法線が無い場合は面法線
+  for (auto &vertex: vertex_) {
+    if (glm::dot(vertex.normal_, vertex.normal_) < 1e-12f) {
+      vertex.normal_ = face_norm_;
+    }
+  }
+  InitTexCoords();
+  // マテリアル
+  material_ = material;
+}
+
+void Triangle::InitTexCoords() {
+  // テクスチャ座標の接線 dp/du と密度 (法線マップとミップレベル用)
+  const auto du1 = vertex_[1].u_ - vertex_[0].u_;
+  const auto dv1 = vertex_[1].v_ - vertex_[0].v_;
+  const auto du2 = vertex_[2].u_ - vertex_[0].u_;
+  const auto dv2 = vertex_[2].v_ - vertex_[0].v_;
+  const auto det_uv = du1 * dv2 - du2 * dv1;
+  tangent_ = det_uv != 0.0f ? (dv2 * e1_ - dv1 * e2_) / det_uv : vec3(0.0f);
+  const auto area = glm::length(glm::cross(e1_, e2_));
+  uv_scale_ = area > 0.0f ? std::sqrt(std::abs(det_uv) / area) : 0.0f;
+}
+
+Triangle Triangle::Transformed(const mat4x4 &m) const {
+  Vertex v[3];
+  for (int i = 0; i < 3; ++i) {
+    v[i] = vertex_[i];
+    v[i].point_ = vec3(m * vec4(vertex_[i].point_, 1));
+    v[i].normal_ = glm::normalize(vec3(m * vec4(vertex_[i].normal_, 0)));
+  }
+  return {v[0], v[1], v[2], material_};
+}
+
+/// Möller–Trumbore intersection
+bool Triangle::Intersect(const Ray &r, HitInfo &closest) const {
+  auto p = glm::cross(r.dir, e2_);
+  auto det = glm::dot(e1_, p);
+  if (fabsf(det) < 1e-8f) {
+    return false;
+  }
+  auto inv_det = 1.0f / det;
+  auto s = r.start - vertex_[0].point_;
+  auto u = glm::dot(s, p) * inv_det;
+  if (u < 0.0f || 1.0f < u) {
+    return false;
+  }
+  auto q = glm::cross(s, e1_);
+  auto v = glm::dot(r.dir, q) * inv_det;
+  if (v < 0.0f || 1.0f < u + v) {
+    return false;
+  }
+  auto t = glm::dot(e2_, q) * inv_det;
+  if (t < kRayMin || kRayMax < t) {
+    return false;
+  }
+  auto pos = r.At(t);
+  auto ray_dist = glm::distance(pos, r.start);
+  if (ray_dist >= closest.dist) {
+    return false;
+  }
+  closest.dist = ray_dist;
+  closest.front_face = glm::dot(r.dir, face_norm_) < 0.0f;
+  closest.shape = 0;
+  closest.pos = pos;
+  // 頂点法線の補間
+  auto w = 1.0f - u - v;
+  auto shading_norm = glm::normalize(w * vertex_[0].normal_ + u * vertex_[1].normal_ + v * vertex_[2].normal_);
+  closest.norm = closest.front_face ? shading_norm : -shading_norm;
+  closest.uv = glm::vec2(w * vertex_[0].u_ + u * vertex_[1].u_ + v * vertex_[2].u_,
+                         w * vertex_[0].v_ + u * vertex_[1].v_ + v * vertex_[2].v_);
+  closest.tangent = tangent_;
+  closest.uv_scale = uv_scale_;
+  closest.material = material_;
+  return true;
+}
@@ -0,0 +1,203 @@
+#include "profiler.h"
+#include <map>
+
+void Profiler::InitTimestamps(Device device, Queue queue) {
+  device_ = device;
+  queue_ = queue;
+  QuerySetDescriptor query_set_desc = Default;
+  query_set_desc.label = "Profiler.timestamps";
+  query_set_desc.type = QueryType::Timestamp;
+  query_set_desc.count = 2 * kMaxPasses;
+  query_set_ = device_.createQuerySet(query_set_desc);
+
+  BufferDescriptor buffer_desc = Default;
+  buffer_desc.size = 2 * kMaxPasses * sizeof(uint64_t);
+  buffer_desc.usage = BufferUsage::QueryResolve | BufferUsage::CopySrc;
+  buffer_desc.label = "Profiler.resolve";
+  resolve_buffer_ = device_.createBuffer(buffer_desc);
+  buffer_desc.usage = BufferUsage::MapRead | BufferUsage::CopyDst;
+  buffer_desc.label = "Profiler.map";
+  map_buffer_ = device_.createBuffer(buffer_desc);
+  pending_passes_.reserve(kMaxPasses);
+}
+
+void Profiler::Release() {
+  if (query_set_) {
+    query_set_.destroy();
+    query_set_.release();
+    resolve_buffer_.destroy();
+    resolve_buffer_.release();
+    map_buffer_.destroy();
+    map_buffer_.release();
+    query_set_ = nullptr;
+  }
+  pending_passes_.clear();
+}
+
+/// \brief Microseconds since the first recorded event, call with mutex_ held
+double Profiler::SinceEpoch(Clock::time_point time) {
+  if (!has_epoch_) {
+    epoch_ = time;
+    has_epoch_ = true;
+  }
+  return std::chrono::duration<double, std::micro>(time - epoch_).count();
+}
+
+/// \brief Small id of the calling thread for the trace, call with mutex_ held
+uint32_t Profiler::ThreadIndex() {
+  return threads_.emplace(std::this_thread::get_id(), (uint32_t) threads_.size()).first->second;
+}
+
+void Profiler::Record(const char *name, Clock::time_point start, Clock::time_point end) {
+  if (!enabled_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  Event event;
+  event.name = name;
+  event.start_us = SinceEpoch(start);
+  event.duration_us = std::chrono::duration<double, std::micro>(end - start).count();
+  event.thread = ThreadIndex();
+  events_.push_back(std::move(event));
+}
+
+uint32_t Profiler::GpuPass(const char *name, ComputePassTimestampWrite *writes) {
+  if (!enabled_ || !query_set_ || pending_passes_.size() >= kMaxPasses) {
+    return 0;
+  }
+  const auto index = (uint32_t) pending_passes_.size();
+  pending_passes_.push_back({name, Clock::now()});
+  writes[0].querySet = query_set_;
+  writes[0].queryIndex = 2 * index;
+  writes[0].location = ComputePassTimestampLocation::Beginning;
+  writes[1].querySet = query_set_;
+  writes[1].queryIndex = 2 * index + 1;
+  writes[1].location = ComputePassTimestampLocation::End;
+  return 2;
+}
+
+void Profiler::Collect(bool force) {
+  if (pending_passes_.empty() || (!force && pending_passes_.size() < kMaxPasses / 2)) {
+    return;
+  }
+  const auto num_queries = 2 * (uint32_t) pending_passes_.size();
+  const auto size = num_queries * sizeof(uint64_t);
+  CommandEncoder encoder = device_.createCommandEncoder(Default);
+  encoder.resolveQuerySet(query_set_, 0, num_queries, resolve_buffer_, 0);
+  encoder.copyBufferToBuffer(resolve_buffer_, 0, map_buffer_, 0, size);
+  CommandBuffer command = encoder.finish(Default);
+  queue_.submit(command);
+  command.release();
+  encoder.release();
+
+  bool done = false;
+  bool mapped = false;
+  auto callback_handle = map_buffer_.mapAsync(MapMode::Read, 0, size, [&](BufferMapAsyncStatus status) {
+      mapped = status == BufferMapAsyncStatus::Success;
+      done = true;
+  });
+  while (!done) {
+    PollDevice(device_, queue_);
+  }
+  if (!mapped) {
+    Error(PrintInfoType::WebGPU, "Timestamp readback failed");
+    pending_passes_.clear();
+    return;
+  }
+  /// Timestamps are in nanoseconds. The GPU clock is aligned with the CPU at the first pass of the batch.
+  const auto *timestamps = (const uint64_t *) map_buffer_.getConstMappedRange(0, size);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto gpu_origin = timestamps[0];
+    const auto cpu_origin = SinceEpoch(pending_passes_[0].cpu_time);
+    for (size_t i = 0; i < pending_passes_.size(); ++i) {
+      const auto begin = timestamps[2 * i];
+      const auto end = timestamps[2 * i + 1];
+      Event event;
+      event.name = pending_passes_[i].name;
+      event.gpu = true;
+      event.start_us = cpu_origin + (double) (int64_t) (begin - gpu_origin) * 1e-3;
+      event.duration_us = end >= begin ? (double) (end - begin) * 1e-3 : 0.0;
+      events_.push_back(std::move(event));
+    }
+  }
+  map_buffer_.unmap();
+  pending_passes_.clear();
+}
+
+bool Profiler::WriteReport(const std::string &base) {
+  Collect(true);
+  std::lock_guard<std::mutex> lock(mutex_);
+  struct Stats {
+      uint32_t count = 0;
+      double total = 0.0;
+      double min = std::numeric_limits<double>::max();
+      double max = 0.0;
+  };
+  /// (gpu, name), ordered for a stable report
+  std::map<std::pair<bool, std::string>, Stats> stats;
+  for (const auto &event: events_) {
+    auto &s = stats[{event.gpu, event.name}];
+    ++s.count;
+    s.total += event.duration_us;
+    s.min = std::min(s.min, event.duration_us);
+    s.max = std::max(s.max, event.duration_us);
+  }
+
+  std::ofstream json(base + ".json");
+  std::ofstream csv(base + ".csv");
+  std::ofstream trace(base + ".trace.json");
+  if (!json || !csv || !trace) {
+    Error(PrintInfoType::WebGPUTracer, "Could not write profile: ", base);
+    return false;
+  }
+  json << "{\n  \"gpu_timestamps\": " << (query_set_ ? "true" : "false") << ",\n  \"passes\": [";
+  csv << "category,name,count,total_ms,mean_ms,min_ms,max_ms\n";
+  bool first = true;
+  for (const auto &[key, s]: stats) {
+    const auto category = key.first ? "gpu" : "cpu";
+    json << (first ? "\n" : ",\n") << "    {\"category\": \"" << category << "\", \"name\": \"" << key.second
+         << "\", \"count\": " << s.count << ", \"total_ms\": " << s.total * 1e-3 << ", \"mean_ms\": " << s.total * 1e-3 / s.count
+         << ", \"min_ms\": " << s.min * 1e-3 << ", \"max_ms\": " << s.max * 1e-3 << "}";
+    csv << category << "," << key.second << "," << s.count << "," << s.total * 1e-3 << "," << s.total * 1e-3 / s.count
+        << "," << s.min * 1e-3 << "," << s.max * 1e-3 << "\n";
+    first = false;
+  }
+  json << "\n  ]\n}\n";
+
+  /// CPU spans in process 1 (one track per thread), GPU passes in process 2
+  trace << "{\"traceEvents\": [";
+  first = true;
+  for (const auto &event: events_) {
+    trace << (first ? "\n" : ",\n") << "  {\"name\": \"" << event.name << "\", \"cat\": \"" << (event.gpu ? "gpu" : "cpu")
+          << "\", \"ph\": \"X\", \"ts\": " << std::fixed << event.start_us << ", \"dur\": " << event.duration_us
+          << ", \"pid\": " << (event.gpu ? 2 : 1) << ", \"tid\": " << event.thread << "}" << std::defaultfloat;
+    first = false;
+  }
+  trace << "\n]}\n";
+
+  Print(PrintInfoType::WebGPUTracer, "Profile: ", base + ".json");
+  events_.clear();
+  has_epoch_ = false;
+  return true;
+}
+
+bool WritePathStats(const std::string &path, const std::vector<uint64_t> &paths_per_depth) {
+  std::ofstream csv(path);
+  if (!csv) {
+    Error(PrintInfoType::WebGPUTracer, "Could not write path statistics: ", path);
+    return false;
+  }
+  uint64_t total = 0;
+  for (auto paths: paths_per_depth) {
+    total += paths;
+  }
+  csv << "depth,paths,survival,work\n";
+  for (size_t depth = 0; depth < paths_per_depth.size(); ++depth) {
+    const auto paths = paths_per_depth[depth];
+    const auto previous = depth > 0 ? paths_per_depth[depth - 1] : paths;
+    csv << depth << "," << paths << "," << (previous > 0 ? (double) paths / (double) previous : 0.0) << ","
+        << (total > 0 ? (double) paths / (double) total : 0.0) << "\n";
+  }
+  return true;
+}
@@ -1,16 +1,25 @@
 #include "renderer.h"
 #include "camera.h"
-#include "utils/save_texture.h"
 #include "utils/util.h"
+#include "stb_image_write.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <imgui.h>
 #include <backends/imgui_impl_wgpu.h>
 #include <backends/imgui_impl_glfw.h>
 
 /// \brief Initialize function
-/// \param hasWindow Uses window by glfw if true
+/// \param hasWindow Uses window by glfw if true, otherwise sets up the compute path tracer
+/// \param config render settings
+/// \param scene scene of the compute path tracer
 /// \return whether properly initialized
-bool Renderer::OnInit(bool hasWindow) {
+bool Renderer::OnInit(bool hasWindow, const RenderConfig &config, const SceneDesc &scene) {
   hasWindow_ = hasWindow;
+  config_ = config;
+  profiler_.SetEnabled(!config_.profile.empty());
+  scene_desc_ = scene;
+  texture_size_ = {config_.width, config_.height, 1};
   if (hasWindow_) {
     /// Initialize GLFW
     if (!glfwInit()) {
@@ -20,7 +29,7 @@ bool Renderer::OnInit(bool hasWindow) {
     /// Create Window
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-    window_ = glfwCreateWindow(WIDTH, HEIGHT, "WebGPUTracer (_)=---=(_)", NULL, NULL);
+    window_ = glfwCreateWindow((int) config_.width, (int) config_.height, "WebGPUTracer (_)=---=(_)", NULL, NULL);
     if (!window_) {
       Error(PrintInfoType::GLFW, "Could not open window!");
       return false;
@@ -28,22 +37,31 @@ bool Renderer::OnInit(bool hasWindow) {
   }
 
   if (!InitDevice()) return false;
-  // InitTexture();
-  // InitTextureViews();
   if (hasWindow_) {
     InitSwapChain();
     InitRenderPipeline();
     InitDepthBuffer();
     InitDepthTextureView();
+    InitBuffers();
+    InitBindGroup();
+  } else {
+    InitComputeBindGroupLayout();
+    InitSamplerTables();
+    InitComputePipeline();
+    denoiser_.Init(device_, device_limits_);
+    if (!InitFrameResources()) return false;
+    frame_writer_.Init(device_, queue_, config_.readback_ring_size, &profiler_);
   }
-  // InitComputePipeline();
-  InitBuffers();
-  InitBindGroup();
   /// TODO: Gui
   // if (!InitGui()) return false;
   return true;
 }
 
+/// \brief Headless initialization (RenderBackend)
+bool Renderer::OnInit(const RenderConfig &config, const SceneDesc &scene) {
+  return OnInit(false, config, scene);
+}
+
 /// \brief WebGPU Device setup
 /// \return
 bool Renderer::InitDevice() {
@@ -81,7 +99,8 @@ bool Renderer::InitDevice() {
   // Without this, wgpu-native crashes
   requiredLimits.limits.maxVertexAttributes = 2;
   requiredLimits.limits.maxVertexBuffers = 1;
-  requiredLimits.limits.maxBufferSize = 15 * 5 * sizeof(float);
+  // Accumulation buffer and scene buffers grow with the resolution and the scene, InitTiles checks the former
+  requiredLimits.limits.maxBufferSize = supported_limits.limits.maxBufferSize;
   requiredLimits.limits.maxVertexBufferArrayStride = 6 * sizeof(float);
   // This must be set even if we do not use storage buffers for now
   requiredLimits.limits.minStorageBufferOffsetAlignment = supported_limits.limits.minStorageBufferOffsetAlignment;
@@ -89,18 +108,32 @@ bool Renderer::InitDevice() {
   requiredLimits.limits.minUniformBufferOffsetAlignment = supported_limits.limits.minUniformBufferOffsetAlignment;
   // Number of components transiting from vertex to fragment shader
   requiredLimits.limits.maxInterStageShaderComponents = 3;
-  requiredLimits.limits.maxBindGroups = 1;
-  requiredLimits.limits.maxUniformBuffersPerShaderStage = 1;
-  requiredLimits.limits.maxUniformBufferBindingSize = 16 * 4;
+  // Compute: camera, scene, output, sampler tables
+  requiredLimits.limits.maxBindGroups = 4;
+  // Camera + TileParam (+ WaveParam) + Sobol matrices
+  requiredLimits.limits.maxUniformBuffersPerShaderStage = 4;
+  requiredLimits.limits.maxUniformBufferBindingSize = sizeof(uint32_t) * SamplerTables::kSobolBits * SamplerTables::kSobolDimensions;
+  // Tile accumulation range and TileParam (and the WaveParam of a bounce) are selected with dynamic offsets
+  requiredLimits.limits.maxDynamicUniformBuffersPerPipelineLayout = 2;
+  requiredLimits.limits.maxDynamicStorageBuffersPerPipelineLayout = 1;
   // For the depth buffer, we enable texture
-  requiredLimits.limits.maxTextureDimension1D = WIDTH;
-  requiredLimits.limits.maxTextureDimension2D = HEIGHT;
+  // Adapter maximum, so that later shots of a batch can change the resolution
+  requiredLimits.limits.maxTextureDimension1D = supported_limits.limits.maxTextureDimension1D;
+  requiredLimits.limits.maxTextureDimension2D = supported_limits.limits.maxTextureDimension2D;
   // Cannot be 4096 on local macOS (wgpu-native)
   requiredLimits.limits.maxTextureDimension3D = 2048;
-  requiredLimits.limits.maxTextureArrayLayers = 1;
-  requiredLimits.limits.maxStorageBuffersPerShaderStage = 3;
-  requiredLimits.limits.maxStorageBufferBindingSize = WIDTH * HEIGHT * sizeof(float);;
-  requiredLimits.limits.maxStorageTexturesPerShaderStage = 1;
+  // Every texture map of the scene is a layer of one array (Scene::CreateTextureArray)
+  requiredLimits.limits.maxTextureArrayLayers = supported_limits.limits.maxTextureArrayLayers;
+  // Scene (lights, quads, spheres, bvh nodes, bvh prims, tris, light nodes, instances, materials) + accumBuffer + path_stats,
+  // the wavefront kernels also bind path state and ray queues where the adapter allows it
+  requiredLimits.limits.maxStorageBuffersPerShaderStage = std::clamp(supported_limits.limits.maxStorageBuffersPerShaderStage, 11u, WavefrontIntegrator::kStorageBuffers);
+  // Only one tile of the accumulation buffer is bound at a time, scene buffers are bound whole
+  requiredLimits.limits.maxStorageBufferBindingSize = supported_limits.limits.maxStorageBufferBindingSize;
+  requiredLimits.limits.maxStorageTexturesPerShaderStage = 4;
+  // Blue-noise tile and the texture array of the scene, temporal accumulation reads the frame and its history with their G-buffers
+  requiredLimits.limits.maxSampledTexturesPerShaderStage = 4;
+  // Texture maps
+  requiredLimits.limits.maxSamplersPerShaderStage = 1;
   // For Compute Pipeline
   // requiredLimits.limits.maxComputeWorkgroupSizeX = 32;
   // requiredLimits.limits.maxComputeWorkgroupSizeY = 32;
@@ -108,13 +141,21 @@ bool Renderer::InitDevice() {
   // requiredLimits.limits.maxComputeInvocationsPerWorkgroup = 256;
   // requiredLimits.limits.maxComputeWorkgroupsPerDimension = 32;
   // Minimal descriptor setting
+  // GPU pass timings, the profiler falls back to CPU spans without them
+  const bool has_timestamps = adapter_.hasFeature(FeatureName::TimestampQuery);
+  std::vector<WGPUFeatureName> required_features;
+  if (has_timestamps) {
+    required_features.push_back(FeatureName::TimestampQuery);
+  }
   DeviceDescriptor device_desc = {};
   device_desc.label = "WebGPUTracer Device";
-  device_desc.requiredFeaturesCount = 0;
+  device_desc.requiredFeaturesCount = required_features.size();
+  device_desc.requiredFeatures = required_features.data();
   device_desc.requiredLimits = &requiredLimits;
   device_desc.defaultQueue.label = "Default Queue";
   device_ = adapter_.requestDevice(device_desc);
   Print(PrintInfoType::WebGPU, "Got device: ", device_);
+  device_limits_ = requiredLimits.limits;
 
   // Error handling
   auto onDeviceError = [](WGPUErrorType type, char const *message, void * /* pUserData */) {
@@ -132,14 +173,29 @@ bool Renderer::InitDevice() {
   }, nullptr);
 #endif
 
-  // TODO: Leave this for Compute Pipeline
-  /// Initialize Camera
-  // camera_ = Camera(device_, SPP);
-  /// Initialize Scene
-  // scene_ = Scene(device_);
+  if (!hasWindow_) {
+    /// Initialize Camera
+    camera_ = Camera(device_, config_.spp);
+    camera_.SetDepth(config_.max_depth, config_.rr_depth, config_.path_stats);
+    camera_.SetLightTree(config_.light_sampling == LightSampling::Tree);
+    camera_.SetSampler((uint32_t) config_.sampler);
+    camera_.SetAdaptiveThreshold(config_.adaptive_threshold);
+    camera_.SetGBuffer(config_.GBuffer());
+    camera_.SetTrack(scene_desc_.animation.camera);
+    /// Initialize Scene
+    auto span = profiler_.Scope("scene upload");
+    scene_ = Scene(device_, scene_desc_);
+    camera_.SetCompactGeometry(scene_.CompactLayout());
+  }
 
   /// Get device queue
   queue_ = device_.getQueue();
+  submissions_.Init(device_, queue_, config_.max_in_flight);
+  if (has_timestamps) {
+    profiler_.InitTimestamps(device_, queue_);
+  } else if (profiler_.Enabled()) {
+    Print(PrintInfoType::WebGPU, "timestamp-query is not supported by the adapter, profiling CPU spans only");
+  }
 #ifdef WEBGPU_BACKEND_DAWN
   instance_.processEvents();
 #endif
@@ -183,8 +239,8 @@ void Renderer::InitTextureViews() {
 void Renderer::InitSwapChain() {
   SwapChainDescriptor swap_chain_desc = {};
   swap_chain_desc.nextInChain = nullptr;
-  swap_chain_desc.width = WIDTH;
-  swap_chain_desc.height = HEIGHT;
+  swap_chain_desc.width = config_.width;
+  swap_chain_desc.height = config_.height;
   /// Texture format
 #ifdef WEBGPU_BACKEND_WGPU
   swap_chain_format_ = surface_.getPreferredFormat(adapter_);
@@ -353,12 +409,13 @@ void Renderer::InitComputePipeline() {
   PipelineLayoutDescriptor layout_desc{};
   std::vector<WGPUBindGroupLayout> bind_group_layouts{camera_.GetUniforms().bind_group_layout_,
                                                       scene_.objects_.bind_group_layout_,
-                                                      bind_group_layout_};
-  layout_desc.bindGroupLayoutCount = 3;
+                                                      compute_bind_group_layout_,
+                                                      sampler_bind_group_layout_};
+  layout_desc.bindGroupLayoutCount = (uint32_t) bind_group_layouts.size();
   layout_desc.bindGroupLayouts = (WGPUBindGroupLayout *) bind_group_layouts.data();
   Print(PrintInfoType::WebGPU, "Creating pipeline layout ...");
-  pipeline_layout_ = device_.createPipelineLayout(layout_desc);
-  Print(PrintInfoType::WebGPU, "Compute pipeline: ", pipeline_layout_);
+  compute_pipeline_layout_ = device_.createPipelineLayout(layout_desc);
+  Print(PrintInfoType::WebGPU, "Compute pipeline layout: ", compute_pipeline_layout_);
 
   /// Compute pipeline setup
   ComputePipelineDescriptor pipeline_desc;
@@ -366,11 +423,341 @@ void Renderer::InitComputePipeline() {
   pipeline_desc.compute.constants = nullptr;
   pipeline_desc.compute.entryPoint = "compute_sample";
   pipeline_desc.compute.module = shader_module;
-  pipeline_desc.layout = pipeline_layout_;
+  pipeline_desc.layout = compute_pipeline_layout_;
   /// Create a compute pipeline
   Print(PrintInfoType::WebGPU, "Creating compute pipeline ...");
   compute_pipeline_ = device_.createComputePipeline(pipeline_desc);
   Print(PrintInfoType::WebGPU, "Compute pipeline: ", compute_pipeline_);
+  /// Resolve pipeline (accumulation buffer -> output texture)
+  pipeline_desc.compute.entryPoint = "resolve";
+  resolve_pipeline_ = device_.createComputePipeline(pipeline_desc);
+  Print(PrintInfoType::WebGPU, "Resolve pipeline: ", resolve_pipeline_);
+  /// Adaptive sampling pipeline (one workgroup per tile)
+  pipeline_desc.compute.entryPoint = "adaptive_update";
+  adaptive_pipeline_ = device_.createComputePipeline(pipeline_desc);
+  Print(PrintInfoType::WebGPU, "Adaptive pipeline: ", adaptive_pipeline_);
+  shader_module.release();
+}
+
+/// \brief Resources depending on the resolution and the tile size
+/// \return false if the resolution cannot be rendered on this device
+bool Renderer::InitFrameResources() {
+  texture_size_ = {config_.width, config_.height, 1};
+  if (!InitTiles(device_limits_)) return false;
+  InitTexture();
+  InitTextureViews();
+  InitTileBuffer();
+  InitAccumulationBuffer();
+  InitPathStatsBuffer();
+  InitTileSummaryBuffer();
+  denoiser_.InitFrameResources(config_.width, config_.height, config_.GBuffer(), config_.temporal_frames > 0, output_texture_view_);
+  InitComputeBindGroup();
+  if (config_.kernel == KernelMode::Wavefront) {
+    if (!wavefront_.Ready() && !wavefront_.Init(device_, camera_.GetUniforms().bind_group_layout_, scene_.objects_.bind_group_layout_,
+                                                 sampler_bind_group_layout_, device_limits_)) {
+      return false;
+    }
+    return wavefront_.InitFrameResources(tile_size_, config_.max_depth, accum_buffer_, accum_tile_stride_, output_texture_view_,
+                                         tile_param_buffer_, sizeof(TileParam), path_stats_buffer_, config_.path_stats,
+                                         denoiser_.AlbedoView(), denoiser_.NormalDepthView());
+  }
+  return true;
+}
+
+void Renderer::ReleaseFrameResources() {
+  wavefront_.ReleaseFrameResources();
+  denoiser_.ReleaseFrameResources();
+  compute_bind_group_.release();
+  tile_summary_buffer_.destroy();
+  tile_summary_buffer_.release();
+  path_stats_buffer_.destroy();
+  path_stats_buffer_.release();
+  accum_buffer_.destroy();
+  accum_buffer_.release();
+  tile_param_buffer_.destroy();
+  tile_param_buffer_.release();
+  output_texture_view_.release();
+  texture_.destroy();
+  texture_.release();
+}
+
+/// \brief Switch to the next shot of a batch
+/// Device, pipelines and bind group layouts are kept. Frame resources are rebuilt only when the
+/// resolution, tile size, kernel, depth or the path counters of the wave kernels change, the scene only when its
+/// description changes.
+/// \param config render settings of the shot
+/// \param scene scene of the shot
+/// \return false if the shot cannot be rendered on this device
+bool Renderer::SetShot(const RenderConfig &config, const SceneDesc &scene) {
+  // Nothing queued may still reference the resources replaced below
+  submissions_.WaitAll();
+  frame_writer_.Flush();
+  const bool resize = config.width != config_.width || config.height != config_.height || config.tile_size != config_.tile_size ||
+                     config.kernel != config_.kernel || config.max_depth != config_.max_depth ||
+                     config.GBuffer() != config_.GBuffer() || (config.temporal_frames > 0) != (config_.temporal_frames > 0) ||
+                     (config.kernel == KernelMode::Wavefront && config.path_stats != config_.path_stats);
+  config_ = config;
+  profiler_.SetEnabled(!config_.profile.empty());
+  camera_.SetSpp(config_.spp);
+  camera_.SetDepth(config_.max_depth, config_.rr_depth, config_.path_stats);
+  camera_.SetLightTree(config_.light_sampling == LightSampling::Tree);
+  camera_.SetSampler((uint32_t) config_.sampler);
+  camera_.SetAdaptiveThreshold(config_.adaptive_threshold);
+  camera_.SetGBuffer(config_.GBuffer());
+  camera_.SetTrack(scene.animation.camera);
+  denoiser_.ResetHistory();
+  submissions_.Init(device_, queue_, config_.max_in_flight);
+  frame_writer_.Init(device_, queue_, config_.readback_ring_size, &profiler_);
+  if (scene != scene_desc_) {
+    auto span = profiler_.Scope("scene upload");
+    scene_desc_ = scene;
+    scene_.Reload(device_, scene_desc_);
+    camera_.SetCompactGeometry(scene_.CompactLayout());
+  }
+  if (resize) {
+    ReleaseFrameResources();
+    return InitFrameResources();
+  }
+  return true;
+}
+
+/// \brief Split the output into tiles and check the resolution against the device
+/// \param limits device limits
+/// \return false if the resolution cannot be rendered on this device
+bool Renderer::InitTiles(const Limits &limits) {
+  auto align = [](uint64_t size, uint64_t alignment) { return (size + alignment - 1) / alignment * alignment; };
+  const auto width = config_.width;
+  const auto height = config_.height;
+  tile_size_ = (uint32_t) align(std::clamp(config_.tile_size, WORKGROUP_SIZE, std::max(width, height)), WORKGROUP_SIZE);
+  tiles_.clear();
+  all_tiles_.clear();
+  for (uint32_t y = 0; y < height; y += tile_size_) {
+    for (uint32_t x = 0; x < width; x += tile_size_) {
+      TileParam tile{};
+      tile.origin[0] = x;
+      tile.origin[1] = y;
+      tile.size[0] = std::min(tile_size_, width - x);
+      tile.size[1] = std::min(tile_size_, height - y);
+      tile.stride = tile_size_;
+      all_tiles_.push_back((uint32_t) tiles_.size());
+      tiles_.push_back(tile);
+    }
+  }
+  tile_param_stride_ = (uint32_t) align(sizeof(TileParam), limits.minUniformBufferOffsetAlignment);
+  /// Accumulation and moments planes, then the TileSummary
+  accum_tile_stride_ = align((2 * (uint64_t) tile_size_ * tile_size_ + 1) * 4 * sizeof(float), limits.minStorageBufferOffsetAlignment);
+  accum_buffer_size_ = accum_tile_stride_ * tiles_.size();
+
+  if (std::max(width, height) > limits.maxTextureDimension2D) {
+    Error(PrintInfoType::WebGPUTracer, "Resolution exceeds maxTextureDimension2D: ", limits.maxTextureDimension2D);
+    return false;
+  }
+  if (accum_buffer_size_ > limits.maxBufferSize) {
+    Error(PrintInfoType::WebGPUTracer, "Accumulation buffer exceeds maxBufferSize: ", limits.maxBufferSize);
+    return false;
+  }
+  if (accum_tile_stride_ > limits.maxStorageBufferBindingSize) {
+    Error(PrintInfoType::WebGPUTracer, "Tile too large for maxStorageBufferBindingSize: ", limits.maxStorageBufferBindingSize);
+    return false;
+  }
+  std::ostringstream sout;
+  sout << width << "x" << height << ", " << tiles_.size() << " tiles of " << tile_size_ << "px";
+  Print(PrintInfoType::WebGPUTracer, "Tiles: ", sout.str());
+  return true;
+}
+
+/// \brief Uniform buffer holding one TileParam per tile
+void Renderer::InitTileBuffer() {
+  BufferDescriptor buffer_desc{};
+  buffer_desc.mappedAtCreation = true;
+  buffer_desc.size = (uint64_t) tile_param_stride_ * tiles_.size();
+  buffer_desc.usage = BufferUsage::Uniform;
+  buffer_desc.label = "Renderer.tile_param_buffer_";
+  tile_param_buffer_ = device_.createBuffer(buffer_desc);
+  auto *mapping = (uint8_t *) tile_param_buffer_.getMappedRange(0, buffer_desc.size);
+  std::fill(mapping, mapping + buffer_desc.size, 0);
+  for (size_t i = 0; i < tiles_.size(); ++i) {
+    std::memcpy(mapping + i * tile_param_stride_, &tiles_[i], sizeof(TileParam));
+  }
+  tile_param_buffer_.unmap();
+  Print(PrintInfoType::WebGPU, "Tile param buffer: ", tile_param_buffer_);
+}
+
+/// \brief Accumulation buffer for progressive rendering
+void Renderer::InitAccumulationBuffer() {
+  BufferDescriptor buffer_desc{};
+  buffer_desc.mappedAtCreation = false;
+  buffer_desc.size = accum_buffer_size_;
+  buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopySrc;
+  buffer_desc.label = "Renderer.accum_buffer_";
+  accum_buffer_ = device_.createBuffer(buffer_desc);
+  Print(PrintInfoType::WebGPU, "Accumulation buffer: ", accum_buffer_);
+}
+
+/// \brief Paths entering every bounce, one 64-bit counter (two words) per depth
+void Renderer::InitPathStatsBuffer() {
+  BufferDescriptor buffer_desc{};
+  buffer_desc.mappedAtCreation = false;
+  buffer_desc.size = PathStatsSize();
+  buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopySrc | BufferUsage::CopyDst;
+  buffer_desc.label = "Renderer.path_stats_buffer_";
+  path_stats_buffer_ = device_.createBuffer(buffer_desc);
+}
+
+/// \brief Readback of the TileSummary of every tile (adaptive sampling)
+void Renderer::InitTileSummaryBuffer() {
+  BufferDescriptor buffer_desc{};
+  buffer_desc.mappedAtCreation = false;
+  buffer_desc.size = sizeof(TileSummary) * tiles_.size();
+  buffer_desc.usage = BufferUsage::CopyDst | BufferUsage::MapRead;
+  buffer_desc.label = "Renderer.tile_summary_buffer_";
+  tile_summary_buffer_ = device_.createBuffer(buffer_desc);
+}
+
+/// \brief BindGroupLayout of the compute outputs (group 2)
+void Renderer::InitComputeBindGroupLayout() {
+  std::vector<BindGroupLayoutEntry> bindings(7, Default);
+  /// Accumulation buffer (one tile)
+  bindings[0].binding = 0;
+  bindings[0].buffer.type = BufferBindingType::Storage;
+  bindings[0].buffer.hasDynamicOffset = true;
+  bindings[0].visibility = ShaderStage::Compute;
+  /// Output texture
+  bindings[1].binding = 1;
+  bindings[1].storageTexture.access = StorageTextureAccess::WriteOnly;
+  bindings[1].storageTexture.format = TextureFormat::RGBA8Unorm;
+  bindings[1].storageTexture.viewDimension = TextureViewDimension::_2D;
+  bindings[1].visibility = ShaderStage::Compute;
+  /// TileParam
+  bindings[2].binding = 2;
+  bindings[2].buffer.type = BufferBindingType::Uniform;
+  bindings[2].buffer.hasDynamicOffset = true;
+  bindings[2].buffer.minBindingSize = sizeof(TileParam);
+  bindings[2].visibility = ShaderStage::Compute;
+  /// Path statistics
+  bindings[3].binding = 6;
+  bindings[3].buffer.type = BufferBindingType::Storage;
+  bindings[3].visibility = ShaderStage::Compute;
+  /// Denoiser radiance and G-buffer
+  const std::array<std::pair<uint32_t, TextureFormat>, 3> denoise_textures{{{7, TextureFormat::RGBA32Float},
+                                                                            {8, TextureFormat::RGBA16Float},
+                                                                            {9, TextureFormat::RGBA32Float}}};
+  for (size_t i = 0; i < denoise_textures.size(); ++i) {
+    auto &binding = bindings[4 + i];
+    binding.binding = denoise_textures[i].first;
+    binding.storageTexture.access = StorageTextureAccess::WriteOnly;
+    binding.storageTexture.format = denoise_textures[i].second;
+    binding.storageTexture.viewDimension = TextureViewDimension::_2D;
+    binding.visibility = ShaderStage::Compute;
+  }
+  BindGroupLayoutDescriptor bind_group_layout_desc{};
+  bind_group_layout_desc.entryCount = (uint32_t) bindings.size();
+  bind_group_layout_desc.entries = bindings.data();
+  bind_group_layout_desc.label = "Renderer.compute_bind_group_layout_";
+  compute_bind_group_layout_ = device_.createBindGroupLayout(bind_group_layout_desc);
+}
+
+/// \brief BindGroup of the compute outputs (group 2)
+void Renderer::InitComputeBindGroup() {
+  std::vector<BindGroupEntry> entries(7, Default);
+  entries[0].binding = 0;
+  entries[0].buffer = accum_buffer_;
+  entries[0].offset = 0;
+  entries[0].size = accum_tile_stride_;
+  entries[1].binding = 1;
+  entries[1].textureView = output_texture_view_;
+  entries[2].binding = 2;
+  entries[2].buffer = tile_param_buffer_;
+  entries[2].offset = 0;
+  entries[2].size = sizeof(TileParam);
+  entries[3].binding = 6;
+  entries[3].buffer = path_stats_buffer_;
+  entries[3].offset = 0;
+  entries[3].size = PathStatsSize();
+  entries[4].binding = 7;
+  entries[4].textureView = denoiser_.RadianceView();
+  entries[5].binding = 8;
+  entries[5].textureView = denoiser_.AlbedoView();
+  entries[6].binding = 9;
+  entries[6].textureView = denoiser_.NormalDepthView();
+  BindGroupDescriptor bind_group_desc;
+  bind_group_desc.layout = compute_bind_group_layout_;
+  bind_group_desc.entryCount = (uint32_t) entries.size();
+  bind_group_desc.entries = (WGPUBindGroupEntry *) entries.data();
+  compute_bind_group_ = device_.createBindGroup(bind_group_desc);
+  Print(PrintInfoType::WebGPU, "Compute bind group: ", compute_bind_group_);
+}
+
+/// \brief Lookup tables of the quasi-random samplers (group 3), uploaded once per Renderer
+void Renderer::InitSamplerTables() {
+  const auto &tables = SamplerTables::Shared();
+  std::vector<BindGroupLayoutEntry> bindings(2, Default);
+  /// Sobol generator matrices
+  bindings[0].binding = 0;
+  bindings[0].buffer.type = BufferBindingType::Uniform;
+  bindings[0].buffer.minBindingSize = sizeof(tables.SobolMatrices());
+  bindings[0].visibility = ShaderStage::Compute;
+  /// Blue-noise tile, read with textureLoad
+  bindings[1].binding = 1;
+  bindings[1].texture.sampleType = TextureSampleType::UnfilterableFloat;
+  bindings[1].texture.viewDimension = TextureViewDimension::_2D;
+  bindings[1].visibility = ShaderStage::Compute;
+  BindGroupLayoutDescriptor bind_group_layout_desc{};
+  bind_group_layout_desc.entryCount = (uint32_t) bindings.size();
+  bind_group_layout_desc.entries = bindings.data();
+  bind_group_layout_desc.label = "Renderer.sampler_bind_group_layout_";
+  sampler_bind_group_layout_ = device_.createBindGroupLayout(bind_group_layout_desc);
+
+  BufferDescriptor buffer_desc{};
+  buffer_desc.mappedAtCreation = false;
+  buffer_desc.size = sizeof(tables.SobolMatrices());
+  buffer_desc.usage = BufferUsage::Uniform | BufferUsage::CopyDst;
+  buffer_desc.label = "Renderer.sobol_buffer_";
+  sobol_buffer_ = device_.createBuffer(buffer_desc);
+  queue_.writeBuffer(sobol_buffer_, 0, tables.SobolMatrices().data(), buffer_desc.size);
+
+  TextureDescriptor texture_desc;
+  texture_desc.dimension = TextureDimension::_2D;
+  texture_desc.format = TextureFormat::R32Float;
+  texture_desc.size = {SamplerTables::kBlueNoiseSize, SamplerTables::kBlueNoiseSize, 1};
+  texture_desc.sampleCount = 1;
+  texture_desc.viewFormatCount = 0;
+  texture_desc.viewFormats = nullptr;
+  texture_desc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+  texture_desc.mipLevelCount = 1;
+  texture_desc.label = "Renderer.blue_noise_texture_";
+  blue_noise_texture_ = device_.createTexture(texture_desc);
+  ImageCopyTexture destination = Default;
+  destination.texture = blue_noise_texture_;
+  TextureDataLayout data_layout = Default;
+  data_layout.bytesPerRow = SamplerTables::kBlueNoiseSize * sizeof(float);
+  data_layout.rowsPerImage = SamplerTables::kBlueNoiseSize;
+  queue_.writeTexture(destination, tables.BlueNoise().data(), tables.BlueNoise().size() * sizeof(float), data_layout,
+                      texture_desc.size);
+  TextureViewDescriptor texture_view_desc;
+  texture_view_desc.aspect = TextureAspect::All;
+  texture_view_desc.baseArrayLayer = 0;
+  texture_view_desc.arrayLayerCount = 1;
+  texture_view_desc.dimension = TextureViewDimension::_2D;
+  texture_view_desc.format = TextureFormat::R32Float;
+  texture_view_desc.mipLevelCount = 1;
+  texture_view_desc.baseMipLevel = 0;
+  texture_view_desc.label = "Blue Noise View";
+  blue_noise_view_ = blue_noise_texture_.createView(texture_view_desc);
+
+  std::vector<BindGroupEntry> entries(2, Default);
+  entries[0].binding = 0;
+  entries[0].buffer = sobol_buffer_;
+  entries[0].offset = 0;
+  entries[0].size = buffer_desc.size;
+  entries[1].binding = 1;
+  entries[1].textureView = blue_noise_view_;
+  BindGroupDescriptor bind_group_desc;
+  bind_group_desc.layout = sampler_bind_group_layout_;
+  bind_group_desc.entryCount = (uint32_t) entries.size();
+  bind_group_desc.entries = (WGPUBindGroupEntry *) entries.data();
+  sampler_bind_group_ = device_.createBindGroup(bind_group_desc);
+  Print(PrintInfoType::WebGPU, "Sampler bind group: ", sampler_bind_group_);
 }
 
 /// \brief WebGPU Buffer setup
@@ -429,6 +816,12 @@ void Renderer::InitBindGroup() {
 /// \brief Compute pass
 bool Renderer::OnCompute(uint32_t start_frame, uint32_t end_frame) {
   Print(PrintInfoType::WebGPUTracer, "Running compute pass ...");
+  std::error_code ec;
+  fs::create_directories(config_.output_dir, ec);
+  if (ec) {
+    Error(PrintInfoType::WebGPUTracer, "Could not create output directory: ", config_.output_dir);
+    return false;
+  }
   auto success = false;
   // chrono変数
   std::chrono::system_clock::time_point start, end;
@@ -437,7 +830,11 @@ bool Renderer::OnCompute(uint32_t start_frame, uint32_t end_frame) {
   for (uint32_t i = start_frame - 1; i < end_frame; ++i) {
     success = OnRender(i);
   }
-  queue_.release();
+  // Frames still in readback or encoding
+  success = frame_writer_.Flush() && success;
+  if (profiler_.Enabled()) {
+    success = profiler_.WriteReport(config_.profile) && success;
+  }
   // 時間計測終了
   end = std::chrono::system_clock::now();
   // 経過時間の算出
@@ -448,68 +845,322 @@ bool Renderer::OnCompute(uint32_t start_frame, uint32_t end_frame) {
   return success;
 }
 
+/// \brief Render one frame progressively
+/// Samples are accumulated in chunks of config_.samples_per_dispatch so that a single
+/// dispatch stays short, previews can be written and the frame can stop at a time budget.
+/// The finished frame is handed to frame_writer_, so its readback overlaps with the next frame.
+/// \param frame frame number
+/// \return whether the frame was queued
 bool Renderer::OnRender(uint32_t frame) {
+  auto span = profiler_.Scope("frame");
   // chrono変数
   std::chrono::system_clock::time_point start, end;
   // 時間計測開始
   start = std::chrono::system_clock::now();
   float t = (float) frame / (float) MAX_FRAME;
+  /// Move animated objects, only what moved is written (ordered before this frame's dispatches by the queue)
+  {
+    auto animate_span = profiler_.Scope("scene animate");
+    if (scene_.Animate(t)) {
+      scene_.WriteDirty(queue_);
+    }
+  }
   /// Update camera
-  float aspect = (float) WIDTH / (float) HEIGHT;
-  camera_.Update(queue_, t, aspect);
-
-  // Initialize a command encoder
-  CommandEncoderDescriptor encoder_desc = Default;
-  CommandEncoder encoder = device_.createCommandEncoder(encoder_desc);
+  float aspect = (float) config_.width / (float) config_.height;
+  camera_.Update(queue_, t, aspect, config_.SamplerSeed(frame));
+  if (config_.GBuffer()) {
+    const float pixel_angle = 2.0f * std::tan(0.5f * glm::radians(camera_.Param().fovy)) / (float) config_.height;
+    denoiser_.SetParams(queue_, config_, pixel_angle);
+  }
+  if (config_.temporal_frames > 0) {
+    denoiser_.SetTemporalParams(queue_, config_, Camera::ViewOf(camera_.Param(), config_.width, config_.height));
+  }
 
-  // Create compute pass
-  ComputePassDescriptor compute_pass_desc;
-  compute_pass_desc.timestampWriteCount = 0;
-  compute_pass_desc.timestampWrites = nullptr;
-  ComputePassEncoder compute_pass = encoder.beginComputePass(compute_pass_desc);
-
-  // Use compute pass
-  compute_pass.setPipeline(compute_pipeline_);
-  compute_pass.setBindGroup(0, camera_.GetUniforms().bind_group_, 0, nullptr);
-  compute_pass.setBindGroup(1, scene_.objects_.bind_group_, 0, nullptr);
-  compute_pass.setBindGroup(2, bind_group_, 0, nullptr);
-
-  uint32_t invocation_count_x = texture_size_.width;
-  uint32_t invocation_count_y = texture_size_.height;
-  uint32_t workgroup_size_x = 16;
-  uint32_t workgroup_size_y = 16;
-  // This ceils invocationCountX / workgroupSizePerDim
-  uint32_t workgroup_count_x = (invocation_count_x + workgroup_size_x - 1) / workgroup_size_x;
-  uint32_t workgroup_count_y = (invocation_count_y + workgroup_size_y - 1) / workgroup_size_y;
-  compute_pass.dispatchWorkgroups(workgroup_count_x, workgroup_count_y, 1);
-
-  // Finalize compute pass
-  compute_pass.end();
-
-  // Encode and submit the GPU commands
-  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
-  queue_.submit(commands);
+  const auto frame_name = RenderConfig::FrameName(frame);
+  if (config_.path_stats) {
+    const std::vector<uint8_t> zeros(PathStatsSize(), 0);
+    queue_.writeBuffer(path_stats_buffer_, 0, zeros.data(), zeros.size());
+  }
+  const uint32_t spp = config_.spp;
+  const bool adaptive = config_.adaptive_threshold > 0.0f;
+  active_tiles_ = all_tiles_;
+  tile_summaries_.assign(tiles_.size(), TileSummary{});
+  const uint32_t samples_per_dispatch = config_.samples_per_dispatch == 0 ? spp : config_.samples_per_dispatch;
+  uint32_t samples = 0;
+  uint32_t dispatches = 0;
+  while (samples < spp) {
+    uint32_t sample_count = std::min(samples_per_dispatch, spp - samples);
+    // Ordered by the queue: submissions already in flight keep the previous range
+    camera_.SetProgress(queue_, samples, sample_count, config_.DispatchSeed(frame, dispatches));
+    if (config_.kernel == KernelMode::Wavefront) {
+      DispatchWavefront(sample_count);
+    } else {
+      DispatchTiles(compute_pipeline_, "path trace", active_tiles_);
+    }
+    samples += sample_count;
+    ++dispatches;
+    if (adaptive && samples >= config_.adaptive_min_spp && samples < spp) {
+      UpdateAdaptive();
+      if (active_tiles_.empty()) {
+        Print(PrintInfoType::WebGPUTracer, "Adaptive sampling converged at spp: ", samples);
+        break;
+      }
+    }
+    double elapsed_sec = std::chrono::duration<double>(std::chrono::system_clock::now() - start).count();
+    if (config_.time_budget_sec > 0.0f && elapsed_sec >= config_.time_budget_sec) {
+      Print(PrintInfoType::WebGPUTracer, "Time budget reached at spp: ", samples);
+      break;
+    }
+    if (config_.preview_interval > 0 && dispatches % config_.preview_interval == 0 && samples < spp) {
+      Resolve(false);
+      WriteOutput(frame_name + "_preview");
+    }
+  }
+  if (adaptive) {
+    // Summaries of the tiles that were still sampling
+    if (!active_tiles_.empty()) UpdateAdaptive();
+    ReportAdaptive();
+  }
+  // Resolve the accumulated samples
+  Resolve(true);
   // Save image
-  /// PNG出力
-  std::ostringstream sout;
-  sout << std::setw(3) << std::setfill('0') << frame;
-  std::string output_file = sout.str() + ".png";
-  if (!saveTexture(output_file.c_str(), device_, texture_, 0 /* output MIP level */)) {
-    Error(PrintInfoType::WebGPUTracer, "Image output failed.");
-    return false;
+  /// 画像出力 (readback and encoding overlap with the next frame)
+  WriteOutput(frame_name);
+  if (config_.path_stats) {
+    const auto path = config_.OutputBase(frame_name + "_paths").string() + ".csv";
+    frame_writer_.WriteBuffer(path_stats_buffer_, PathStatsSize(), [path](const std::vector<uint8_t> &data) {
+        const auto *words = (const uint32_t *) data.data();
+        std::vector<uint64_t> paths(data.size() / (2 * sizeof(uint32_t)));
+        for (size_t depth = 0; depth < paths.size(); ++depth) {
+          paths[depth] = (uint64_t) words[2 * depth + 1] << 32 | words[2 * depth];
+        }
+        return WritePathStats(path, paths);
+    });
   }
-  // Clean up
-  commands.release();
-  encoder.release();
-  compute_pass.release();
   // 時間計測終了
   end = std::chrono::system_clock::now();
   // 経過時間の算出
   double elapsed = (double) std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-  std::cout << "[" << sout.str() << "]: " << elapsed * 0.001 << "(sec)s" << std::endl;
+  std::cout << "[" << frame_name << "]: " << elapsed * 0.001 << "(sec)s, " << samples << "spp" << std::endl;
   return true;
 }
 
+/// \brief Dispatch a compute pipeline over tiles of the output texture
+/// \param pipeline compute_pipeline_ or resolve_pipeline_
+/// \param pass_name name of the compute passes in the profile
+/// \param tiles indices into tiles_
+void Renderer::DispatchTiles(ComputePipeline &pipeline, const char *pass_name, const std::vector<uint32_t> &tiles) {
+  RecordTiles(pass_name, tiles, [&](ComputePassEncoder &compute_pass, const TileParam &tile, const std::array<uint32_t, 2> &offsets) {
+      compute_pass.setPipeline(pipeline);
+      compute_pass.setBindGroup(0, camera_.GetUniforms().bind_group_, 0, nullptr);
+      compute_pass.setBindGroup(1, scene_.objects_.bind_group_, 0, nullptr);
+      compute_pass.setBindGroup(2, compute_bind_group_, (uint32_t) offsets.size(), offsets.data());
+      compute_pass.setBindGroup(3, sampler_bind_group_, 0, nullptr);
+      // This ceils tile size / workgroup size
+      uint32_t workgroup_count_x = (tile.size[0] + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+      uint32_t workgroup_count_y = (tile.size[1] + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE;
+      compute_pass.dispatchWorkgroups(workgroup_count_x, workgroup_count_y, 1);
+  });
+}
+
+/// \brief Trace the samples of the current dispatch with the wavefront kernels
+/// \param sample_count samples per pixel of the dispatch (CameraParam::sample_count)
+void Renderer::DispatchWavefront(uint32_t sample_count) {
+  RecordTiles("path trace", active_tiles_, [&](ComputePassEncoder &compute_pass, const TileParam &tile, const std::array<uint32_t, 2> &offsets) {
+      wavefront_.Record(compute_pass, camera_.GetUniforms().bind_group_, scene_.objects_.bind_group_, sampler_bind_group_,
+                        offsets, tile.size, sample_count);
+  });
+}
+
+/// \brief Record commands for tiles of the output texture
+/// config_.tiles_per_submit tiles share a command buffer and a compute pass, each selecting its TileParam
+/// and accumulation range through dynamic offsets. submissions_ bounds the command buffers in flight.
+/// \param pass_name name of the compute passes in the profile
+/// \param tiles indices into tiles_
+/// \param record records the commands of one tile, given the dynamic offsets of accumBuffer(0) and tile(2)
+void Renderer::RecordTiles(const char *pass_name, const std::vector<uint32_t> &tiles, const TileRecorder &record) {
+  const auto tiles_per_submit = std::max(config_.tiles_per_submit, 1u);
+  for (size_t first = 0; first < tiles.size(); first += tiles_per_submit) {
+    const auto last = std::min(first + tiles_per_submit, tiles.size());
+    // Earlier passes are submitted, their timestamps can be read back
+    profiler_.Collect(false);
+    // Initialize a command encoder
+    CommandEncoderDescriptor encoder_desc = Default;
+    CommandEncoder encoder = device_.createCommandEncoder(encoder_desc);
+
+    // Create compute pass
+    std::array<ComputePassTimestampWrite, 2> timestamp_writes{};
+    ComputePassDescriptor compute_pass_desc;
+    compute_pass_desc.timestampWriteCount = profiler_.GpuPass(pass_name, timestamp_writes.data());
+    compute_pass_desc.timestampWrites = compute_pass_desc.timestampWriteCount > 0 ? timestamp_writes.data() : nullptr;
+    ComputePassEncoder compute_pass = encoder.beginComputePass(compute_pass_desc);
+
+    // Use compute pass
+    for (size_t n = first; n < last; ++n) {
+      const auto i = tiles[n];
+      // Dynamic offsets are ordered by binding: accumBuffer(0), tile(2)
+      std::array<uint32_t, 2> offsets{(uint32_t) (i * accum_tile_stride_), (uint32_t) (i * tile_param_stride_)};
+      record(compute_pass, tiles_[i], offsets);
+    }
+
+    // Finalize compute pass
+    compute_pass.end();
+
+    // Encode and submit the GPU commands
+    CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+    submissions_.Submit(commands);
+    // Clean up
+    commands.release();
+    encoder.release();
+    compute_pass.release();
+  }
+}
+
+/// \brief Average the accumulated samples into the output texture, then accumulate it over frames and
+/// denoise it if enabled
+/// \param final the finished frame, which becomes the history of the next one (previews are not kept)
+void Renderer::Resolve(bool final) {
+  DispatchTiles(resolve_pipeline_, "resolve", all_tiles_);
+  const bool temporal = final && config_.temporal_frames > 0;
+  if (!temporal && config_.denoise_iterations == 0) {
+    return;
+  }
+  CommandEncoder encoder = device_.createCommandEncoder(Default);
+  auto record_pass = [&](const char *pass_name, const std::function<void(ComputePassEncoder &)> &record) {
+      std::array<ComputePassTimestampWrite, 2> timestamp_writes{};
+      ComputePassDescriptor compute_pass_desc;
+      compute_pass_desc.timestampWriteCount = profiler_.GpuPass(pass_name, timestamp_writes.data());
+      compute_pass_desc.timestampWrites = compute_pass_desc.timestampWriteCount > 0 ? timestamp_writes.data() : nullptr;
+      ComputePassEncoder compute_pass = encoder.beginComputePass(compute_pass_desc);
+      record(compute_pass);
+      compute_pass.end();
+      compute_pass.release();
+  };
+  if (temporal) {
+    record_pass("temporal", [&](ComputePassEncoder &pass) { denoiser_.RecordTemporal(pass); });
+    denoiser_.KeepHistory(encoder);
+  }
+  if (config_.denoise_iterations > 0) {
+    record_pass("denoise", [&](ComputePassEncoder &pass) { denoiser_.Record(pass); });
+  }
+  CommandBuffer commands = encoder.finish(CommandBufferDescriptor{});
+  submissions_.Submit(commands);
+  commands.release();
+  encoder.release();
+}
+
+/// \brief Adaptive sampling: retire the converged pixels of the active tiles
+/// adaptive_update writes a TileSummary per tile, which is read back here (blocking, like
+/// Profiler::Collect). Tiles without active pixels are dropped from active_tiles_.
+void Renderer::UpdateAdaptive() {
+  RecordTiles("adaptive", active_tiles_, [&](ComputePassEncoder &compute_pass, const TileParam &, const std::array<uint32_t, 2> &offsets) {
+      compute_pass.setPipeline(adaptive_pipeline_);
+      compute_pass.setBindGroup(0, camera_.GetUniforms().bind_group_, 0, nullptr);
+      compute_pass.setBindGroup(1, scene_.objects_.bind_group_, 0, nullptr);
+      compute_pass.setBindGroup(2, compute_bind_group_, (uint32_t) offsets.size(), offsets.data());
+      compute_pass.setBindGroup(3, sampler_bind_group_, 0, nullptr);
+      compute_pass.dispatchWorkgroups(1, 1, 1);
+  });
+  CommandEncoder encoder = device_.createCommandEncoder(Default);
+  const uint64_t summary_offset = 2 * (uint64_t) tile_size_ * tile_size_ * 4 * sizeof(float);
+  for (size_t n = 0; n < active_tiles_.size(); ++n) {
+    encoder.copyBufferToBuffer(accum_buffer_, active_tiles_[n] * accum_tile_stride_ + summary_offset, tile_summary_buffer_,
+                               n * sizeof(TileSummary), sizeof(TileSummary));
+  }
+  CommandBuffer command = encoder.finish(Default);
+  submissions_.Submit(command);
+  command.release();
+  encoder.release();
+
+  const auto size = active_tiles_.size() * sizeof(TileSummary);
+  bool done = false;
+  bool mapped = false;
+  auto callback_handle = tile_summary_buffer_.mapAsync(MapMode::Read, 0, size, [&](BufferMapAsyncStatus status) {
+      mapped = status == BufferMapAsyncStatus::Success;
+      done = true;
+  });
+  while (!done) {
+    PollDevice(device_, queue_);
+  }
+  if (!mapped) {
+    // Every active tile keeps sampling
+    Error(PrintInfoType::WebGPU, "Tile summary readback failed");
+    return;
+  }
+  const auto *summaries = (const TileSummary *) tile_summary_buffer_.getConstMappedRange(0, size);
+  for (size_t n = 0; n < active_tiles_.size(); ++n) {
+    tile_summaries_[active_tiles_[n]] = summaries[n];
+  }
+  tile_summary_buffer_.unmap();
+  active_tiles_.erase(std::remove_if(active_tiles_.begin(), active_tiles_.end(),
+                                     [&](uint32_t i) { return tile_summaries_[i].active_pixels == 0.0f; }),
+                      active_tiles_.end());
+}
+
+/// \brief Print how adaptive sampling distributed the samples of the frame
+void Renderer::ReportAdaptive() const {
+  double samples = 0.0;
+  double active = 0.0;
+  float min_spp = std::numeric_limits<float>::max();
+  float max_spp = 0.0f;
+  for (size_t i = 0; i < tiles_.size(); ++i) {
+    const auto pixels = (double) tiles_[i].size[0] * tiles_[i].size[1];
+    samples += tile_summaries_[i].mean_spp * pixels;
+    active += tile_summaries_[i].active_pixels;
+    min_spp = std::min(min_spp, tile_summaries_[i].mean_spp);
+    max_spp = std::max(max_spp, tile_summaries_[i].mean_spp);
+  }
+  const auto pixels = (double) config_.width * config_.height;
+  std::ostringstream sout;
+  sout << samples / pixels << "spp on average, tiles " << min_spp << " - " << max_spp << "spp, "
+       << 100.0 * (1.0 - active / pixels) << "% of the pixels converged";
+  Print(PrintInfoType::WebGPUTracer, "Adaptive sampling: ", sout.str());
+}
+
+/// \brief Queue the current frame for readback and encoding
+/// \param name output file name without extension
+void Renderer::WriteOutput(const std::string &name) {
+  const auto path = config_.OutputPath(name).string();
+  switch (config_.output_format) {
+    case OutputFormat::PNG:
+      frame_writer_.WritePNG(texture_, path);
+      break;
+    case OutputFormat::HDR: {
+      if (config_.GBuffer()) {
+        frame_writer_.WriteHDR(denoiser_.Output(), path);
+        break;
+      }
+      /// Untile and average the accumulation buffer on the worker
+      const auto width = config_.width;
+      const auto height = config_.height;
+      const auto tile_stride = accum_tile_stride_;
+      frame_writer_.WriteBuffer(accum_buffer_, accum_buffer_size_, [path, width, height, tile_stride, tiles = tiles_](const std::vector<uint8_t> &data) {
+          std::vector<float> rgb((size_t) width * height * 3);
+          for (size_t i = 0; i < tiles.size(); ++i) {
+            const auto &tile = tiles[i];
+            const auto *accum = (const float *) (data.data() + i * tile_stride);
+            for (uint32_t y = 0; y < tile.size[1]; ++y) {
+              for (uint32_t x = 0; x < tile.size[0]; ++x) {
+                const auto *src = accum + 4 * (x + y * tile.stride);
+                const auto count = std::max(src[3], 1.0f);
+                auto *dst = rgb.data() + 3 * ((size_t) (tile.origin[1] + y) * width + tile.origin[0] + x);
+                dst[0] = src[0] / count;
+                dst[1] = src[1] / count;
+                dst[2] = src[2] / count;
+              }
+            }
+          }
+          if (!stbi_write_hdr(path.c_str(), (int) width, (int) height, 3, rgb.data())) {
+            Error(PrintInfoType::WebGPUTracer, "Could not write image: ", path);
+            return false;
+          }
+          return true;
+      });
+      break;
+    }
+  }
+}
+
 /// \brief Called every frame
 void Renderer::OnFrame() {
   glfwPollEvents();
@@ -599,42 +1250,60 @@ void Renderer::OnFrame() {
 void Renderer::OnFinish() {
   /// TODO: Dear ImGui
   // TerminateGui();
-  /// TODO: Leave this for compute pipeline
-  /// Release Camera
-  // camera_.Release();
-  /// Release Scene
-  // scene_.Release();
-  /// WebGPU stuff
-  /// Release WebGPU bind group
-  bind_group_.release();
-  /// Release WebGPU buffer
-  uniform_buffer_.destroy();
-  uniform_buffer_.release();
-  index_buffer_.destroy();
-  index_buffer_.release();
-  vertex_buffer_.destroy();
-  vertex_buffer_.release();
-  /// Release WebGPU pipelines
-  render_pipeline_.release();
-  // compute_pipeline_.release();
-  pipeline_layout_.release();
-  /// Release WebGPU bind group layout
-  bind_group_layout_.release();
-  /// Release WebGPU depth buffer
-  depth_texture_view_.release();
-  depth_texture_.destroy();
-  depth_texture_.release();
-  /// Release WebGPU swap chain
-  swap_chain_.release();
-  /// Release WebGPU texture views
-  // output_texture_view_.release();
-  /// Release WebGPU texture
-  // texture_.destroy();
-  // texture_.release();
+  if (hasWindow_) {
+    /// WebGPU stuff
+    /// Release WebGPU bind group
+    bind_group_.release();
+    /// Release WebGPU buffer
+    uniform_buffer_.destroy();
+    uniform_buffer_.release();
+    index_buffer_.destroy();
+    index_buffer_.release();
+    vertex_buffer_.destroy();
+    vertex_buffer_.release();
+    /// Release WebGPU pipelines
+    render_pipeline_.release();
+    pipeline_layout_.release();
+    /// Release WebGPU bind group layout
+    bind_group_layout_.release();
+    /// Release WebGPU depth buffer
+    depth_texture_view_.release();
+    depth_texture_.destroy();
+    depth_texture_.release();
+    /// Release WebGPU swap chain
+    swap_chain_.release();
+  } else {
+    /// Release Camera
+    camera_.Release();
+    /// Release Scene
+    scene_.Release();
+    /// Release WebGPU compute resources
+    frame_writer_.Release();
+    profiler_.Release();
+    ReleaseFrameResources();
+    wavefront_.Release();
+    denoiser_.Release();
+    sampler_bind_group_.release();
+    blue_noise_view_.release();
+    blue_noise_texture_.destroy();
+    blue_noise_texture_.release();
+    sobol_buffer_.destroy();
+    sobol_buffer_.release();
+    sampler_bind_group_layout_.release();
+    compute_bind_group_layout_.release();
+    adaptive_pipeline_.release();
+    resolve_pipeline_.release();
+    compute_pipeline_.release();
+    compute_pipeline_layout_.release();
+  }
+  /// Release WebGPU queue
+  queue_.release();
   /// Release WebGPU device
   device_.release();
   /// Release WebGPU surface
-  surface_.release();
+  if (hasWindow_) {
+    surface_.release();
+  }
   /// Release WebGPU adapter
   adapter_.release();
   /// Release WebGPU instance
@@ -0,0 +1,455 @@
+#include "render_job.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+    std::string Trim(const std::string &str) {
+      const auto first = str.find_first_not_of(" \t\r\n");
+      if (first == std::string::npos) {
+        return "";
+      }
+      const auto last = str.find_last_not_of(" \t\r\n");
+      return str.substr(first, last - first + 1);
+    }
+
+    std::string Unquote(const std::string &str) {
+      if (str.size() >= 2 && (str.front() == '"' || str.front() == '\'') && str.back() == str.front()) {
+        return str.substr(1, str.size() - 2);
+      }
+      return str;
+    }
+
+    std::vector<std::string> Split(const std::string &str, char delimiter) {
+      std::vector<std::string> tokens;
+      std::istringstream iss(str);
+      std::string token;
+      while (std::getline(iss, token, delimiter)) {
+        tokens.push_back(Unquote(Trim(token)));
+      }
+      return tokens;
+    }
+
+    bool ParseUint(const std::string &str, uint32_t &value) {
+      if (str.empty() || str[0] == '-') {
+        return false;
+      }
+      char *end = nullptr;
+      auto parsed = std::strtoul(str.c_str(), &end, 10);
+      if (*end != '\0' || parsed > std::numeric_limits<uint32_t>::max()) {
+        return false;
+      }
+      value = (uint32_t) parsed;
+      return true;
+    }
+
+    bool ParseFloat(const std::string &str, float &value) {
+      if (str.empty()) {
+        return false;
+      }
+      char *end = nullptr;
+      value = std::strtof(str.c_str(), &end);
+      return *end == '\0';
+    }
+
+    bool ParseUints(const std::vector<std::string> &values, uint32_t *out, size_t count) {
+      if (values.size() != count) {
+        return false;
+      }
+      for (size_t i = 0; i < count; ++i) {
+        if (!ParseUint(values[i], out[i])) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool ParseVec3(const std::vector<std::string> &values, vec3 &out) {
+      if (values.size() != 3) {
+        return false;
+      }
+      for (int i = 0; i < 3; ++i) {
+        if (!ParseFloat(values[i], out[i])) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /// \brief Apply one setting, shared by the command line and job files
+    bool ApplySetting(const std::string &key, const std::vector<std::string> &values, RenderShot &shot, std::string &error) {
+      auto &config = shot.config;
+      const auto single = values.size() == 1 ? values[0] : std::string();
+      bool ok = true;
+      if (key == "name") {
+        shot.name = single;
+        ok = !single.empty();
+      } else if (key == "width") {
+        ok = ParseUints(values, &config.width, 1) && config.width > 0;
+      } else if (key == "height") {
+        ok = ParseUints(values, &config.height, 1) && config.height > 0;
+      } else if (key == "resolution") {
+        /// 3840x2160 or [3840, 2160]
+        uint32_t size[2]{};
+        ok = ParseUints(values.size() == 1 ? Split(single, 'x') : values, size, 2) && size[0] > 0 && size[1] > 0;
+        config.width = size[0];
+        config.height = size[1];
+      } else if (key == "spp") {
+        ok = ParseUints(values, &config.spp, 1) && config.spp > 0;
+      } else if (key == "frame" || key == "frames") {
+        uint32_t frames[2]{};
+        ok = ParseUints(values, frames, 2) && frames[0] >= 1 && frames[0] <= frames[1];
+        shot.start_frame = frames[0];
+        shot.end_frame = frames[1];
+      } else if (key == "output" || key == "output_dir") {
+        config.output_dir = single;
+        ok = !single.empty();
+      } else if (key == "prefix" || key == "output_prefix") {
+        config.output_prefix = single;
+        ok = values.size() == 1;
+      } else if (key == "format") {
+        if (single == "png") {
+          config.output_format = OutputFormat::PNG;
+        } else if (single == "hdr") {
+          config.output_format = OutputFormat::HDR;
+        } else {
+          ok = false;
+        }
+      } else if (key == "kernel") {
+        if (single == "megakernel") {
+          config.kernel = KernelMode::Megakernel;
+        } else if (single == "wavefront") {
+          config.kernel = KernelMode::Wavefront;
+        } else {
+          ok = false;
+        }
+      } else if (key == "max_depth") {
+        ok = ParseUints(values, &config.max_depth, 1) && config.max_depth > 0;
+      } else if (key == "rr_depth") {
+        ok = ParseUints(values, &config.rr_depth, 1);
+      } else if (key == "path_stats") {
+        uint32_t enabled = 0;
+        ok = ParseUints(values, &enabled, 1) && enabled <= 1;
+        config.path_stats = enabled != 0;
+      } else if (key == "light_sampling") {
+        if (single == "alias") {
+          config.light_sampling = LightSampling::Alias;
+        } else if (single == "tree") {
+          config.light_sampling = LightSampling::Tree;
+        } else {
+          ok = false;
+        }
+      } else if (key == "sampler") {
+        if (single == "pcg") {
+          config.sampler = SamplerType::PCG;
+        } else if (single == "sobol") {
+          config.sampler = SamplerType::Sobol;
+        } else if (single == "bluenoise") {
+          config.sampler = SamplerType::BlueNoise;
+        } else {
+          ok = false;
+        }
+      } else if (key == "scene") {
+        shot.scene.obj_file = single;
+        ok = !single.empty();
+        if (ok && !std::filesystem::exists(single)) {
+          error = "Scene file not found: " + single;
+          return false;
+        }
+      } else if (key == "scene_translate") {
+        ok = ParseVec3(values, shot.scene.translation);
+      } else if (key == "scene_color") {
+        ok = ParseVec3(values, shot.scene.color);
+      } else if (key == "texture_size") {
+        ok = ParseUints(values, &shot.scene.texture_size, 1) && shot.scene.texture_size > 0;
+      } else if (key == "scene_cache") {
+        uint32_t enabled = 0;
+        ok = ParseUints(values, &enabled, 1) && enabled <= 1;
+        shot.scene.scene_cache = enabled != 0;
+      } else if (key == "compact_geometry") {
+        uint32_t enabled = 0;
+        ok = ParseUints(values, &enabled, 1) && enabled <= 1;
+        shot.scene.compact_geometry = enabled != 0;
+      } else if (key == "scene_instance") {
+        /// translation[, rotation around Y in degrees], repeated keys add instances
+        ObjectPose pose;
+        ok = (values.size() == 3 || values.size() == 4) && ParseVec3({values.begin(), values.begin() + 3}, pose.translation) &&
+             (values.size() == 3 || ParseFloat(values[3], pose.rotate_y));
+        if (ok) {
+          shot.scene.mesh_instances.push_back(pose);
+        }
+      } else if (key == "camera_key") {
+        /// time, origin, target, fovy[, easing], repeated keys add keyframes
+        Keyframe<CameraPose> keyframe;
+        ok = (values.size() == 8 || values.size() == 9) && ParseFloat(values[0], keyframe.time) &&
+             ParseVec3({values.begin() + 1, values.begin() + 4}, keyframe.value.origin) &&
+             ParseVec3({values.begin() + 4, values.begin() + 7}, keyframe.value.target) &&
+             ParseFloat(values[7], keyframe.value.fovy) && keyframe.value.fovy > 0.0f && keyframe.value.fovy < 180.0f &&
+             (values.size() == 8 || ParseEasing(values[8], keyframe.easing));
+        if (ok) {
+          shot.scene.animation.camera.Add(keyframe);
+        }
+      } else if (key == "object_key") {
+        /// name, time, translation, rotation around Y in degrees[, easing]
+        Keyframe<ObjectPose> keyframe;
+        ok = (values.size() == 6 || values.size() == 7) && ParseFloat(values[1], keyframe.time) &&
+             ParseVec3({values.begin() + 2, values.begin() + 5}, keyframe.value.translation) &&
+             ParseFloat(values[5], keyframe.value.rotate_y) &&
+             (values.size() == 6 || ParseEasing(values[6], keyframe.easing));
+        if (ok && !Scene::HasObject(values[0])) {
+          error = "Unknown object: " + values[0];
+          return false;
+        }
+        if (ok) {
+          shot.scene.animation.objects[values[0]].Add(keyframe);
+        }
+      } else if (key == "object_material") {
+        /// name, bxdf, base color[, roughness[, metallic[, ior[, emission]]]]
+        Material material;
+        ok = values.size() >= 5 && values.size() <= 9 && ParseBxDF(values[1], material.bxdf) &&
+             ParseVec3({values.begin() + 2, values.begin() + 5}, material.base_color);
+        float *optional[] = {&material.roughness, &material.metallic, &material.ior, &material.emission};
+        for (size_t i = 5; ok && i < values.size(); ++i) {
+          ok = ParseFloat(values[i], *optional[i - 5]);
+        }
+        ok = ok && material.roughness >= 0.0f && material.roughness <= 1.0f && material.metallic >= 0.0f &&
+             material.metallic <= 1.0f && material.ior > 0.0f && material.emission >= 0.0f;
+        if (ok && !Scene::HasObject(values[0])) {
+          error = "Unknown object: " + values[0];
+          return false;
+        }
+        if (ok && values[0] == "light" && !material.Emissive()) {
+          error = "The light needs an emission above zero";
+          return false;
+        }
+        if (ok) {
+          shot.scene.materials[values[0]] = material;
+        }
+      } else if (key == "tile" || key == "tile_size") {
+        ok = ParseUints(values, &config.tile_size, 1) && config.tile_size > 0;
+      } else if (key == "tiles_per_submit") {
+        ok = ParseUints(values, &config.tiles_per_submit, 1) && config.tiles_per_submit > 0;
+      } else if (key == "max_in_flight") {
+        ok = ParseUints(values, &config.max_in_flight, 1) && config.max_in_flight > 0;
+      } else if (key == "samples_per_dispatch") {
+        ok = ParseUints(values, &config.samples_per_dispatch, 1);
+      } else if (key == "time_budget") {
+        ok = values.size() == 1 && ParseFloat(single, config.time_budget_sec) && config.time_budget_sec >= 0.0f;
+      } else if (key == "preview_interval") {
+        ok = ParseUints(values, &config.preview_interval, 1);
+      } else if (key == "readback_ring") {
+        ok = ParseUints(values, &config.readback_ring_size, 1) && config.readback_ring_size > 0;
+      } else if (key == "seed") {
+        ok = ParseUints(values, &config.seed, 1);
+      } else if (key == "reference" || key == "reference_dir") {
+        config.reference_dir = single;
+        ok = !single.empty();
+      } else if (key == "adaptive_threshold") {
+        ok = values.size() == 1 && ParseFloat(single, config.adaptive_threshold) && config.adaptive_threshold >= 0.0f;
+      } else if (key == "adaptive_min_spp") {
+        ok = ParseUints(values, &config.adaptive_min_spp, 1) && config.adaptive_min_spp > 0;
+      } else if (key == "denoise_iterations") {
+        ok = ParseUints(values, &config.denoise_iterations, 1) && config.denoise_iterations <= RenderConfig::kMaxDenoiseIterations;
+      } else if (key == "denoise_sigma_color") {
+        ok = values.size() == 1 && ParseFloat(single, config.denoise_sigma_color) && config.denoise_sigma_color > 0.0f;
+      } else if (key == "denoise_sigma_normal") {
+        ok = values.size() == 1 && ParseFloat(single, config.denoise_sigma_normal) && config.denoise_sigma_normal >= 0.0f;
+      } else if (key == "denoise_sigma_depth") {
+        ok = values.size() == 1 && ParseFloat(single, config.denoise_sigma_depth) && config.denoise_sigma_depth > 0.0f;
+      } else if (key == "temporal_frames") {
+        ok = ParseUints(values, &config.temporal_frames, 1);
+      } else if (key == "max_rmse") {
+        ok = values.size() == 1 && ParseFloat(single, config.max_rmse) && config.max_rmse >= 0.0f;
+      } else if (key == "profile") {
+        config.profile = single;
+        ok = !single.empty();
+      } else if (key == "max_block_sigma") {
+        ok = values.size() == 1 && ParseFloat(single, config.max_block_sigma) && config.max_block_sigma > 0.0f;
+      } else {
+        error = "Unknown setting: " + key;
+        return false;
+      }
+      if (!ok) {
+        error = "Invalid value for " + key;
+      }
+      return ok;
+    }
+}
+
+bool ParseCommandLine(int argc, char *argv[], RenderJob &job, std::string &error) {
+  RenderShot defaults;
+  std::string job_file;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      error = "Unexpected argument: " + arg;
+      return false;
+    }
+    auto key = arg.substr(2);
+    std::replace(key.begin(), key.end(), '-', '_');
+    if (key == "help") {
+      job.show_help = true;
+      return true;
+    }
+    if (key == "window") {
+      job.has_window = true;
+      continue;
+    }
+    /// `--frame start end` takes two values, everything else one (comma separated for vectors)
+    const int arity = (key == "frame" || key == "frames") ? 2 : 1;
+    if (i + arity >= argc) {
+      error = "Missing value for " + arg;
+      return false;
+    }
+    std::vector<std::string> values;
+    if (arity == 2) {
+      values = {argv[i + 1], argv[i + 2]};
+    } else {
+      values = Split(argv[i + 1], ',');
+    }
+    i += arity;
+    if (key == "job") {
+      job_file = values[0];
+    } else if (key == "backend") {
+      if (values[0] == "gpu") {
+        job.backend = BackendType::GPU;
+      } else if (values[0] == "cpu") {
+        job.backend = BackendType::CPU;
+      } else {
+        error = "Invalid value for backend";
+        return false;
+      }
+    } else if (!ApplySetting(key, values, defaults, error)) {
+      return false;
+    }
+  }
+  job.shots.clear();
+  if (job_file.empty()) {
+    job.shots.push_back(defaults);
+    return true;
+  }
+  return LoadJobFile(job_file, defaults, job.shots, error);
+}
+
+bool LoadJobFile(const std::filesystem::path &path, const RenderShot &defaults, std::vector<RenderShot> &shots, std::string &error) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    error = "Could not open job file: " + path.string();
+    return false;
+  }
+  auto shot_defaults = defaults;
+  std::vector<RenderShot> loaded;
+  RenderShot *current = &shot_defaults;
+  std::string line;
+  for (uint32_t line_no = 1; std::getline(file, line); ++line_no) {
+    const auto location = path.string() + ":" + std::to_string(line_no) + ": ";
+    /// Strip comments outside of strings
+    bool in_string = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+      if (line[i] == '"') {
+        in_string = !in_string;
+      } else if (line[i] == '#' && !in_string) {
+        line.resize(i);
+        break;
+      }
+    }
+    line = Trim(line);
+    if (line.empty()) {
+      continue;
+    }
+    if (line == "[[shot]]") {
+      loaded.push_back(shot_defaults);
+      current = &loaded.back();
+      continue;
+    }
+    if (line[0] == '[') {
+      error = location + "Unsupported table " + line;
+      return false;
+    }
+    const auto eq = line.find('=');
+    if (eq == std::string::npos) {
+      error = location + "Expected key = value";
+      return false;
+    }
+    const auto key = Trim(line.substr(0, eq));
+    const auto value = Trim(line.substr(eq + 1));
+    std::vector<std::string> values;
+    if (value.size() >= 2 && value.front() == '[' && value.back() == ']') {
+      values = Split(value.substr(1, value.size() - 2), ',');
+    } else {
+      values = {Unquote(value)};
+    }
+    if (!ApplySetting(key, values, *current, error)) {
+      error = location + error;
+      return false;
+    }
+  }
+  if (loaded.empty()) {
+    loaded.push_back(shot_defaults);
+  }
+  /// Shots of one job must not overwrite each other's frames
+  for (size_t i = 0; i < loaded.size(); ++i) {
+    auto &shot = loaded[i];
+    if (shot.name.empty()) {
+      shot.name = "shot" + std::to_string(i + 1);
+    }
+    if (loaded.size() > 1 && shot.config.output_prefix.empty()) {
+      shot.config.output_prefix = shot.name + "_";
+    }
+  }
+  shots = std::move(loaded);
+  return true;
+}
+
+void PrintUsage() {
+  std::cout << "Usage: WebGPUTracer [options]\n"
+               "  --window                     Interactive window instead of the headless renderer\n"
+               "  --backend gpu|cpu            Headless renderer: WebGPU compute or the CPU reference\n"
+               "  --job FILE                   Job file with [[shot]] tables, options below become their defaults\n"
+               "  --resolution WxH             Output resolution (or --width N --height N)\n"
+               "  --spp N                      Samples per pixel\n"
+               "  --frame START END            Frame range\n"
+               "  --output DIR                 Output directory\n"
+               "  --prefix NAME                Output file prefix\n"
+               "  --format png|hdr             Output format\n"
+               "  --kernel MODE                megakernel (default) or wavefront: per-bounce kernels over ray queues\n"
+               "  --max-depth N                Bounce limit of a path\n"
+               "  --rr-depth N                 Bounces before Russian roulette (>= max depth disables it)\n"
+               "  --path-stats 0|1             Write the paths entering every bounce to FRAME_paths.csv\n"
+               "  --light-sampling alias|tree  Light selection: by power (default) or light BVH for many lights\n"
+               "  --sampler pcg|sobol|bluenoise  Random numbers: PCG (default), Owen-scrambled Sobol or blue-noise dithered Sobol\n"
+               "  --scene FILE.obj             Mesh added to the Cornell box\n"
+               "  --scene-translate X,Y,Z      Mesh translation\n"
+               "  --scene-color R,G,B          Mesh color, for faces without an MTL material\n"
+               "  --texture-size N             Largest texture map size, maps of the MTL materials share one (default 1024)\n"
+               "  --scene-cache 0|1            Load the mesh from FILE.obj.scene written by scene_compile if up to date (default 1)\n"
+               "  --compact-geometry 0|1       Quantized mesh positions and normals, half-size quad and triangle buffers (default 0)\n"
+               "  --scene-instance X,Y,Z[,DEG]  Another copy of the mesh, moved and turned around Y, repeat for more\n"
+               "  --camera-key T,OX,OY,OZ,TX,TY,TZ,FOVY[,EASING]  Camera keyframe at frame T (origin, target, fovy), repeat for more\n"
+               "  --object-key NAME,T,X,Y,Z,DEG[,EASING]  Keyframe of light, tall_box, short_box or mesh: translation, Y rotation\n"
+               "                               EASING: linear (default), ease_in_quart, ease_out_cubic, ease_in_out_expo, sigmoid\n"
+               "  --object-material NAME,BXDF,R,G,B[,ROUGHNESS[,METALLIC[,IOR[,EMISSION]]]]  Material of light, tall_box,\n"
+               "                               short_box or mesh, BXDF: lambertian, ggx or dielectric (defaults 0.5, 0, 1.5, 0)\n"
+               "  --tile N                     Tile size in pixels\n"
+               "  --tiles-per-submit N         Tiles per command buffer\n"
+               "  --max-in-flight N            Command buffers queued on the GPU\n"
+               "  --samples-per-dispatch N     Progressive samples per dispatch\n"
+               "  --time-budget SEC            Stop a frame after SEC seconds\n"
+               "  --preview-interval N         Write a preview every N dispatches\n"
+               "  --adaptive-threshold E       Stop sampling pixels below relative error E, end the frame when all are (0 = off)\n"
+               "  --adaptive-min-spp N         Samples per pixel before adaptive sampling may stop a pixel\n"
+               "  --denoise-iterations N       A-trous denoiser iterations, at most 10 (0 = off)\n"
+               "  --denoise-sigma-color X      Denoiser luminance edge-stopping, relative difference\n"
+               "  --denoise-sigma-normal X     Denoiser normal edge-stopping exponent\n"
+               "  --denoise-sigma-depth X      Denoiser depth edge-stopping, in pixel depth extents\n"
+               "  --temporal-frames N          Reproject and accumulate up to N frames of history (0 = off)\n"
+               "  --readback-ring N            Frames in readback at the same time\n"
+               "  --seed N                     Fixed random seed for reproducible images (0 = random)\n"
+               "  --reference DIR              Compare every frame with the image of the same name in DIR\n"
+               "  --max-rmse X                 Allowed RMSE against the reference\n"
+               "  --max-block-sigma X          Allowed block bias against the reference, in standard errors\n"
+               "  --profile BASE               Write BASE.json/.csv/.trace.json with GPU pass and CPU timings\n"
+               "  --help                       Show this message\n";
+}
@@ -0,0 +1,199 @@
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+/// Largest float below 1
+const float kOneMinusEpsilon = 0x1.fffffep-1f;
+/// Upper 24 bits of a sample to [0, 1)
+const float kBitsScale = 0x1p-24f;
+
+uint32_t ReverseBits(uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+/// \brief Hash that only lets lower bits affect higher ones (Laine & Karras, Burley's constants)
+uint32_t LaineKarrasPermutation(uint32_t x, uint32_t seed) {
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return x;
+}
+
+/// \brief Owen scrambling: random flips of every bit, depending on the higher bits only
+uint32_t NestedUniformScramble(uint32_t x, uint32_t seed) {
+  return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+}
+
+const SamplerTables &SamplerTables::Shared() {
+  static const SamplerTables tables;
+  return tables;
+}
+
+SamplerTables::SamplerTables() {
+  BuildSobolMatrices();
+  BuildBlueNoise();
+}
+
+float SamplerTables::Sample(uint32_t sampler, uint32_t x, uint32_t y, uint32_t index, uint32_t dim, uint32_t seed) const {
+  if (sampler == 1) {
+    /// Decorrelated sequence per pixel
+    return (float) (OwenSobol(index, dim, Hash(x ^ Hash(y ^ seed))) >> 8) * kBitsScale;
+  }
+  /// One sequence for the image, shifted by a blue-noise tile placed differently per dimension
+  const auto u = (float) (OwenSobol(index, dim, seed) >> 8) * kBitsScale;
+  const auto h = Hash(dim ^ seed);
+  const auto texel_x = (x + h) % kBlueNoiseSize;
+  const auto texel_y = (y + (h >> 16)) % kBlueNoiseSize;
+  const auto v = u + blue_noise_[texel_y * kBlueNoiseSize + texel_x];
+  return std::min(v >= 1.0f ? v - 1.0f : v, kOneMinusEpsilon);
+}
+
+uint32_t SamplerTables::OwenSobol(uint32_t index, uint32_t dim, uint32_t seed) const {
+  const auto group_seed = Hash(seed ^ Hash(dim / kSobolDimensions));
+  const auto component = dim % kSobolDimensions;
+  /// Owen scrambling the index keeps every power of two prefix of the samples well distributed
+  auto shuffled = NestedUniformScramble(index, group_seed);
+  uint32_t bits = 0;
+  for (uint32_t j = 0; shuffled != 0; ++j, shuffled >>= 1) {
+    if (shuffled & 1u) {
+      bits ^= sobol_[j * kSobolDimensions + component];
+    }
+  }
+  return NestedUniformScramble(bits, Hash(group_seed + component + 1));
+}
+
+void SamplerTables::BuildSobolMatrices() {
+  /// Primitive polynomial degree, its coefficients and initial direction numbers (new-joe-kuo-6.21201)
+  struct DirectionNumbers {
+      uint32_t s;
+      uint32_t a;
+      uint32_t m[3];
+  };
+  const DirectionNumbers numbers[kSobolDimensions - 1] = {{1, 0, {1}},
+                                                          {2, 1, {1, 3}},
+                                                          {3, 1, {1, 3, 1}}};
+  /// Dimension 0 is the van der Corput sequence
+  for (uint32_t j = 0; j < kSobolBits; ++j) {
+    sobol_[j * kSobolDimensions] = 1u << (31 - j);
+  }
+  for (uint32_t d = 1; d < kSobolDimensions; ++d) {
+    const auto &n = numbers[d - 1];
+    uint32_t v[kSobolBits];
+    for (uint32_t j = 0; j < kSobolBits; ++j) {
+      if (j < n.s) {
+        v[j] = n.m[j] << (31 - j);
+        continue;
+      }
+      v[j] = v[j - n.s] ^ (v[j - n.s] >> n.s);
+      for (uint32_t k = 1; k < n.s; ++k) {
+        if ((n.a >> (n.s - 1 - k)) & 1u) {
+          v[j] ^= v[j - k];
+        }
+      }
+    }
+    for (uint32_t j = 0; j < kSobolBits; ++j) {
+      sobol_[j * kSobolDimensions + d] = v[j];
+    }
+  }
+}
+
+/// \brief Void and cluster (Ulichney): ranks every texel so that the texels below any rank are spread evenly
+void SamplerTables::BuildBlueNoise() {
+  const uint32_t size = kBlueNoiseSize;
+  const uint32_t count = size * size;
+  /// Gaussian energy of a point, cut off where it falls below 1e-3 and wrapped around the tile
+  const float sigma = 1.5f;
+  const int radius = 6;
+  auto toggle = [&](std::vector<uint8_t> &pattern, std::vector<float> &energy, uint32_t p) {
+      pattern[p] ^= 1u;
+      const float sign = pattern[p] ? 1.0f : -1.0f;
+      const auto px = (int) (p % size);
+      const auto py = (int) (p / size);
+      for (int dy = -radius; dy <= radius; ++dy) {
+        for (int dx = -radius; dx <= radius; ++dx) {
+          const auto x = (uint32_t) (px + dx + (int) size) % size;
+          const auto y = (uint32_t) (py + dy + (int) size) % size;
+          energy[y * size + x] += sign * std::exp(-(float) (dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+      }
+  };
+  /// Point with the most energy, or empty texel with the least
+  auto find = [&](const std::vector<uint8_t> &pattern, const std::vector<float> &energy, bool cluster) {
+      uint32_t best = 0;
+      bool found = false;
+      for (uint32_t p = 0; p < count; ++p) {
+        if (pattern[p] == (cluster ? 1u : 0u) &&
+            (!found || (cluster ? energy[p] > energy[best] : energy[p] < energy[best]))) {
+          best = p;
+          found = true;
+        }
+      }
+      return best;
+  };
+
+  /// Initial pattern: a tenth of the texels at hashed positions, relaxed by moving the tightest
+  /// cluster into the largest void until that changes nothing
+  const uint32_t initial = count / 10;
+  std::vector<uint8_t> prototype(count, 0);
+  std::vector<float> prototype_energy(count, 0.0f);
+  for (uint32_t i = 0, points = 0; points < initial; ++i) {
+    const auto p = Hash(i + 1) % count;
+    if (!prototype[p]) {
+      toggle(prototype, prototype_energy, p);
+      ++points;
+    }
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto cluster = find(prototype, prototype_energy, true);
+    toggle(prototype, prototype_energy, cluster);
+    const auto void_texel = find(prototype, prototype_energy, false);
+    toggle(prototype, prototype_energy, void_texel);
+    if (void_texel == cluster) {
+      break;
+    }
+  }
+
+  std::vector<uint32_t> rank(count);
+  /// Phase 1: ranks of the initial points, the tightest cluster gets the highest rank
+  auto pattern = prototype;
+  auto energy = prototype_energy;
+  for (uint32_t r = initial; r > 0; --r) {
+    const auto cluster = find(pattern, energy, true);
+    toggle(pattern, energy, cluster);
+    rank[cluster] = r - 1;
+  }
+  /// Phase 2: fill the largest void up to half of the tile
+  pattern = prototype;
+  energy = prototype_energy;
+  for (uint32_t r = initial; r < count / 2; ++r) {
+    const auto void_texel = find(pattern, energy, false);
+    toggle(pattern, energy, void_texel);
+    rank[void_texel] = r;
+  }
+  /// Phase 3: empty texels are the minority now, rank their tightest cluster first
+  std::vector<uint8_t> empty(count, 0);
+  std::fill(energy.begin(), energy.end(), 0.0f);
+  for (uint32_t p = 0; p < count; ++p) {
+    if (!pattern[p]) {
+      toggle(empty, energy, p);
+    }
+  }
+  for (uint32_t r = count / 2; r < count; ++r) {
+    const auto cluster = find(empty, energy, true);
+    toggle(empty, energy, cluster);
+    rank[cluster] = r;
+  }
+
+  blue_noise_.resize(count);
+  for (uint32_t p = 0; p < count; ++p) {
+    blue_noise_[p] = ((float) rank[p] + 0.5f) / (float) count;
+  }
+}
@@ -7,38 +7,438 @@
 #include "tiny_obj_loader.h"
 #include "utils/color_util.h"
 #include "objects/box.h"
+#include "obj_loader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+namespace {
+/// \brief Path of a map named in an MTL file, relative to the directory of the OBJ
+std::string TexturePath(const std::string &base_dir, std::string name) {
+  std::replace(name.begin(), name.end(), '\\', '/');
+  return (std::filesystem::path(base_dir) / name).string();
+}
+
+/// \brief Material of an MTL entry, its maps become layers of `textures`
+/// Glass for the refracting illumination models (4, 6, 7, 9) or d < 1; GGX for PBR roughness / metallic (Pr, Pm, map_Pr)
+/// or a Phong highlight (Ks, Ns); Lambertian otherwise. Ke makes it emissive.
+Material MtlMaterial(const tinyobj::material_t &mtl, const std::string &base_dir, TextureArray &textures) {
+  auto material = Material::Diffuse(Color3(mtl.diffuse[0], mtl.diffuse[1], mtl.diffuse[2]));
+  const auto specular = std::max({mtl.specular[0], mtl.specular[1], mtl.specular[2]});
+  const auto transmittance = Color3(mtl.transmittance[0], mtl.transmittance[1], mtl.transmittance[2]);
+  if (mtl.ior > 1.0f) {
+    material.ior = mtl.ior;
+  }
+  if (mtl.illum == 4 || mtl.illum == 6 || mtl.illum == 7 || mtl.illum == 9 || mtl.dissolve < 1.0f) {
+    material.bxdf = BxDF::Dielectric;
+    /// Tf tints the transmission, clear glass without it
+    material.base_color = transmittance == Color3(0.0f) ? Color3(1.0f) : transmittance;
+  } else if (!mtl.roughness_texname.empty() || mtl.roughness > 0.0f || mtl.metallic > 0.0f) {
+    material.bxdf = BxDF::GGX;
+    /// A roughness map alone is taken as is
+    material.roughness = mtl.roughness > 0.0f || mtl.roughness_texname.empty() ? Clamp(mtl.roughness, 0.0f, 1.0f) : 1.0f;
+    material.metallic = Clamp(mtl.metallic, 0.0f, 1.0f);
+  } else if (mtl.illum >= 2 && specular > 0.0f) {
+    material.bxdf = BxDF::GGX;
+    /// Blinn-Phong exponent to GGX alpha = sqrt(2 / (Ns + 2)), roughness = sqrt(alpha)
+    material.roughness = std::pow(2.0f / (std::max(mtl.shininess, 0.0f) + 2.0f), 0.25f);
+  }
+  const auto emission = std::max({mtl.emission[0], mtl.emission[1], mtl.emission[2]});
+  if (emission > 0.0f) {
+    material.base_color = Color3(mtl.emission[0], mtl.emission[1], mtl.emission[2]) / emission;
+    material.emission = emission;
+  }
+  if (!mtl.diffuse_texname.empty()) {
+    material.base_color_texture = textures.Load(TexturePath(base_dir, mtl.diffuse_texname), true);
+  }
+  /// map_Bump is often a normal map as well, grayscale ones are height maps and ignored
+  if (!mtl.normal_texname.empty()) {
+    material.normal_texture = textures.Load(TexturePath(base_dir, mtl.normal_texname), false);
+  } else if (!mtl.bump_texname.empty() && TextureArray::Channels(TexturePath(base_dir, mtl.bump_texname)) >= 3) {
+    material.normal_texture = textures.Load(TexturePath(base_dir, mtl.bump_texname), false);
+  }
+  if (!mtl.roughness_texname.empty()) {
+    material.roughness_texture = textures.Load(TexturePath(base_dir, mtl.roughness_texname), false);
+  }
+  return material;
+}
+}
+
+/*
+ * コンストラクタ (CPUのみ)
+ */
+Scene::Scene(const SceneDesc &desc) : desc_(desc) {
+  InitObjects();
+  BuildBVH();
+  BuildLightSampler();
+}
 
 /*
  * コンストラクタ
  */
-Scene::Scene(Device &device) {
+Scene::Scene(Device &device, const SceneDesc &desc) : Scene(desc) {
+  InitBindGroupLayout(device);
+  InitBuffers(device);
+  InitBindGroup(device);
+}
+
+/*
+ * シーンの再読み込み (BindGroupLayoutはそのまま)
+ */
+void Scene::Reload(Device &device, const SceneDesc &desc) {
+  ReleaseBuffers();
+  desc_ = desc;
+  InitObjects();
+  BuildBVH();
+  BuildLightSampler();
+  InitBuffers(device);
+  InitBindGroup(device);
+}
+
+/*
+ * オブジェクトの配置
+ */
+void Scene::InitObjects() {
+  tris_.clear();
+  lights_.clear();
+  quads_.clear();
+  spheres_.clear();
+  instances_.clear();
+  blobs_.clear();
+  scene_objects_.clear();
+  materials_.clear();
+  textures_.Clear();
+  blas_.clear();
+  cache_.Close();
+  mesh_materials_ = 0;
+  compact_ = CompactGeometry();
+  /// Add Mesh first: its materials and blob lead their tables, as the scene cache stores them
+  uint32_t mesh_blob = kNoHit;
+  if (!desc_.obj_file.empty()) {
+    const auto mesh_material = AddMaterial(Material::Diffuse(desc_.color));
+    /// A mesh that cannot be loaded is left out, the scene cache holds the mesh before snapping and its BVH
+    const auto use_cache = desc_.scene_cache && !desc_.compact_geometry;
+    if ((use_cache && LoadCache()) || LoadObj(desc_.obj_file.c_str(), mesh_material)) {
+      mesh_materials_ = (uint32_t) materials_.size();
+      if (desc_.compact_geometry) {
+        SnapMesh();
+      }
+      if (textures_.Layers() > 0) {
+        std::ostringstream sout;
+        sout << textures_.Layers() << " maps, " << textures_.Size() << "x" << textures_.Size() << " with "
+             << textures_.MipLevels() << " mip levels";
+        Print(PrintInfoType::WebGPUTracer, "Textures: ", sout.str());
+      }
+      mesh_blob = AddBlob(PrimType::Triangle, 0, (uint32_t) tris_.size());
+    }
+  }
   /// Add Light
-  lights_.emplace_back(Point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), COL_LIGHT, true);
+  auto light = desc_.materials.find("light");
+  lights_.emplace_back(Point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105),
+                       AddMaterial(light != desc_.materials.end() ? light->second : Material::Light(Color3(1.0f), 15.0f)));
+  AddObject("light", PrimType::Light, 0, 1);
   /// Add CornellBox
-  auto cb = CornellBox();
+  const auto white = AddMaterial(Material::Diffuse(COL_WHITE));
+  auto cb = CornellBox(AddMaterial(Material::Diffuse(COL_RED)), AddMaterial(Material::Diffuse(COL_GREEN)), white);
   cb.PushToQuads(quads_);
-  /// Add Boxes
-  auto box1 = Box(Point3(0, 0, 0), Point3(165, 330, 165), COL_WHITE);
-  box1.RotateY(15);
-  box1.Translate(vec3(265, 0, 295));
-  auto box2 = Box(Point3(0, 0, 0), Point3(165, 165, 165), COL_WHITE);
-  box2.RotateY(-18);
-  box2.Translate(vec3(130, 0, 65));
-  box1.PushQuads(quads_);
-  box2.PushQuads(quads_);
+  world_quads_ = (uint32_t) quads_.size();
   /// Add Sphere
   /// Dummy Sphere
-  spheres_.emplace_back(Point3(0, 0, 0), 0, COL_ZERO);
-  // spheres_.emplace_back(Point3(190, 90, 190), 90, COL_BLUE);
-  InitBindGroupLayout(device);
-  InitBuffers(device);
-  InitBindGroup(device);
+  spheres_.emplace_back(Point3(0, 0, 0), 0, white);
+  // spheres_.emplace_back(Point3(190, 90, 190), 90, AddMaterial(Material::Diffuse(COL_BLUE)));
+  /// Add Boxes: two instances of a unit cube
+  auto cube = Box(Point3(0, 0, 0), Point3(1, 1, 1), white);
+  const auto cube_blob = AddBlob(PrimType::Quad, (uint32_t) quads_.size(), 6);
+  cube.PushQuads(quads_);
+  AddInstance("tall_box", cube_blob, glm::translate(mat4x4(1), vec3(265, 0, 295)) *
+                                     glm::rotate(mat4x4(1), glm::radians(15.0f), vec3(0, 1, 0)) *
+                                     glm::scale(mat4x4(1), vec3(165, 330, 165)));
+  AddInstance("short_box", cube_blob, glm::translate(mat4x4(1), vec3(130, 0, 65)) *
+                                      glm::rotate(mat4x4(1), glm::radians(-18.0f), vec3(0, 1, 0)) *
+                                      glm::scale(mat4x4(1), vec3(165, 165, 165)));
+  /// Place the Mesh: loaded once, placed by every instance
+  if (mesh_blob != kNoHit) {
+    const auto center = BlobBounds(mesh_blob).Centroid();
+    AddInstance("mesh", mesh_blob, glm::translate(mat4x4(1), desc_.translation));
+    for (const auto &pose: desc_.mesh_instances) {
+      AddInstance("", mesh_blob, glm::translate(mat4x4(1), center + pose.translation) *
+                                 glm::rotate(mat4x4(1), glm::radians(pose.rotate_y), vec3(0, 1, 0)) *
+                                 glm::translate(mat4x4(1), -center));
+    }
+  }
+  /// Rest placement of the animated objects
+  for (auto &object: scene_objects_) {
+    if (desc_.animation.objects.count(object.name) == 0) {
+      continue;
+    }
+    if (object.type == PrimType::Instance) {
+      const auto &instance = instances_[object.first];
+      object.rest_transform = instance.object_to_world;
+      object.pivot = vec3(instance.object_to_world * vec4(BlobBounds(instance.blas).Centroid(), 1));
+      continue;
+    }
+    AABB bounds;
+    const auto prims = Primitives();
+    for (uint32_t i = object.first; i < object.first + object.count; ++i) {
+      bounds.Grow(prims.Bounds(PackPrim(object.type, i)));
+    }
+    object.pivot = bounds.Centroid();
+    const auto &quads = object.type == PrimType::Light ? lights_ : quads_;
+    object.rest_quads.assign(quads.begin() + object.first, quads.begin() + object.first + object.count);
+  }
+}
+
+/*
+ * 名前付きオブジェクトの登録
+ */
+void Scene::AddObject(const std::string &name, PrimType type, uint32_t first, uint32_t count) {
+  SceneObject object;
+  object.name = name;
+  object.type = type;
+  object.first = first;
+  object.count = count;
+  scene_objects_.push_back(std::move(object));
+}
+
+/*
+ * インスタンスで共有されるプリミティブの登録
+ */
+uint32_t Scene::AddBlob(PrimType type, uint32_t first, uint32_t count) {
+  blobs_.push_back({type, first, count});
+  return (uint32_t) blobs_.size() - 1;
+}
+
+/*
+ * インスタンスの配置
+ */
+void Scene::AddInstance(const std::string &name, uint32_t blob, const mat4x4 &object_to_world) {
+  BVHInstance instance;
+  instance.SetTransform(object_to_world);
+  instance.blas = blob;
+  if (!name.empty()) {
+    auto material = desc_.materials.find(name);
+    if (material != desc_.materials.end()) {
+      instance.material = AddMaterial(material->second);
+    }
+    AddObject(name, PrimType::Instance, (uint32_t) instances_.size(), 1);
+  }
+  instances_.push_back(instance);
+}
+
+/*
+ * マテリアルの登録
+ */
+uint32_t Scene::AddMaterial(const Material &material) {
+  materials_.push_back(material);
+  return (uint32_t) materials_.size() - 1;
+}
+
+/*
+ * 共有プリミティブのオブジェクト空間のバウンディングボックス
+ */
+AABB Scene::BlobBounds(uint32_t blob) const {
+  AABB bounds;
+  const auto prims = Primitives();
+  for (uint32_t i = blobs_[blob].first; i < blobs_[blob].first + blobs_[blob].count; ++i) {
+    bounds.Grow(prims.Bounds(PackPrim(blobs_[blob].type, i)));
+  }
+  return bounds;
+}
+
+bool Scene::HasObject(const std::string &name) {
+  return name == "light" || name == "tall_box" || name == "short_box" || name == "mesh";
+}
+
+/*
+ * アニメーション (姿勢が変わったオブジェクトだけ動かしてBVHをリフィット)
+ */
+bool Scene::Animate(float t) {
+  dirty_quads_.clear();
+  dirty_instances_.clear();
+  dirty_nodes_.clear();
+  dirty_lights_ = false;
+  std::vector<uint32_t> moved;
+  for (auto &object: scene_objects_) {
+    auto track = desc_.animation.objects.find(object.name);
+    if (track == desc_.animation.objects.end()) {
+      continue;
+    }
+    auto pose = track->second.Sample(t, ObjectPose{});
+    if (pose != object.pose) {
+      MoveObject(object, pose, moved);
+    }
+  }
+  if (moved.empty()) {
+    return false;
+  }
+  /// Only the top-level BVH: instances move as a whole, their bottom-level BVH stays as is
+  /// Consecutive refitted nodes become one upload
+  for (auto node: bvh_.Refit(Primitives(), moved)) {
+    if (!dirty_nodes_.empty() && dirty_nodes_.back().first + dirty_nodes_.back().count == node) {
+      ++dirty_nodes_.back().count;
+    } else {
+      dirty_nodes_.push_back({node, 1});
+    }
+  }
+  if (dirty_lights_) {
+    light_sampler_.Build(lights_, spheres_, materials_);
+  }
+  return true;
+}
+
+/*
+ * オブジェクトを静止姿勢からposeへ移動
+ */
+void Scene::MoveObject(SceneObject &object, const ObjectPose &pose, std::vector<uint32_t> &moved) {
+  object.pose = pose;
+  auto m = glm::translate(mat4x4(1), object.pivot + pose.translation) *
+           glm::rotate(mat4x4(1), glm::radians(pose.rotate_y), vec3(0, 1, 0)) *
+           glm::translate(mat4x4(1), -object.pivot);
+  for (uint32_t i = 0; i < object.count; ++i) {
+    const auto idx = object.first + i;
+    switch (object.type) {
+      case PrimType::Quad:
+        quads_[idx] = object.rest_quads[i].Transformed(m);
+        break;
+      case PrimType::Light:
+        lights_[idx] = object.rest_quads[i].Transformed(m);
+        break;
+      case PrimType::Instance:
+        instances_[idx].SetTransform(m * object.rest_transform);
+        break;
+      case PrimType::Triangle:
+      case PrimType::Sphere:
+        break;
+    }
+    moved.push_back(PackPrim(object.type, idx));
+  }
+  switch (object.type) {
+    case PrimType::Quad:
+      dirty_quads_.push_back({object.first, object.count});
+      break;
+    case PrimType::Light:
+      dirty_lights_ = true;
+      break;
+    case PrimType::Instance:
+      dirty_instances_.push_back({object.first, object.count});
+      break;
+    case PrimType::Triangle:
+    case PrimType::Sphere:
+      break;
+  }
+}
+
+/*
+ * 変更された範囲だけGPUへ書き込み
+ */
+uint64_t Scene::WriteDirty(Queue &queue) {
+  uint64_t bytes = 0;
+  std::vector<float> data;
+  for (const auto &range: dirty_quads_) {
+    data.assign(range.count * QuadStride() / sizeof(float), 0.0f);
+    for (uint32_t i = 0; i < range.count; ++i) {
+      WriteQuadRecord(quads_[range.first + i], data.data() + i * QuadStride() / sizeof(float));
+    }
+    queue.writeBuffer(quad_buffer_, (uint64_t) range.first * QuadStride(), data.data(), data.size() * sizeof(float));
+    bytes += data.size() * sizeof(float);
+  }
+  for (const auto &range: dirty_instances_) {
+    data.assign(range.count * instance_stride_ / sizeof(float), 0.0f);
+    for (uint32_t i = 0; i < range.count; ++i) {
+      WriteInstance(instances_[range.first + i], data.data() + i * instance_stride_ / sizeof(float));
+    }
+    queue.writeBuffer(instance_buffer_, (uint64_t) range.first * instance_stride_, data.data(),
+                      data.size() * sizeof(float));
+    bytes += data.size() * sizeof(float);
+  }
+  const auto &nodes = bvh_.Nodes();
+  for (const auto &range: dirty_nodes_) {
+    queue.writeBuffer(bvh_node_buffer_, (uint64_t) range.first * bvh_node_stride_, &nodes[range.first],
+                      (uint64_t) range.count * bvh_node_stride_);
+    bytes += (uint64_t) range.count * bvh_node_stride_;
+  }
+  /// Few lights: the whole light buffer and light tree
+  if (dirty_lights_) {
+    data.assign(light_stride_ * light_sampler_.Count() / sizeof(float), 0.0f);
+    WriteLights(data.data());
+    queue.writeBuffer(light_buffer_, 0, data.data(), data.size() * sizeof(float));
+    const auto &light_nodes = light_sampler_.Nodes();
+    queue.writeBuffer(light_node_buffer_, 0, light_nodes.data(), light_node_stride_ * light_nodes.size());
+    bytes += data.size() * sizeof(float) + light_node_stride_ * light_nodes.size();
+  }
+  dirty_quads_.clear();
+  dirty_instances_.clear();
+  dirty_nodes_.clear();
+  dirty_lights_ = false;
+  return bytes;
+}
+
+/*
+ * BVHの構築 (共有プリミティブごとのBLAS + ワールド空間のプリミティブとインスタンスのTLAS)
+ */
+void Scene::BuildBVH() {
+  auto start = std::chrono::steady_clock::now();
+  const auto prims = Primitives();
+  blas_.resize(blobs_.size());
+  std::vector<uint32_t> packed;
+  for (size_t b = 0; b < blobs_.size(); ++b) {
+    /// Loaded from the scene cache
+    if (!blas_[b].Nodes().empty()) {
+      continue;
+    }
+    packed.clear();
+    for (uint32_t i = blobs_[b].first; i < blobs_[b].first + blobs_[b].count; ++i) {
+      packed.push_back(PackPrim(blobs_[b].type, i));
+    }
+    blas_[b].Build(prims, packed);
+  }
+  packed.clear();
+  for (uint32_t i = 0; i < lights_.size(); ++i) packed.push_back(PackPrim(PrimType::Light, i));
+  for (uint32_t i = 0; i < world_quads_; ++i) packed.push_back(PackPrim(PrimType::Quad, i));
+  for (uint32_t i = 0; i < spheres_.size(); ++i) packed.push_back(PackPrim(PrimType::Sphere, i));
+  for (uint32_t i = 0; i < instances_.size(); ++i) packed.push_back(PackPrim(PrimType::Instance, i));
+  bvh_.Build(prims, packed);
+  auto end = std::chrono::steady_clock::now();
+  /// The bottom-level BVHs follow the top-level one in the node and prim buffers
+  blas_node_offsets_.assign(1, (uint32_t) bvh_.Nodes().size());
+  blas_prim_offsets_.assign(1, (uint32_t) bvh_.Prims().size());
+  for (const auto &blas: blas_) {
+    blas_node_offsets_.push_back(blas_node_offsets_.back() + (uint32_t) blas.Nodes().size());
+    blas_prim_offsets_.push_back(blas_prim_offsets_.back() + (uint32_t) blas.Prims().size());
+  }
+  std::ostringstream sout;
+  sout << bvh_.Nodes().size() << " top-level nodes, " << instances_.size() << " instances of " << blas_.size()
+       << " bottom-level BVHs (" << blas_node_offsets_.back() - bvh_.Nodes().size() << " nodes), "
+       << std::chrono::duration<double, std::milli>(end - start).count() << "(ms)";
+  Print(PrintInfoType::WebGPUTracer, "BVH: ", sout.str());
+}
+
+/*
+ * 光源サンプラーの構築 (パワー比例のエイリアステーブルと光源BVH)
+ */
+void Scene::BuildLightSampler() {
+  light_sampler_.Build(lights_, spheres_, materials_);
+  std::ostringstream sout;
+  sout << lights_.size() << " quad lights, " << light_sampler_.Count() - lights_.size() << " sphere lights, "
+       << light_sampler_.Nodes().size() << " light tree nodes";
+  Print(PrintInfoType::WebGPUTracer, "Lights: ", sout.str());
 }
 
 /*
  * シーンの解放
  */
 void Scene::Release() {
+  ReleaseBuffers();
+  objects_.bind_group_layout_.release();
+}
+
+/*
+ * Bufferの解放
+ */
+void Scene::ReleaseBuffers() {
   objects_.bind_group_.release();
   light_buffer_.destroy();
   light_buffer_.release();
@@ -46,95 +446,241 @@ void Scene::Release() {
   quad_buffer_.release();
   sphere_buffer_.destroy();
   sphere_buffer_.release();
-  objects_.bind_group_layout_.release();
+  tri_buffer_.destroy();
+  tri_buffer_.release();
+  bvh_node_buffer_.destroy();
+  bvh_node_buffer_.release();
+  bvh_prim_buffer_.destroy();
+  bvh_prim_buffer_.release();
+  light_node_buffer_.destroy();
+  light_node_buffer_.release();
+  instance_buffer_.destroy();
+  instance_buffer_.release();
+  material_buffer_.destroy();
+  material_buffer_.release();
+  texture_array_view_.release();
+  texture_array_.destroy();
+  texture_array_.release();
+  texture_sampler_.release();
 }
 
 
 /*
- * Objファイルのロード
+ * Objファイルのロード (インデックス付きのメッシュから三角形を作成)
  */
-void Scene::LoadObj(const char *file_path, Color3 color, vec3 translation, bool emissive) {
-  std::vector<Vertex> vertices;
-  LoadVertices(file_path, vertices);
-  for (size_t i = 0; i < vertices.size() / 3; ++i) {
-    auto v0 = vertices[i * 3].Translate(translation);
-    auto v1 = vertices[i * 3 + 1].Translate(translation);
-    auto v2 = vertices[i * 3 + 2].Translate(translation);
-    tris_.emplace_back(v0, v1, v2, color, emissive);
+bool Scene::LoadObj(const char *file_path, uint32_t material, vec3 translation) {
+  auto start = std::chrono::steady_clock::now();
+  ObjMesh mesh;
+  std::string error;
+  if (!LoadObjFile(file_path, mesh, error)) {
+    Error(PrintInfoType::WebGPUTracer, "OBJ: ", error);
+    return false;
   }
+  // MTLファイルとテクスチャはObjファイルと同じディレクトリから
+  const auto base_dir = std::filesystem::path(file_path).parent_path().string();
+  std::map<std::string, int> mtl_ids;
+  std::vector<tinyobj::material_t> mtls;
+  for (const auto &library: mesh.material_libraries) {
+    std::ifstream mtl_stream(TexturePath(base_dir, library));
+    if (!mtl_stream) {
+      Print(PrintInfoType::WebGPUTracer, "OBJ: MTL file not found: ", library);
+      continue;
+    }
+    std::string warning, mtl_error;
+    tinyobj::LoadMtl(&mtl_ids, &mtls, &mtl_stream, &warning, &mtl_error);
+    if (!mtl_error.empty()) {
+      Error(PrintInfoType::WebGPUTracer, "OBJ: ", mtl_error);
+    }
+  }
+  // マテリアルの登録 (MTLの順)
+  std::vector<uint32_t> mtl_materials;
+  for (const auto &mtl: mtls) {
+    mtl_materials.push_back(AddMaterial(MtlMaterial(mtl, base_dir, textures_)));
+  }
+  // usemtlの名前からマテリアルへ (MTLに無い名前は既定のマテリアル)
+  std::vector<uint32_t> material_ids;
+  for (const auto &name: mesh.material_names) {
+    auto mtl = mtl_ids.find(name);
+    material_ids.push_back(mtl != mtl_ids.end() ? mtl_materials[mtl->second] : material);
+  }
+  // 三角形の作成
+  const auto first = tris_.size();
+  tris_.resize(first + mesh.Triangles());
+  ParallelFor(ThreadPool::Shared(), (uint32_t) mesh.Triangles(), 1u << 14, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        Vertex v[3];
+        for (int k = 0; k < 3; ++k) {
+          v[k] = mesh.vertices[mesh.indices[i * 3 + k]];
+          v[k].Translate(translation);
+        }
+        const auto face_material = mesh.face_materials[i];
+        tris_[first + i] = Triangle(v[0], v[1], v[2], face_material != kNoHit ? material_ids[face_material] : material);
+      }
+  });
+  textures_.Build(desc_.texture_size);
+  auto end = std::chrono::steady_clock::now();
+  const auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+  std::ostringstream sout;
+  sout << mesh.Triangles() << " triangles, " << mesh.vertices.size() << " vertices, " << mtls.size()
+       << " materials, " << ms << "(ms), "
+       << (double) std::filesystem::file_size(file_path) / (1024.0 * 1024.0) / (ms / 1000.0) << " MB/s";
+  Print(PrintInfoType::WebGPUTracer, "OBJ: ", sout.str());
+  return true;
 }
 
 /*
- * Objファイルから頂点リストをロード
+ * シーンキャッシュからメッシュをロード (三角形, マテリアル, BLAS, テクスチャ)
  */
-void Scene::LoadVertices(const char *file_path, std::vector<Vertex> &vertices) {
-  tinyobj::ObjReaderConfig reader_config;
-  tinyobj::ObjReader reader;
-  reader_config.mtl_search_path = "./assets/obj/";
-  if (!reader.ParseFromFile(file_path, reader_config)) {
-    if (!reader.Error().empty()) {
-      Error(PrintInfoType::WebGPUTracer, "TinyObjReader: ", reader.Error());
+bool Scene::LoadCache() {
+  auto start = std::chrono::steady_clock::now();
+  const auto path = SceneCache::Path(desc_.obj_file);
+  if (!cache_.Open(path, desc_.obj_file, desc_.texture_size, CacheLayout())) {
+    return false;
+  }
+  const auto &sections = cache_.Get();
+  /// MaterialはGPUのレイアウトと一致
+  const auto *materials = (const Material *) sections.materials.data;
+  materials_.insert(materials_.end(), materials, materials + sections.materials.count);
+  /// 三角形 (GPUへはInitBuffersでファイルからそのまま書き込む)
+  const auto *tri_data = (const float *) sections.triangles.data;
+  tris_.resize(sections.triangles.count);
+  ParallelFor(ThreadPool::Shared(), (uint32_t) tris_.size(), 1u << 14, [&](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        tris_[i] = ReadTriangle(tri_data + (size_t) i * tri_stride_ / sizeof(float));
+      }
+  });
+  /// 次に登録する共有プリミティブのBLAS
+  blas_.resize(blobs_.size() + 1);
+  blas_.back().Assign((const BVHNode *) sections.bvh_nodes.data, sections.bvh_nodes.count,
+                      (const uint32_t *) sections.bvh_prims.data, sections.bvh_prims.count);
+  /// テクスチャ (ミップマップ込み)
+  uint64_t layer_texels = 0;
+  for (uint32_t mip = 0; mip < cache_.MipLevels(); ++mip) {
+    layer_texels += (uint64_t) std::max(cache_.LayerSize() >> mip, 1u) * std::max(cache_.LayerSize() >> mip, 1u);
+  }
+  const auto layers = layer_texels > 0 ? (uint32_t) (sections.textures.count / layer_texels) : 0;
+  if (layers > 0) {
+    textures_.Assign(cache_.LayerSize(), layers, cache_.MipLevels(), (const uint8_t *) sections.textures.data);
+  }
+  auto end = std::chrono::steady_clock::now();
+  std::ostringstream sout;
+  sout << tris_.size() << " triangles, " << sections.materials.count << " materials, " << layers << " maps from "
+       << path << ", " << std::chrono::duration<double, std::milli>(end - start).count() << "(ms)";
+  Print(PrintInfoType::WebGPUTracer, "Scene cache: ", sout.str());
+  return true;
+}
+
+/*
+ * メッシュを圧縮レイアウトの格子へ (BVHとCPUバックエンドもGPUと同じ三角形を使う)
+ */
+void Scene::SnapMesh() {
+  AABB bounds;
+  for (const auto &tri: tris_) {
+    for (const auto &vertex: tri.vertex_) {
+      bounds.Grow(vertex.point_);
     }
-    exit(1);
-  }
-
-  if (!reader.Warning().empty()) {
-    Print(PrintInfoType::WebGPUTracer, "TinyObjReader: ", reader.Warning());
-  }
-  tinyobj::attrib_t attrib = reader.GetAttrib();
-  std::vector<tinyobj::shape_t> shapes = reader.GetShapes();
-  std::vector<tinyobj::material_t> materials = reader.GetMaterials();
-  // 頂点の登録
-  for (size_t s = 0; s < shapes.size(); ++s) {
-    // ポリゴンでループ
-    size_t index_offset = 0;
-    for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); ++f) {
-      auto fv = size_t(shapes[s].mesh.num_face_vertices[f]);
-
-      // ポリゴン内の頂点でループ
-      for (size_t v = 0; v < fv; ++v) {
-        // 頂点取得
-        tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-        auto vx = attrib.vertices[3 * size_t(idx.vertex_index) + 0];
-        auto vy = attrib.vertices[3 * size_t(idx.vertex_index) + 1];
-        auto vz = attrib.vertices[3 * size_t(idx.vertex_index) + 2];
-        auto nx = 0.0f;
-        auto ny = 0.0f;
-        auto nz = 1.0f;
-        auto tx = 0.0f;
-        auto ty = 0.0f;
-
-        // 法線判定
-        if (idx.normal_index >= 0) {
-          nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
-          ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
-          nz = attrib.normals[3 * size_t(idx.normal_index) + 2];
+  }
+  compact_ = CompactGeometry(bounds);
+  const auto step = compact_.Step();
+  /// 全精度からの誤差 (位置は格子の間隔, 法線は角度のcos)
+  std::mutex error_mutex;
+  float position_error = 0.0f;
+  float normal_cos = 1.0f;
+  ParallelFor(ThreadPool::Shared(), (uint32_t) tris_.size(), 1u << 14, [&](uint32_t begin, uint32_t end) {
+      float chunk_position_error = 0.0f;
+      float chunk_normal_cos = 1.0f;
+      for (uint32_t i = begin; i < end; ++i) {
+        const auto snapped = compact_.Snap(tris_[i]);
+        for (int k = 0; k < 3; ++k) {
+          const auto d = glm::abs(snapped.vertex_[k].point_ - tris_[i].vertex_[k].point_);
+          for (int axis = 0; axis < 3; ++axis) {
+            if (step[axis] > 0.0f) {
+              chunk_position_error = std::max(chunk_position_error, d[axis] / step[axis]);
+            }
+          }
+          const auto n = glm::normalize(tris_[i].vertex_[k].normal_);
+          chunk_normal_cos = std::min(chunk_normal_cos, glm::dot(n, snapped.vertex_[k].normal_));
         }
+        tris_[i] = snapped;
+      }
+      std::lock_guard<std::mutex> lock(error_mutex);
+      position_error = std::max(position_error, chunk_position_error);
+      normal_cos = std::min(normal_cos, chunk_normal_cos);
+  });
+  std::ostringstream sout;
+  sout << tris_.size() << " triangles on a grid of " << step.x << " x " << step.y << " x " << step.z
+       << ", max error " << position_error << " steps, " << glm::degrees(std::acos(Clamp(normal_cos, -1.0f, 1.0f)))
+       << " degrees";
+  Print(PrintInfoType::WebGPUTracer, "Compact geometry: ", sout.str());
+}
 
-        // テクスチャ座標
-        if (idx.texcoord_index >= 0) {
-          tx = attrib.texcoords[2 * size_t(idx.texcoord_index) + 0];
-          ty = attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
-        }
+/*
+ * シーンキャッシュの要素サイズ
+ */
+SceneCache::Sections Scene::CacheLayout() const {
+  SceneCache::Sections layout;
+  layout.materials.stride = material_stride_;
+  layout.triangles.stride = tri_stride_;
+  layout.bvh_nodes.stride = bvh_node_stride_;
+  layout.bvh_prims.stride = sizeof(uint32_t);
+  layout.textures.stride = 4;
+  return layout;
+}
 
-        Vertex vert;
-        vert.point_ = vec3(vx, vy, vz);
-        vert.normal_ = vec3(nx, ny, nz);
-        vert.u_ = tx;
-        vert.v_ = ty;
-        vertices.push_back(vert);
-      }
-      index_offset += fv;
+/*
+ * メッシュをシーンキャッシュへ書き込み
+ */
+bool Scene::WriteCache(const std::string &path) const {
+  if (mesh_materials_ == 0) {
+    Error(PrintInfoType::WebGPUTracer, "No mesh to cache");
+    return false;
+  }
+  /// キャッシュは全精度のメッシュ
+  if (desc_.compact_geometry) {
+    Error(PrintInfoType::WebGPUTracer, "The scene cache is not written from a snapped mesh (compact_geometry)");
+    return false;
+  }
+  auto sections = CacheLayout();
+  /// SceneDesc::colorのマテリアル以外
+  sections.materials.data = materials_.data() + 1;
+  sections.materials.count = mesh_materials_ - 1;
+  /// 三角形
+  std::vector<float> tri_data(tris_.size() * tri_stride_ / sizeof(float), 0.0f);
+  for (size_t i = 0; i < tris_.size(); ++i) {
+    WriteTriangle(tris_[i], tri_data.data() + i * tri_stride_ / sizeof(float));
+  }
+  sections.triangles.data = tri_data.data();
+  sections.triangles.count = (uint32_t) tris_.size();
+  /// メッシュのBLAS (最初の共有プリミティブ)
+  const auto &blas = blas_[0];
+  sections.bvh_nodes.data = blas.Nodes().data();
+  sections.bvh_nodes.count = (uint32_t) blas.Nodes().size();
+  sections.bvh_prims.data = blas.Prims().data();
+  sections.bvh_prims.count = (uint32_t) blas.Prims().size();
+  /// テクスチャ (レイヤーごとに全ミップレベル)
+  std::vector<uint8_t> texels;
+  std::vector<std::string> dependencies;
+  for (uint32_t layer = 0; layer < textures_.Layers(); ++layer) {
+    for (uint32_t mip = 0; mip < textures_.MipLevels(); ++mip) {
+      const auto &level = textures_.Level(layer, mip);
+      texels.insert(texels.end(), level.begin(), level.end());
+    }
+    /// 読み込んだ画像ファイル (キャッシュから読んだレイヤーは無し)
+    if (!textures_.Path(layer).empty()) {
+      dependencies.push_back(textures_.Path(layer));
     }
   }
-  shapes.clear();
+  sections.textures.data = texels.data();
+  sections.textures.count = (uint32_t) (texels.size() / 4);
+  return SceneCache::Write(path, desc_.obj_file, desc_.texture_size, textures_.Size(), textures_.MipLevels(), sections,
+                           dependencies);
 }
 
 /*
  * BindGroupLayoutの初期化
  */
 void Scene::InitBindGroupLayout(Device &device) {
-  std::vector<BindGroupLayoutEntry> bindings(3, Default);
+  std::vector<BindGroupLayoutEntry> bindings(11, Default);
   /// Scene: Lights
   bindings[0].binding = 0;
   bindings[0].buffer.type = BufferBindingType::ReadOnlyStorage;
@@ -147,6 +693,39 @@ void Scene::InitBindGroupLayout(Device &device) {
   bindings[2].binding = 2;
   bindings[2].buffer.type = BufferBindingType::ReadOnlyStorage;
   bindings[2].visibility = ShaderStage::Compute;
+  /// Scene: BVH Nodes
+  bindings[3].binding = 3;
+  bindings[3].buffer.type = BufferBindingType::ReadOnlyStorage;
+  bindings[3].visibility = ShaderStage::Compute;
+  /// Scene: BVH Primitive References
+  bindings[4].binding = 4;
+  bindings[4].buffer.type = BufferBindingType::ReadOnlyStorage;
+  bindings[4].visibility = ShaderStage::Compute;
+  /// Scene: Triangles
+  bindings[5].binding = 5;
+  bindings[5].buffer.type = BufferBindingType::ReadOnlyStorage;
+  bindings[5].visibility = ShaderStage::Compute;
+  /// Scene: Light tree
+  bindings[6].binding = 6;
+  bindings[6].buffer.type = BufferBindingType::ReadOnlyStorage;
+  bindings[6].visibility = ShaderStage::Compute;
+  /// Scene: Instances
+  bindings[7].binding = 7;
+  bindings[7].buffer.type = BufferBindingType::ReadOnlyStorage;
+  bindings[7].visibility = ShaderStage::Compute;
+  /// Scene: Materials
+  bindings[8].binding = 8;
+  bindings[8].buffer.type = BufferBindingType::ReadOnlyStorage;
+  bindings[8].visibility = ShaderStage::Compute;
+  /// Scene: Texture maps, every map is a layer
+  bindings[9].binding = 9;
+  bindings[9].texture.sampleType = TextureSampleType::Float;
+  bindings[9].texture.viewDimension = TextureViewDimension::_2DArray;
+  bindings[9].visibility = ShaderStage::Compute;
+  /// Scene: Trilinear sampler of the texture maps
+  bindings[10].binding = 10;
+  bindings[10].sampler.type = SamplerBindingType::Filtering;
+  bindings[10].visibility = ShaderStage::Compute;
   /// BindGroupLayoutの作成
   BindGroupLayoutDescriptor bind_group_layout_desc{};
   bind_group_layout_desc.entryCount = (uint32_t) bindings.size();
@@ -159,9 +738,18 @@ void Scene::InitBindGroupLayout(Device &device) {
  * Buffer作成
  */
 void Scene::InitBuffers(Device &device) {
-  light_buffer_ = CreateQuadBuffer(device, lights_, BufferUsage::Storage, true);
-  quad_buffer_ = CreateQuadBuffer(device, quads_, BufferUsage::Storage, true);
+  light_buffer_ = CreateLightBuffer(device);
+  quad_buffer_ = CreateQuadBuffer(device, quads_, BufferUsage::Storage | BufferUsage::CopyDst, true);
   sphere_buffer_ = CreateSphereBuffer(device, spheres_.size(), BufferUsage::Storage, true);
+  tri_buffer_ = CreateTriangleBuffer(device);
+  bvh_node_buffer_ = CreateBVHNodeBuffer(device);
+  bvh_prim_buffer_ = CreateBVHPrimBuffer(device);
+  light_node_buffer_ = CreateLightNodeBuffer(device);
+  instance_buffer_ = CreateInstanceBuffer(device);
+  material_buffer_ = CreateMaterialBuffer(device);
+  CreateTextureArray(device);
+  /// 書き込み済みなのでキャッシュは不要
+  cache_.Close();
 }
 
 /*
@@ -169,60 +757,115 @@ void Scene::InitBuffers(Device &device) {
  */
 Buffer Scene::CreateTriangleBuffer(Device &device) {
   BufferDescriptor tri_buffer_desc{};
-  auto tri_buffer_size = tri_stride_ * tris_.size();
+  const auto tri_buffer_size = TriangleBufferSize();
   tri_buffer_desc.size = tri_buffer_size;
-  tri_buffer_desc.usage = BufferUsage::Storage;
-  tri_buffer_desc.mappedAtCreation = true;
+  tri_buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+  /// キャッシュの三角形は全精度のGPUレイアウトなのでマップしたファイルからそのまま書き込む (圧縮レイアウトではキャッシュを使わない)
+  const auto &cached = cache_.Get().triangles;
+  tri_buffer_desc.mappedAtCreation = !cache_.IsOpen() || cached.count == 0;
   Buffer tri_buffer = device.createBuffer(tri_buffer_desc);
-  const uint32_t offset = 0;
-  const uint32_t size = 0;
-  auto *tri_data = (float *) tri_buffer.getConstMappedRange(offset, size);
-  uint32_t tri_offset = 0;
-  const float dummy = 1.0f;
-  for (int idx = 0; idx < (int) tris_.size(); ++idx) {
-    Triangle tri = tris_[idx];
-    /// 頂点v0
-    const Point3 vertex = tri.vertex_[0].point_;
-    tri_data[tri_offset++] = vertex[0];
-    tri_data[tri_offset++] = vertex[1];
-    tri_data[tri_offset++] = vertex[2];
-    tri_data[tri_offset++] = dummy;
-    /// ベクトルe1
-    const vec3 e1 = tri.e1_;
-    tri_data[tri_offset++] = e1[0];
-    tri_data[tri_offset++] = e1[1];
-    tri_data[tri_offset++] = e1[2];
-    tri_data[tri_offset++] = dummy;
-    /// ベクトルe2
-    const vec3 e2 = tri.e2_;
-    tri_data[tri_offset++] = e2[0];
-    tri_data[tri_offset++] = e2[1];
-    tri_data[tri_offset++] = e2[2];
-    tri_data[tri_offset++] = dummy;
-    /// 面法線
-    const vec3 face_norm = tri.face_norm_;
-    tri_data[tri_offset++] = face_norm[0];
-    tri_data[tri_offset++] = face_norm[1];
-    tri_data[tri_offset++] = face_norm[2];
-    tri_data[tri_offset++] = dummy;
-    /// カラー
-    const Color3 color = tri.color_;
-    tri_data[tri_offset++] = color[0];
-    tri_data[tri_offset++] = color[1];
-    tri_data[tri_offset++] = color[2];
-    /// エミッシブ
-    tri_data[tri_offset++] = tri.emissive_;
+  if (!tri_buffer_desc.mappedAtCreation) {
+    Queue queue = device.getQueue();
+    queue.writeBuffer(tri_buffer, 0, cached.data, (uint64_t) cached.count * cached.stride);
+    return tri_buffer;
+  }
+  auto *tri_data = (float *) tri_buffer.getMappedRange(0, tri_buffer_size);
+  std::fill(tri_data, tri_data + tri_buffer_size / sizeof(float), 0.0f);
+  if (desc_.compact_geometry) {
+    /// 格子 + 圧縮した三角形
+    auto *compact_data = (uint32_t *) tri_data;
+    compact_.WriteHeader(compact_data);
+    compact_data += compact_header_size_ / sizeof(uint32_t);
+    ParallelFor(ThreadPool::Shared(), (uint32_t) tris_.size(), 1u << 14, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+          compact_.EncodeTriangle(tris_[i], compact_data + (size_t) i * compact_tri_stride_ / sizeof(uint32_t));
+        }
+    });
+    tri_buffer.unmap();
+    return tri_buffer;
+  }
+  for (size_t i = 0; i < tris_.size(); ++i) {
+    WriteTriangle(tris_[i], tri_data + i * tri_stride_ / sizeof(float));
   }
   tri_buffer.unmap();
   return tri_buffer;
 }
 
+/*
+ * Triangleの書き込み (32 floats)
+ */
+void Scene::WriteTriangle(const Triangle &tri, float *tri_data) {
+  uint32_t tri_offset = 0;
+  /// 頂点v0 + u0
+  const Point3 vertex = tri.vertex_[0].point_;
+  tri_data[tri_offset++] = vertex[0];
+  tri_data[tri_offset++] = vertex[1];
+  tri_data[tri_offset++] = vertex[2];
+  tri_data[tri_offset++] = tri.vertex_[0].u_;
+  /// ベクトルe1 + v0
+  const vec3 e1 = tri.e1_;
+  tri_data[tri_offset++] = e1[0];
+  tri_data[tri_offset++] = e1[1];
+  tri_data[tri_offset++] = e1[2];
+  tri_data[tri_offset++] = tri.vertex_[0].v_;
+  /// ベクトルe2 + u1
+  const vec3 e2 = tri.e2_;
+  tri_data[tri_offset++] = e2[0];
+  tri_data[tri_offset++] = e2[1];
+  tri_data[tri_offset++] = e2[2];
+  tri_data[tri_offset++] = tri.vertex_[1].u_;
+  /// 面法線 + v1
+  const vec3 face_norm = tri.face_norm_;
+  tri_data[tri_offset++] = face_norm[0];
+  tri_data[tri_offset++] = face_norm[1];
+  tri_data[tri_offset++] = face_norm[2];
+  tri_data[tri_offset++] = tri.vertex_[1].v_;
+  /// 頂点法線n0 + u2
+  const vec3 n0 = tri.vertex_[0].normal_;
+  tri_data[tri_offset++] = n0[0];
+  tri_data[tri_offset++] = n0[1];
+  tri_data[tri_offset++] = n0[2];
+  tri_data[tri_offset++] = tri.vertex_[2].u_;
+  /// 頂点法線n1 + v2
+  const vec3 n1 = tri.vertex_[1].normal_;
+  tri_data[tri_offset++] = n1[0];
+  tri_data[tri_offset++] = n1[1];
+  tri_data[tri_offset++] = n1[2];
+  tri_data[tri_offset++] = tri.vertex_[2].v_;
+  /// 頂点法線n2
+  const vec3 n2 = tri.vertex_[2].normal_;
+  tri_data[tri_offset++] = n2[0];
+  tri_data[tri_offset++] = n2[1];
+  tri_data[tri_offset++] = n2[2];
+  /// テクスチャ座標の密度
+  tri_data[tri_offset++] = tri.uv_scale_;
+  /// マテリアル
+  std::memcpy(tri_data + tri_offset, &tri.material_, sizeof(uint32_t));
+}
+
+/*
+ * Triangleの読み込み (WriteTriangleの逆, 頂点v1, v2は辺から復元)
+ */
+Triangle Scene::ReadTriangle(const float *tri_data) {
+  Triangle tri;
+  const vec3 v0(tri_data[0], tri_data[1], tri_data[2]);
+  tri.e1_ = vec3(tri_data[4], tri_data[5], tri_data[6]);
+  tri.e2_ = vec3(tri_data[8], tri_data[9], tri_data[10]);
+  tri.face_norm_ = vec3(tri_data[12], tri_data[13], tri_data[14]);
+  tri.vertex_[0] = Vertex(v0, vec3(tri_data[16], tri_data[17], tri_data[18]), tri_data[3], tri_data[7]);
+  tri.vertex_[1] = Vertex(v0 + tri.e1_, vec3(tri_data[20], tri_data[21], tri_data[22]), tri_data[11], tri_data[15]);
+  tri.vertex_[2] = Vertex(v0 + tri.e2_, vec3(tri_data[24], tri_data[25], tri_data[26]), tri_data[19], tri_data[23]);
+  tri.InitTexCoords();
+  std::memcpy(&tri.material_, tri_data + 28, sizeof(uint32_t));
+  return tri;
+}
+
 /*
  * QuadBufferの作成
  */
 Buffer Scene::CreateQuadBuffer(Device &device, std::vector<Quad> &quads, WGPUBufferUsageFlags usage_flags, bool mapped_at_creation) const {
   BufferDescriptor quad_buffer_desc{};
-  auto quad_buffer_size = quad_stride_ * quads.size();
+  auto quad_buffer_size = QuadStride() * quads.size();
   quad_buffer_desc.size = quad_buffer_size;
   quad_buffer_desc.usage = usage_flags;
   quad_buffer_desc.mappedAtCreation = mapped_at_creation;
@@ -230,46 +873,164 @@ Buffer Scene::CreateQuadBuffer(Device &device, std::vector<Quad> &quads, WGPUBuf
   const uint32_t offset = 0;
   const uint32_t size = 0;
   auto *quad_data = (float *) quad_buffer.getConstMappedRange(offset, size);
-  uint32_t quad_offset = 0;
-  const float dummy = 1.0f;
-  for (auto quad: quads) {
-    /// 位置
-    quad_data[quad_offset++] = quad.q_[0];
-    quad_data[quad_offset++] = quad.q_[1];
-    quad_data[quad_offset++] = quad.q_[2];
-    quad_data[quad_offset++] = dummy;
-    /// 右ベクトル
-    quad_data[quad_offset++] = quad.right_[0];
-    quad_data[quad_offset++] = quad.right_[1];
-    quad_data[quad_offset++] = quad.right_[2];
-    quad_data[quad_offset++] = dummy;
-    /// 上ベクトル
-    quad_data[quad_offset++] = quad.up_[0];
-    quad_data[quad_offset++] = quad.up_[1];
-    quad_data[quad_offset++] = quad.up_[2];
-    quad_data[quad_offset++] = dummy;
-    /// 法線
-    quad_data[quad_offset++] = quad.norm_[0];
-    quad_data[quad_offset++] = quad.norm_[1];
-    quad_data[quad_offset++] = quad.norm_[2];
-    quad_data[quad_offset++] = dummy;
-    /// W = n / dot(n, n)
-    quad_data[quad_offset++] = quad.w_[0];
-    quad_data[quad_offset++] = quad.w_[1];
-    quad_data[quad_offset++] = quad.w_[2];
-    /// D = n_x q_x + n_y q_y + n_z q_z
-    quad_data[quad_offset++] = quad.d_;
-    /// カラー
-    quad_data[quad_offset++] = quad.color_[0];
-    quad_data[quad_offset++] = quad.color_[1];
-    quad_data[quad_offset++] = quad.color_[2];
-    /// エミッシブ
-    quad_data[quad_offset++] = quad.emissive_ ? 1.0f : 0.0f;
+  for (size_t i = 0; i < quads.size(); ++i) {
+    WriteQuadRecord(quads[i], quad_data + i * QuadStride() / sizeof(float));
   }
   quad_buffer.unmap();
   return quad_buffer;
 }
 
+/*
+ * QuadBufferのレコードサイズ (圧縮レイアウトでは12 words)
+ */
+uint32_t Scene::QuadStride() const {
+  return desc_.compact_geometry ? compact_quad_stride_ : quad_stride_;
+}
+
+/*
+ * TriangleBufferのサイズ (圧縮レイアウトでは格子が先頭, 空のバインディングは作れないので最低1要素)
+ */
+uint64_t Scene::TriangleBufferSize() const {
+  const auto count = std::max<uint64_t>(tris_.size(), 1);
+  return desc_.compact_geometry ? compact_header_size_ + compact_tri_stride_ * count : tri_stride_ * count;
+}
+
+/*
+ * QuadBufferのレコードの書き込み
+ */
+void Scene::WriteQuadRecord(const Quad &quad, float *quad_data) const {
+  if (desc_.compact_geometry) {
+    CompactGeometry::EncodeQuad(quad, (uint32_t *) quad_data);
+  } else {
+    WriteQuad(quad, quad_data);
+  }
+}
+
+/*
+ * Quadの書き込み (24 floats)
+ */
+void Scene::WriteQuad(const Quad &quad, float *quad_data) {
+  uint32_t quad_offset = 0;
+  const float dummy = 1.0f;
+  /// 位置
+  quad_data[quad_offset++] = quad.q_[0];
+  quad_data[quad_offset++] = quad.q_[1];
+  quad_data[quad_offset++] = quad.q_[2];
+  quad_data[quad_offset++] = dummy;
+  /// 右ベクトル
+  quad_data[quad_offset++] = quad.right_[0];
+  quad_data[quad_offset++] = quad.right_[1];
+  quad_data[quad_offset++] = quad.right_[2];
+  quad_data[quad_offset++] = dummy;
+  /// 上ベクトル
+  quad_data[quad_offset++] = quad.up_[0];
+  quad_data[quad_offset++] = quad.up_[1];
+  quad_data[quad_offset++] = quad.up_[2];
+  quad_data[quad_offset++] = dummy;
+  /// 法線
+  quad_data[quad_offset++] = quad.norm_[0];
+  quad_data[quad_offset++] = quad.norm_[1];
+  quad_data[quad_offset++] = quad.norm_[2];
+  quad_data[quad_offset++] = dummy;
+  /// W = n / dot(n, n)
+  quad_data[quad_offset++] = quad.w_[0];
+  quad_data[quad_offset++] = quad.w_[1];
+  quad_data[quad_offset++] = quad.w_[2];
+  /// D = n_x q_x + n_y q_y + n_z q_z
+  quad_data[quad_offset++] = quad.d_;
+  /// マテリアル
+  std::memcpy(quad_data + quad_offset, &quad.material_, sizeof(uint32_t));
+}
+
+/*
+ * LightBufferの作成 (Quad + エイリアステーブル, 球光源はQuadの後ろ)
+ */
+Buffer Scene::CreateLightBuffer(Device &device) {
+  const auto &alias_table = light_sampler_.AliasTable();
+  BufferDescriptor light_buffer_desc{};
+  light_buffer_desc.size = light_stride_ * alias_table.size();
+  light_buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+  light_buffer_desc.mappedAtCreation = true;
+  Buffer light_buffer = device.createBuffer(light_buffer_desc);
+  auto *light_data = (float *) light_buffer.getMappedRange(0, light_buffer_desc.size);
+  std::fill(light_data, light_data + light_buffer_desc.size / sizeof(float), 0.0f);
+  WriteLights(light_data);
+  light_buffer.unmap();
+  return light_buffer;
+}
+
+/*
+ * Lightの書き込み (Quad + エイリアステーブル)
+ */
+void Scene::WriteLights(float *light_data) const {
+  const auto &alias_table = light_sampler_.AliasTable();
+  for (size_t i = 0; i < alias_table.size(); ++i) {
+    auto *entry = light_data + i * light_stride_ / sizeof(float);
+    if (i < lights_.size()) {
+      WriteQuad(lights_[i], entry);
+    }
+    /// エイリアステーブル
+    std::memcpy(entry + quad_stride_ / sizeof(float), &alias_table[i], sizeof(LightAlias));
+  }
+}
+
+/*
+ * LightNodeBufferの作成
+ */
+Buffer Scene::CreateLightNodeBuffer(Device &device) {
+  const auto &nodes = light_sampler_.Nodes();
+  BufferDescriptor light_node_buffer_desc{};
+  light_node_buffer_desc.size = light_node_stride_ * nodes.size();
+  light_node_buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+  light_node_buffer_desc.mappedAtCreation = true;
+  Buffer light_node_buffer = device.createBuffer(light_node_buffer_desc);
+  auto *node_data = (LightNode *) light_node_buffer.getMappedRange(0, light_node_buffer_desc.size);
+  /// LightNodeはGPUのレイアウトと一致
+  std::copy(nodes.begin(), nodes.end(), node_data);
+  light_node_buffer.unmap();
+  return light_node_buffer;
+}
+
+/*
+ * InstanceBufferの作成
+ */
+Buffer Scene::CreateInstanceBuffer(Device &device) {
+  BufferDescriptor instance_buffer_desc{};
+  /// 空のバインディングは作れないので最低1要素
+  auto instance_buffer_size = instance_stride_ * std::max<size_t>(instances_.size(), 1);
+  instance_buffer_desc.size = instance_buffer_size;
+  instance_buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+  instance_buffer_desc.mappedAtCreation = true;
+  Buffer instance_buffer = device.createBuffer(instance_buffer_desc);
+  auto *instance_data = (float *) instance_buffer.getMappedRange(0, instance_buffer_size);
+  std::fill(instance_data, instance_data + instance_buffer_size / sizeof(float), 0.0f);
+  for (size_t i = 0; i < instances_.size(); ++i) {
+    WriteInstance(instances_[i], instance_data + i * instance_stride_ / sizeof(float));
+  }
+  instance_buffer.unmap();
+  return instance_buffer;
+}
+
+/*
+ * Instanceの書き込み (28 floats)
+ */
+void Scene::WriteInstance(const BVHInstance &instance, float *instance_data) const {
+  uint32_t instance_offset = 0;
+  /// 変換行列の上3行 (glmは列優先)
+  for (const auto &m: {instance.object_to_world, instance.world_to_object}) {
+    for (int row = 0; row < 3; ++row) {
+      for (int col = 0; col < 4; ++col) {
+        instance_data[instance_offset++] = m[col][row];
+      }
+    }
+  }
+  /// マテリアル
+  std::memcpy(instance_data + instance_offset++, &instance.material, sizeof(uint32_t));
+  /// BLASのルートノード
+  const uint32_t root = blas_node_offsets_[instance.blas];
+  std::memcpy(instance_data + instance_offset, &root, sizeof(uint32_t));
+}
+
 /*
  * SphereBufferの作成
  */
@@ -293,39 +1054,202 @@ Buffer Scene::CreateSphereBuffer(Device &device, size_t num, WGPUBufferUsageFlag
       sphere_data[sphere_offset++] = sphere.center_[2];
       /// 半径
       sphere_data[sphere_offset++] = sphere.radius_;
-      /// カラー
-      sphere_data[sphere_offset++] = sphere.color_[0];
-      sphere_data[sphere_offset++] = sphere.color_[1];
-      sphere_data[sphere_offset++] = sphere.color_[2];
-      /// エミッシブ
-      sphere_data[sphere_offset++] = sphere.emissive_;
+      /// マテリアル + パディング
+      std::memcpy(sphere_data + sphere_offset, &sphere.material_, sizeof(uint32_t));
+      sphere_offset += 4;
     }
     sphere_buffer.unmap();
   }
   return sphere_buffer;
 }
 
+/*
+ * BVHNodeBufferの作成
+ */
+Buffer Scene::CreateBVHNodeBuffer(Device &device) {
+  const auto &nodes = bvh_.Nodes();
+  BufferDescriptor bvh_node_buffer_desc{};
+  bvh_node_buffer_desc.size = bvh_node_stride_ * blas_node_offsets_.back();
+  bvh_node_buffer_desc.usage = BufferUsage::Storage | BufferUsage::CopyDst;
+  bvh_node_buffer_desc.mappedAtCreation = true;
+  Buffer bvh_node_buffer = device.createBuffer(bvh_node_buffer_desc);
+  auto *node_data = (BVHNode *) bvh_node_buffer.getMappedRange(0, bvh_node_buffer_desc.size);
+  /// BVHNodeはGPUのレイアウトと一致
+  std::copy(nodes.begin(), nodes.end(), node_data);
+  /// BLASの子ノードとプリミティブの添字はバッファ内の位置へずらす
+  for (size_t b = 0; b < blas_.size(); ++b) {
+    auto *blas_data = node_data + blas_node_offsets_[b];
+    std::copy(blas_[b].Nodes().begin(), blas_[b].Nodes().end(), blas_data);
+    for (size_t i = 0; i < blas_[b].Nodes().size(); ++i) {
+      blas_data[i].left_first += blas_data[i].IsLeaf() ? blas_prim_offsets_[b] : blas_node_offsets_[b];
+    }
+  }
+  bvh_node_buffer.unmap();
+  return bvh_node_buffer;
+}
+
+/*
+ * BVHPrimBufferの作成
+ */
+Buffer Scene::CreateBVHPrimBuffer(Device &device) {
+  const auto &prims = bvh_.Prims();
+  BufferDescriptor bvh_prim_buffer_desc{};
+  bvh_prim_buffer_desc.size = sizeof(uint32_t) * blas_prim_offsets_.back();
+  bvh_prim_buffer_desc.usage = BufferUsage::Storage;
+  bvh_prim_buffer_desc.mappedAtCreation = true;
+  Buffer bvh_prim_buffer = device.createBuffer(bvh_prim_buffer_desc);
+  auto *prim_data = (uint32_t *) bvh_prim_buffer.getMappedRange(0, bvh_prim_buffer_desc.size);
+  std::copy(prims.begin(), prims.end(), prim_data);
+  for (size_t b = 0; b < blas_.size(); ++b) {
+    std::copy(blas_[b].Prims().begin(), blas_[b].Prims().end(), prim_data + blas_prim_offsets_[b]);
+  }
+  bvh_prim_buffer.unmap();
+  return bvh_prim_buffer;
+}
+
+/*
+ * MaterialBufferの作成
+ */
+Buffer Scene::CreateMaterialBuffer(Device &device) {
+  BufferDescriptor material_buffer_desc{};
+  material_buffer_desc.size = material_stride_ * materials_.size();
+  material_buffer_desc.usage = BufferUsage::Storage;
+  material_buffer_desc.mappedAtCreation = true;
+  Buffer material_buffer = device.createBuffer(material_buffer_desc);
+  auto *material_data = (Material *) material_buffer.getMappedRange(0, material_buffer_desc.size);
+  /// MaterialはGPUのレイアウトと一致
+  std::copy(materials_.begin(), materials_.end(), material_data);
+  material_buffer.unmap();
+  return material_buffer;
+}
+
+/*
+ * TextureArrayの作成 (マップごとに1レイヤー + ミップマップ, マップが無ければ白の1x1)
+ */
+void Scene::CreateTextureArray(Device &device) {
+  SupportedLimits limits;
+  device.getLimits(&limits);
+  const auto size = std::max(textures_.Size(), 1u);
+  auto layers = std::max(textures_.Layers(), 1u);
+  if (layers > limits.limits.maxTextureArrayLayers) {
+    Error(PrintInfoType::WebGPUTracer, "Texture maps beyond the array layer limit are dropped: ", textures_.Layers());
+    layers = limits.limits.maxTextureArrayLayers;
+  }
+  TextureDescriptor texture_desc;
+  texture_desc.dimension = TextureDimension::_2D;
+  texture_desc.format = TextureFormat::RGBA8Unorm;
+  texture_desc.size = {size, size, layers};
+  texture_desc.sampleCount = 1;
+  texture_desc.viewFormatCount = 0;
+  texture_desc.viewFormats = nullptr;
+  texture_desc.usage = TextureUsage::TextureBinding | TextureUsage::CopyDst;
+  texture_desc.mipLevelCount = std::max(textures_.MipLevels(), 1u);
+  texture_desc.label = "Scene.texture_array_";
+  texture_array_ = device.createTexture(texture_desc);
+  Queue queue = device.getQueue();
+  ImageCopyTexture destination = Default;
+  destination.texture = texture_array_;
+  TextureDataLayout data_layout = Default;
+  if (textures_.Layers() == 0) {
+    const uint8_t white[] = {255, 255, 255, 255};
+    data_layout.bytesPerRow = sizeof(white);
+    data_layout.rowsPerImage = 1;
+    queue.writeTexture(destination, white, sizeof(white), data_layout, {1, 1, 1});
+  }
+  for (uint32_t layer = 0; layer < std::min(textures_.Layers(), layers); ++layer) {
+    for (uint32_t mip = 0; mip < textures_.MipLevels(); ++mip) {
+      const auto &level = textures_.Level(layer, mip);
+      const auto level_size = std::max(size >> mip, 1u);
+      destination.origin = {0, 0, layer};
+      destination.mipLevel = mip;
+      data_layout.bytesPerRow = 4 * level_size;
+      data_layout.rowsPerImage = level_size;
+      queue.writeTexture(destination, level.data(), level.size(), data_layout, {level_size, level_size, 1});
+    }
+  }
+  TextureViewDescriptor texture_view_desc;
+  texture_view_desc.aspect = TextureAspect::All;
+  texture_view_desc.baseArrayLayer = 0;
+  texture_view_desc.arrayLayerCount = layers;
+  texture_view_desc.dimension = TextureViewDimension::_2DArray;
+  texture_view_desc.format = TextureFormat::RGBA8Unorm;
+  texture_view_desc.mipLevelCount = texture_desc.mipLevelCount;
+  texture_view_desc.baseMipLevel = 0;
+  texture_view_desc.label = "Scene.texture_array_view_";
+  texture_array_view_ = texture_array_.createView(texture_view_desc);
+  /// Trilinear filtering, the shader picks the mip level (ray cone)
+  SamplerDescriptor sampler_desc;
+  sampler_desc.addressModeU = AddressMode::Repeat;
+  sampler_desc.addressModeV = AddressMode::Repeat;
+  sampler_desc.addressModeW = AddressMode::ClampToEdge;
+  sampler_desc.magFilter = FilterMode::Linear;
+  sampler_desc.minFilter = FilterMode::Linear;
+  sampler_desc.mipmapFilter = MipmapFilterMode::Linear;
+  sampler_desc.lodMinClamp = 0.0f;
+  sampler_desc.lodMaxClamp = (float) texture_desc.mipLevelCount;
+  sampler_desc.compare = CompareFunction::Undefined;
+  sampler_desc.maxAnisotropy = 1;
+  sampler_desc.label = "Scene.texture_sampler_";
+  texture_sampler_ = device.createSampler(sampler_desc);
+}
+
 /*
  * BindGroupの初期化
  */
 void Scene::InitBindGroup(Device &device) {
   /// BindGroup を作成
-  std::vector<BindGroupEntry> entries(3, Default);
+  std::vector<BindGroupEntry> entries(11, Default);
   /// LightBuffer
   entries[0].binding = 0;
   entries[0].buffer = light_buffer_;
   entries[0].offset = 0;
-  entries[0].size = quad_stride_ * lights_.size();
+  entries[0].size = light_stride_ * light_sampler_.Count();
   /// QuadBuffer
   entries[1].binding = 1;
   entries[1].buffer = quad_buffer_;
   entries[1].offset = 0;
-  entries[1].size = quad_stride_ * quads_.size();
+  entries[1].size = QuadStride() * quads_.size();
   /// SphereBuffer
   entries[2].binding = 2;
   entries[2].buffer = sphere_buffer_;
   entries[2].offset = 0;
   entries[2].size = sphere_stride_ * spheres_.size();
+  /// BVHNodeBuffer
+  entries[3].binding = 3;
+  entries[3].buffer = bvh_node_buffer_;
+  entries[3].offset = 0;
+  entries[3].size = bvh_node_stride_ * blas_node_offsets_.back();
+  /// BVHPrimBuffer
+  entries[4].binding = 4;
+  entries[4].buffer = bvh_prim_buffer_;
+  entries[4].offset = 0;
+  entries[4].size = sizeof(uint32_t) * blas_prim_offsets_.back();
+  /// TriangleBuffer
+  entries[5].binding = 5;
+  entries[5].buffer = tri_buffer_;
+  entries[5].offset = 0;
+  entries[5].size = TriangleBufferSize();
+  /// LightNodeBuffer
+  entries[6].binding = 6;
+  entries[6].buffer = light_node_buffer_;
+  entries[6].offset = 0;
+  entries[6].size = light_node_stride_ * light_sampler_.Nodes().size();
+  /// InstanceBuffer
+  entries[7].binding = 7;
+  entries[7].buffer = instance_buffer_;
+  entries[7].offset = 0;
+  entries[7].size = instance_stride_ * std::max<size_t>(instances_.size(), 1);
+  /// MaterialBuffer
+  entries[8].binding = 8;
+  entries[8].buffer = material_buffer_;
+  entries[8].offset = 0;
+  entries[8].size = material_stride_ * materials_.size();
+  /// TextureArray
+  entries[9].binding = 9;
+  entries[9].textureView = texture_array_view_;
+  /// TextureSampler
+  entries[10].binding = 10;
+  entries[10].sampler = texture_sampler_;
   BindGroupDescriptor bind_group_desc;
   bind_group_desc.layout = objects_.bind_group_layout_;
   bind_group_desc.entryCount = (uint32_t) entries.size();
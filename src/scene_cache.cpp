@@ -0,0 +1,242 @@
+#include "scene_cache.h"
+#include "utils/print_util.h"
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace {
+constexpr uint32_t kSections = 5;
+constexpr char kMagic[8] = {'W', 'G', 'T', 'S', 'C', 'E', 'N', 'E'};
+
+struct FileSection {
+    uint64_t offset;
+    uint32_t count;
+    uint32_t stride;
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t texture_size;
+    uint32_t layer_size;
+    uint32_t mip_levels;
+    uint64_t obj_size;
+    uint64_t obj_hash;
+    FileSection sections[kSections];
+    /// Hash, size, path length and path of every dependency, after the sections
+    uint64_t dependencies_offset;
+    uint32_t dependency_count;
+    uint32_t pad;
+};
+
+/// \brief The sections in file order
+std::array<SceneCache::Span *, kSections> Spans(SceneCache::Sections &sections) {
+  return {&sections.materials, &sections.triangles, &sections.bvh_nodes, &sections.bvh_prims, &sections.textures};
+}
+
+/// Sections start 16-byte aligned, the mapping itself is page aligned
+uint64_t Align(uint64_t offset) {
+  return (offset + 15) & ~uint64_t(15);
+}
+
+/// \brief Size and hash of a file
+bool HashFile(const std::string &path, uint64_t &size, uint64_t &hash) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+  size = file.Size();
+  hash = SceneCache::Hash(file.Data(), file.Size());
+  return true;
+}
+
+/// \brief MTL files named by the mtllib statements of an OBJ file
+std::vector<std::string> MtlLibraries(const std::string &obj_file) {
+  std::vector<std::string> libraries;
+  std::ifstream in(obj_file);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.rfind("mtllib", 0) != 0 || line.size() < 7 || !std::isspace((unsigned char) line[6])) {
+      continue;
+    }
+    std::istringstream names(line.substr(7));
+    std::string name;
+    while (names >> name) {
+      libraries.push_back(name);
+    }
+  }
+  return libraries;
+}
+}
+
+uint64_t SceneCache::Hash(const uint8_t *data, uint64_t size) {
+  const uint64_t prime = 1099511628211ull;
+  uint64_t hash = 14695981039346656037ull;
+  uint64_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 32;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ data[i]) * prime;
+  }
+  return hash;
+}
+
+bool SceneCache::Write(const std::string &path, const std::string &obj_file, uint32_t texture_size, uint32_t layer_size,
+                       uint32_t mip_levels, const Sections &sections, const std::vector<std::string> &dependencies) {
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.texture_size = texture_size;
+  header.layer_size = layer_size;
+  header.mip_levels = mip_levels;
+  if (!HashFile(obj_file, header.obj_size, header.obj_hash)) {
+    Error(PrintInfoType::WebGPUTracer, "Cannot read OBJ file: ", obj_file);
+    return false;
+  }
+  auto copy = sections;
+  const auto spans = Spans(copy);
+  uint64_t offset = Align(sizeof(FileHeader));
+  for (uint32_t i = 0; i < kSections; ++i) {
+    header.sections[i] = {offset, spans[i]->count, spans[i]->stride};
+    offset = Align(offset + (uint64_t) spans[i]->count * spans[i]->stride);
+  }
+  header.dependencies_offset = offset;
+  /// Paths relative to the OBJ file, the cache stays valid when the directory moves
+  const auto base_dir = std::filesystem::path(obj_file).parent_path();
+  auto files = dependencies;
+  for (const auto &library: MtlLibraries(obj_file)) {
+    files.push_back((base_dir / library).string());
+  }
+  std::ostringstream deps;
+  for (const auto &file: files) {
+    uint64_t size, hash;
+    if (!HashFile(file, size, hash)) {
+      Error(PrintInfoType::WebGPUTracer, "Scene cache dependency not found: ", file);
+      continue;
+    }
+    const auto relative = std::filesystem::path(file).lexically_relative(base_dir).generic_string();
+    const auto length = (uint32_t) relative.size();
+    deps.write((const char *) &hash, sizeof(hash));
+    deps.write((const char *) &size, sizeof(size));
+    deps.write((const char *) &length, sizeof(length));
+    deps.write(relative.data(), length);
+    ++header.dependency_count;
+  }
+  /// Written next to the cache and renamed, a reader never maps a partial file
+  const auto tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      Error(PrintInfoType::WebGPUTracer, "Cannot write scene cache: ", tmp_path);
+      return false;
+    }
+    const char zeros[16] = {};
+    out.write((const char *) &header, sizeof(header));
+    out.write(zeros, (std::streamsize) (Align(sizeof(header)) - sizeof(header)));
+    for (const auto *span: spans) {
+      const auto size = (uint64_t) span->count * span->stride;
+      out.write((const char *) span->data, (std::streamsize) size);
+      out.write(zeros, (std::streamsize) (Align(size) - size));
+    }
+    out << deps.str();
+    if (!out) {
+      Error(PrintInfoType::WebGPUTracer, "Cannot write scene cache: ", tmp_path);
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_path, path, error);
+  if (error) {
+    Error(PrintInfoType::WebGPUTracer, "Cannot write scene cache: ", error.message());
+    std::filesystem::remove(tmp_path, error);
+    return false;
+  }
+  return true;
+}
+
+bool SceneCache::Open(const std::string &path, const std::string &obj_file, uint32_t texture_size, const Sections &layout) {
+  Close();
+  MappedFile file;
+  if (!file.Open(path)) {
+    return false;
+  }
+  const auto stale = [&path](const char *reason) {
+      Print(PrintInfoType::WebGPUTracer, "Scene cache ignored: ", path + " " + reason);
+      return false;
+  };
+  if (file.Size() < sizeof(FileHeader)) {
+    return stale("is truncated");
+  }
+  FileHeader header{};
+  std::memcpy(&header, file.Data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    return stale("is not a scene cache");
+  }
+  if (header.version != kVersion) {
+    return stale("was compiled by another version");
+  }
+  if (header.texture_size != texture_size) {
+    return stale("was compiled with another texture size");
+  }
+  auto expected = layout;
+  const auto expected_spans = Spans(expected);
+  for (uint32_t i = 0; i < kSections; ++i) {
+    const auto &section = header.sections[i];
+    if (section.stride != expected_spans[i]->stride) {
+      return stale("was compiled with other buffer layouts");
+    }
+    if (section.offset % 16 != 0 || section.offset + (uint64_t) section.count * section.stride > file.Size()) {
+      return stale("is truncated");
+    }
+  }
+  uint64_t obj_size, obj_hash;
+  if (!HashFile(obj_file, obj_size, obj_hash) || obj_size != header.obj_size || obj_hash != header.obj_hash) {
+    return stale("is out of date, the OBJ file changed");
+  }
+  /// MTL files and maps
+  const auto base_dir = std::filesystem::path(obj_file).parent_path();
+  auto offset = header.dependencies_offset;
+  for (uint32_t i = 0; i < header.dependency_count; ++i) {
+    uint64_t hash, size;
+    uint32_t length;
+    if (offset + sizeof(hash) + sizeof(size) + sizeof(length) > file.Size()) {
+      return stale("is truncated");
+    }
+    std::memcpy(&hash, file.Data() + offset, sizeof(hash));
+    std::memcpy(&size, file.Data() + offset + sizeof(hash), sizeof(size));
+    std::memcpy(&length, file.Data() + offset + sizeof(hash) + sizeof(size), sizeof(length));
+    offset += sizeof(hash) + sizeof(size) + sizeof(length);
+    if (offset + length > file.Size()) {
+      return stale("is truncated");
+    }
+    const std::string relative((const char *) file.Data() + offset, length);
+    offset += length;
+    uint64_t file_size, file_hash;
+    if (!HashFile((base_dir / relative).string(), file_size, file_hash) || file_size != size || file_hash != hash) {
+      return stale(("is out of date, " + relative + " changed").c_str());
+    }
+  }
+  const auto spans = Spans(sections_);
+  for (uint32_t i = 0; i < kSections; ++i) {
+    const auto &section = header.sections[i];
+    *spans[i] = {file.Data() + section.offset, section.count, section.stride};
+  }
+  layer_size_ = header.layer_size;
+  mip_levels_ = header.mip_levels;
+  file_ = std::move(file);
+  return true;
+}
+
+void SceneCache::Close() {
+  file_.Close();
+  sections_ = {};
+  layer_size_ = 0;
+  mip_levels_ = 0;
+}
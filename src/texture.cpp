@@ -0,0 +1,188 @@
+#include "texture.h"
+#include "ray.h"
+#include "utils/color_util.h"
+#include "utils/print_util.h"
+#include "stb_image.h"
+
+namespace {
+/// \brief Resample every row of a w x h RGBA image to dst_w texels
+/// Box filter where the row shrinks, linear interpolation with wrap-around where it grows (the sampler repeats).
+std::vector<vec4> ResampleRows(const std::vector<vec4> &src, uint32_t w, uint32_t h, uint32_t dst_w) {
+  std::vector<vec4> dst((size_t) dst_w * h);
+  const float ratio = (float) w / (float) dst_w;
+  for (uint32_t y = 0; y < h; ++y) {
+    const auto *row = &src[(size_t) y * w];
+    for (uint32_t x = 0; x < dst_w; ++x) {
+      vec4 sum(0.0f);
+      if (ratio >= 1.0f) {
+        const float a = (float) x * ratio;
+        const float b = a + ratio;
+        for (auto i = (uint32_t) a; i < std::min((uint32_t) std::ceil(b), w); ++i) {
+          sum += row[i] * (std::min(b, (float) i + 1.0f) - std::max(a, (float) i));
+        }
+        sum = sum / ratio;
+      } else {
+        const float s = ((float) x + 0.5f) * ratio - 0.5f;
+        const float f = s - std::floor(s);
+        const auto i0 = (int) std::floor(s);
+        sum = row[(i0 + w) % w] * (1.0f - f) + row[(i0 + 1) % w] * f;
+      }
+      dst[(size_t) y * dst_w + x] = sum;
+    }
+  }
+  return dst;
+}
+
+std::vector<vec4> Transpose(const std::vector<vec4> &src, uint32_t w, uint32_t h) {
+  std::vector<vec4> dst(src.size());
+  for (uint32_t y = 0; y < h; ++y) {
+    for (uint32_t x = 0; x < w; ++x) {
+      dst[(size_t) x * h + y] = src[(size_t) y * w + x];
+    }
+  }
+  return dst;
+}
+
+/// \brief 8-bit texels of a level, color maps are stored sRGB encoded (alpha stays linear)
+std::vector<uint8_t> Encode(const std::vector<vec4> &level, bool srgb) {
+  std::vector<uint8_t> texels(level.size() * 4);
+  for (size_t i = 0; i < level.size(); ++i) {
+    for (int c = 0; c < 4; ++c) {
+      auto v = Clamp(level[i][c], 0.0f, 1.0f);
+      if (srgb && c < 3) {
+        v = LinearToSRGB(v);
+      }
+      texels[i * 4 + c] = (uint8_t) std::lround(v * 255.0f);
+    }
+  }
+  return texels;
+}
+}
+
+uint32_t TextureArray::Load(const std::string &path, bool srgb) {
+  for (uint32_t i = 0; i < layers_.size(); ++i) {
+    if (layers_[i].path == path && layers_[i].srgb == srgb) {
+      return i;
+    }
+  }
+  int width, height, channels;
+  auto *data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+  if (data == nullptr) {
+    Error(PrintInfoType::WebGPUTracer, "Cannot load texture: ", path);
+    return kNoHit;
+  }
+  Layer layer;
+  layer.path = path;
+  layer.srgb = srgb;
+  layer.width = (uint32_t) width;
+  layer.height = (uint32_t) height;
+  layer.texels.assign(data, data + (size_t) width * height * 4);
+  stbi_image_free(data);
+  layers_.push_back(std::move(layer));
+  return (uint32_t) layers_.size() - 1;
+}
+
+int TextureArray::Channels(const std::string &path) {
+  int width, height, channels;
+  return stbi_info(path.c_str(), &width, &height, &channels) ? channels : 0;
+}
+
+void TextureArray::Build(uint32_t max_size) {
+  size_ = 0;
+  if (layers_.empty()) {
+    return;
+  }
+  /// Smallest power of two that holds the largest map
+  uint32_t largest = 1;
+  for (const auto &layer: layers_) {
+    largest = std::max({largest, layer.width, layer.height});
+  }
+  size_ = 1;
+  while (size_ < largest && size_ * 2 <= std::max(max_size, 1u)) {
+    size_ *= 2;
+  }
+  uint32_t mip_levels = 1;
+  while ((size_ >> mip_levels) > 0) {
+    ++mip_levels;
+  }
+  for (auto &layer: layers_) {
+    std::vector<vec4> image((size_t) layer.width * layer.height);
+    for (size_t i = 0; i < image.size(); ++i) {
+      for (int c = 0; c < 4; ++c) {
+        const auto v = (float) layer.texels[i * 4 + c] / 255.0f;
+        image[i][c] = layer.srgb && c < 3 ? SRGBToLinear(v) : v;
+      }
+    }
+    /// Rows, then columns through the transpose
+    image = ResampleRows(image, layer.width, layer.height, size_);
+    image = Transpose(ResampleRows(Transpose(image, size_, layer.height), layer.height, size_, size_), size_, size_);
+    layer.texels.clear();
+    layer.texels.shrink_to_fit();
+    layer.mips.assign(mip_levels, {});
+    layer.mips[0] = Encode(image, layer.srgb);
+    /// Box filtered mips in linear space
+    for (uint32_t mip = 1, size = size_ / 2; mip < mip_levels; ++mip, size /= 2) {
+      std::vector<vec4> level((size_t) size * size);
+      for (uint32_t y = 0; y < size; ++y) {
+        for (uint32_t x = 0; x < size; ++x) {
+          const auto *src = &image[(size_t) 2 * y * 2 * size + 2 * x];
+          level[(size_t) y * size + x] = (src[0] + src[1] + src[2 * size] + src[2 * size + 1]) / 4.0f;
+        }
+      }
+      layer.mips[mip] = Encode(level, layer.srgb);
+      image = std::move(level);
+    }
+  }
+}
+
+void TextureArray::Assign(uint32_t size, uint32_t layers, uint32_t mip_levels, const uint8_t *texels) {
+  size_ = size;
+  layers_.assign(layers, {});
+  for (auto &layer: layers_) {
+    layer.width = size;
+    layer.height = size;
+    layer.mips.resize(mip_levels);
+    for (uint32_t mip = 0; mip < mip_levels; ++mip) {
+      const auto level_size = (size_t) std::max(size >> mip, 1u);
+      layer.mips[mip].assign(texels, texels + level_size * level_size * 4);
+      texels += level_size * level_size * 4;
+    }
+  }
+}
+
+void TextureArray::Clear() {
+  layers_.clear();
+  size_ = 0;
+}
+
+/// Mirrors the sampler: linear filtering between texels and mip levels, repeating coordinates.
+/// Color maps come out sRGB encoded like textureSampleLevel returns them.
+vec4 TextureArray::Sample(uint32_t layer, glm::vec2 uv, float lod) const {
+  const auto max_lod = (float) (MipLevels() - 1);
+  lod = Clamp(lod, 0.0f, max_lod);
+  const auto mip = (uint32_t) lod;
+  const auto f = lod - (float) mip;
+  const auto col = Bilinear(layer, mip, uv);
+  if (f == 0.0f) {
+    return col;
+  }
+  return col * (1.0f - f) + Bilinear(layer, mip + 1, uv) * f;
+}
+
+vec4 TextureArray::Bilinear(uint32_t layer, uint32_t mip, glm::vec2 uv) const {
+  const auto size = (int) std::max(size_ >> mip, 1u);
+  const auto &texels = layers_[layer].mips[mip];
+  const auto x = uv.x * (float) size - 0.5f;
+  const auto y = uv.y * (float) size - 0.5f;
+  const auto fx = x - std::floor(x);
+  const auto fy = y - std::floor(y);
+  const auto wrap = [size](int i) { return ((i % size) + size) % size; };
+  const auto x0 = wrap((int) std::floor(x)), x1 = wrap((int) std::floor(x) + 1);
+  const auto y0 = wrap((int) std::floor(y)), y1 = wrap((int) std::floor(y) + 1);
+  const auto texel = [&](int tx, int ty) {
+    const auto *t = &texels[((size_t) ty * size + tx) * 4];
+    return vec4(t[0], t[1], t[2], t[3]) / 255.0f;
+  };
+  return (texel(x0, y0) * (1.0f - fx) + texel(x1, y0) * fx) * (1.0f - fy) +
+         (texel(x0, y1) * (1.0f - fx) + texel(x1, y1) * fx) * fy;
+}
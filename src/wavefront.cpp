@@ -0,0 +1,286 @@
+#include "wavefront.h"
+#include <cstring>
+
+namespace {
+/// WaveParam of path_tracer.wgsl / wave_prepare.wgsl
+struct WaveParam {
+    uint32_t depth{};
+    uint32_t path_stats{};
+    uint32_t pad[2]{};
+};
+
+ComputePipeline CreatePipeline(Device device, PipelineLayout layout, ShaderModule module, const char *entry_point) {
+  ComputePipelineDescriptor pipeline_desc;
+  pipeline_desc.compute.constantCount = 0;
+  pipeline_desc.compute.constants = nullptr;
+  pipeline_desc.compute.entryPoint = entry_point;
+  pipeline_desc.compute.module = module;
+  pipeline_desc.layout = layout;
+  pipeline_desc.label = entry_point;
+  ComputePipeline pipeline = device.createComputePipeline(pipeline_desc);
+  Print(PrintInfoType::WebGPU, "Wavefront pipeline: ", pipeline);
+  return pipeline;
+}
+}
+
+bool WavefrontIntegrator::Init(Device device, BindGroupLayout camera_layout, BindGroupLayout scene_layout,
+                               BindGroupLayout sampler_layout, const Limits &limits) {
+  if (limits.maxStorageBuffersPerShaderStage < kStorageBuffers) {
+    Error(PrintInfoType::WebGPUTracer, "Wavefront kernels need maxStorageBuffersPerShaderStage: ", kStorageBuffers);
+    return false;
+  }
+  device_ = device;
+  limits_ = limits;
+  InitBindGroupLayouts();
+
+  /// Wave kernels: camera, scene, tile outputs + path state, sampler tables
+  PipelineLayoutDescriptor layout_desc{};
+  std::vector<WGPUBindGroupLayout> bind_group_layouts{camera_layout, scene_layout, wave_bind_group_layout_, sampler_layout};
+  layout_desc.bindGroupLayoutCount = (uint32_t) bind_group_layouts.size();
+  layout_desc.bindGroupLayouts = (WGPUBindGroupLayout *) bind_group_layouts.data();
+  pipeline_layout_ = device_.createPipelineLayout(layout_desc);
+  ShaderModule shader_module = LoadShaderModule(RESOURCE_DIR "/shader/path_tracer.wgsl", device_);
+  begin_pipeline_ = CreatePipeline(device_, pipeline_layout_, shader_module, "wave_begin");
+  generate_pipeline_ = CreatePipeline(device_, pipeline_layout_, shader_module, "wave_generate");
+  extend_pipeline_ = CreatePipeline(device_, pipeline_layout_, shader_module, "wave_extend");
+  sort_pipeline_ = CreatePipeline(device_, pipeline_layout_, shader_module, "wave_sort");
+  shade_pipeline_ = CreatePipeline(device_, pipeline_layout_, shader_module, "wave_shade");
+  shader_module.release();
+
+  /// Queue bookkeeping only
+  layout_desc.bindGroupLayoutCount = 1;
+  layout_desc.bindGroupLayouts = (WGPUBindGroupLayout *) &prepare_bind_group_layout_;
+  prepare_pipeline_layout_ = device_.createPipelineLayout(layout_desc);
+  shader_module = LoadShaderModule(RESOURCE_DIR "/shader/wave_prepare.wgsl", device_);
+  prepare_pipeline_ = CreatePipeline(device_, prepare_pipeline_layout_, shader_module, "wave_prepare");
+  shader_module.release();
+
+  wave_param_stride_ = (uint32_t) ((sizeof(WaveParam) + limits.minUniformBufferOffsetAlignment - 1) /
+                                   limits.minUniformBufferOffsetAlignment * limits.minUniformBufferOffsetAlignment);
+  return true;
+}
+
+/// \brief Group 2 of the wave kernels and group 0 of wave_prepare
+void WavefrontIntegrator::InitBindGroupLayouts() {
+  auto storage = [](uint32_t binding, bool dynamic_offset) {
+      BindGroupLayoutEntry entry = Default;
+      entry.binding = binding;
+      entry.buffer.type = BufferBindingType::Storage;
+      entry.buffer.hasDynamicOffset = dynamic_offset;
+      entry.visibility = ShaderStage::Compute;
+      return entry;
+  };
+  auto uniform = [](uint32_t binding, uint64_t size) {
+      BindGroupLayoutEntry entry = Default;
+      entry.binding = binding;
+      entry.buffer.type = BufferBindingType::Uniform;
+      entry.buffer.hasDynamicOffset = true;
+      entry.buffer.minBindingSize = size;
+      entry.visibility = ShaderStage::Compute;
+      return entry;
+  };
+  /// Same bindings 0-2 as Renderer::compute_bind_group_layout_
+  std::vector<BindGroupLayoutEntry> bindings;
+  bindings.push_back(storage(0, true));
+  BindGroupLayoutEntry output = Default;
+  output.binding = 1;
+  output.storageTexture.access = StorageTextureAccess::WriteOnly;
+  output.storageTexture.format = TextureFormat::RGBA8Unorm;
+  output.storageTexture.viewDimension = TextureViewDimension::_2D;
+  output.visibility = ShaderStage::Compute;
+  bindings.push_back(output);
+  bindings.push_back(uniform(2, 0));
+  bindings.push_back(storage(3, false));
+  bindings.push_back(storage(4, false));
+  bindings.push_back(uniform(5, sizeof(WaveParam)));
+  /// G-buffer of the denoiser, written by wave_shade (bindings 8 and 9 of Renderer::compute_bind_group_layout_)
+  auto storage_texture = [](uint32_t binding, TextureFormat format) {
+      BindGroupLayoutEntry entry = Default;
+      entry.binding = binding;
+      entry.storageTexture.access = StorageTextureAccess::WriteOnly;
+      entry.storageTexture.format = format;
+      entry.storageTexture.viewDimension = TextureViewDimension::_2D;
+      entry.visibility = ShaderStage::Compute;
+      return entry;
+  };
+  bindings.push_back(storage_texture(8, TextureFormat::RGBA16Float));
+  bindings.push_back(storage_texture(9, TextureFormat::RGBA32Float));
+  BindGroupLayoutDescriptor bind_group_layout_desc{};
+  bind_group_layout_desc.entryCount = (uint32_t) bindings.size();
+  bind_group_layout_desc.entries = bindings.data();
+  bind_group_layout_desc.label = "WavefrontIntegrator.wave_bind_group_layout_";
+  wave_bind_group_layout_ = device_.createBindGroupLayout(bind_group_layout_desc);
+
+  bindings = {storage(0, false), storage(1, false), uniform(2, sizeof(WaveParam)), storage(3, false)};
+  bind_group_layout_desc.entryCount = (uint32_t) bindings.size();
+  bind_group_layout_desc.entries = bindings.data();
+  bind_group_layout_desc.label = "WavefrontIntegrator.prepare_bind_group_layout_";
+  prepare_bind_group_layout_ = device_.createBindGroupLayout(bind_group_layout_desc);
+}
+
+void WavefrontIntegrator::Release() {
+  if (!Ready()) {
+    return;
+  }
+  ReleaseFrameResources();
+  prepare_pipeline_.release();
+  shade_pipeline_.release();
+  sort_pipeline_.release();
+  extend_pipeline_.release();
+  generate_pipeline_.release();
+  begin_pipeline_.release();
+  prepare_pipeline_layout_.release();
+  pipeline_layout_.release();
+  prepare_bind_group_layout_.release();
+  wave_bind_group_layout_.release();
+  pipeline_layout_ = nullptr;
+}
+
+bool WavefrontIntegrator::InitFrameResources(uint32_t tile_size, uint32_t max_depth, Buffer accum_buffer, uint64_t accum_tile_stride,
+                                             TextureView output_view, Buffer tile_param_buffer, uint64_t tile_param_size,
+                                             Buffer path_stats_buffer, bool path_stats, TextureView albedo_view,
+                                             TextureView normal_depth_view) {
+  ReleaseFrameResources();
+  max_depth_ = max_depth;
+  const uint64_t capacity = (uint64_t) tile_size * tile_size;
+  const uint64_t path_buffer_size = capacity * kPathStateSize;
+  /// count[2], bin_count and bin_fill followed by two queues and the sorted queue of `capacity` path indices
+  const uint64_t queue_buffer_size = (2 + 2 * kShadeBins + 3 * capacity) * sizeof(uint32_t);
+  const uint64_t args_buffer_size = 3 * sizeof(uint32_t);
+  if (path_buffer_size > limits_.maxStorageBufferBindingSize) {
+    Error(PrintInfoType::WebGPUTracer, "Wavefront path state exceeds maxStorageBufferBindingSize, reduce the tile size: ", tile_size);
+    return false;
+  }
+  BufferDescriptor buffer_desc{};
+  buffer_desc.mappedAtCreation = false;
+  buffer_desc.size = path_buffer_size;
+  buffer_desc.usage = BufferUsage::Storage;
+  buffer_desc.label = "WavefrontIntegrator.path_buffer_";
+  path_buffer_ = device_.createBuffer(buffer_desc);
+  buffer_desc.size = queue_buffer_size;
+  buffer_desc.label = "WavefrontIntegrator.queue_buffer_";
+  queue_buffer_ = device_.createBuffer(buffer_desc);
+  buffer_desc.size = args_buffer_size;
+  buffer_desc.usage = BufferUsage::Storage | BufferUsage::Indirect;
+  buffer_desc.label = "WavefrontIntegrator.args_buffer_";
+  args_buffer_ = device_.createBuffer(buffer_desc);
+
+  /// One WaveParam per bounce, selected with a dynamic offset
+  buffer_desc.mappedAtCreation = true;
+  buffer_desc.size = (uint64_t) wave_param_stride_ * max_depth_;
+  buffer_desc.usage = BufferUsage::Uniform;
+  buffer_desc.label = "WavefrontIntegrator.wave_param_buffer_";
+  wave_param_buffer_ = device_.createBuffer(buffer_desc);
+  auto *mapping = (uint8_t *) wave_param_buffer_.getMappedRange(0, buffer_desc.size);
+  std::fill(mapping, mapping + buffer_desc.size, 0);
+  for (uint32_t depth = 0; depth < max_depth_; ++depth) {
+    WaveParam param{};
+    param.depth = depth;
+    param.path_stats = path_stats ? 1 : 0;
+    std::memcpy(mapping + depth * wave_param_stride_, &param, sizeof(WaveParam));
+  }
+  wave_param_buffer_.unmap();
+
+  std::vector<BindGroupEntry> entries(8, Default);
+  entries[0].binding = 0;
+  entries[0].buffer = accum_buffer;
+  entries[0].size = accum_tile_stride;
+  entries[1].binding = 1;
+  entries[1].textureView = output_view;
+  entries[2].binding = 2;
+  entries[2].buffer = tile_param_buffer;
+  entries[2].size = tile_param_size;
+  entries[3].binding = 3;
+  entries[3].buffer = path_buffer_;
+  entries[3].size = path_buffer_size;
+  entries[4].binding = 4;
+  entries[4].buffer = queue_buffer_;
+  entries[4].size = queue_buffer_size;
+  entries[5].binding = 5;
+  entries[5].buffer = wave_param_buffer_;
+  entries[5].size = sizeof(WaveParam);
+  entries[6].binding = 8;
+  entries[6].textureView = albedo_view;
+  entries[7].binding = 9;
+  entries[7].textureView = normal_depth_view;
+  BindGroupDescriptor bind_group_desc;
+  bind_group_desc.layout = wave_bind_group_layout_;
+  bind_group_desc.entryCount = (uint32_t) entries.size();
+  bind_group_desc.entries = (WGPUBindGroupEntry *) entries.data();
+  wave_bind_group_ = device_.createBindGroup(bind_group_desc);
+  Print(PrintInfoType::WebGPU, "Wavefront bind group: ", wave_bind_group_);
+
+  entries = std::vector<BindGroupEntry>(4, Default);
+  entries[0].binding = 0;
+  entries[0].buffer = queue_buffer_;
+  entries[0].size = queue_buffer_size;
+  entries[1].binding = 1;
+  entries[1].buffer = args_buffer_;
+  entries[1].size = args_buffer_size;
+  entries[2].binding = 2;
+  entries[2].buffer = wave_param_buffer_;
+  entries[2].size = sizeof(WaveParam);
+  entries[3].binding = 3;
+  entries[3].buffer = path_stats_buffer;
+  entries[3].size = 2 * sizeof(uint32_t) * (uint64_t) max_depth_;
+  bind_group_desc.layout = prepare_bind_group_layout_;
+  bind_group_desc.entryCount = (uint32_t) entries.size();
+  bind_group_desc.entries = (WGPUBindGroupEntry *) entries.data();
+  prepare_bind_group_ = device_.createBindGroup(bind_group_desc);
+  return true;
+}
+
+void WavefrontIntegrator::ReleaseFrameResources() {
+  if (!wave_bind_group_) {
+    return;
+  }
+  prepare_bind_group_.release();
+  wave_bind_group_.release();
+  wave_param_buffer_.destroy();
+  wave_param_buffer_.release();
+  args_buffer_.destroy();
+  args_buffer_.release();
+  queue_buffer_.destroy();
+  queue_buffer_.release();
+  path_buffer_.destroy();
+  path_buffer_.release();
+  wave_bind_group_ = nullptr;
+}
+
+void WavefrontIntegrator::Record(ComputePassEncoder &pass, BindGroup camera, BindGroup scene, BindGroup sampler,
+                                 const std::array<uint32_t, 2> &offsets, const uint32_t size[2], uint32_t sample_count) {
+  /// Dynamic offsets are ordered by binding: accumBuffer(0), tile(2), wave(5)
+  auto bind_wave_group = [&](uint32_t depth) {
+      std::array<uint32_t, 3> wave_offsets{offsets[0], offsets[1], depth * wave_param_stride_};
+      pass.setBindGroup(2, wave_bind_group_, (uint32_t) wave_offsets.size(), wave_offsets.data());
+  };
+  const uint32_t workgroup_count_x = (size[0] + kTileGroupSize - 1) / kTileGroupSize;
+  const uint32_t workgroup_count_y = (size[1] + kTileGroupSize - 1) / kTileGroupSize;
+  pass.setPipeline(begin_pipeline_);
+  pass.setBindGroup(0, camera, 0, nullptr);
+  pass.setBindGroup(1, scene, 0, nullptr);
+  bind_wave_group(0);
+  pass.setBindGroup(3, sampler, 0, nullptr);
+  pass.dispatchWorkgroups(workgroup_count_x, workgroup_count_y, 1);
+  for (uint32_t s = 0; s < sample_count; ++s) {
+    pass.setPipeline(generate_pipeline_);
+    pass.setBindGroup(0, camera, 0, nullptr);
+    bind_wave_group(0);
+    pass.dispatchWorkgroups(workgroup_count_x, workgroup_count_y, 1);
+    for (uint32_t depth = 0; depth < max_depth_; ++depth) {
+      /// Group 0 is replaced by the queue bookkeeping of wave_prepare
+      const uint32_t wave_offset = depth * wave_param_stride_;
+      pass.setPipeline(prepare_pipeline_);
+      pass.setBindGroup(0, prepare_bind_group_, 1, &wave_offset);
+      pass.dispatchWorkgroups(1, 1, 1);
+      pass.setPipeline(extend_pipeline_);
+      pass.setBindGroup(0, camera, 0, nullptr);
+      bind_wave_group(depth);
+      pass.dispatchWorkgroupsIndirect(args_buffer_, 0);
+      pass.setPipeline(sort_pipeline_);
+      pass.dispatchWorkgroupsIndirect(args_buffer_, 0);
+      pass.setPipeline(shade_pipeline_);
+      pass.dispatchWorkgroupsIndirect(args_buffer_, 0);
+    }
+  }
+}
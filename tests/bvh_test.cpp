@@ -0,0 +1,128 @@
+/// BVH traversal test
+/// Builds the BVH over random triangles, quads and spheres and checks that BVH::Intersect and BVH::Intersect4 find
+/// the same closest hit as BVH::IntersectBruteForce for random rays, so the CPU traversal the shader mirrors is
+/// checked without a GPU.
+///
+/// Usage: bvh_test [--rays N] [--seed N]
+#include "bvh.h"
+#include <cstring>
+#include <iostream>
+#include <random>
+
+namespace {
+struct TestScene {
+    std::vector<Quad> lights;
+    std::vector<Quad> quads;
+    std::vector<Sphere> spheres;
+    std::vector<Triangle> tris;
+    std::vector<BVHInstance> instances;
+    std::vector<BVH> blas;
+
+    [[nodiscard]] BVHPrimitives Prims() const { return {lights, quads, spheres, tris, instances, blas}; }
+};
+
+/// \brief Primitives scattered over a 100^3 box, small enough that most rays pass through several bounds
+void GenerateScene(std::mt19937 &rng, TestScene &scene) {
+  std::uniform_real_distribution<float> pos(0.0f, 100.0f);
+  std::uniform_real_distribution<float> edge(-6.0f, 6.0f);
+  auto random_vec = [&](std::uniform_real_distribution<float> &dist) { return vec3(dist(rng), dist(rng), dist(rng)); };
+  for (uint32_t i = 0; i < 2000; ++i) {
+    auto p = random_vec(pos);
+    Vertex v0(p, vec3(0.0f), 0.0f, 0.0f);
+    Vertex v1(p + random_vec(edge), vec3(0.0f), 1.0f, 0.0f);
+    Vertex v2(p + random_vec(edge), vec3(0.0f), 0.0f, 1.0f);
+    scene.tris.emplace_back(v0, v1, v2, i);
+  }
+  for (uint32_t i = 0; i < 300; ++i) {
+    scene.quads.emplace_back(random_vec(pos), random_vec(edge), random_vec(edge), i);
+  }
+  for (uint32_t i = 0; i < 4; ++i) {
+    scene.lights.emplace_back(random_vec(pos), random_vec(edge), random_vec(edge), i);
+  }
+  std::uniform_real_distribution<float> radius(0.5f, 4.0f);
+  for (uint32_t i = 0; i < 100; ++i) {
+    scene.spheres.emplace_back(random_vec(pos), radius(rng), i);
+  }
+}
+
+/// \brief Same primitive at the same distance
+bool SameHit(const HitInfo &hit, const HitInfo &expected) {
+  if (hit.IsHit() != expected.IsHit()) {
+    return false;
+  }
+  return !hit.IsHit() || (hit.dist == expected.dist && hit.prim == expected.prim);
+}
+
+void PrintHit(const char *name, const HitInfo &hit) {
+  std::cerr << "  " << name << ": ";
+  if (hit.IsHit()) {
+    std::cerr << "prim " << PrimIndexOf(hit.prim) << " of type " << (uint32_t) PrimTypeOf(hit.prim) << " at " << hit.dist;
+  } else {
+    std::cerr << "no hit";
+  }
+  std::cerr << std::endl;
+}
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t num_rays = 4000;
+  uint32_t seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--rays") == 0) {
+      num_rays = std::max(1, atoi(argv[i + 1]));
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      seed = (uint32_t) strtoul(argv[i + 1], nullptr, 10);
+    } else {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  std::mt19937 rng(seed);
+  TestScene scene;
+  GenerateScene(rng, scene);
+  const auto prims = scene.Prims();
+  BVH bvh;
+  bvh.Build(prims);
+  std::cout << scene.tris.size() << " triangles, " << scene.quads.size() + scene.lights.size() << " quads, "
+            << scene.spheres.size() << " spheres: " << bvh.Nodes().size() << " nodes" << std::endl;
+
+  /// Origins inside and around the primitives, directions uniform on the sphere
+  std::uniform_real_distribution<float> origin(-20.0f, 120.0f);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  uint32_t hits = 0;
+  uint32_t failures = 0;
+  for (uint32_t packet = 0; packet * BVH::kPacketSize < num_rays; ++packet) {
+    Ray rays[BVH::kPacketSize];
+    HitInfo expected[BVH::kPacketSize], packet_hits[BVH::kPacketSize];
+    for (auto &ray: rays) {
+      vec3 dir;
+      do {
+        dir = vec3(normal(rng), normal(rng), normal(rng));
+      } while (glm::dot(dir, dir) < 1e-6f);
+      ray = Ray(vec3(origin(rng), origin(rng), origin(rng)), glm::normalize(dir));
+    }
+    /// Every other packet with one ray switched off, which must stay untouched
+    const uint32_t active = packet % 2 == 0 ? 0xfu : 0xbu;
+    bvh.Intersect4(rays, active, prims, packet_hits);
+    for (uint32_t i = 0; i < BVH::kPacketSize; ++i) {
+      BVH::IntersectBruteForce(rays[i], prims, expected[i]);
+      HitInfo single;
+      bvh.Intersect(rays[i], prims, single);
+      const auto packet_ok = (active >> i & 1u) != 0 ? SameHit(packet_hits[i], expected[i]) : !packet_hits[i].IsHit();
+      if (!SameHit(single, expected[i]) || !packet_ok) {
+        if (++failures <= 10) {
+          std::cerr << "Ray " << packet * BVH::kPacketSize + i << " differs" << std::endl;
+          PrintHit("brute force", expected[i]);
+          PrintHit("Intersect", single);
+          PrintHit("Intersect4", packet_hits[i]);
+        }
+      }
+      hits += expected[i].IsHit() ? 1 : 0;
+    }
+  }
+  const auto traced = ((num_rays + BVH::kPacketSize - 1) / BVH::kPacketSize) * BVH::kPacketSize;
+  std::cout << traced << " rays, " << hits << " hits, " << failures << " mismatches: "
+            << (failures == 0 ? "PASS" : "FAIL") << std::endl;
+  return failures == 0 ? 0 : 1;
+}
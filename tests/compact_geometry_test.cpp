@@ -0,0 +1,159 @@
+/// Compact geometry test
+/// Encodes random quads and triangles in the compact layout (SceneDesc::compact_geometry) and checks the decoded
+/// records against the full precision primitives: quads exactly, the quad plane rebuilt from the raw words as load_quad
+/// in path_tracer.wgsl does, triangle positions within half a grid step, normals within the octahedral quantization,
+/// texture coordinates and materials exactly. Snapped triangles, which the BVH and the CPU backend use, keep their
+/// positions through another encode; their normals may move by one quantization step.
+///
+/// Usage: compact_geometry_test [--count N] [--seed N]
+#include "compact_geometry.h"
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+namespace {
+uint32_t failures = 0;
+
+void Check(bool ok, const char *what, uint32_t index) {
+  if (!ok && ++failures <= 10) {
+    std::cerr << what << " differs for element " << index << std::endl;
+  }
+}
+
+bool SameBits(float a, float b) {
+  return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+bool Close(float a, float b) {
+  return std::abs(a - b) <= 1e-5f * std::max(1.0f, std::max(std::abs(a), std::abs(b)));
+}
+
+bool Close(vec3 a, vec3 b) {
+  return Close(a.x, b.x) && Close(a.y, b.y) && Close(a.z, b.z);
+}
+
+vec3 WordsToVec3(const uint32_t *data) {
+  vec3 v;
+  std::memcpy(&v.x, data, sizeof(float));
+  std::memcpy(&v.y, data + 1, sizeof(float));
+  std::memcpy(&v.z, data + 2, sizeof(float));
+  return v;
+}
+
+/// \brief Within half a grid step, plus the rounding of origin + index * step
+bool OnGrid(vec3 a, vec3 b, vec3 step) {
+  const auto d = glm::abs(a - b);
+  return d.x <= 0.51f * step.x && d.y <= 0.51f * step.y && d.z <= 0.51f * step.z;
+}
+
+vec3 RandomDirection(std::mt19937 &rng) {
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  vec3 dir;
+  do {
+    dir = vec3(normal(rng), normal(rng), normal(rng));
+  } while (glm::dot(dir, dir) < 1e-6f);
+  return glm::normalize(dir);
+}
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t count = 20000;
+  uint32_t seed = 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--count") == 0) {
+      count = std::max(1, atoi(argv[i + 1]));
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      seed = (uint32_t) strtoul(argv[i + 1], nullptr, 10);
+    } else {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> pos(-300.0f, 500.0f);
+  std::uniform_real_distribution<float> edge(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> uv(-2.0f, 2.0f);
+  auto random_vec = [&](std::uniform_real_distribution<float> &dist) { return vec3(dist(rng), dist(rng), dist(rng)); };
+
+  /// Quads: q, right, up and material stored; norm, w and d rebuilt from the raw words like load_quad, which has no
+  /// bit-exact guarantee for cross and normalize, so those within a relative tolerance
+  uint32_t quad_data[CompactGeometry::kQuadWords];
+  for (uint32_t i = 0; i < count; ++i) {
+    const Quad quad(random_vec(pos), random_vec(edge), random_vec(edge), i);
+    CompactGeometry::EncodeQuad(quad, quad_data);
+    const auto decoded = CompactGeometry::DecodeQuad(quad_data);
+    Check(decoded.q_ == quad.q_ && decoded.right_ == quad.right_ && decoded.up_ == quad.up_, "Quad", i);
+    Check(decoded.material_ == quad.material_, "Quad material", i);
+    const auto q = WordsToVec3(quad_data), right = WordsToVec3(quad_data + 4), up = WordsToVec3(quad_data + 8);
+    const auto n = vec3(right.y * up.z - right.z * up.y, right.z * up.x - right.x * up.z,
+                        right.x * up.y - right.y * up.x);
+    const auto norm = n / std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+    const auto w = n / (n.x * n.x + n.y * n.y + n.z * n.z);
+    const auto d = norm.x * q.x + norm.y * q.y + norm.z * q.z;
+    Check(Close(norm, quad.norm_) && Close(w, quad.w_) && std::abs(d - quad.d_) <= 1e-5f * glm::length(q) + 1e-5f,
+          "Quad plane", i);
+    Check(quad_data[3] == quad.material_, "Quad material word", i);
+  }
+
+  /// Normals: every octant, the axes and degenerate input (decoded as +z)
+  float max_normal_error = 0.0f;
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto n = i < 6 ? vec3(i == 0 ? 1.0f : i == 1 ? -1.0f : 0.0f, i == 2 ? 1.0f : i == 3 ? -1.0f : 0.0f,
+                                i == 4 ? 1.0f : i == 5 ? -1.0f : 0.0f) : RandomDirection(rng);
+    const auto decoded = CompactGeometry::DecodeNormal(CompactGeometry::EncodeNormal(n));
+    const auto error = glm::length(decoded - n);
+    max_normal_error = std::max(max_normal_error, error);
+    Check(error <= 1e-4f, "Normal", i);
+  }
+  Check(CompactGeometry::DecodeNormal(CompactGeometry::EncodeNormal(vec3(0.0f))) == vec3(0, 0, 1), "Zero normal", 0);
+
+  /// Triangles on the grid of their bounds
+  std::vector<Triangle> tris;
+  tris.reserve(count);
+  AABB bounds;
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto p = random_vec(pos);
+    Vertex v[3];
+    for (int k = 0; k < 3; ++k) {
+      v[k] = Vertex(k == 0 ? p : p + random_vec(edge), RandomDirection(rng), uv(rng), uv(rng));
+      bounds.Grow(v[k].point_);
+    }
+    tris.emplace_back(v[0], v[1], v[2], i);
+    tris.back().InitTexCoords();
+  }
+  const CompactGeometry compact(bounds);
+  const auto step = compact.Step();
+  float max_position_error = 0.0f;
+  uint32_t tri_data[CompactGeometry::kTriangleWords];
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto &tri = tris[i];
+    compact.EncodeTriangle(tri, tri_data);
+    const auto decoded = compact.DecodeTriangle(tri_data);
+    for (int k = 0; k < 3; ++k) {
+      const auto d = glm::abs(decoded.vertex_[k].point_ - tri.vertex_[k].point_) / step;
+      max_position_error = std::max({max_position_error, d.x, d.y, d.z});
+      Check(OnGrid(decoded.vertex_[k].point_, tri.vertex_[k].point_, step), "Triangle position", i);
+      Check(glm::length(decoded.vertex_[k].normal_ - tri.vertex_[k].normal_) <= 1e-4f, "Triangle normal", i);
+      Check(SameBits(decoded.vertex_[k].u_, tri.vertex_[k].u_) && SameBits(decoded.vertex_[k].v_, tri.vertex_[k].v_),
+            "Triangle texture coordinates", i);
+    }
+    Check(SameBits(decoded.uv_scale_, tri.uv_scale_) && decoded.material_ == tri.material_, "Triangle attributes", i);
+    /// Snapped positions are grid points and survive another encode; decode then encode of a normal is not a fixed
+    /// point, so the normal the GPU decodes may differ from the snapped one by a quantization step
+    const auto snapped = compact.Snap(tri);
+    compact.EncodeTriangle(snapped, tri_data);
+    const auto again = compact.DecodeTriangle(tri_data);
+    for (int k = 0; k < 3; ++k) {
+      Check(again.vertex_[k].point_ == snapped.vertex_[k].point_, "Snapped triangle position", i);
+      Check(glm::length(again.vertex_[k].normal_ - snapped.vertex_[k].normal_) <= 1e-4f, "Snapped triangle normal", i);
+    }
+    Check(again.face_norm_ == snapped.face_norm_ && again.e1_ == snapped.e1_ && again.e2_ == snapped.e2_,
+          "Snapped triangle edges", i);
+  }
+
+  std::cout << count << " quads, normals and triangles: max position error " << max_position_error
+            << " grid steps, max normal error " << max_normal_error << ", " << failures << " mismatches: "
+            << (failures == 0 ? "PASS" : "FAIL") << std::endl;
+  return failures == 0 ? 0 : 1;
+}
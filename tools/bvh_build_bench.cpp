@@ -0,0 +1,85 @@
+/// BVH build benchmark
+/// Builds the binned SAH BVH over synthetic meshes and reports build time, node count and SAH cost.
+///
+/// Usage: bvh_build_bench [--max-tris N] [--threads N] [--runs N]
+#include "bvh_builder.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+/// \brief Displaced height-field with roughly `num_tris` triangles
+/// Triangles are generated directly as bounds, the builder never sees anything else.
+static void GenerateTerrain(uint32_t num_tris, std::vector<AABB> &bounds) {
+  auto res = std::max(1u, (uint32_t) std::sqrt((double) num_tris / 2.0));
+  auto height = [res](uint32_t x, uint32_t z) {
+      auto u = (float) x / (float) res;
+      auto v = (float) z / (float) res;
+      return 40.0f * std::sin(u * 12.0f) * std::cos(v * 9.0f) + 8.0f * std::sin(u * 71.0f + v * 53.0f);
+  };
+  auto vertex = [&](uint32_t x, uint32_t z) {
+      return vec3((float) x, height(x, z), (float) z);
+  };
+  bounds.clear();
+  bounds.reserve((size_t) res * res * 2);
+  for (uint32_t z = 0; z < res; ++z) {
+    for (uint32_t x = 0; x < res; ++x) {
+      auto p00 = vertex(x, z);
+      auto p10 = vertex(x + 1, z);
+      auto p01 = vertex(x, z + 1);
+      auto p11 = vertex(x + 1, z + 1);
+      AABB t0, t1;
+      t0.Grow(p00);
+      t0.Grow(p10);
+      t0.Grow(p11);
+      t1.Grow(p00);
+      t1.Grow(p11);
+      t1.Grow(p01);
+      bounds.push_back(t0);
+      bounds.push_back(t1);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t max_tris = 10000000;
+  uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+  uint32_t runs = 3;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--max-tris") == 0) {
+      max_tris = strtoull(argv[i + 1], nullptr, 10);
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      threads = std::max(1, atoi(argv[i + 1]));
+    } else if (strcmp(argv[i], "--runs") == 0) {
+      runs = std::max(1, atoi(argv[i + 1]));
+    } else {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  ThreadPool pool(threads);
+  std::cout << "threads: " << threads << ", runs: " << runs << std::endl;
+  std::cout << std::setw(12) << "triangles" << std::setw(14) << "build (ms)" << std::setw(12) << "Mtri/s"
+            << std::setw(12) << "nodes" << std::setw(12) << "SAH cost" << std::endl;
+  std::vector<AABB> bounds;
+  std::vector<BVHNode> nodes;
+  std::vector<uint32_t> order;
+  for (uint64_t num_tris = 10000; num_tris <= max_tris; num_tris *= 10) {
+    GenerateTerrain((uint32_t) num_tris, bounds);
+    /// Best of `runs` to hide allocator warm-up
+    double best_ms = std::numeric_limits<double>::max();
+    for (uint32_t run = 0; run < runs; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      BVHBuilder(pool).Build(bounds, nodes, order);
+      auto end = std::chrono::steady_clock::now();
+      best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::cout << std::setw(12) << bounds.size()
+              << std::setw(14) << std::fixed << std::setprecision(2) << best_ms
+              << std::setw(12) << std::setprecision(1) << (double) bounds.size() / (best_ms * 1000.0)
+              << std::setw(12) << nodes.size()
+              << std::setw(12) << std::setprecision(2) << BVHBuilder::SAHCost(nodes) << std::endl;
+  }
+  return 0;
+}
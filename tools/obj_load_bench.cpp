@@ -0,0 +1,196 @@
+/// OBJ load benchmark
+/// Loads an OBJ file (or a synthetic height-field written once) with tinyobjloader, copying every face corner the way
+/// the renderer used to, and with the chunked parallel loader (LoadObjFile). Each loader runs in its own process so
+/// the peak resident size is its own.
+///
+/// Usage: obj_load_bench [FILE.obj] [--tris N] [--threads N] [--runs N] [--loader tinyobj|parallel]
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+#include "obj_loader.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/// \brief Displaced height-field with roughly `num_tris` triangles, positions, normals and texture coordinates
+static void GenerateTerrain(uint32_t num_tris, const std::string &path) {
+  auto res = std::max(1u, (uint32_t) std::sqrt((double) num_tris / 2.0));
+  auto height = [res](uint32_t x, uint32_t z) {
+      auto u = (float) x / (float) res;
+      auto v = (float) z / (float) res;
+      return 40.0f * std::sin(u * 12.0f) * std::cos(v * 9.0f) + 8.0f * std::sin(u * 71.0f + v * 53.0f);
+  };
+  std::ofstream out(path);
+  out << std::fixed << std::setprecision(6);
+  for (uint32_t z = 0; z <= res; ++z) {
+    for (uint32_t x = 0; x <= res; ++x) {
+      auto dx = height(std::min(x + 1, res), z) - height(x > 0 ? x - 1 : 0, z);
+      auto dz = height(x, std::min(z + 1, res)) - height(x, z > 0 ? z - 1 : 0);
+      auto length = std::sqrt(dx * dx + 4.0f + dz * dz);
+      out << "v " << (float) x << " " << height(x, z) << " " << (float) z << "\n"
+          << "vn " << -dx / length << " " << 2.0f / length << " " << -dz / length << "\n"
+          << "vt " << (float) x / (float) res << " " << (float) z / (float) res << "\n";
+    }
+  }
+  auto index = [res](uint32_t x, uint32_t z) {
+      return std::to_string((size_t) z * (res + 1) + x + 1);
+  };
+  for (uint32_t z = 0; z < res; ++z) {
+    for (uint32_t x = 0; x < res; ++x) {
+      auto i00 = index(x, z), i10 = index(x + 1, z), i01 = index(x, z + 1), i11 = index(x + 1, z + 1);
+      out << "f " << i00 << "/" << i00 << "/" << i00 << " " << i10 << "/" << i10 << "/" << i10 << " "
+          << i11 << "/" << i11 << "/" << i11 << "\n"
+          << "f " << i00 << "/" << i00 << "/" << i00 << " " << i11 << "/" << i11 << "/" << i11 << " "
+          << i01 << "/" << i01 << "/" << i01 << "\n";
+    }
+  }
+}
+
+/// \brief Peak resident size of this process (MB)
+static double PeakMemory() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+  return (double) counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return (double) usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return (double) usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+/// \brief tinyobjloader followed by one vertex per face corner
+static bool LoadTinyObj(const std::string &path, size_t &triangles, size_t &vertices) {
+  tinyobj::ObjReader reader;
+  if (!reader.ParseFromFile(path)) {
+    std::cerr << reader.Error() << std::endl;
+    return false;
+  }
+  const auto &attrib = reader.GetAttrib();
+  std::vector<Vertex> corners;
+  for (const auto &shape: reader.GetShapes()) {
+    for (const auto &idx: shape.mesh.indices) {
+      Vertex vert;
+      vert.point_ = vec3(attrib.vertices[3 * size_t(idx.vertex_index) + 0],
+                         attrib.vertices[3 * size_t(idx.vertex_index) + 1],
+                         attrib.vertices[3 * size_t(idx.vertex_index) + 2]);
+      vert.normal_ = vec3(0.0f);
+      if (idx.normal_index >= 0) {
+        vert.normal_ = vec3(attrib.normals[3 * size_t(idx.normal_index) + 0],
+                            attrib.normals[3 * size_t(idx.normal_index) + 1],
+                            attrib.normals[3 * size_t(idx.normal_index) + 2]);
+      }
+      vert.u_ = idx.texcoord_index >= 0 ? attrib.texcoords[2 * size_t(idx.texcoord_index) + 0] : 0.0f;
+      vert.v_ = idx.texcoord_index >= 0 ? attrib.texcoords[2 * size_t(idx.texcoord_index) + 1] : 0.0f;
+      corners.push_back(vert);
+    }
+  }
+  triangles = corners.size() / 3;
+  vertices = corners.size();
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  std::string file;
+  uint32_t num_tris = 2000000;
+  uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+  uint32_t runs = 3;
+  std::string loader;
+  int i = 1;
+  if (argc > 1 && argv[1][0] != '-') {
+    file = argv[i++];
+  }
+  for (; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--tris") == 0) {
+      num_tris = (uint32_t) std::max(1, atoi(argv[i + 1]));
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      threads = std::max(1, atoi(argv[i + 1]));
+    } else if (strcmp(argv[i], "--runs") == 0) {
+      runs = std::max(1, atoi(argv[i + 1]));
+    } else if (strcmp(argv[i], "--loader") == 0) {
+      loader = argv[i + 1];
+    } else {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  /// Parent: prepare the file and run every loader in a process of its own
+  if (loader.empty()) {
+    if (file.empty()) {
+      file = (std::filesystem::temp_directory_path() / ("obj_load_bench_" + std::to_string(num_tris) + ".obj")).string();
+      if (!std::filesystem::exists(file)) {
+        GenerateTerrain(num_tris, file);
+      }
+    }
+    if (!std::filesystem::exists(file)) {
+      std::cerr << "OBJ file not found: " << file << std::endl;
+      return 1;
+    }
+    std::cout << file << ": " << std::fixed << std::setprecision(1)
+              << (double) std::filesystem::file_size(file) / (1024.0 * 1024.0) << " MB, threads: " << threads
+              << ", runs: " << runs << std::endl;
+    std::cout << std::setw(10) << "loader" << std::setw(12) << "load (ms)" << std::setw(10) << "MB/s"
+              << std::setw(12) << "triangles" << std::setw(12) << "vertices" << std::setw(12) << "peak (MB)"
+              << std::endl;
+    int status = 0;
+    for (const char *name: {"tinyobj", "parallel"}) {
+      std::cout.flush();
+      const auto command = "\"" + std::string(argv[0]) + "\" \"" + file + "\" --threads " + std::to_string(threads)
+                           + " --runs " + std::to_string(runs) + " --loader " + name;
+      status |= std::system(command.c_str());
+    }
+    return status != 0 ? 1 : 0;
+  }
+
+  ThreadPool pool(threads);
+  size_t triangles = 0;
+  size_t vertices = 0;
+  /// Best of `runs` to hide page cache and allocator warm-up
+  double best_ms = std::numeric_limits<double>::max();
+  for (uint32_t run = 0; run < runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    if (loader == "tinyobj") {
+      if (!LoadTinyObj(file, triangles, vertices)) {
+        return 1;
+      }
+    } else if (loader == "parallel") {
+      ObjMesh mesh;
+      std::string error;
+      if (!LoadObjFile(file, mesh, error, pool)) {
+        std::cerr << error << std::endl;
+        return 1;
+      }
+      triangles = mesh.Triangles();
+      vertices = mesh.vertices.size();
+    } else {
+      std::cerr << "Unknown loader: " << loader << std::endl;
+      return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  const auto mb = (double) std::filesystem::file_size(file) / (1024.0 * 1024.0);
+  std::cout << std::setw(10) << loader
+            << std::setw(12) << std::fixed << std::setprecision(1) << best_ms
+            << std::setw(10) << mb / (best_ms / 1000.0)
+            << std::setw(12) << triangles
+            << std::setw(12) << vertices
+            << std::setw(12) << PeakMemory() << std::endl;
+  return 0;
+}
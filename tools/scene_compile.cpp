@@ -0,0 +1,55 @@
+/// Scene compiler
+/// Parses an OBJ mesh with its MTL materials and maps, builds its BVH and texture array once and writes them as the
+/// scene cache the renderer maps at startup instead (SceneCache). Reports the parse and the cached load time.
+///
+/// Usage: scene_compile FILE.obj [--output FILE] [--texture-size N]
+#include "scene.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argv[1][0] == '-') {
+    std::cerr << "Usage: scene_compile FILE.obj [--output FILE] [--texture-size N]" << std::endl;
+    return 1;
+  }
+  SceneDesc desc;
+  desc.obj_file = argv[1];
+  std::string output = SceneCache::Path(desc.obj_file);
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--output") == 0) {
+      output = argv[i + 1];
+    } else if (strcmp(argv[i], "--texture-size") == 0) {
+      desc.texture_size = (uint32_t) std::max(1, atoi(argv[i + 1]));
+    } else {
+      std::cerr << "Unknown option: " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  if (!std::filesystem::exists(desc.obj_file)) {
+    std::cerr << "Scene file not found: " << desc.obj_file << std::endl;
+    return 1;
+  }
+  /// Always from the OBJ file, an existing cache may be the one being replaced
+  desc.scene_cache = false;
+  auto start = std::chrono::steady_clock::now();
+  Scene scene(desc);
+  auto end = std::chrono::steady_clock::now();
+  const auto parse_ms = std::chrono::duration<double, std::milli>(end - start).count();
+  if (!scene.WriteCache(output)) {
+    return 1;
+  }
+  std::cout << "compiled " << desc.obj_file << " in " << parse_ms << " ms: " << output << " ("
+            << std::filesystem::file_size(output) / (1024.0 * 1024.0) << " MB)" << std::endl;
+  /// Load it back the way the renderer finds it
+  if (output == SceneCache::Path(desc.obj_file)) {
+    desc.scene_cache = true;
+    start = std::chrono::steady_clock::now();
+    Scene cached(desc);
+    end = std::chrono::steady_clock::now();
+    std::cout << "cached load: " << std::chrono::duration<double, std::milli>(end - start).count() << " ms"
+              << std::endl;
+  }
+  return 0;
+}